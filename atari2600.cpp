@@ -1,97 +1,425 @@
 #include "atari2600.hpp"
+#include "mos6502_impl.hpp"
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
 #include <iomanip>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+// Instantiate CPU here so Atari2600::read and Atari2600::write can be inlined into it
+template class Mos6502Core<Atari2600Bus>;
 
 Atari2600::Atari2600() :
-  cpu_{
-    [this](uint16_t addr) -> uint8_t {
-      return this->read(addr);
-    },
-    [this](uint16_t addr, uint8_t data) {
-      this->write(addr, data);
-    }
-    }
+  cpu_{Atari2600Bus{this}},
+  trace_{TRACE_ENABLED ? TraceBuffer::DEFAULT_CAPACITY : 1}
 {
-  rom_.resize(ROM_SIZE, 0);
-  std::fill(ram_.begin(), ram_.end(), 0);
+  tia_.trace_ = &trace_;
+  // All instances start out sharing one blank ROM
+  static const std::shared_ptr<const RomImage> blank_rom = RomImage::fromBytes(std::vector<uint8_t>(ROM_SIZE, 0));
+  loadRom(blank_rom);
 }
 
 void Atari2600::loadRom(std::istream& in)
 {
-  rom_.clear();
-  rom_.resize(ROM_SIZE, 0);
-  in.read(reinterpret_cast<char*>(rom_.data()), ROM_SIZE);
-  if (!in)
+  std::vector<uint8_t> rom{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+  if ((rom.size() < ROM_SIZE) and (rom.size() != ROM_SIZE / 2))
   {
-    std::cerr << "WARNING, only read " << in.gcount() << " bytes from file to ROM" << std::endl;
+    std::cerr << "WARNING, only read " << rom.size() << " bytes from file to ROM" << std::endl;
+    rom.resize(ROM_SIZE, 0);
   }
+  loadRom(RomImage::fromBytes(std::move(rom)));
 }
 
-// https://forums.atariage.com/topic/192418-mirrored-memory/#comment-2439795
-uint8_t Atari2600::read(uint16_t addr)
+namespace
 {
-  // address is 13-bit at most because 6507 has only 13 address pins
-  addr &= 0x1FFF;
 
-  if (addr & 0x1000)
+// Branches, jumps, calls, returns and BRK continue somewhere else, so they are last instruction of a basic block
+bool endsBlock(uint8_t op_code)
+{
+  switch (op_code)
+  {
+    case 0x00:
+    case 0x20:
+    case 0x40:
+    case 0x4C:
+    case 0x60:
+    case 0x6C:
+      return true;
+    default:
+      // BPL, BMI, BVC, BVS, BCC, BCS, BNE, BEQ
+      return (op_code & 0x1F) == 0x10;
+  }
+}
+
+/**
+ * How an instruction accesses memory besides its own bytes, when it is translated into a threaded block
+ */
+enum class OpAccess : uint8_t
+{
+  // registers and RIOT RAM only, RAM is never watched when blocks are translated
+  NONE,
+  // can access TIA, RIOT or cartridge, which can depend on cycle it happens on, apply a TIA write or switch banks
+  BUS
+};
+
+struct ThreadedOpInfo
+{
+  bool supported;
+  OpAccess access;
+  uint8_t cycles;
+  // page crossing or taken branch
+  uint8_t max_extra_cycles;
+};
+
+// access to 13-bit address, known when translating
+OpAccess addressAccess(uint16_t addr)
+{
+  // RIOT RAM : A12 = 0, A7 = 1, A9 = 0, see Atari2600::mapBus
+  const bool ram = ((addr & 0x1000) == 0) and (addr & 0x80) and ((addr & 0x200) == 0);
+  return ram ? OpAccess::NONE : OpAccess::BUS;
+}
+
+/**
+ * Access and cycles of every instruction Mos6502 implements
+ * Cycles match what handlers return, except they return more for page crossings and taken branches.
+ */
+ThreadedOpInfo threadedOpInfo(const uint8_t* instr)
+{
+  const OpAccess zero_page = addressAccess(instr[1]);
+  const OpAccess absolute = addressAccess((instr[1] | (instr[2] << 8)) & 0x1FFF);
+  switch (instr[0])
+  {
+    // implied and accumulator
+    case 0x0A: case 0x18: case 0x2A: case 0x38: case 0x4A: case 0x6A: case 0x78: case 0x88: case 0x8A: case 0x98:
+    case 0x9A: case 0xA8: case 0xAA: case 0xBA: case 0xC8: case 0xCA: case 0xD8: case 0xE8: case 0xEA:
+    // immediate
+    case 0x09: case 0x29: case 0x49: case 0x69: case 0xA0: case 0xA2: case 0xA9: case 0xC0: case 0xC9: case 0xE0:
+    case 0xE9:
+      return {true, OpAccess::NONE, 2, 0};
+    // zero page read, write and read-modify-write
+    case 0x05: case 0x24: case 0x25: case 0x45: case 0x65: case 0xA4: case 0xA5: case 0xA6: case 0xC4: case 0xC5:
+    case 0xE4: case 0xE5:
+    case 0x84: case 0x85: case 0x86:
+      return {true, zero_page, 3, 0};
+    case 0x06: case 0x26: case 0x66: case 0xC6: case 0xE6:
+      return {true, zero_page, 5, 0};
+    // zero page indexed, can wrap around to TIA
+    case 0x35: case 0x75: case 0xB4: case 0xB5: case 0xD5: case 0xF5:
+    case 0x94: case 0x95:
+      return {true, OpAccess::BUS, 4, 0};
+    case 0x16: case 0x36: case 0x76: case 0xF6:
+      return {true, OpAccess::BUS, 6, 0};
+    // absolute
+    case 0x2C: case 0x2D: case 0x6D: case 0xAC: case 0xAD: case 0xAE: case 0xCC: case 0xCD: case 0xEC: case 0xED:
+    case 0x8C: case 0x8D:
+      return {true, absolute, 4, 0};
+    case 0x0E: case 0x2E: case 0x6E: case 0xEE:
+      return {true, absolute, 6, 0};
+    // absolute indexed and indirect could end up anywhere
+    case 0x39: case 0x3D: case 0x79: case 0x7D: case 0xB9: case 0xBC: case 0xBD: case 0xBE: case 0xD9: case 0xDD:
+    case 0xF9: case 0xFD:
+      return {true, OpAccess::BUS, 4, 1};
+    case 0x99: case 0x9D:
+      return {true, OpAccess::BUS, 5, 0};
+    case 0x1E: case 0x3E: case 0x7E: case 0xFE:
+      return {true, OpAccess::BUS, 7, 0};
+    case 0x21: case 0x61: case 0xC1: case 0xE1:
+      return {true, OpAccess::BUS, 6, 0};
+    case 0x31: case 0x71: case 0xB1: case 0xD1: case 0xF1:
+      return {true, OpAccess::BUS, 5, 1};
+    // branches
+    case 0x10: case 0x30: case 0x50: case 0x70: case 0x90: case 0xB0: case 0xD0: case 0xF0:
+      return {true, OpAccess::NONE, 2, 2};
+    case 0x4C:
+      return {true, OpAccess::NONE, 3, 0};
+    // stack is RIOT RAM or TIA, depending on stack pointer
+    case 0x20: case 0x60:
+      return {true, OpAccess::BUS, 6, 0};
+    case 0x48:
+      return {true, OpAccess::BUS, 3, 0};
+    case 0x68:
+      return {true, OpAccess::BUS, 4, 0};
+    default:
+      return {false, OpAccess::BUS, 0, 0};
+  }
+}
+
+/**
+ * decoded ROM for image, decoding it only if no other instance using image has already
+ */
+std::shared_ptr<const Atari2600::DecodedRom> decodeRom(const std::shared_ptr<const RomImage>& rom)
+{
+  static std::mutex mutex;
+  static std::unordered_map<const RomImage*, std::pair<std::weak_ptr<const RomImage>, std::weak_ptr<const Atari2600::DecodedRom>>> decoded_roms;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto& entry = decoded_roms[rom.get()];
+  std::shared_ptr<const Atari2600::DecodedRom> decoded_rom = entry.second.lock();
+  // Another image could have been at same address before
+  if (decoded_rom and (entry.first.lock() == rom))
   {
-    // Addresses 0x1000 to 0x1FFF are rom
-    //std::cerr << "Read rom " << (addr & 0xFFF) << std::endl;
-    return rom_[addr & 0xFFF];
+    return decoded_rom;
   }
-  else if (addr & 0x80)
+
+  const size_t size = rom->size();
+  auto decoded = std::make_shared<Atari2600::DecodedRom>();
+  decoded->instrs.resize(size);
+  decoded->block_lengths.resize(size);
+  for (size_t offset = 0; offset < size; ++offset)
   {
-    // 6532 RIOT CHIP : Chipselect A12 = 0, and A7 = 1
-    // PIA 532
-    if (addr & 0x200)
+    Atari2600::Cpu::DecodedInstr& instr = decoded->instrs[offset];
+    instr = Atari2600::Cpu::decode(rom->data() + offset, size - offset);
+    // ROM is mapped in whole pages, an instruction that crosses one could continue in another bank
+    if ((offset % Cartridge::PAGE_SIZE) + instr.len > Cartridge::PAGE_SIZE)
     {
-      // TODO timer registers
-      switch (addr)
-      {
-        case 0x280:  // SWCHA
-          // https://alienbill.com/2600/101/docs/stella.html#pia5.0
-          std::cerr << "SWCHA read" << std::endl;
-          // 0 = pressed, 1 not pressed
-          // Bit7 : P0 right
-          // Bit6 : P0 left
-          // Bit5 : P0 down
-          // Bit4 : P0 up
-          // Bit3 : P1 right
-          // Bit2 : P1 left
-          // Bit1 : P1 down
-          // Bit0 : P1 up
-          return 0xFF;  // nothing pressed (for now)
-
-        case 0x282:  // SWCHB
-          // https://alienbill.com/2600/101/docs/stella.html#pia4.0
-          std::cerr << "SWCHB read" << std::endl;
-          // Bit7 : P1 difficulty 0= Amature
-          // Bit6 : P0 difficulty 1= Pro
-          // Bit5-4 : unused
-          // Bit3 : Color =1, B/W =0
-          // Bit2 : unused
-          // Bit1 : Game select 0=pressed
-          // Bit0 : Game reset 0=pressed
-          return 0x7F;
-      }
+      instr.func = nullptr;
     }
-    else
+  }
+
+  // Block starting at an offset is its instruction, followed by block starting at next instruction
+  for (size_t offset = size; offset-- > 0;)
+  {
+    const Atari2600::Cpu::DecodedInstr& instr = decoded->instrs[offset];
+    if (!instr.func)
     {
-      return ram_[addr & 0x7F];
+      continue;
     }
-    // TODO
+    const size_t next_offset = offset + instr.len;
+    unsigned block_length = 1;
+    if (!endsBlock(instr.instr[0]) and ((next_offset % Cartridge::PAGE_SIZE) != 0))
+    {
+      block_length += decoded->block_lengths[next_offset];
+    }
+    decoded->block_lengths[offset] = std::min(block_length, 255u);
+  }
+  entry = {rom, decoded};
+  for (auto it = decoded_roms.begin(); it != decoded_roms.end();)
+  {
+    it = it->second.second.expired() ? decoded_roms.erase(it) : std::next(it);
+  }
+  return decoded;
+}
+
+}  // namespace
+
+void Atari2600::loadRom(std::shared_ptr<const RomImage> rom, Cartridge::Mapper mapper)
+{
+  std::unique_ptr<Cartridge> cartridge = Cartridge::create(rom, mapper);
+  decoded_rom_ = decodeRom(rom);
+  rom_data_ = rom->data();
+  rom_size_ = rom->size();
+  cartridge_ = std::move(cartridge);
+  mapBus();
+
+  // Compiled code is per instance, since it is only generated for blocks this instance runs often
+  jit_.reset();
+  jit_entries_.clear();
+  jit_blocks_.clear();
+  // Translated blocks too, for same reason
+  threaded_entries_.clear();
+  threaded_blocks_.clear();
+}
+
+const char* Atari2600::execModeName(ExecMode exec_mode)
+{
+  switch (exec_mode)
+  {
+    case ExecMode::FETCH:
+      return "fetch";
+    case ExecMode::DECODED:
+      return "decoded";
+    case ExecMode::THREADED:
+      return "threaded";
+    case ExecMode::JIT:
+      return "jit";
   }
+  return "?";
+}
 
-  return 0;
+void Atari2600::saveState(Atari2600State& state) const
+{
+  state.magic = Atari2600State::MAGIC;
+  state.version = Atari2600State::VERSION;
+  state.flags = 0;
+  riot_.saveState(state.riot);
+  cpu_.saveState(state.cpu);
+  tia_.saveState(state.tia);
+  cartridge_->saveState(state.cartridge);
+  state.reserved = 0;
+}
+
+void Atari2600::loadState(const Atari2600State& state)
+{
+  if ((state.magic != Atari2600State::MAGIC) or (state.version != Atari2600State::VERSION))
+  {
+    std::stringstream ss;
+    ss << "Not a version " << Atari2600State::VERSION << " Atari2600 state, magic " << std::hex << state.magic
+       << std::dec << " version " << state.version;
+    throw std::runtime_error(ss.str());
+  }
+  // Cartridge checks its state fits ROM, before anything is changed
+  cartridge_->loadState(state.cartridge);
+  riot_.loadState(state.riot);
+  cpu_.loadState(state.cpu);
+  tia_.loadState(state.tia);
 }
 
+std::vector<uint8_t> Atari2600::saveState(bool include_display) const
+{
+  Atari2600State state;
+  saveState(state);
+  // front display, then back display so a frame saved part way through is finished the same way
+  // RGBA displays aren't drawn in indexed mode, so only displays being drawn are saved
+  const bool indexed = include_display and tia_.indexed_output_;
+  const bool rgba = include_display and !indexed;
+  const size_t display_size = tia_.display_.size() * sizeof(RGBA);
+  const size_t indexed_size = tia_.indexed_display_.size();
+  if (rgba)
+  {
+    state.flags |= Atari2600State::HAS_DISPLAY | Atari2600State::HAS_BACK_DISPLAY;
+  }
+  if (indexed)
+  {
+    state.flags |= Atari2600State::HAS_INDEXED_DISPLAY;
+  }
+  std::vector<uint8_t> blob(sizeof(state) + (rgba ? (2 * display_size) : 0) + (indexed ? (2 * indexed_size) : 0));
+  std::memcpy(blob.data(), &state, sizeof(state));
+  uint8_t* data = blob.data() + sizeof(state);
+  if (rgba)
+  {
+    std::memcpy(data, tia_.display_.data(), display_size);
+    std::memcpy(data + display_size, tia_.back_display_.data(), display_size);
+  }
+  if (indexed)
+  {
+    std::memcpy(data, tia_.indexed_display_.data(), indexed_size);
+    std::memcpy(data + indexed_size, tia_.back_indexed_display_.data(), indexed_size);
+  }
+  return blob;
+}
 
+void Atari2600::loadState(const uint8_t* data, size_t size)
+{
+  Atari2600State state;
+  if (size < sizeof(state))
+  {
+    throw std::runtime_error("Atari2600 state is too short");
+  }
+  std::memcpy(&state, data, sizeof(state));
+  const bool has_display = state.flags & Atari2600State::HAS_DISPLAY;
+  const bool has_back_display = state.flags & Atari2600State::HAS_BACK_DISPLAY;
+  const bool has_indexed_display = state.flags & Atari2600State::HAS_INDEXED_DISPLAY;
+  if (has_back_display and !has_display)
+  {
+    throw std::runtime_error("Atari2600 state has back display without display");
+  }
+  const size_t display_size = tia_.display_.size() * sizeof(RGBA);
+  const size_t display_count = (has_display ? 1 : 0) + (has_back_display ? 1 : 0);
+  const size_t indexed_size = tia_.indexed_display_.size();
+  const size_t rgba_size = display_count * display_size;
+  if (size != (sizeof(state) + rgba_size + (has_indexed_display ? (2 * indexed_size) : 0)))
+  {
+    throw std::runtime_error("Atari2600 state has wrong size");
+  }
+  loadState(state);
+  if (has_display)
+  {
+    std::memcpy(tia_.display_.data(), data + sizeof(state), display_size);
+    // Frame in progress is drawn over last complete one when blob only has front display
+    const uint8_t* back = has_back_display ? (data + sizeof(state) + display_size) : (data + sizeof(state));
+    std::memcpy(tia_.back_display_.data(), back, display_size);
+  }
+  if (has_indexed_display)
+  {
+    const uint8_t* indexed = data + sizeof(state) + rgba_size;
+    std::memcpy(tia_.indexed_display_.data(), indexed, indexed_size);
+    std::memcpy(tia_.back_indexed_display_.data(), indexed + indexed_size, indexed_size);
+  }
+}
 
-void Atari2600::write(uint16_t addr, uint8_t data)
+// https://forums.atariage.com/topic/192418-mirrored-memory/#comment-2439795
+void Atari2600::mapBus()
 {
   // address is 13-bit at most because 6507 has only 13 address pins
+  const bool watched = cartridge_->watches_low_addresses_;
+  for (unsigned page = 0; page < BUS_PAGE_COUNT; ++page)
+  {
+    const uint16_t addr = page * BUS_PAGE_SIZE;
+    read_pages_[page] = nullptr;
+    write_pages_[page] = nullptr;
+    if (addr & 0x1000)
+    {
+      // Addresses 0x1000 to 0x1FFF are cartridge, which fills in its pages below
+      page_handlers_[page] = BusHandler::CARTRIDGE;
+    }
+    else if ((addr & 0x80) == 0)
+    {
+      // TIA chip : Chipselect A12 = 0 and A7 = 0
+      page_handlers_[page] = BusHandler::TIA;
+    }
+    else if (addr & 0x200)
+    {
+      // 6532 RIOT CHIP : Chipselect A12 = 0, and A7 = 1, A9 = 1 selects I/O and timer
+      page_handlers_[page] = BusHandler::RIOT;
+    }
+    else
+    {
+      // RIOT RAM, and its mirrors
+      page_handlers_[page] = BusHandler::RAM;
+      if (!watched)
+      {
+        uint8_t* ram_page = &riot_.ram_[addr & 0x7F];
+        read_pages_[page] = ram_page;
+        write_pages_[page] = ram_page;
+      }
+    }
+  }
+  constexpr unsigned CARTRIDGE_FIRST_PAGE = 0x1000 / BUS_PAGE_SIZE;
+  static_assert(BUS_PAGE_COUNT - CARTRIDGE_FIRST_PAGE == Cartridge::PAGE_COUNT);
+  cartridge_->attachBus(&read_pages_[CARTRIDGE_FIRST_PAGE], &write_pages_[CARTRIDGE_FIRST_PAGE]);
+}
+
+__attribute__((noinline))
+uint8_t Atari2600::readHandler(uint16_t addr)
+{
+  const BusHandler handler = page_handlers_[(addr >> BUS_PAGE_BITS) & (BUS_PAGE_COUNT - 1)];
+  if (handler == BusHandler::CARTRIDGE)
+  {
+    // Cartridge gets all 16 bits of address for FE bank switching
+    return cartridge_->read(addr);
+  }
+
   addr &= 0x1FFF;
+  if (cartridge_->watches_low_addresses_)
+  {
+    cartridge_->lowAccess(addr, 0, false);
+  }
+
+  switch (handler)
+  {
+    case BusHandler::RAM:
+      return riot_.ram_[addr & 0x7F];
+    case BusHandler::RIOT:
+    {
+      uint8_t data = riot_.read(addr);
+      ATARI2600_TRACE_EVENT(tia_.trace_, TraceType::RIOT_READ, tia_.getPixelClock(), addr, data);
+      return data;
+    }
+    default:
+      // TODO TIA registers
+      return 0;
+  }
+}
 
+__attribute__((noinline))
+void Atari2600::writeHandler(uint16_t addr, uint8_t data)
+{
   if (false)
   {
   std::cerr << "Write "
@@ -101,44 +429,653 @@ void Atari2600::write(uint16_t addr, uint8_t data)
             << std::endl;
   }
 
-  if ((addr & (1<<12)) == 0)
+  const BusHandler handler = page_handlers_[(addr >> BUS_PAGE_BITS) & (BUS_PAGE_COUNT - 1)];
+  if (handler == BusHandler::CARTRIDGE)
   {
-    // A12 = 0
-    if (addr & (1<<7))
+    // bank switching, or ROM which ignores writes
+    cartridge_->write(addr, data);
+    return;
+  }
+
+  addr &= 0x1FFF;
+  if (cartridge_->watches_low_addresses_)
+  {
+    cartridge_->lowAccess(addr, data, true);
+  }
+
+  switch (handler)
+  {
+    case BusHandler::RAM:
+      riot_.ram_[addr & 0x7F] = data;
+      break;
+    case BusHandler::RIOT:
+      ATARI2600_TRACE_EVENT(tia_.trace_, TraceType::RIOT_WRITE, tia_.getPixelClock(), addr, data);
+      riot_.write(addr, data);
+      break;
+    default:
+      tia_.write(addr, data);
+      break;
+  }
+}
+
+template<typename DONE_FUNC>
+Atari2600::RunStatus Atari2600::run(unsigned max_instructions, unsigned max_cycles, unsigned stop_line_count, DONE_FUNC done)
+{
+  RunStatus status;
+  const unsigned start_frame_count = tia_.frame_count_;
+  while ((status.instructions < max_instructions) and (status.cycles < max_cycles))
+  {
+    bool ran = skip_idle_loops_ and skipIdleLoop(status, max_instructions, max_cycles, stop_line_count);
+    if (!ran and ((exec_mode_ == ExecMode::THREADED) or (exec_mode_ == ExecMode::JIT)) and breakpoints_.empty())
     {
-      // 6532 RIOT CHIP : Chipselect A12 = 0, and A7 = 1
-      if (addr & 0x200)
-      {
-        // TODO 6532 timer registers
-      }
-      else
-      {
-        // 6532 128bytes of RAM
-        ram_[addr & 0x7F] = data;
-      }
+      ran = runBlock(status, max_instructions, max_cycles, stop_line_count);
     }
-    else
+    if (!ran)
     {
-      // TIA chip : Chipselect A12 = 0 and A7 = 0
-      tia_.write(addr, data);
+      unsigned cycles = execOne();
+      tia_.advancePixels(cycles * 3);
+      riot_.advanceCycles(cycles);
+      status.cycles += cycles;
+      ++status.instructions;
+    }
+    status.frame_complete = (tia_.frame_count_ != start_frame_count);
+    if (!breakpoints_.empty() and breakpoints_.count(cpu_.pc_))
+    {
+      std::cerr << "Hit breakpoint at " << std::hex << cpu_.pc_ << std::dec << std::endl;
+      status.breakpoint_hit = true;
+      break;
+    }
+    if (done(status))
+    {
+      break;
     }
   }
+  // Force a "sync" of tia
+  tia_.syncPixels();
+  return status;
 }
 
-void Atari2600::execInstructions(unsigned instruction_count)
+bool Atari2600::runBlock(RunStatus& status, unsigned max_instructions, unsigned max_cycles, unsigned stop_line_count)
 {
-  for (unsigned ii = 0; ii < instruction_count; ++ii)
+  const size_t offset = decodedOffset();
+  if ((offset >= rom_size_) or cpu_.reseting_)
+  {
+    return false;
+  }
+  if ((exec_mode_ == ExecMode::JIT) and runCompiledBlock(status, max_instructions, max_cycles, stop_line_count, offset))
+  {
+    return true;
+  }
+  if (runThreadedBlock(status, max_instructions, max_cycles, stop_line_count, offset))
   {
-    unsigned pixel_cycles = cpu_.execOne() * 3;
-    tia_.advancePixels(pixel_cycles);
-    if (breakpoints_.count(cpu_.pc_))
+    return true;
+  }
+  const unsigned block_length = std::min<unsigned>(decoded_rom_->block_lengths[offset], max_instructions - status.instructions);
+  if (block_length == 0)
+  {
+    return false;
+  }
+
+  // A bank switch in middle of block replaces rest of it with other code
+  const uint8_t* const* page = &read_pages_[(cpu_.pc_ >> BUS_PAGE_BITS) & (BUS_PAGE_COUNT - 1)];
+  const uint8_t* const block_page = *page;
+
+  // TIA and RIOT are still advanced after each instruction, so bus accesses happen at same cycle as
+  // when instructions are run one at a time. Only draws and applied writes change line and frame
+  // counters, besides pending lines reaching stop line.
+  const uint64_t max_pixels = maxPixelsBeforeStop(stop_line_count);
+  uint64_t pixels = 0;
+  const Cpu::DecodedInstr* instr = &decoded_rom_->instrs[offset];
+  for (unsigned ii = 0; ii < block_length; ++ii)
+  {
+    const unsigned cycles = cpu_.execDecoded(*instr);
+    const bool tia_updated = tia_.advancePixels(cycles * 3);
+    riot_.advanceCycles(cycles);
+    status.cycles += cycles;
+    ++status.instructions;
+    pixels += cycles * 3;
+    if (tia_updated or (pixels >= max_pixels) or (status.cycles >= max_cycles) or (*page != block_page))
     {
-      std::cerr << "Hit breakpoint at " << std::hex << cpu_.pc_ << std::dec << std::endl;
       break;
     }
+    instr += instr->len;
   }
-  // Force a "sync" of tia
+  return true;
+}
+
+const Atari2600::ThreadedBlock* Atari2600::threadedBlock(size_t offset)
+{
+  if (threaded_entries_.empty())
+  {
+    threaded_entries_.resize(rom_size_, 0);
+  }
+  uint32_t& entry = threaded_entries_[offset];
+  if (entry == THREADED_UNSUPPORTED)
+  {
+    return nullptr;
+  }
+  if (entry != 0)
+  {
+    return &threaded_blocks_[entry - 1];
+  }
+
+  // Same instructions as decoded block, up to first one that can't be translated
+  ThreadedBlock block{{}, 0, 0};
+  const unsigned block_length = decoded_rom_->block_lengths[offset];
+  const Cpu::DecodedInstr* instr = &decoded_rom_->instrs[offset];
+  unsigned base_cycles = 0;
+  for (unsigned ii = 0; ii < block_length; ++ii)
+  {
+    const ThreadedOpInfo info = threadedOpInfo(instr->instr.data());
+    if (!info.supported)
+    {
+      break;
+    }
+    const ThreadedOp::Step step = (info.access == OpAccess::NONE) ? &stepThreaded : &stepThreadedAccess;
+    block.ops.push_back(ThreadedOp{step, instr->func, instr->instr, instr->len, info.cycles,
+                                   static_cast<uint16_t>(base_cycles)});
+    ++block.instruction_count;
+    base_cycles += info.cycles;
+    block.max_cycles += info.cycles + info.max_extra_cycles;
+    instr += instr->len;
+  }
+  if (block.ops.empty())
+  {
+    entry = THREADED_UNSUPPORTED;
+    return nullptr;
+  }
+  block.ops.push_back(ThreadedOp{&stepThreadedExit, nullptr, {0, 0, 0}, 0, 0, static_cast<uint16_t>(base_cycles)});
+  threaded_blocks_.push_back(std::move(block));
+  entry = threaded_blocks_.size();
+  return &threaded_blocks_.back();
+}
+
+bool Atari2600::runThreadedBlock(RunStatus& status, unsigned max_instructions, unsigned max_cycles,
+                                 unsigned stop_line_count, size_t offset)
+{
+  // With a watching cartridge even RIOT RAM accesses go through bus
+  if (cartridge_->watches_low_addresses_)
+  {
+    return false;
+  }
+  const ThreadedBlock* block = threadedBlock(offset);
+  if (!block or (status.instructions + block->instruction_count > max_instructions) or
+      (status.cycles + block->max_cycles >= max_cycles) or tia_.updatePending() or
+      (tia_.pixel_cycles_ + block->max_cycles * 3 >= Tia::SCANLINE_PIXELS) or
+      (block->max_cycles * 3 >= maxPixelsBeforeStop(stop_line_count)))
+  {
+    return false;
+  }
+
+  threaded_run_.synced_cycles = 0;
+  threaded_run_.page = &read_pages_[(cpu_.pc_ >> BUS_PAGE_BITS) & (BUS_PAGE_COUNT - 1)];
+  threaded_run_.block_page = *threaded_run_.page;
+  const ThreadedOp* first = block->ops.data();
+  const int extra_cycles = first->step(*this, first, 0);
+  const unsigned cycles = threaded_run_.exit->cycle_offset + extra_cycles;
+  const unsigned instructions = threaded_run_.exit - first;
+  cpu_.instr_cycle_count_ += cycles;
+
+  // Only last instruction can make TIA update, same as when advancing after each of them
+  const unsigned remaining = cycles - threaded_run_.synced_cycles;
+  tia_.advancePixels(remaining * 3);
+  riot_.advanceCycles(remaining);
+  status.cycles += cycles;
+  status.instructions += instructions;
+  threaded_cycles_ += cycles;
+  return true;
+}
+
+// Same as Mos6502Core::execDecoded, returns cycles instruction took beyond its base cycles
+inline int Atari2600::runThreadedOp(Cpu& cpu, const ThreadedOp* op)
+{
+  // Bytes past instruction length keep their old value
+  cpu.instr_[0] = op->instr[0];
+  for (unsigned ii = 1; ii < op->len; ++ii)
+  {
+    cpu.instr_[ii] = op->instr[ii];
+  }
+  cpu.instr_len_ = op->len;
+  cpu.pc_ += op->len;
+  return static_cast<int>(op->func(cpu)) - op->cycles;
+}
+
+int Atari2600::stepThreaded(Atari2600& atari, const ThreadedOp* op, int extra_cycles)
+{
+  extra_cycles += runThreadedOp(atari.cpu_, op);
+  ++op;
+  return op->step(atari, op, extra_cycles);
+}
+
+int Atari2600::stepThreadedAccess(Atari2600& atari, const ThreadedOp* op, int extra_cycles)
+{
+  // Block never gets as far as TIA updating before it exits, so catching up doesn't draw
+  ThreadedRun& run = atari.threaded_run_;
+  const unsigned cycles = op->cycle_offset + extra_cycles;
+  const unsigned catch_up = cycles - run.synced_cycles;
+  atari.tia_.advancePixels(catch_up * 3);
+  atari.riot_.advanceCycles(catch_up);
+  run.synced_cycles = cycles;
+
+  extra_cycles += runThreadedOp(atari.cpu_, op);
+  ++op;
+  if (atari.tia_.updatePending() or (*run.page != run.block_page))
+  {
+    run.exit = op;
+    return extra_cycles;
+  }
+  return op->step(atari, op, extra_cycles);
+}
+
+int Atari2600::stepThreadedExit(Atari2600& atari, const ThreadedOp* op, int extra_cycles)
+{
+  atari.threaded_run_.exit = op;
+  return extra_cycles;
+}
+
+bool Atari2600::runCompiledBlock(RunStatus& status, unsigned max_instructions, unsigned max_cycles,
+                                 unsigned stop_line_count, size_t offset)
+{
+  // With a watching cartridge even RIOT RAM accesses go through bus
+  if (!Mos6502Jit::SUPPORTED or cartridge_->watches_low_addresses_)
+  {
+    return false;
+  }
+
+  if (jit_entries_.empty())
+  {
+    jit_entries_.resize(rom_size_, 0);
+  }
+  uint32_t& entry = jit_entries_[offset];
+  if (entry == JIT_UNSUPPORTED)
+  {
+    return false;
+  }
+  if (entry < JIT_COMPILED)
+  {
+    if (++entry < HOT_BLOCK_COUNT)
+    {
+      return false;
+    }
+    if (!jit_)
+    {
+      jit_ = std::make_unique<Mos6502Jit>();
+    }
+    // Block can't run past page it starts in, next page could be another bank
+    const size_t page_end = (offset | (BUS_PAGE_SIZE - 1)) + 1;
+    const Mos6502Jit::Block* block = jit_->compile(rom_data_ + offset, page_end - offset, cpu_.pc_);
+    if (!block)
+    {
+      entry = JIT_UNSUPPORTED;
+      return false;
+    }
+    entry = JIT_COMPILED + jit_blocks_.size();
+    jit_blocks_.push_back(block);
+  }
+
+  const Mos6502Jit::Block& block = *jit_blocks_[entry - JIT_COMPILED];
+  // Branch targets are compiled in, so a block only runs at PC it was compiled for, not at a mirror.
+  // Z and N both set can't come from a single result byte, which is all compiled code keeps.
+  if ((block.pc != cpu_.pc_) or (cpu_.nz_ > 0xFF) or
+      (status.instructions + block.instruction_count > max_instructions) or
+      (status.cycles + block.body_cycles >= max_cycles) or tia_.updatePending() or
+      (tia_.pixel_cycles_ + block.body_cycles * 3 >= Tia::SCANLINE_PIXELS) or
+      (block.body_cycles * 3 >= maxPixelsBeforeStop(stop_line_count)))
+  {
+    return false;
+  }
+
+  Mos6502JitRegs regs{cpu_.a_, cpu_.x_, cpu_.y_, cpu_.carry(), cpu_.overflow(), static_cast<uint8_t>(cpu_.nz_), cpu_.pc_};
+  const unsigned cycles = block.func(&regs, riot_.ram_.data());
+  cpu_.a_ = regs.a;
+  cpu_.x_ = regs.x;
+  cpu_.y_ = regs.y;
+  cpu_.setFlag(Cpu::FLAG_CARRY, regs.carry);
+  cpu_.setFlag(Cpu::FLAG_OVERFLOW, regs.overflow);
+  cpu_.nz_ = regs.nz;
+  cpu_.pc_ = regs.pc;
+  for (unsigned ii = 0; ii < block.final_instr.size(); ++ii)
+  {
+    if (block.final_instr[ii] >= 0)
+    {
+      cpu_.instr_[ii] = block.final_instr[ii];
+    }
+  }
+  cpu_.instr_len_ = block.final_instr_len;
+  cpu_.instr_cycle_count_ += cycles;
+
+  // Only last instruction of block can make TIA update, same as when advancing after each of them
+  tia_.advancePixels(cycles * 3);
+  riot_.advanceCycles(cycles);
+  status.cycles += cycles;
+  status.instructions += block.instruction_count;
+  jit_cycles_ += cycles;
+  return true;
+}
+
+uint64_t Atari2600::maxPixelsBeforeStop(unsigned stop_line_count) const
+{
+  if (tia_.vertical_sync_)
+  {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  if (tia_.line_count_ >= stop_line_count)
+  {
+    return 0;
+  }
+  const int64_t new_lines = std::min<int64_t>(stop_line_count - 1 - tia_.line_count_, Tia::AUTO_VSYNC - 1 - tia_.scan_y_);
+  const int64_t max_pixels = (Tia::SCANLINE_PIXELS - (tia_.scan_x_ + 1 + static_cast<int64_t>(tia_.pixel_cycles_))) +
+    new_lines * Tia::SCANLINE_PIXELS;
+  return std::max<int64_t>(max_pixels, 0);
+}
+
+uint8_t Atari2600::peek(uint16_t addr, uint64_t riot_cycle) const
+{
+  switch (page_handlers_[(addr >> BUS_PAGE_BITS) & (BUS_PAGE_COUNT - 1)])
+  {
+    case BusHandler::CARTRIDGE:
+      return cartridge_->peek(addr);
+    case BusHandler::RAM:
+    case BusHandler::RIOT:
+      return riot_.peek(addr & 0x1FFF, riot_cycle);
+    default:
+      // TIA registers, not implemented by read() either
+      return 0;
+  }
+}
+
+namespace
+{
+
+/**
+ * Bus for trying out an idle loop iteration, without touching the real machine
+ * Instructions come from cartridge, without switching banks, and any other read returns data_
+ */
+struct IdleLoopBus
+{
+  const Cartridge* cartridge_;
+  uint8_t data_;
+
+  uint8_t read(uint16_t addr)
+  {
+    return (addr & 0x1000) ? cartridge_->peek(addr) : data_;
+  }
+
+  void write(uint16_t, uint8_t)
+  {
+  }
+};
+
+template<typename TO_CPU, typename FROM_CPU>
+void copyRegisters(TO_CPU& to, const FROM_CPU& from)
+{
+  to.a_ = from.a_;
+  to.x_ = from.x_;
+  to.y_ = from.y_;
+  to.sp_ = from.sp_;
+  to.pc_ = from.pc_;
+  to.status_ = from.status_;
+  to.nz_ = from.nz_;
+  to.reseting_ = from.reseting_;
+}
+
+// Absolute or zero page LDA, LDX, LDY and BIT, returns instruction length, or 0 for other instructions
+unsigned idleLoopLoadLength(uint8_t op_code)
+{
+  switch (op_code)
+  {
+    case 0xAD:
+    case 0xAE:
+    case 0xAC:
+    case 0x2C:
+      return 3;
+    case 0xA5:
+    case 0xA6:
+    case 0xA4:
+    case 0x24:
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+}  // namespace
+
+template class Mos6502Core<IdleLoopBus>;
+
+bool Atari2600::skipIdleLoop(RunStatus& status, unsigned max_instructions, unsigned max_cycles, unsigned stop_line_count)
+{
+  // Idle loops are only looked for in cartridge, where code can't be changed by loop,
+  // and not in pages where fetching instructions could switch banks
+  const uint16_t pc = cpu_.pc_;
+  if (cpu_.reseting_ or ((pc & 0x1000) == 0) or ((pc & 0xFFF) > (ROM_SIZE - 6)) or !breakpoints_.empty() or
+      !cartridge_->readPage(pc) or !cartridge_->readPage(pc + 5))
+  {
+    return false;
+  }
+  // Most instructions can't start an idle loop, check that before gathering rest of loop
+  const uint8_t first_op_code = cartridge_->peek(pc);
+  if ((first_op_code != 0x4C) and ((first_op_code & 0x1F) != 0x10) and (idleLoopLoadLength(first_op_code) == 0))
+  {
+    return false;
+  }
+  std::array<uint8_t, 6> instr;
+  for (unsigned ii = 0; ii < instr.size(); ++ii)
+  {
+    instr[ii] = cartridge_->peek(pc + ii);
+  }
+
+  // true if JMP or branch at instr[offset] goes to pc
+  auto goesToStart = [&instr, pc](unsigned offset) -> bool
+  {
+    uint8_t op_code = instr[offset];
+    if (op_code == 0x4C)
+    {
+      return ((instr[offset + 2] << 8) | instr[offset + 1]) == pc;
+    }
+    // BPL, BMI, BVC, BVS, BCC, BCS, BNE, BEQ
+    uint16_t branch_pc = pc + offset + 2 + static_cast<int8_t>(instr[offset + 1]);
+    return ((op_code & 0x1F) == 0x10) and (branch_pc == pc);
+  };
+
+  // Either "loop : JMP loop" / "loop : BNE loop", or "loop : LDA addr / BNE loop"
+  unsigned loop_instructions = 1;
+  bool has_read = false;
+  uint16_t read_addr = 0;
+  if (!goesToStart(0))
+  {
+    unsigned load_length = idleLoopLoadLength(instr[0]);
+    if ((load_length == 0) or !goesToStart(load_length))
+    {
+      return false;
+    }
+    loop_instructions = 2;
+    has_read = true;
+    read_addr = (load_length == 3) ? ((instr[2] << 8) | instr[1]) : instr[1];
+    // Reads that switch banks, or that mapper watches, have side effects
+    const bool cartridge_read = read_addr & 0x1000;
+    if ((cartridge_read and !cartridge_->readPage(read_addr)) or
+        (!cartridge_read and cartridge_->watches_low_addresses_))
+    {
+      return false;
+    }
+  }
+
+  // Whether loop continues only depends on data read, since load replaces whatever last
+  // iteration changed. Try iteration out on a scratch CPU so it behaves exactly like this one.
+  std::array<unsigned, 2> instr_cycles = {0, 0};
+  auto continues = [this, pc, loop_instructions, &instr_cycles](uint8_t data) -> bool
+  {
+    Mos6502Core<IdleLoopBus> cpu{IdleLoopBus{cartridge_.get(), data}};
+    copyRegisters(cpu, cpu_);
+    for (unsigned ii = 0; ii < loop_instructions; ++ii)
+    {
+      instr_cycles[ii] = cpu.execOne();
+    }
+    return cpu.pc_ == pc;
+  };
+
+  const uint64_t start_cycle = riot_.cycle_count_;
+  if (!continues(has_read ? peek(read_addr, start_cycle) : 0))
+  {
+    return false;
+  }
+  const std::array<unsigned, 2> taken_instr_cycles = instr_cycles;
+  const unsigned taken_loop_cycles = instr_cycles[0] + instr_cycles[1];
+
+  // Don't go over run limits
+  uint64_t max_loops = std::min((max_cycles - status.cycles) / taken_loop_cycles,
+                                (max_instructions - status.instructions) / loop_instructions);
+
+  // Don't reach stop line, or force a VSYNC, so done condition doesn't need to be
+  // checked after each skipped instruction. Lines don't start during VSYNC.
+  // Pending TIA writes and line starts are left to normal execution.
+  if (tia_.settings_changed_ or (tia_.getPendingLineCount() != 0))
+  {
+    return false;
+  }
+  unsigned pending_pixels = tia_.pixel_cycles_;
+  max_loops = std::min<uint64_t>(max_loops, maxPixelsBeforeStop(stop_line_count) / (3 * taken_loop_cycles));
+
+  // Count iterations that keep looping. Only RIOT timer registers change without a write,
+  // loops on anything else never exit.
+  uint64_t loops = max_loops;
+  const bool timer_read = has_read and ((read_addr & 0x1284) == 0x0284);
+  // LDA, LDX or LDY followed by BNE exits on first iteration that reads 0
+  const bool exits_on_zero = (instr[0] != 0x2C) and (instr[0] != 0x24) and
+    (instr[idleLoopLoadLength(instr[0])] == 0xD0);
+  if (timer_read and (read_addr & 0x1))
+  {
+    // TIMINT reads 0x00 until timer expires and 0x80 after, until INTIM is read (which loop doesn't do),
+    // so first iteration after expiry is only one that can read something new
+    const uint64_t expire_cycle = riot_.getTimerExpireCycle();
+    if (!riot_.getTimerFlag(start_cycle) and riot_.getTimerFlag(expire_cycle) and !continues(0x80))
+    {
+      loops = std::min<uint64_t>(max_loops, (expire_cycle - start_cycle + taken_loop_cycles - 1) / taken_loop_cycles);
+    }
+  }
+  else if (timer_read and exits_on_zero)
+  {
+    // Jump to first iteration that reads at or after next cycle INTIM is 0, until one reads 0
+    // (INTIM is 0 for a whole interval before expiring, and iterations may step over 0 after that)
+    for (loops = 1; loops < max_loops;)
+    {
+      const uint64_t read_cycle = start_cycle + loops * taken_loop_cycles;
+      if (riot_.getIntim(read_cycle) == 0)
+      {
+        break;
+      }
+      const uint64_t zero_cycle = riot_.getIntimZeroCycle(read_cycle);
+      loops = (zero_cycle - start_cycle + taken_loop_cycles - 1) / taken_loop_cycles;
+    }
+    loops = std::min(loops, max_loops);
+  }
+  else if (timer_read)
+  {
+    // Other checks of INTIM, try out each iteration
+    // 0 unknown, 1 continues, 2 exits
+    std::array<uint8_t, 256> continues_by_data = {};
+    for (loops = 1; loops < max_loops; ++loops)
+    {
+      uint8_t data = peek(read_addr, start_cycle + loops * taken_loop_cycles);
+      if (continues_by_data[data] == 0)
+      {
+        continues_by_data[data] = continues(data) ? 1 : 2;
+      }
+      if (continues_by_data[data] == 2)
+      {
+        break;
+      }
+    }
+  }
+  if (loops < 2)
+  {
+    return false;
+  }
+
+  // Skip all but last iteration
+  const unsigned skipped_loops = loops - 1;
+  const unsigned cycles = skipped_loops * taken_loop_cycles;
+  cpu_.instr_cycle_count_ += cycles;
+  riot_.advanceCycles(cycles);
+
+  // Pixels are drawn once a scanline of them is pending, leave as many pending as
+  // advancing TIA after each instruction would, so frame_count_ changes at same point
+  // Pending count at start of an iteration only depends on count at start of one before,
+  // so it repeats within SCANLINE_PIXELS iterations, and whole periods of it can be skipped.
+  const unsigned start_pending_pixels = pending_pixels;
+  std::array<unsigned, Tia::SCANLINE_PIXELS> first_loop;
+  first_loop.fill(std::numeric_limits<unsigned>::max());
+  bool skipped_periods = false;
+  for (unsigned loop = 0; loop < skipped_loops; ++loop)
+  {
+    assert(pending_pixels < Tia::SCANLINE_PIXELS);
+    if (!skipped_periods and (first_loop[pending_pixels] != std::numeric_limits<unsigned>::max()))
+    {
+      const unsigned period = loop - first_loop[pending_pixels];
+      loop += (skipped_loops - loop) / period * period;
+      skipped_periods = true;
+      if (loop == skipped_loops)
+      {
+        break;
+      }
+    }
+    first_loop[pending_pixels] = loop;
+    for (unsigned ii = 0; ii < loop_instructions; ++ii)
+    {
+      pending_pixels += taken_instr_cycles[ii] * 3;
+      pending_pixels = (pending_pixels >= Tia::SCANLINE_PIXELS) ? 0 : pending_pixels;
+    }
+  }
+  tia_.pixel_cycles_ = start_pending_pixels + cycles * 3 - pending_pixels;
   tia_.syncPixels();
+  tia_.pixel_cycles_ = pending_pixels;
+
+  status.cycles += cycles;
+  status.instructions += skipped_loops * loop_instructions;
+  status.skipped_cycles += cycles;
+  skipped_cycles_ += cycles;
+
+  // Run last iteration, so registers and timer flag (cleared by reading INTIM) end up as if all iterations ran
+  for (unsigned ii = 0; ii < loop_instructions; ++ii)
+  {
+    unsigned instr_cycles = execOne();
+    tia_.advancePixels(instr_cycles * 3);
+    riot_.advanceCycles(instr_cycles);
+    status.cycles += instr_cycles;
+    ++status.instructions;
+  }
+  return true;
+}
+
+void Atari2600::execInstructions(unsigned instruction_count)
+{
+  run(instruction_count, std::numeric_limits<unsigned>::max(), std::numeric_limits<unsigned>::max(),
+      [](const RunStatus&) { return false; });
+}
+
+Atari2600::RunStatus Atari2600::runFrame(unsigned max_cycles)
+{
+  return run(std::numeric_limits<unsigned>::max(), max_cycles, std::numeric_limits<unsigned>::max(), [](const RunStatus& status)
+  {
+    return status.frame_complete;
+  });
+}
+
+Atari2600::RunStatus Atari2600::runScanlines(unsigned scanline_count)
+{
+  const unsigned stop_line_count = tia_.line_count_ + scanline_count;
+  return run(std::numeric_limits<unsigned>::max(), std::numeric_limits<unsigned>::max(), stop_line_count,
+             [this, stop_line_count](const RunStatus&)
+  {
+    return (tia_.line_count_ + tia_.getPendingLineCount()) >= stop_line_count;
+  });
+}
+
+Atari2600::RunStatus Atari2600::runCycles(unsigned cycle_count)
+{
+  return run(std::numeric_limits<unsigned>::max(), cycle_count, std::numeric_limits<unsigned>::max(),
+             [](const RunStatus&) { return false; });
 }
 
 void Atari2600::addBreakpoint(uint16_t addr)
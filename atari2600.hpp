@@ -4,35 +4,454 @@
 #include <array>
 #include <cstdint>
 #include <iostream>
+#include <memory>
+#include <type_traits>
 #include <unordered_set>
 #include <vector>
 
+#include "cartridge.hpp"
 #include "mos6502.hpp"
+#include "mos6502_jit.hpp"
+#include "riot.hpp"
+#include "rom.hpp"
 #include "tia.hpp"
 
+class Atari2600;
+
+/**
+ * Memory bus of the Atari2600 as seen by the CPU
+ * Forwards accesses directly to Atari2600::read / Atari2600::write
+ * so they can be inlined into the CPU's instruction functions
+ */
+struct Atari2600Bus
+{
+  Atari2600* atari_;
+
+  inline uint8_t read(uint16_t addr);
+  inline void write(uint16_t addr, uint8_t data);
+};
+
+extern template class Mos6502Core<Atari2600Bus>;
+
+/**
+ * Fixed layout, versioned snapshot of the whole machine except ROM and display
+ * Plain data, so forking a state is a copy of a couple hundred bytes
+ * Multi-byte fields are in host byte order
+ */
+struct Atari2600State
+{
+  static constexpr uint32_t MAGIC = 0x53363241; // "A26S"
+  static constexpr uint16_t VERSION = 3;
+
+  // flags bit, set if tia_.display_ follows state in a saved blob
+  static constexpr uint16_t HAS_DISPLAY = 0x1;
+  // flags bit, set if tia_.back_display_ follows display in a saved blob, only valid with HAS_DISPLAY
+  static constexpr uint16_t HAS_BACK_DISPLAY = 0x2;
+  // flags bit, set if tia_.indexed_display_ and tia_.back_indexed_display_ follow any RGBA displays in a saved blob
+  static constexpr uint16_t HAS_INDEXED_DISPLAY = 0x4;
+
+  uint32_t magic;
+  uint16_t version;
+  uint16_t flags;
+  RiotState riot;
+  Mos6502State cpu;
+  TiaState tia;
+  CartridgeState cartridge;
+  uint32_t reserved;
+};
+
+static_assert(std::is_trivially_copyable_v<Atari2600State>);
+static_assert(sizeof(Atari2600State) == 376, "Atari2600State layout changed, update VERSION");
+
 class Atari2600
 {
 public:
   Atari2600();
 
-  Mos6502 cpu_;
+  using Cpu = Mos6502Core<Atari2600Bus>;
+
+  Cpu cpu_;
   Tia tia_;
-  std::array<uint8_t, 128> ram_;
-  std::vector<uint8_t> rom_;
+  Riot riot_;
+  // Bank switching of ROM image, which may be shared with other instances
+  std::unique_ptr<Cartridge> cartridge_;
 
+  // TIA and RIOT trace events, only recorded if tracing is compiled in (see trace.hpp)
+  TraceBuffer trace_;
+
+  /**
+   * @brief copy stream into a ROM image of its own, ROMs shorter than ROM_SIZE (except 2K) are padded
+   * Convenience wrapper, RomImage::mapFile or RomStore::open can share one image between instances
+   */
   void loadRom(std::istream& in);
 
+  /**
+   * @brief use an already loaded ROM image, that can be shared by many instances
+   * Mapper is detected from ROM if it is AUTO, throws std::runtime_error if ROM doesn't fit mapper
+   */
+  void loadRom(std::shared_ptr<const RomImage> rom, Cartridge::Mapper mapper = Cartridge::Mapper::AUTO);
+
+  // Cartridge address space, ROMs that are larger are bank switched
   static constexpr unsigned ROM_SIZE = 1<<12; // 4k ROM
 
+  /**
+   * @brief snapshot of CPU, TIA, RIOT and cartridge banks, ROM and display_ are not included
+   * Restoring it continues emulation exactly as if it had never stopped
+   */
+  void saveState(Atari2600State& state) const;
+
+  /**
+   * @brief restore snapshot from saveState, throws std::runtime_error if it is from another version,
+   * or from a cartridge with another mapper or fewer banks
+   * ROM that state was saved with must already be loaded
+   */
+  void loadState(const Atari2600State& state);
+
+  /**
+   * @brief Atari2600State as bytes, followed by tia_.display_ and tia_.back_display_ if include_display is set
+   * When tia_.indexed_output_ is set, tia_.indexed_display_ and tia_.back_indexed_display_ are saved instead
+   */
+  std::vector<uint8_t> saveState(bool include_display = false) const;
+
+  /**
+   * @brief restore blob from saveState(bool), throws std::runtime_error if it is not valid
+   * Displays are only changed if blob includes them, a blob with only a front display copies it to back display
+   * Indexed displays are restored whether or not tia_.indexed_output_ is set, it is not changed
+   */
+  void loadState(const uint8_t* data, size_t size);
+
   void execInstructions(unsigned instruction_count);
   void addBreakpoint(uint16_t addr);
   void clearBreakpoints();
 
+  struct RunStatus
+  {
+    // a new frame was started (VSYNC) during the run
+    bool frame_complete = false;
+    // run stopped early because PC reached a breakpoint
+    bool breakpoint_hit = false;
+    unsigned instructions = 0;
+    // includes skipped_cycles
+    unsigned cycles = 0;
+    // cycles of idle loop iterations that were skipped instead of executed
+    unsigned skipped_cycles = 0;
+  };
+
+  // Limit for runFrame, enough for a couple of frames even without VSYNC
+  static constexpr unsigned MAX_FRAME_CYCLES = 2 * Tia::AUTO_VSYNC * Tia::SCANLINE_PIXELS / 3;
+
+  /**
+   * @brief run until next VSYNC starts (frame is complete), or max_cycles have run
+   * When frame_complete is set, tia_.display_ holds the completed frame (unless rendering is off),
+   * and keeps holding it until next frame is complete
+   */
+  RunStatus runFrame(unsigned max_cycles = MAX_FRAME_CYCLES);
+
+  /**
+   * @brief draw frames, or only run them without drawing anything
+   * Can be changed between frames, to skip drawing frames nobody looks at (like all but last frame of a repeated
+   * action). Emulation is exactly the same either way, tia_.display_ just keeps last frame that was drawn.
+   * Frames that aren't drawn don't change tia_.ready_frame_count_.
+   */
+  void setRendering(bool render)
+  {
+    tia_.render_ = render;
+  }
+
+  bool rendering() const
+  {
+    return tia_.render_;
+  }
+
+  /**
+   * @brief run until scanline_count more scanlines have started
+   */
+  RunStatus runScanlines(unsigned scanline_count);
+
+  /**
+   * @brief run instructions until at least cycle_count CPU cycles have been run
+   * Returned cycles will be more than cycle_count if last instruction does not end exactly at budget
+   */
+  RunStatus runCycles(unsigned cycle_count);
+
+  /**
+   * Skip over iterations of idle loops, instead of executing each of them
+   * An idle loop is a load (or BIT) followed by a branch back to it, or a jump or branch to itself,
+   * like "LDA INTIM / BNE" or "BIT TIMINT / BPL". It has no side effects and only the timer can
+   * make it exit. Emulated state ends up same as when running every iteration.
+   */
+  bool skip_idle_loops_ = true;
+
+  // Total cycles of idle loop iterations that were skipped
+  uint64_t skipped_cycles_ = 0;
+
+  /**
+   * How instructions from cartridge ROM are run, emulated state is identical in every mode
+   */
+  enum class ExecMode : uint8_t
+  {
+    // Read and decode instruction bytes from bus each time they run
+    FETCH,
+    // Run instructions from a table decoded when ROM was loaded
+    DECODED,
+    // Run basic blocks translated into threaded code, see ThreadedBlock
+    THREADED,
+    // Like THREADED, but blocks that run often are compiled to machine code, where Mos6502Jit is supported
+    JIT
+  };
+
+  ExecMode exec_mode_ = ExecMode::DECODED;
+
+  static const char* execModeName(ExecMode exec_mode);
+
+  // Cycles run by compiled blocks in JIT mode
+  uint64_t jit_cycles_ = 0;
+
+  // Cycles run by translated blocks in THREADED (or JIT) mode
+  uint64_t threaded_cycles_ = 0;
+
+  /**
+   * Every offset of a ROM image decoded as an instruction, shared by all instances using image
+   */
+  struct DecodedRom
+  {
+    // Entries for instructions that would cross a page have a null func, they are fetched from bus instead
+    std::vector<Cpu::DecodedInstr> instrs;
+
+    // Number of instructions in basic block starting at each offset. Blocks end with a branch, jump,
+    // call or return, or at end of page, since next page could be mapped to another bank.
+    std::vector<uint8_t> block_lengths;
+  };
+
 protected:
+  friend struct Atari2600Bus;
+
   std::unordered_set<uint16_t> breakpoints_;
 
-  uint8_t read(uint16_t addr);
-  void write(uint16_t addr, uint8_t data);
+  /**
+   * @brief run instructions until done(status) is true, or cycle or instruction limit is reached
+   * done(status) must not become true before stop_line_count scanlines are reached,
+   * unless a frame is completed, so idle loops can be skipped without checking it
+   */
+  template<typename DONE_FUNC>
+  RunStatus run(unsigned max_instructions, unsigned max_cycles, unsigned stop_line_count, DONE_FUNC done);
+
+  /**
+   * @brief if CPU is at start of an idle loop, skip iterations of it
+   * Never skips past run limits, the start of scanline stop_line_count or a forced VSYNC,
+   * so run() stops at same instruction as without skipping.
+   * Returns false if nothing was skipped.
+   */
+  bool skipIdleLoop(RunStatus& status, unsigned max_instructions, unsigned max_cycles, unsigned stop_line_count);
+
+  std::shared_ptr<const DecodedRom> decoded_rom_;
+  const uint8_t* rom_data_ = nullptr;
+  size_t rom_size_ = 0;
+
+  /**
+   * @brief offset in ROM image of instruction at PC, or rom_size_ or more if PC isn't in a page mapped to image
+   * Bank switching only changes page pointers, so decoded_rom_ never needs to be invalidated,
+   * and pages that switch banks when read (or map cartridge RAM) aren't in image.
+   */
+  size_t decodedOffset() const
+  {
+    const uint16_t pc = cpu_.pc_;
+    // nullptr pages wrap around to a huge offset
+    return reinterpret_cast<uintptr_t>(read_pages_[(pc >> BUS_PAGE_BITS) & (BUS_PAGE_COUNT - 1)]) -
+      reinterpret_cast<uintptr_t>(rom_data_) + (pc & (BUS_PAGE_SIZE - 1));
+  }
+
+  /**
+   * @brief execute next instruction, from decoded_rom_ unless exec_mode_ is FETCH
+   */
+  unsigned execOne()
+  {
+    const size_t offset = decodedOffset();
+    if ((offset < rom_size_) and (exec_mode_ != ExecMode::FETCH) and !cpu_.reseting_)
+    {
+      const Cpu::DecodedInstr& decoded = decoded_rom_->instrs[offset];
+      if (decoded.func)
+      {
+        return cpu_.execDecoded(decoded);
+      }
+    }
+    return cpu_.execOne();
+  }
+
+  /**
+   * @brief run rest of basic block starting at PC, returns false if PC isn't at a block of decoded instructions
+   * Runs compiled or translated block if it can, otherwise runs decoded instructions one at a time,
+   * and then block stops early after an instruction that made TIA draw or apply a write, switched the bank
+   * code is running from, or reached a run limit, so run() checks done() after same instruction
+   * it would when running instructions one at a time. Like skipIdleLoop, it must not start the
+   * scanline stop_line_count without stopping.
+   */
+  bool runBlock(RunStatus& status, unsigned max_instructions, unsigned max_cycles, unsigned stop_line_count);
+
+  /**
+   * @brief pixels TIA can advance without starting scanline stop_line_count or forcing a VSYNC
+   * Pending TIA writes must have been applied, lines don't start during VSYNC
+   */
+  uint64_t maxPixelsBeforeStop(unsigned stop_line_count) const;
+
+  /**
+   * Instruction of a ThreadedBlock, its handler bound to its operand bytes
+   * step runs it and tail calls step of next op, last op of a block just returns, so a block
+   * runs without going back to a dispatch loop between instructions.
+   */
+  struct ThreadedOp
+  {
+    // returns cycles op and ops after it took beyond their base cycles (page crossings, taken branches)
+    using Step = int (*)(Atari2600& atari, const ThreadedOp* op, int extra_cycles);
+    Step step;
+    Cpu::OpFunc func;
+    std::array<uint8_t, 3> instr;
+    uint8_t len;
+    // cycles instruction takes without page crossings or taken branch
+    uint8_t cycles;
+    // base cycles of instructions before this one in block
+    uint16_t cycle_offset;
+  };
+
+  /**
+   * Basic block of ROM instructions translated for THREADED mode
+   * Cycles are summed when block is translated, running it only adds up what instructions take beyond that,
+   * and TIA and RIOT are advanced once for the whole block. An instruction that can access anything but
+   * RIOT RAM and ROM first catches TIA and RIOT up to its cycle_offset (plus extra cycles so far), so they
+   * see the access on same cycle as when advanced after each instruction. Block exits after such an
+   * instruction if it left a TIA write to apply, or switched the bank block runs from.
+   */
+  struct ThreadedBlock
+  {
+    // one op per instruction, followed by an op that returns, its cycle_offset is base cycles of whole block
+    std::vector<ThreadedOp> ops;
+    unsigned instruction_count;
+    // most cycles block can take
+    unsigned max_cycles;
+  };
+
+  static constexpr uint32_t THREADED_UNSUPPORTED = 0xFFFFFFFF;
+
+  // Per ROM offset, 0 until block starting there is translated, then index + 1 into threaded_blocks_
+  std::vector<uint32_t> threaded_entries_;
+  std::vector<ThreadedBlock> threaded_blocks_;
+
+  // Block being run
+  struct ThreadedRun
+  {
+    // cycles TIA and RIOT have been caught up to
+    unsigned synced_cycles;
+    // read page block runs from, and what it pointed to when block started
+    const uint8_t* const* page;
+    const uint8_t* block_page;
+    // op block exited before
+    const ThreadedOp* exit;
+  };
+  ThreadedRun threaded_run_ = {};
+
+  /**
+   * @brief translated block for ROM offset, translating it first time, or nullptr if first instruction can't be
+   */
+  const ThreadedBlock* threadedBlock(size_t offset);
+
+  /**
+   * @brief run translated block for ROM offset at PC, returns false if it didn't run
+   * Like compiled blocks, it only runs if no TIA update is pending, and none could happen and no run limit
+   * could be reached before its last instruction, so it ends up same as running instructions one at a time.
+   */
+  bool runThreadedBlock(RunStatus& status, unsigned max_instructions, unsigned max_cycles, unsigned stop_line_count,
+                        size_t offset);
+
+  static int runThreadedOp(Cpu& cpu, const ThreadedOp* op);
+  static int stepThreaded(Atari2600& atari, const ThreadedOp* op, int extra_cycles);
+  static int stepThreadedAccess(Atari2600& atari, const ThreadedOp* op, int extra_cycles);
+  static int stepThreadedExit(Atari2600& atari, const ThreadedOp* op, int extra_cycles);
+
+  /**
+   * Blocks are compiled once they have started HOT_BLOCK_COUNT times. jit_entries_ has an entry per
+   * ROM offset, a start count until then, and after that JIT_COMPILED + index into jit_blocks_,
+   * or JIT_UNSUPPORTED if not enough of block could be compiled.
+   */
+  static constexpr uint32_t HOT_BLOCK_COUNT = 16;
+  static constexpr uint32_t JIT_UNSUPPORTED = 0xFFFFFFFF;
+  static constexpr uint32_t JIT_COMPILED = 0x80000000;
+
+  std::unique_ptr<Mos6502Jit> jit_;
+  std::vector<uint32_t> jit_entries_;
+  std::vector<const Mos6502Jit::Block*> jit_blocks_;
+
+  /**
+   * @brief run compiled block for ROM offset at PC, compiling it if it has become hot
+   * Compiled code only touches CPU registers and RIOT RAM, so TIA and RIOT are advanced once
+   * after it. Block only runs if that ends up same as advancing them after each instruction:
+   * no TIA update is pending and none would happen before block's last instruction, and block
+   * fits in run limits. Returns false if block didn't run.
+   */
+  bool runCompiledBlock(RunStatus& status, unsigned max_instructions, unsigned max_cycles, unsigned stop_line_count,
+                        size_t offset);
+
+  // value addr would read at given RIOT cycle, without side effects
+  uint8_t peek(uint16_t addr, uint64_t riot_cycle) const;
+
+  /**
+   * Memory bus decode, one entry per BUS_PAGE_SIZE bytes of the 13-bit address space
+   * Pages of RIOT RAM and cartridge have a host pointer, an access to them is an indexed load or store.
+   * Other pages (and RAM, if cartridge watches TIA and RIOT accesses) have a nullptr entry,
+   * and page_handlers_ tells which chip handles the access.
+   */
+  enum class BusHandler : uint8_t
+  {
+    RAM,
+    TIA,
+    RIOT,
+    CARTRIDGE
+  };
+
+  static constexpr unsigned BUS_PAGE_BITS = Cartridge::PAGE_BITS;
+  static constexpr unsigned BUS_PAGE_SIZE = 1 << BUS_PAGE_BITS;
+  static constexpr unsigned BUS_PAGE_COUNT = 0x2000 / BUS_PAGE_SIZE;
+
+  std::array<const uint8_t*, BUS_PAGE_COUNT> read_pages_ = {};
+  std::array<uint8_t*, BUS_PAGE_COUNT> write_pages_ = {};
+  std::array<BusHandler, BUS_PAGE_COUNT> page_handlers_ = {};
+
+  // Fill in bus tables for cartridge_
+  void mapBus();
+
+  uint8_t read(uint16_t addr)
+  {
+    const uint8_t* page = read_pages_[(addr >> BUS_PAGE_BITS) & (BUS_PAGE_COUNT - 1)];
+    if (page)
+    {
+      return page[addr & (BUS_PAGE_SIZE - 1)];
+    }
+    return readHandler(addr);
+  }
+
+  void write(uint16_t addr, uint8_t data)
+  {
+    uint8_t* page = write_pages_[(addr >> BUS_PAGE_BITS) & (BUS_PAGE_COUNT - 1)];
+    if (page)
+    {
+      page[addr & (BUS_PAGE_SIZE - 1)] = data;
+      return;
+    }
+    writeHandler(addr, data);
+  }
+
+  // Accesses to pages without a host pointer, kept out of line so read and write stay small
+  uint8_t readHandler(uint16_t addr);
+  void writeHandler(uint16_t addr, uint8_t data);
 };
 
+uint8_t Atari2600Bus::read(uint16_t addr)
+{
+  return atari_->read(addr);
+}
+
+void Atari2600Bus::write(uint16_t addr, uint8_t data)
+{
+  atari_->write(addr, data);
+}
+
 #endif  // ATARI2600_ATARI2600_HPP_GUARD
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include "atari2600_batch.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+Atari2600Batch::Atari2600Batch(size_t instance_count, std::shared_ptr<const RomImage> rom,
+                               unsigned thread_count)
+{
+  // Detect mapper once, instead of for each instance
+  const Cartridge::Mapper mapper = rom ? Cartridge::detect(*rom) : Cartridge::Mapper::AUTO;
+  instances_.reserve(instance_count);
+  for (size_t ii = 0; ii < instance_count; ++ii)
+  {
+    instances_.push_back(std::make_unique<Atari2600>());
+    instances_.back()->loadRom(rom, mapper);
+  }
+
+  if (thread_count == 0)
+  {
+    thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  for (unsigned ii = 1; ii < thread_count; ++ii)
+  {
+    workers_.emplace_back(&Atari2600Batch::workerLoop, this);
+  }
+}
+
+Atari2600Batch::~Atari2600Batch()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  start_cv_.notify_all();
+  for (std::thread& worker : workers_)
+  {
+    worker.join();
+  }
+}
+
+void Atari2600Batch::loadPalette(std::istream& input)
+{
+  if (instances_.empty())
+  {
+    return;
+  }
+  Tia& first = instances_.front()->tia_;
+  first.loadPalette(input);
+  for (auto& atari : instances_)
+  {
+    atari->tia_.palette_ = first.palette_;
+  }
+}
+
+void Atari2600Batch::observe(TiaObservation::Format format, uint8_t channels)
+{
+  observers_.clear();
+  for (auto& atari : instances_)
+  {
+    observers_.push_back(std::make_unique<TiaObservation>(format, channels));
+    atari->tia_.observation_ = observers_.back().get();
+    atari->tia_.indexed_output_ = true;
+  }
+  clear_observations_ = true;
+}
+
+void Atari2600Batch::step(const uint8_t* actions, uint8_t* observations)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    actions_ = actions;
+    observations_ = observations;
+    next_instance_ = 0;
+    exception_ = nullptr;
+    busy_workers_ = workers_.size();
+    ++generation_;
+  }
+  start_cv_.notify_all();
+
+  stepInstances();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this] { return busy_workers_ == 0; });
+  clear_observations_ = false;
+  if (exception_)
+  {
+    std::rethrow_exception(exception_);
+  }
+}
+
+void Atari2600Batch::workerLoop()
+{
+  uint64_t generation = 0;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_cv_.wait(lock, [this, generation] { return stop_ or (generation_ != generation); });
+      if (stop_)
+      {
+        return;
+      }
+      generation = generation_;
+    }
+
+    stepInstances();
+
+    bool last;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      last = (--busy_workers_ == 0);
+    }
+    if (last)
+    {
+      done_cv_.notify_one();
+    }
+  }
+}
+
+void Atari2600Batch::stepInstances()
+{
+  while (true)
+  {
+    size_t index = next_instance_.fetch_add(1, std::memory_order_relaxed);
+    if (index >= instances_.size())
+    {
+      return;
+    }
+
+    Atari2600& atari = *instances_[index];
+    try
+    {
+      atari.riot_.swcha_input_ = actions_[index];
+      if (!observers_.empty())
+      {
+        // TIA writes observation while frame runs
+        TiaObservation& observer = *observers_[index];
+        observer.buffer_ = observations_ ? (observations_ + index * observer.size()) : nullptr;
+        if (clear_observations_ and observer.buffer_)
+        {
+          std::memset(observer.buffer_, 0, observer.size());
+        }
+      }
+      atari.runFrame();
+      if (observations_ and observers_.empty())
+      {
+        std::memcpy(observations_ + index * OBSERVATION_SIZE, atari.tia_.display_.data(), OBSERVATION_SIZE);
+      }
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!exception_)
+      {
+        exception_ = std::current_exception();
+      }
+    }
+  }
+}
@@ -0,0 +1,107 @@
+#ifndef ATARI2600_ATARI2600_BATCH_HPP_GUARD
+#define ATARI2600_ATARI2600_BATCH_HPP_GUARD
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "atari2600.hpp"
+#include "tia_observation.hpp"
+
+/**
+ * Many Atari2600 instances running same ROM, stepped a frame at a time on a pool of worker threads
+ * Instances share one copy of the ROM, and are handed out to threads one at a time,
+ * so instances that take longer don't hold up a whole thread's share of the batch.
+ */
+class Atari2600Batch
+{
+public:
+  // Observation of an instance is its RGBA display_, right after a frame completes, unless observe() was called
+  static constexpr size_t OBSERVATION_SIZE = Tia::DISPLAY_WIDTH * Tia::DISPLAY_HEIGHT * sizeof(RGBA);
+
+  /**
+   * @brief thread_count includes calling thread, 0 uses std::thread::hardware_concurrency()
+   */
+  Atari2600Batch(size_t instance_count, std::shared_ptr<const RomImage> rom, unsigned thread_count = 0);
+  ~Atari2600Batch();
+
+  Atari2600Batch(const Atari2600Batch&) = delete;
+  Atari2600Batch& operator=(const Atari2600Batch&) = delete;
+
+  // Load palette once, and copy it to every instance
+  void loadPalette(std::istream& input);
+
+  /**
+   * @brief have step() write observations in format instead of RGBA display
+   * Instances draw palette indices, and their TIAs write observations straight into step()'s buffer as they draw.
+   * Next step() zeroes each observation before it runs, since rows an instance drew before observe() was called
+   * (if it was mid-frame) aren't drawn again in that step, and stay zero.
+   */
+  void observe(TiaObservation::Format format,
+               uint8_t channels = TiaObservation::CHANNEL_R | TiaObservation::CHANNEL_G | TiaObservation::CHANNEL_B);
+
+  // bytes of observation of each instance
+  size_t observationSize() const
+  {
+    return observers_.empty() ? OBSERVATION_SIZE : observers_.front()->size();
+  }
+
+  /**
+   * @brief set each instance's joystick inputs (SWCHA levels, 0 = pressed) to actions[i], and run it for a frame
+   * Observation of instance i is written to observations + i * observationSize(), observations can be nullptr.
+   * If an instance throws, remaining instances still run, then first exception is rethrown.
+   */
+  void step(const uint8_t* actions, uint8_t* observations);
+
+  size_t size() const
+  {
+    return instances_.size();
+  }
+
+  unsigned threadCount() const
+  {
+    return workers_.size() + 1;
+  }
+
+  Atari2600& instance(size_t index)
+  {
+    return *instances_.at(index);
+  }
+
+protected:
+  // Atari2600 can't be moved, CPU bus points back at it
+  std::vector<std::unique_ptr<Atari2600>> instances_;
+  // one per instance once observe() is called
+  std::vector<std::unique_ptr<TiaObservation>> observers_;
+  // set by observe(), so next step() zeroes observations before instances draw into them
+  bool clear_observations_ = false;
+  std::vector<std::thread> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  // incremented for each step, workers wait for it to change
+  uint64_t generation_ = 0;
+  unsigned busy_workers_ = 0;
+  bool stop_ = false;
+  std::exception_ptr exception_;
+
+  // Arguments of current step
+  const uint8_t* actions_ = nullptr;
+  uint8_t* observations_ = nullptr;
+  std::atomic<size_t> next_instance_{0};
+
+  void workerLoop();
+
+  // Step instances until there are none left in current step
+  void stepInstances();
+};
+
+#endif  // ATARI2600_ATARI2600_BATCH_HPP_GUARD
@@ -0,0 +1,702 @@
+#include <benchmark/benchmark.h>
+
+#include "atari2600.hpp"
+#include "atari2600_batch.hpp"
+#include "mos6502_impl.hpp"
+#include "rewind.hpp"
+
+#include <array>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+/**
+ * Small kernel that only touches RAM and ROM, so benchmark measures CPU / bus overhead
+ */
+const uint8_t kernel_instructions[] =
+{
+  0xA2, 0x00,        // F000 : LDX #0
+  0xB5, 0x80,        // F002 : LDA $80,X
+  0x69, 0x01,        // F004 : ADC #1
+  0x95, 0x80,        // F006 : STA $80,X
+  0xE8,              // F008 : INX
+  0x8A,              // F009 : TXA
+  0x29, 0x7F,        // F00A : AND #7F
+  0xAA,              // F00C : TAX
+  0xBD, 0x00, 0xF0,  // F00D : LDA $F000,X
+  0x4C, 0x02, 0xF0,  // F010 : JMP $F002
+};
+
+// Instructions per iteration of kernel loop
+constexpr unsigned KERNEL_LOOP_INSTRUCTIONS = 8;
+
+/**
+ * Kernel of instructions that set flags, most of which are overwritten before a branch reads them
+ */
+const uint8_t flags_kernel_instructions[] =
+{
+  0xA2, 0x00,        // F000 : LDX #0
+  0xA5, 0x80,        // F002 : LDA $80
+  0xC9, 0x40,        // F004 : CMP #$40
+  0x69, 0x01,        // F006 : ADC #1
+  0x29, 0x7F,        // F008 : AND #$7F
+  0x85, 0x80,        // F00A : STA $80
+  0x45, 0x81,        // F00C : EOR $81
+  0xE0, 0x10,        // F00E : CPX #$10
+  0xE8,              // F010 : INX
+  0x88,              // F011 : DEY
+  0xD0, 0xEE,        // F012 : BNE $F002
+  0x4C, 0x00, 0xF0,  // F014 : JMP $F000
+};
+
+// 13-bit address space of 6507, with kernel in ROM and reset vector pointing to F000
+template<size_t N>
+std::array<uint8_t, 0x2000> makeMemory(const uint8_t (&instructions)[N])
+{
+  std::array<uint8_t, 0x2000> memory = {};
+  std::copy(std::begin(instructions), std::end(instructions), memory.begin() + 0x1000);
+  memory[0x1FFC] = 0x00;
+  memory[0x1FFD] = 0xF0;
+  return memory;
+}
+
+std::array<uint8_t, 0x2000> makeMemory()
+{
+  return makeMemory(kernel_instructions);
+}
+
+std::string makeKernelRom()
+{
+  auto memory = makeMemory();
+  return std::string(memory.begin() + 0x1000, memory.end());
+}
+
+/**
+ * Kernel that only uses instructions Mos6502Jit compiles, a loop counting down X
+ */
+const uint8_t jit_kernel_instructions[] =
+{
+  0xA2, 0x64,        // F000 : LDX #100
+  0xA5, 0x80,        // F002 : LDA $80
+  0x18,              // F004 : CLC
+  0x69, 0x03,        // F005 : ADC #3
+  0x85, 0x80,        // F007 : STA $80
+  0x45, 0x81,        // F009 : EOR $81
+  0x85, 0x81,        // F00B : STA $81
+  0xCA,              // F00D : DEX
+  0xD0, 0xF2,        // F00E : BNE $F002
+  0x4C, 0x00, 0xF0,  // F010 : JMP $F000
+};
+
+std::string makeJitKernelRom()
+{
+  std::string rom(0x1000, '\0');
+  std::copy(std::begin(jit_kernel_instructions), std::end(jit_kernel_instructions), rom.begin());
+  rom[0xFFC] = 0x00;
+  rom[0xFFD] = static_cast<char>(0xF0);
+  return rom;
+}
+
+struct ArrayBus
+{
+  std::array<uint8_t, 0x2000>* memory_;
+
+  uint8_t read(uint16_t addr)
+  {
+    return (*memory_)[addr & 0x1FFF];
+  }
+
+  void write(uint16_t addr, uint8_t data)
+  {
+    (*memory_)[addr & 0x1FFF] = data;
+  }
+};
+
+}  // namespace
+
+template class Mos6502Core<ArrayBus>;
+
+template<typename CPU>
+void runKernel(benchmark::State& state, CPU& cpu)
+{
+  constexpr unsigned INSTRUCTIONS = 1000 * KERNEL_LOOP_INSTRUCTIONS;
+  for (auto _ : state)
+  {
+    for (unsigned ii = 0; ii < INSTRUCTIONS; ++ii)
+    {
+      cpu.execOne();
+    }
+    benchmark::DoNotOptimize(cpu.a_);
+  }
+  state.SetItemsProcessed(state.iterations() * INSTRUCTIONS);
+}
+
+// Memory accesses go through std::function callbacks
+static void BM_Mos6502CallbackBus(benchmark::State& state)
+{
+  auto memory = makeMemory();
+  Mos6502 cpu{Mos6502CallbackBus{
+    [&memory](uint16_t addr) -> uint8_t { return memory[addr & 0x1FFF]; },
+    [&memory](uint16_t addr, uint8_t data) { memory[addr & 0x1FFF] = data; }
+    }};
+  runKernel(state, cpu);
+}
+BENCHMARK(BM_Mos6502CallbackBus);
+
+// Memory accesses are statically dispatched and inlined
+static void BM_Mos6502StaticBus(benchmark::State& state)
+{
+  auto memory = makeMemory();
+  Mos6502Core<ArrayBus> cpu{ArrayBus{&memory}};
+  runKernel(state, cpu);
+}
+BENCHMARK(BM_Mos6502StaticBus);
+
+// Dispatch loop running mostly instructions that set N and Z, with a few compares and branches
+static void BM_Mos6502Flags(benchmark::State& state)
+{
+  auto memory = makeMemory(flags_kernel_instructions);
+  Mos6502Core<ArrayBus> cpu{ArrayBus{&memory}};
+  runKernel(state, cpu);
+}
+BENCHMARK(BM_Mos6502Flags);
+
+static void BM_Atari2600ExecInstructions(benchmark::State& state)
+{
+  Atari2600 atari;
+  std::istringstream rom_input(makeKernelRom());
+  atari.loadRom(rom_input);
+  constexpr unsigned INSTRUCTIONS = 1000 * KERNEL_LOOP_INSTRUCTIONS;
+  for (auto _ : state)
+  {
+    atari.execInstructions(INSTRUCTIONS);
+  }
+  state.SetItemsProcessed(state.iterations() * INSTRUCTIONS);
+}
+BENCHMARK(BM_Atari2600ExecInstructions);
+
+// Atari2600::ExecMode FETCH (0), DECODED (1), THREADED (2) or JIT (3)
+static void BM_Atari2600ExecMode(benchmark::State& state)
+{
+  Atari2600 atari;
+  std::istringstream rom_input(makeKernelRom());
+  atari.loadRom(rom_input);
+  atari.exec_mode_ = static_cast<Atari2600::ExecMode>(state.range(0));
+  atari.skip_idle_loops_ = false;
+  constexpr unsigned INSTRUCTIONS = 1000 * KERNEL_LOOP_INSTRUCTIONS;
+  for (auto _ : state)
+  {
+    atari.execInstructions(INSTRUCTIONS);
+  }
+  state.SetItemsProcessed(state.iterations() * INSTRUCTIONS);
+  state.SetLabel(Atari2600::execModeName(atari.exec_mode_));
+}
+BENCHMARK(BM_Atari2600ExecMode)->DenseRange(0, 3);
+
+// Same as BM_Atari2600ExecMode, with a kernel JIT can compile
+static void BM_Atari2600ExecModeJitKernel(benchmark::State& state)
+{
+  Atari2600 atari;
+  std::istringstream rom_input(makeJitKernelRom());
+  atari.loadRom(rom_input);
+  atari.exec_mode_ = static_cast<Atari2600::ExecMode>(state.range(0));
+  atari.skip_idle_loops_ = false;
+  constexpr unsigned INSTRUCTIONS = 8000;
+  for (auto _ : state)
+  {
+    atari.execInstructions(INSTRUCTIONS);
+  }
+  state.SetItemsProcessed(state.iterations() * INSTRUCTIONS);
+  state.SetLabel(Atari2600::execModeName(atari.exec_mode_));
+}
+BENCHMARK(BM_Atari2600ExecModeJitKernel)->DenseRange(0, 3);
+
+namespace
+{
+
+// Branching decode of bus from before it used page tables, for comparison
+struct BranchingBus
+{
+  Atari2600* atari_;
+
+  uint8_t read(uint16_t addr)
+  {
+    addr &= 0x1FFF;
+    if (addr & 0x1000)
+    {
+      return atari_->cartridge_->read(addr);
+    }
+    else if (addr & 0x80)
+    {
+      return atari_->riot_.read(addr);
+    }
+    return 0;
+  }
+};
+
+// Addresses of an access pattern, ROM fetches and RAM accesses like kernel loop, only ROM, or only RAM
+std::vector<uint16_t> makeBusAddresses(int pattern)
+{
+  std::vector<uint16_t> addresses;
+  for (unsigned ii = 0; ii < 4096; ++ii)
+  {
+    const uint16_t rom_addr = 0xF000 + (ii & 0xFFF);
+    const uint16_t ram_addr = 0x80 + (ii * 5 & 0x7F);
+    addresses.push_back(((pattern == 1) or ((pattern == 0) and (ii % 3 != 0))) ? rom_addr : ram_addr);
+  }
+  return addresses;
+}
+
+template<typename BUS>
+void runBusReads(benchmark::State& state, BUS bus)
+{
+  const std::vector<uint16_t> addresses = makeBusAddresses(state.range(0));
+  for (auto _ : state)
+  {
+    unsigned sum = 0;
+    for (uint16_t addr : addresses)
+    {
+      sum += bus.read(addr);
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * addresses.size());
+}
+
+}  // namespace
+
+// items_per_second is reads per second, arg 0 is mix of ROM and RAM, 1 only ROM, 2 only RAM
+static void BM_Atari2600BusRead(benchmark::State& state)
+{
+  Atari2600 atari;
+  std::istringstream rom_input(makeKernelRom());
+  atari.loadRom(rom_input);
+  runBusReads(state, Atari2600Bus{&atari});
+}
+BENCHMARK(BM_Atari2600BusRead)->DenseRange(0, 2);
+
+static void BM_Atari2600BranchingBusRead(benchmark::State& state)
+{
+  Atari2600 atari;
+  std::istringstream rom_input(makeKernelRom());
+  atari.loadRom(rom_input);
+  runBusReads(state, BranchingBus{&atari});
+}
+BENCHMARK(BM_Atari2600BranchingBusRead)->DenseRange(0, 2);
+
+// Frame loop that waits for the RIOT timer during VBLANK and overscan, like most games
+const uint8_t timer_frame_instructions[] =
+{
+  0xA9, 0x02,        // F000 : LDA #2
+  0x85, 0x00,        // F002 : STA VSYNC
+  0x85, 0x02,        // F004 : STA WSYNC
+  0x85, 0x02,        // F006 : STA WSYNC
+  0x85, 0x02,        // F008 : STA WSYNC
+  0xA9, 0x00,        // F00A : LDA #0
+  0x85, 0x00,        // F00C : STA VSYNC
+  0xA9, 0x2B,        // F00E : LDA #43
+  0x8D, 0x96, 0x02,  // F010 : STA TIM64T
+  0xAD, 0x84, 0x02,  // F013 : LDA INTIM
+  0xD0, 0xFB,        // F016 : BNE F013
+  0x85, 0x02,        // F018 : STA WSYNC
+  0xA2, 0xC0,        // F01A : LDX #192
+  0x86, 0x09,        // F01C : STX COLUBK
+  0x85, 0x02,        // F01E : STA WSYNC
+  0xCA,              // F020 : DEX
+  0xD0, 0xF9,        // F021 : BNE F01C
+  0xA9, 0x23,        // F023 : LDA #35
+  0x8D, 0x96, 0x02,  // F025 : STA TIM64T
+  0xAD, 0x84, 0x02,  // F028 : LDA INTIM
+  0xD0, 0xFB,        // F02B : BNE F028
+  0x4C, 0x00, 0xF0,  // F02D : JMP F000
+};
+
+static void loadTimerFrameRom(Atari2600& atari)
+{
+  std::string rom(Atari2600::ROM_SIZE, '\0');
+  std::copy(std::begin(timer_frame_instructions), std::end(timer_frame_instructions), rom.begin());
+  rom[0xFFC] = 0x00;
+  rom[0xFFD] = static_cast<char>(0xF0);
+  std::istringstream rom_input(rom);
+  atari.loadRom(rom_input);
+}
+
+static void BM_Atari2600RunFrameTimer(benchmark::State& state, bool skip_idle_loops)
+{
+  Atari2600 atari;
+  loadTimerFrameRom(atari);
+  atari.skip_idle_loops_ = skip_idle_loops;
+  uint64_t instructions = 0;
+  for (auto _ : state)
+  {
+    instructions += atari.runFrame().instructions;
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["instructions_per_frame"] = static_cast<double>(instructions) / state.iterations();
+  state.counters["skipped_cycles_per_frame"] = static_cast<double>(atari.skipped_cycles_) / state.iterations();
+}
+// items_per_second is frames per second
+BENCHMARK_CAPTURE(BM_Atari2600RunFrameTimer, Exact, false);
+BENCHMARK_CAPTURE(BM_Atari2600RunFrameTimer, SkipIdleLoops, true);
+
+// items_per_second is frames per second, with or without drawing them
+static void BM_Atari2600RunFrameRendering(benchmark::State& state, bool render)
+{
+  Atari2600 atari;
+  loadTimerFrameRom(atari);
+  atari.setRendering(render);
+  for (auto _ : state)
+  {
+    atari.runFrame();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_Atari2600RunFrameRendering, Render, true);
+BENCHMARK_CAPTURE(BM_Atari2600RunFrameRendering, Suppressed, false);
+
+// items_per_second is snapshots per second
+static void BM_Atari2600SaveState(benchmark::State& state)
+{
+  Atari2600 atari;
+  loadTimerFrameRom(atari);
+  atari.runFrame();
+  atari.runCycles(1000);
+  Atari2600State snapshot;
+  for (auto _ : state)
+  {
+    atari.saveState(snapshot);
+    benchmark::DoNotOptimize(snapshot);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["bytes"] = sizeof(snapshot);
+}
+BENCHMARK(BM_Atari2600SaveState);
+
+static void BM_Atari2600LoadState(benchmark::State& state)
+{
+  Atari2600 atari;
+  loadTimerFrameRom(atari);
+  atari.runFrame();
+  atari.runCycles(1000);
+  Atari2600State snapshot;
+  atari.saveState(snapshot);
+  for (auto _ : state)
+  {
+    atari.loadState(snapshot);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Atari2600LoadState);
+
+// Byte blob round trip, with and without display
+static void BM_Atari2600StateBlob(benchmark::State& state)
+{
+  const bool include_display = state.range(0);
+  Atari2600 atari;
+  loadTimerFrameRom(atari);
+  atari.runFrame();
+  atari.runCycles(1000);
+  size_t bytes = 0;
+  for (auto _ : state)
+  {
+    std::vector<uint8_t> blob = atari.saveState(include_display);
+    atari.loadState(blob.data(), blob.size());
+    bytes = blob.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["bytes"] = bytes;
+}
+BENCHMARK(BM_Atari2600StateBlob)->Arg(0)->Arg(1);
+
+// ROM file for load benchmarks, written once to current directory
+static const std::string& timerFrameRomFile()
+{
+  static const std::string fn = "bench_timer_frame.bin";
+  static bool written = false;
+  if (!written)
+  {
+    std::string rom(Atari2600::ROM_SIZE, '\0');
+    std::copy(std::begin(timer_frame_instructions), std::end(timer_frame_instructions), rom.begin());
+    std::ofstream output(fn, std::ofstream::binary);
+    output.write(rom.data(), rom.size());
+    written = true;
+  }
+  return fn;
+}
+
+// items_per_second is ROM loads per second, for each way of loading
+static void BM_RomLoadStream(benchmark::State& state)
+{
+  const std::string& fn = timerFrameRomFile();
+  Atari2600 atari;
+  for (auto _ : state)
+  {
+    std::ifstream rom_input(fn, std::ifstream::binary);
+    atari.loadRom(rom_input);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RomLoadStream);
+
+static void BM_RomMapFile(benchmark::State& state)
+{
+  const std::string& fn = timerFrameRomFile();
+  Atari2600 atari;
+  for (auto _ : state)
+  {
+    atari.loadRom(RomImage::mapFile(fn));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RomMapFile);
+
+// Image that is already in use is found by hash, instead of another copy being kept
+static void BM_RomStoreOpen(benchmark::State& state)
+{
+  const std::string& fn = timerFrameRomFile();
+  RomStore store;
+  std::shared_ptr<const RomImage> in_use = store.open(fn);
+  Atari2600 atari;
+  for (auto _ : state)
+  {
+    atari.loadRom(store.open(fn));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RomStoreOpen);
+
+// items_per_second is aggregate frames per second of all instances, with state.range(0) threads
+static void BM_Atari2600Batch(benchmark::State& state)
+{
+  constexpr size_t INSTANCES = 64;
+  std::vector<uint8_t> rom(Atari2600::ROM_SIZE, 0);
+  std::copy(std::begin(timer_frame_instructions), std::end(timer_frame_instructions), rom.begin());
+  rom[0xFFC] = 0x00;
+  rom[0xFFD] = 0xF0;
+
+  Atari2600Batch batch(INSTANCES, RomImage::fromBytes(std::move(rom)), state.range(0));
+  std::vector<uint8_t> actions(INSTANCES, 0xFF);
+  std::vector<uint8_t> observations(INSTANCES * Atari2600Batch::OBSERVATION_SIZE);
+  for (auto _ : state)
+  {
+    batch.step(actions.data(), observations.data());
+  }
+  state.SetItemsProcessed(state.iterations() * INSTANCES);
+}
+BENCHMARK(BM_Atari2600Batch)->RangeMultiplier(2)->Range(1, 16)->UseRealTime();
+
+// Batch on one thread with TIAs writing observations as they draw, arg is TiaObservation::Format or -1 for RGBA copy
+static void BM_Atari2600BatchObservation(benchmark::State& state)
+{
+  constexpr size_t INSTANCES = 16;
+  std::vector<uint8_t> rom(Atari2600::ROM_SIZE, 0);
+  std::copy(std::begin(timer_frame_instructions), std::end(timer_frame_instructions), rom.begin());
+  rom[0xFFC] = 0x00;
+  rom[0xFFD] = 0xF0;
+
+  Atari2600Batch batch(INSTANCES, RomImage::fromBytes(std::move(rom)), 1);
+  if (state.range(0) >= 0)
+  {
+    const auto format = static_cast<TiaObservation::Format>(state.range(0));
+    batch.observe(format);
+    state.SetLabel(TiaObservation::formatName(format));
+  }
+  else
+  {
+    state.SetLabel("rgba");
+  }
+  std::vector<uint8_t> actions(INSTANCES, 0xFF);
+  std::vector<uint8_t> observations(INSTANCES * batch.observationSize());
+  for (auto _ : state)
+  {
+    batch.step(actions.data(), observations.data());
+  }
+  state.SetItemsProcessed(state.iterations() * INSTANCES);
+}
+BENCHMARK(BM_Atari2600BatchObservation)->DenseRange(-1, 3);
+
+// One minute of frame states from timer frame loop
+static const std::vector<Atari2600State>& minuteOfStates()
+{
+  static std::vector<Atari2600State> states;
+  if (states.empty())
+  {
+    Atari2600 atari;
+    loadTimerFrameRom(atari);
+    states.resize(60 * 60);
+    for (Atari2600State& state : states)
+    {
+      atari.runFrame();
+      atari.saveState(state);
+    }
+  }
+  return states;
+}
+
+// items_per_second is frames recorded per second, bytes_per_minute is arena used by 60s of frames
+static void BM_RewindPush(benchmark::State& state)
+{
+  const unsigned keyframe_interval = state.range(0);
+  const std::vector<Atari2600State>& states = minuteOfStates();
+  RewindBuffer rewind(RewindBuffer::DEFAULT_ARENA_SIZE, keyframe_interval);
+  unsigned frame = 0;
+  for (auto _ : state)
+  {
+    rewind.push(states[frame % states.size()], frame);
+    ++frame;
+  }
+  state.SetItemsProcessed(state.iterations());
+
+  rewind.clear();
+  for (unsigned ii = 0; ii < states.size(); ++ii)
+  {
+    rewind.push(states[ii], ii);
+  }
+  state.counters["bytes_per_minute"] = rewind.usedBytes();
+}
+BENCHMARK(BM_RewindPush)->Arg(10)->Arg(30)->Arg(120);
+
+// Time per iteration is seek latency to a random frame in last minute
+static void BM_RewindSeek(benchmark::State& state)
+{
+  const unsigned keyframe_interval = state.range(0);
+  const std::vector<Atari2600State>& states = minuteOfStates();
+  RewindBuffer rewind(RewindBuffer::DEFAULT_ARENA_SIZE, keyframe_interval);
+  for (unsigned ii = 0; ii < states.size(); ++ii)
+  {
+    rewind.push(states[ii], ii);
+  }
+  Atari2600 atari;
+  loadTimerFrameRom(atari);
+  uint32_t lcg = 1;
+  for (auto _ : state)
+  {
+    lcg = lcg * 1664525 + 1013904223;
+    rewind.seek((lcg >> 8) % states.size(), atari);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["bytes_per_minute"] = rewind.usedBytes();
+}
+BENCHMARK(BM_RewindSeek)->Arg(10)->Arg(30)->Arg(120);
+
+static void BM_Atari2600Construct(benchmark::State& state)
+{
+  for (auto _ : state)
+  {
+    Atari2600 atari;
+    benchmark::DoNotOptimize(atari);
+  }
+  state.counters["sizeof_Mos6502"] = sizeof(Mos6502);
+  state.counters["sizeof_Atari2600_Cpu"] = sizeof(Atari2600::Cpu);
+  state.counters["sizeof_Atari2600"] = sizeof(Atari2600);
+}
+BENCHMARK(BM_Atari2600Construct);
+
+// TIA settings similar to playfield_colors.asm : reflected playfield, players side by side
+void setPlayfieldColorsSettings(Tia& tia)
+{
+  tia.settings_.pf_mask = 0x5C0F;
+  tia.settings_.ctrl_pf = 1;
+  tia.settings_.p0_mask = 0xC1;
+  tia.settings_.p1_mask = 0xA3;
+  tia.position_x_p0_ = 20;
+  tia.position_x_p1_ = 40;
+}
+
+// Busier line : playfield changes every cell, players overlap and are reflected
+void setBusySettings(Tia& tia)
+{
+  tia.settings_.pf_mask = 0xAAAAA;
+  tia.settings_.ctrl_pf = 0;
+  tia.settings_.p0_mask = 0x99;
+  tia.settings_.p1_mask = 0xE7;
+  tia.settings_.reflect_p0 = true;
+  tia.position_x_p0_ = 76;
+  tia.position_x_p1_ = 80;
+}
+
+static void BM_TiaDrawPixelSpans(benchmark::State& state, void (*set_settings)(Tia&), Tia::Compositor compositor, bool slow,
+                                 bool indexed = false)
+{
+  if (!Tia::compositorSupported(compositor))
+  {
+    state.SkipWithError("compositor not supported by CPU");
+    return;
+  }
+  Tia tia;
+  tia.compositor_ = compositor;
+  tia.indexed_output_ = indexed;
+  set_settings(tia);
+  tia.settings_.rgba_pf = RGBA{255, 255, 255, 255};
+  tia.settings_.rgba_bk = RGBA{0, 0, 0, 255};
+  tia.settings_.rgba_p0 = RGBA{255, 255, 0, 255};
+  tia.settings_.rgba_p1 = RGBA{255, 0, 255, 255};
+
+  // Draw whole line in spans of this many pixels, like lazy drawing between TIA writes does
+  const int span_pixels = state.range(0);
+  for (auto _ : state)
+  {
+    for (int scan_y = 0; scan_y < Tia::DISPLAY_HEIGHT; ++scan_y)
+    {
+      tia.scan_y_ = scan_y;
+      for (int display_x = 0; display_x < Tia::DISPLAY_WIDTH; display_x += span_pixels)
+      {
+        int display_x_stop = std::min(display_x + span_pixels, Tia::DISPLAY_WIDTH);
+        if (slow)
+        {
+          tia.drawPixelSpanSlow(display_x, display_x_stop);
+        }
+        else
+        {
+          tia.drawPixelSpan(display_x, display_x_stop);
+        }
+      }
+    }
+    benchmark::DoNotOptimize(tia.back_display_.data());
+    benchmark::DoNotOptimize(tia.back_indexed_display_.data());
+  }
+  state.SetItemsProcessed(state.iterations() * Tia::DISPLAY_WIDTH * Tia::DISPLAY_HEIGHT);
+}
+
+// items_per_second is pixels per second
+BENCHMARK_CAPTURE(BM_TiaDrawPixelSpans, PerPixelPlayfieldColors, setPlayfieldColorsSettings, Tia::Compositor::SCALAR, true)->Arg(9)->Arg(160);
+BENCHMARK_CAPTURE(BM_TiaDrawPixelSpans, ScalarPlayfieldColors, setPlayfieldColorsSettings, Tia::Compositor::SCALAR, false)->Arg(9)->Arg(160);
+BENCHMARK_CAPTURE(BM_TiaDrawPixelSpans, Sse2PlayfieldColors, setPlayfieldColorsSettings, Tia::Compositor::SSE2, false)->Arg(9)->Arg(160);
+BENCHMARK_CAPTURE(BM_TiaDrawPixelSpans, Avx2PlayfieldColors, setPlayfieldColorsSettings, Tia::Compositor::AVX2, false)->Arg(9)->Arg(160);
+BENCHMARK_CAPTURE(BM_TiaDrawPixelSpans, PerPixelBusy, setBusySettings, Tia::Compositor::SCALAR, true)->Arg(9)->Arg(160);
+BENCHMARK_CAPTURE(BM_TiaDrawPixelSpans, ScalarBusy, setBusySettings, Tia::Compositor::SCALAR, false)->Arg(9)->Arg(160);
+BENCHMARK_CAPTURE(BM_TiaDrawPixelSpans, Sse2Busy, setBusySettings, Tia::Compositor::SSE2, false)->Arg(9)->Arg(160);
+BENCHMARK_CAPTURE(BM_TiaDrawPixelSpans, Avx2Busy, setBusySettings, Tia::Compositor::AVX2, false)->Arg(9)->Arg(160);
+BENCHMARK_CAPTURE(BM_TiaDrawPixelSpans, IndexedScalarBusy, setBusySettings, Tia::Compositor::SCALAR, false, true)->Arg(9)->Arg(160);
+BENCHMARK_CAPTURE(BM_TiaDrawPixelSpans, IndexedSse2Busy, setBusySettings, Tia::Compositor::SSE2, false, true)->Arg(9)->Arg(160);
+
+// Whole frame of palette indices to RGBA, items_per_second is pixels per second
+static void BM_TiaExpandIndexed(benchmark::State& state, bool gather)
+{
+  if (gather and !Tia::compositorSupported(Tia::Compositor::AVX2))
+  {
+    state.SkipWithError("AVX2 not supported by CPU");
+    return;
+  }
+  Tia tia;
+  for (size_t ii = 0; ii < tia.indexed_display_.size(); ++ii)
+  {
+    tia.indexed_display_[ii] = (ii * 37) & 0xFE;
+  }
+  for (auto _ : state)
+  {
+    Tia::expandIndexed(tia.indexed_display_.data(), tia.indexed_display_.size(), tia.palette_, tia.display_.data(),
+                       gather);
+    benchmark::DoNotOptimize(tia.display_.data());
+  }
+  state.SetItemsProcessed(state.iterations() * Tia::DISPLAY_WIDTH * Tia::DISPLAY_HEIGHT);
+}
+BENCHMARK_CAPTURE(BM_TiaExpandIndexed, Scalar, false);
+BENCHMARK_CAPTURE(BM_TiaExpandIndexed, Avx2, true);
+
+BENCHMARK_MAIN();
@@ -1,11 +1,26 @@
 #include <gtest/gtest.h>
 
 #include "atari2600.hpp"
+#include "atari2600_batch.hpp"
+#include "cartridge.hpp"
+#include "frame_mailbox.hpp"
+#include "rewind.hpp"
+#include "rom.hpp"
 #include "tia.hpp"
+#include "tia_observation.hpp"
 #include "util.hpp"
 
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iomanip>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <thread>
 
 TEST(reverseBits32, simple)
 {
@@ -107,6 +122,311 @@ TEST(Atari2600, execMultiple)
 }
 
 
+/**
+ * N and Z are kept lazily, but read back same as they were set
+ */
+TEST(Mos6502, flags)
+{
+  std::array<uint8_t, 0x2000> memory = {};
+  const uint8_t code[] = {
+    0xA9, 0x40,  // F000 : LDA #$40
+    0x69, 0x40,  // F002 : ADC #$40, sets V and N
+    0xC9, 0x70,  // F004 : CMP #$70, sets C, leaves V
+    0xA9, 0x00,  // F006 : LDA #0
+    0xC9, 0x00,  // F008 : CMP #0, sets Z
+  };
+  std::copy(std::begin(code), std::end(code), memory.begin() + 0x1000);
+  Mos6502 cpu{Mos6502CallbackBus{
+    [&memory](uint16_t addr) -> uint8_t { return memory[addr & 0x1FFF]; },
+    [&memory](uint16_t addr, uint8_t data) { memory[addr & 0x1FFF] = data; }
+    }};
+  cpu.reseting_ = false;
+  cpu.pc_ = 0xF000;
+  cpu.setStatus(0);
+
+  cpu.execOne();
+  cpu.execOne();
+  EXPECT_EQ(cpu.getStatus(), 0xE0) << std::hex << static_cast<unsigned>(cpu.getStatus());
+  cpu.execOne();
+  EXPECT_EQ(cpu.getStatus(), 0x61) << std::hex << static_cast<unsigned>(cpu.getStatus());
+  cpu.execOne();
+  cpu.execOne();
+  EXPECT_EQ(cpu.getStatus(), 0x63) << std::hex << static_cast<unsigned>(cpu.getStatus());
+
+  // Every other instruction that sets N and Z, run from cleared flags
+  struct FlagsCase
+  {
+    std::array<uint8_t, 2> instr;
+    uint8_t a, x, y, m;
+    uint8_t status;
+  };
+  const FlagsCase cases[] = {
+    {{0xA9, 0x80}, 0x00, 0x00, 0x00, 0x00, 0xA0},  // LDA #$80
+    {{0xA9, 0x00}, 0x01, 0x00, 0x00, 0x00, 0x22},  // LDA #0
+    {{0xA5, 0x80}, 0x01, 0x00, 0x00, 0x00, 0x22},  // LDA $80
+    {{0xA2, 0xFF}, 0x00, 0x00, 0x00, 0x00, 0xA0},  // LDX #$FF
+    {{0xA6, 0x80}, 0x00, 0x01, 0x00, 0x90, 0xA0},  // LDX $80
+    {{0xA0, 0x00}, 0x00, 0x00, 0x01, 0x00, 0x22},  // LDY #0
+    {{0xA4, 0x80}, 0x00, 0x00, 0x00, 0x01, 0x20},  // LDY $80
+    {{0xAA, 0xEA}, 0x00, 0x01, 0x00, 0x00, 0x22},  // TAX
+    {{0xA8, 0xEA}, 0x90, 0x00, 0x00, 0x00, 0xA0},  // TAY
+    {{0x8A, 0xEA}, 0x01, 0x00, 0x00, 0x00, 0x22},  // TXA
+    {{0x98, 0xEA}, 0x00, 0x00, 0x01, 0x00, 0x20},  // TYA
+    {{0xBA, 0xEA}, 0x00, 0x00, 0x00, 0x00, 0xA0},  // TSX, SP = $FE
+    {{0xE8, 0xEA}, 0x00, 0xFF, 0x00, 0x00, 0x22},  // INX
+    {{0xCA, 0xEA}, 0x00, 0x00, 0x00, 0x00, 0xA0},  // DEX
+    {{0xC8, 0xEA}, 0x00, 0x00, 0x7F, 0x00, 0xA0},  // INY
+    {{0x88, 0xEA}, 0x00, 0x00, 0x01, 0x00, 0x22},  // DEY
+    {{0x29, 0x0F}, 0xF0, 0x00, 0x00, 0x00, 0x22},  // AND #$0F
+    {{0x09, 0x80}, 0x00, 0x00, 0x00, 0x00, 0xA0},  // ORA #$80
+    {{0x49, 0xFF}, 0xFF, 0x00, 0x00, 0x00, 0x22},  // EOR #$FF
+    {{0x45, 0x80}, 0x0F, 0x00, 0x00, 0xF0, 0xA0},  // EOR $80
+    {{0x69, 0x01}, 0xFF, 0x00, 0x00, 0x00, 0x23},  // ADC #1, sets C and Z
+    {{0xE9, 0x01}, 0x01, 0x00, 0x00, 0x00, 0xA0},  // SBC #1, borrows
+    {{0x0A, 0xEA}, 0x80, 0x00, 0x00, 0x00, 0x23},  // ASL A
+    {{0x4A, 0xEA}, 0x01, 0x00, 0x00, 0x00, 0x23},  // LSR A
+    {{0x2A, 0xEA}, 0x40, 0x00, 0x00, 0x00, 0xA0},  // ROL A
+    {{0x6A, 0xEA}, 0x01, 0x00, 0x00, 0x00, 0x23},  // ROR A
+    {{0x06, 0x80}, 0x00, 0x00, 0x00, 0x40, 0xA0},  // ASL $80
+    {{0xC5, 0x80}, 0x10, 0x00, 0x00, 0x20, 0xA0},  // CMP $80
+    {{0xE0, 0x05}, 0x00, 0x05, 0x00, 0x00, 0x23},  // CPX #5
+    {{0xC0, 0x05}, 0x00, 0x00, 0x04, 0x00, 0xA0},  // CPY #5
+    {{0xE6, 0x80}, 0x00, 0x00, 0x00, 0xFF, 0x22},  // INC $80
+    {{0xC6, 0x80}, 0x00, 0x00, 0x00, 0x00, 0xA0},  // DEC $80
+    {{0x68, 0xEA}, 0x01, 0x00, 0x00, 0x00, 0x22},  // PLA, pulls 0
+  };
+  for (const FlagsCase& test : cases)
+  {
+    memory[0x1100] = test.instr[0];
+    memory[0x1101] = test.instr[1];
+    memory[0x80] = test.m;
+    memory[0x1FF] = 0;
+    cpu.pc_ = 0xF100;
+    cpu.a_ = test.a;
+    cpu.x_ = test.x;
+    cpu.y_ = test.y;
+    cpu.sp_ = 0xFE;
+    cpu.setStatus(0);
+    cpu.execOne();
+    EXPECT_EQ(cpu.getStatus(), test.status)
+        << std::hex << static_cast<unsigned>(test.instr[0]) << " " << static_cast<unsigned>(cpu.getStatus());
+  }
+
+  // Every combination of flags, including N and Z both set, bit 5 always reads as 1
+  for (unsigned status = 0; status < 0x100; ++status)
+  {
+    cpu.setStatus(status);
+    EXPECT_EQ(cpu.getStatus(), status | 0x20);
+    EXPECT_EQ(cpu.negative(), (status & 0x80) != 0);
+    EXPECT_EQ(cpu.zero(), (status & 0x02) != 0);
+  }
+}
+
+/**
+ * BIT sets Z when A AND M is zero, and copies N and V from M
+ */
+TEST(Mos6502, bit)
+{
+  std::array<uint8_t, 0x2000> memory = {};
+  const uint8_t code[] = {
+    0xA9, 0x01,  // F000 : LDA #$01
+    0x24, 0x80,  // F002 : BIT $80, M = $C1, A AND M != 0
+    0x24, 0x81,  // F004 : BIT $81, M = $80, A AND M == 0
+    0x24, 0x82,  // F006 : BIT $82, M = $01, A AND M != 0
+    0x24, 0x83,  // F008 : BIT $83, M = $00, A AND M == 0
+  };
+  std::copy(std::begin(code), std::end(code), memory.begin() + 0x1000);
+  memory[0x80] = 0xC1;
+  memory[0x81] = 0x80;
+  memory[0x82] = 0x01;
+  memory[0x83] = 0x00;
+  Mos6502 cpu{Mos6502CallbackBus{
+    [&memory](uint16_t addr) -> uint8_t { return memory[addr & 0x1FFF]; },
+    [&memory](uint16_t addr, uint8_t data) { memory[addr & 0x1FFF] = data; }
+    }};
+  cpu.reseting_ = false;
+  cpu.pc_ = 0xF000;
+  cpu.setStatus(0);
+
+  cpu.execOne();
+  cpu.execOne();
+  EXPECT_FALSE(cpu.zero());
+  EXPECT_TRUE(cpu.negative());
+  EXPECT_EQ(cpu.getStatus(), 0xE0) << std::hex << static_cast<unsigned>(cpu.getStatus());
+  cpu.execOne();
+  EXPECT_TRUE(cpu.zero());
+  EXPECT_TRUE(cpu.negative());
+  EXPECT_EQ(cpu.getStatus(), 0xA2) << std::hex << static_cast<unsigned>(cpu.getStatus());
+  cpu.execOne();
+  EXPECT_FALSE(cpu.zero());
+  EXPECT_FALSE(cpu.negative());
+  EXPECT_EQ(cpu.getStatus(), 0x20) << std::hex << static_cast<unsigned>(cpu.getStatus());
+  cpu.execOne();
+  EXPECT_TRUE(cpu.zero());
+  EXPECT_FALSE(cpu.negative());
+  EXPECT_EQ(cpu.getStatus(), 0x22) << std::hex << static_cast<unsigned>(cpu.getStatus());
+}
+
+void loadPlayfieldColors(Atari2600& atari)
+{
+  std::ifstream rom_input("playfield_colors_out.bin", std::ifstream::binary);
+  ASSERT_TRUE(rom_input.good());
+  atari.loadRom(rom_input);
+  std::ifstream palette_input("palette/REALNTSC.pal", std::ifstream::binary);
+  ASSERT_TRUE(palette_input.good());
+  atari.tia_.loadPalette(palette_input);
+}
+
+/**
+ * Test that runFrame() stops at same instruction as stepping until frame count changes
+ */
+TEST(Atari2600, runFrame)
+{
+  std::vector<Atari2600> ataris(2);
+  auto& atari0 = ataris.at(0);
+  auto& atari1 = ataris.at(1);
+  loadPlayfieldColors(atari0);
+  loadPlayfieldColors(atari1);
+
+  for (unsigned frame = 1; frame <= 3; ++frame)
+  {
+    unsigned start_cycle_count = atari0.cpu_.instr_cycle_count_;
+    while (atari0.tia_.frame_count_ < frame)
+    {
+      atari0.execInstructions(1);
+    }
+
+    Atari2600::RunStatus status = atari1.runFrame();
+    EXPECT_TRUE(status.frame_complete);
+    EXPECT_FALSE(status.breakpoint_hit);
+    EXPECT_EQ(atari1.tia_.frame_count_, frame);
+    EXPECT_EQ(status.cycles, atari0.cpu_.instr_cycle_count_ - start_cycle_count);
+
+    EXPECT_EQ(atari0.cpu_.pc_, atari1.cpu_.pc_);
+    EXPECT_EQ(atari0.cpu_.instr_cycle_count_, atari1.cpu_.instr_cycle_count_);
+    EXPECT_EQ(atari0.tia_.scan_x_, atari1.tia_.scan_x_);
+    EXPECT_EQ(atari0.tia_.scan_y_, atari1.tia_.scan_y_);
+    EXPECT_EQ(atari0.tia_.pixel_count_, atari1.tia_.pixel_count_);
+    ASSERT_TRUE(atari0.tia_.display_ == atari1.tia_.display_);
+  }
+
+  // after first frame, every frame of ROM has same number of cycles,
+  // and 37 + 192 + 30 scanlines outside of vertical sync
+  Atari2600::RunStatus prev_status = atari1.runFrame();
+  for (unsigned frame = 0; frame < 3; ++frame)
+  {
+    unsigned start_line_count = atari1.tia_.line_count_;
+    Atari2600::RunStatus status = atari1.runFrame();
+    EXPECT_TRUE(status.frame_complete);
+    EXPECT_EQ(status.cycles, prev_status.cycles);
+    EXPECT_EQ(atari1.tia_.line_count_ - start_line_count, 37 + 192 + 30);
+  }
+}
+
+TEST(Atari2600, runCycles)
+{
+  Atari2600 atari;
+  loadPlayfieldColors(atari);
+
+  for (unsigned cycle_count : {1, 10, 76, 1000, 30000})
+  {
+    unsigned start_cycle_count = atari.cpu_.instr_cycle_count_;
+    Atari2600::RunStatus status = atari.runCycles(cycle_count);
+    EXPECT_GE(status.cycles, cycle_count);
+    // Longest instruction is 7 cycles
+    EXPECT_LT(status.cycles, cycle_count + 7);
+    EXPECT_EQ(status.cycles, atari.cpu_.instr_cycle_count_ - start_cycle_count);
+  }
+}
+
+TEST(Atari2600, runScanlines)
+{
+  Atari2600 atari;
+  loadPlayfieldColors(atari);
+
+  for (unsigned scanline_count : {1, 2, 10, 100, 500})
+  {
+    unsigned start_line_count = atari.tia_.line_count_;
+    atari.runScanlines(scanline_count);
+    EXPECT_EQ(atari.tia_.line_count_, start_line_count + scanline_count);
+  }
+}
+
+/**
+ * Completed frame is only flipped to front when VSYNC starts, and stays there while next frame is drawn
+ */
+TEST(Atari2600, frontDisplay)
+{
+  Atari2600 atari;
+  loadPlayfieldColors(atari);
+
+  atari.runFrame();
+  for (unsigned frame = 2; frame <= 4; ++frame)
+  {
+    const unsigned ready_frame_count = atari.tia_.ready_frame_count_;
+    const std::vector<RGBA> front = atari.tia_.display_;
+
+    // part way through next frame, only back display has changed
+    atari.runScanlines(100);
+    EXPECT_EQ(atari.tia_.ready_frame_count_, ready_frame_count);
+    ASSERT_TRUE(atari.tia_.display_ == front) << " frame " << frame;
+    const std::vector<RGBA> partial = atari.tia_.back_display_;
+
+    Atari2600::RunStatus status = atari.runFrame();
+    EXPECT_TRUE(status.frame_complete);
+    EXPECT_EQ(atari.tia_.ready_frame_count_, ready_frame_count + 1);
+    EXPECT_EQ(atari.tia_.ready_frame_count_, atari.tia_.frame_count_);
+
+    // rows drawn before runFrame are still there after the flip
+    const size_t drawn = 50 * Tia::DISPLAY_WIDTH;
+    ASSERT_TRUE(std::equal(partial.begin(), partial.begin() + drawn, atari.tia_.display_.begin()))
+      << " frame " << frame;
+  }
+}
+
+/**
+ * Display after where beam stopped is only filled when fill_undrawn_ is set
+ */
+TEST(Tia, flipDisplay)
+{
+  for (bool indexed : {false, true})
+  {
+    for (bool fill : {false, true})
+    {
+      Tia tia;
+      tia.palette_[0] = RGBA{0, 0, 0, 255};
+      tia.indexed_output_ = indexed;
+      tia.fill_undrawn_ = fill;
+      std::fill(tia.back_display_.begin(), tia.back_display_.end(), RGBA{1, 2, 3, 255});
+      std::fill(tia.back_indexed_display_.begin(), tia.back_indexed_display_.end(), 0x42);
+      const std::vector<RGBA> old_front = tia.display_;
+
+      // last pixel drawn was x 9 of row 100
+      tia.scan_y_ = 100;
+      tia.scan_x_ = Tia::HORIZONTAL_BLANK + 9;
+      tia.flipDisplay();
+      EXPECT_EQ(tia.ready_frame_count_, 1);
+      ASSERT_TRUE(tia.back_display_ == old_front);
+
+      const size_t start = 100 * Tia::DISPLAY_WIDTH + 10;
+      for (size_t ii = 0; ii < tia.display_.size(); ++ii)
+      {
+        const bool filled = fill and (ii >= start);
+        if (indexed)
+        {
+          ASSERT_EQ(tia.indexed_display_[ii], filled ? 0 : 0x42) << " pixel " << ii;
+          ASSERT_EQ(tia.display_[ii], (RGBA{1, 2, 3, 255})) << " pixel " << ii;
+        }
+        else
+        {
+          ASSERT_EQ(tia.display_[ii], (filled ? RGBA{0, 0, 0, 255} : RGBA{1, 2, 3, 255})) << " pixel " << ii;
+          ASSERT_EQ(tia.indexed_display_[ii], 0x42) << " pixel " << ii;
+        }
+      }
+    }
+  }
+}
+
 TEST(Tia, usePlayer)
 {
   for (int offset_x = 0; offset_x < 192; offset_x += 1)
@@ -132,4 +452,1883 @@ TEST(Tia, usePlayer)
   }
 
   //uint8_t mask = 0xFF;
-}
\ No newline at end of file
+}
+
+/**
+ * Span based drawing should produce same pixels as drawing each pixel separately
+ */
+TEST(Tia, drawPixelSpan)
+{
+  Tia tia;
+  tia.settings_.rgba_pf = RGBA{1, 0, 0, 255};
+  tia.settings_.rgba_bk = RGBA{0, 1, 0, 255};
+  tia.settings_.rgba_p0 = RGBA{0, 0, 1, 255};
+  tia.settings_.rgba_p1 = RGBA{1, 1, 1, 255};
+  tia.scan_y_ = 10;
+
+  // span boundaries, including ones that don't line up with playfield cells
+  const std::vector<std::pair<int, int>> spans = {{0, 160}, {0, 1}, {3, 9}, {5, 77}, {80, 81}, {150, 160}, {7, 135}};
+  const uint32_t pf_masks[] = {0x00000, 0xFFFFF, 0xAAAAA, 0x0F00F, 0x12345, 0xF3560};
+  const uint8_t player_masks[] = {0x00, 0xFF, 0xC1, 0xA3};
+  const uint8_t positions[] = {0, 1, 4, 7, 30, 76, 80, 152, 155, 159, 0xFF};
+
+  for (uint32_t pf_mask : pf_masks)
+  {
+    tia.settings_.pf_mask = pf_mask;
+    for (uint8_t ctrl_pf : {0, 1})
+    {
+      tia.settings_.ctrl_pf = ctrl_pf;
+      for (uint8_t p0_mask : player_masks)
+      {
+        tia.settings_.p0_mask = p0_mask;
+        tia.settings_.p1_mask = ~p0_mask;
+        for (bool reflect : {false, true})
+        {
+          tia.settings_.reflect_p0 = reflect;
+          tia.settings_.reflect_p1 = !reflect;
+          for (uint8_t position_x_p0 : positions)
+          {
+            for (uint8_t position_x_p1 : positions)
+            {
+              tia.position_x_p0_ = position_x_p0;
+              tia.position_x_p1_ = position_x_p1;
+              for (auto span : spans)
+              {
+                auto row = tia.back_display_.begin() + tia.scan_y_ * Tia::DISPLAY_WIDTH;
+                std::fill(row, row + Tia::DISPLAY_WIDTH, RGBA{0, 0, 0, 0});
+                tia.drawPixelSpanSlow(span.first, span.second);
+                std::vector<RGBA> expected(row, row + Tia::DISPLAY_WIDTH);
+
+                std::fill(row, row + Tia::DISPLAY_WIDTH, RGBA{0, 0, 0, 0});
+                tia.drawPixelSpan(span.first, span.second);
+                ASSERT_TRUE(std::equal(expected.begin(), expected.end(), row))
+                  << std::hex
+                  << " pf " << pf_mask << " ctrl_pf " << static_cast<int>(ctrl_pf)
+                  << " p0 " << static_cast<int>(p0_mask) << std::dec
+                  << " reflect " << reflect
+                  << " p0 x " << static_cast<int>(position_x_p0)
+                  << " p1 x " << static_cast<int>(position_x_p1)
+                  << " span " << span.first << "-" << span.second;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Every supported SIMD compositor should draw same pixels as scalar one
+ */
+TEST(Tia, compositors)
+{
+  Tia tia;
+  tia.settings_.rgba_pf = RGBA{1, 0, 0, 255};
+  tia.settings_.rgba_bk = RGBA{0, 1, 0, 255};
+  tia.settings_.rgba_p0 = RGBA{0, 0, 1, 255};
+  tia.settings_.rgba_p1 = RGBA{1, 1, 1, 255};
+  tia.scan_y_ = 20;
+
+  // lengths cover whole vectors and tails of SSE2 (8 pixels) and AVX2 (16 pixels)
+  const std::vector<std::pair<int, int>> spans = {{0, 160}, {0, 7}, {1, 17}, {3, 40}, {64, 95}, {144, 160}, {151, 160}};
+  const uint32_t pf_masks[] = {0x00000, 0xFFFFF, 0xAAAAA, 0x12345};
+
+  // AVX2 is opt-in
+  EXPECT_NE(Tia::defaultCompositor(), Tia::Compositor::AVX2);
+
+  for (Tia::Compositor compositor : {Tia::Compositor::SSE2, Tia::Compositor::AVX2})
+  {
+    if (!Tia::compositorSupported(compositor))
+    {
+      std::cout << Tia::compositorName(compositor) << " not supported, skipping" << std::endl;
+      continue;
+    }
+
+    for (uint32_t pf_mask : pf_masks)
+    {
+      tia.settings_.pf_mask = pf_mask;
+      // only bit 0 (reflect) of CTRLPF changes drawing, try other bits anyways
+      for (uint8_t ctrl_pf : {0x00, 0x01, 0x02, 0x03})
+      {
+        tia.settings_.ctrl_pf = ctrl_pf;
+        for (bool reflect : {false, true})
+        {
+          tia.settings_.p0_mask = 0xC1;
+          tia.settings_.p1_mask = 0xA7;
+          tia.settings_.reflect_p0 = reflect;
+          tia.settings_.reflect_p1 = !reflect;
+          // every position of one player, with other player overlapping it or hidden
+          for (int position_x = 0; position_x <= 0xFF; ++position_x)
+          {
+            for (int other_offset : {-3, 0xFF})
+            {
+              tia.position_x_p0_ = position_x;
+              tia.position_x_p1_ = (other_offset == 0xFF) ? 0xFF : std::max(position_x + other_offset, 0);
+              for (bool swap : {false, true})
+              {
+                if (swap)
+                {
+                  std::swap(tia.position_x_p0_, tia.position_x_p1_);
+                }
+                for (auto span : spans)
+                {
+                  auto row = tia.back_display_.begin() + tia.scan_y_ * Tia::DISPLAY_WIDTH;
+                  std::fill(row, row + Tia::DISPLAY_WIDTH, RGBA{0, 0, 0, 0});
+                  tia.drawPixelSpanScalar(span.first, span.second);
+                  std::vector<RGBA> expected(row, row + Tia::DISPLAY_WIDTH);
+
+                  std::fill(row, row + Tia::DISPLAY_WIDTH, RGBA{0, 0, 0, 0});
+                  tia.compositor_ = compositor;
+                  tia.drawPixelSpan(span.first, span.second);
+                  ASSERT_TRUE(std::equal(expected.begin(), expected.end(), row))
+                    << Tia::compositorName(compositor) << std::hex
+                    << " pf " << pf_mask << " ctrl_pf " << static_cast<int>(ctrl_pf) << std::dec
+                    << " reflect " << reflect
+                    << " p0 x " << static_cast<int>(tia.position_x_p0_)
+                    << " p1 x " << static_cast<int>(tia.position_x_p1_)
+                    << " span " << span.first << "-" << span.second;
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Indexed compositors draw color register values, that expand to same pixels RGBA compositors draw
+ */
+TEST(Tia, indexedCompositors)
+{
+  Tia tia;
+  for (unsigned ii = 0; ii < tia.palette_.size(); ++ii)
+  {
+    tia.palette_[ii] = RGBA{static_cast<uint8_t>(ii), static_cast<uint8_t>(ii * 3), static_cast<uint8_t>(ii * 7), 255};
+  }
+  tia.settings_.color_pf = 0x1E;
+  tia.settings_.color_bk = 0x80;
+  tia.settings_.color_p0 = 0x44;
+  tia.settings_.color_p1 = 0xC6;
+  tia.settings_.rgba_pf = tia.palette_[tia.settings_.color_pf];
+  tia.settings_.rgba_bk = tia.palette_[tia.settings_.color_bk];
+  tia.settings_.rgba_p0 = tia.palette_[tia.settings_.color_p0];
+  tia.settings_.rgba_p1 = tia.palette_[tia.settings_.color_p1];
+  tia.settings_.p0_mask = 0xC1;
+  tia.settings_.p1_mask = 0xA7;
+  tia.scan_y_ = 30;
+
+  const std::vector<std::pair<int, int>> spans = {{0, 160}, {0, 15}, {1, 17}, {3, 40}, {64, 95}, {144, 160}, {151, 160}};
+  for (Tia::Compositor compositor : {Tia::Compositor::SCALAR, Tia::Compositor::SSE2, Tia::Compositor::AVX2})
+  {
+    if (!Tia::compositorSupported(compositor))
+    {
+      std::cout << Tia::compositorName(compositor) << " not supported, skipping" << std::endl;
+      continue;
+    }
+    tia.compositor_ = compositor;
+    for (uint32_t pf_mask : {0x00000, 0xAAAAA, 0x12345})
+    {
+      tia.settings_.pf_mask = pf_mask;
+      for (int position_x = 0; position_x <= 0xFF; ++position_x)
+      {
+        tia.position_x_p0_ = position_x;
+        tia.position_x_p1_ = std::max(position_x - 3, 0);
+        for (auto span : spans)
+        {
+          auto row = tia.back_display_.begin() + tia.scan_y_ * Tia::DISPLAY_WIDTH;
+          std::fill(row, row + Tia::DISPLAY_WIDTH, RGBA{0, 0, 0, 0});
+          tia.indexed_output_ = false;
+          tia.drawPixelSpan(span.first, span.second);
+
+          auto indexed_row = tia.back_indexed_display_.begin() + tia.scan_y_ * Tia::DISPLAY_WIDTH;
+          std::fill(indexed_row, indexed_row + Tia::DISPLAY_WIDTH, 0);
+          tia.indexed_output_ = true;
+          tia.drawPixelSpan(span.first, span.second);
+
+          std::vector<RGBA> expanded(Tia::DISPLAY_WIDTH);
+          std::vector<RGBA> gathered(Tia::DISPLAY_WIDTH);
+          Tia::expandIndexed(&*indexed_row, Tia::DISPLAY_WIDTH, tia.palette_, expanded.data(), false);
+          Tia::expandIndexed(&*indexed_row, Tia::DISPLAY_WIDTH, tia.palette_, gathered.data(), true);
+          ASSERT_EQ(gathered, expanded);
+          for (int x = 0; x < Tia::DISPLAY_WIDTH; ++x)
+          {
+            if ((x < span.first) or (x >= span.second))
+            {
+              ASSERT_EQ(indexed_row[x], 0) << Tia::compositorName(compositor) << " drew outside span, x " << x;
+              continue;
+            }
+            ASSERT_EQ(expanded[x], row[x])
+              << Tia::compositorName(compositor) << std::hex << " pf " << pf_mask << std::dec
+              << " p0 x " << position_x << " span " << span.first << "-" << span.second << " x " << x;
+          }
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Frames drawn as palette indices expand to same display as RGBA drawing,
+ * and can be expanded again with another palette
+ */
+TEST(Tia, indexedOutput)
+{
+  std::vector<Atari2600> ataris(2);
+  auto& atari_rgba = ataris.at(0);
+  auto& atari_indexed = ataris.at(1);
+  loadPlayfieldColors(atari_rgba);
+  loadPlayfieldColors(atari_indexed);
+  atari_indexed.tia_.indexed_output_ = true;
+
+  // First frame starts part way down display, what is above it is left from before emulation started
+  atari_rgba.runFrame();
+  atari_indexed.runFrame();
+  for (unsigned frame = 1; frame <= 3; ++frame)
+  {
+    atari_rgba.runFrame();
+    atari_indexed.runFrame();
+    std::vector<RGBA> expanded(atari_indexed.tia_.display_.size());
+    atari_indexed.tia_.expandDisplay(expanded.data());
+    ASSERT_TRUE(expanded == atari_rgba.tia_.display_) << " frame " << frame;
+  }
+
+  // Palette change applies to frame that was already drawn
+  std::array<RGBA, 256> gray_palette;
+  for (unsigned ii = 0; ii < gray_palette.size(); ++ii)
+  {
+    uint8_t luma = (ii & 0xE) * 16;
+    gray_palette[ii] = RGBA{luma, luma, luma, 255};
+  }
+  atari_indexed.tia_.palette_ = gray_palette;
+  std::vector<RGBA> expanded(atari_indexed.tia_.display_.size());
+  atari_indexed.tia_.expandDisplay(expanded.data());
+  for (size_t ii = 0; ii < expanded.size(); ++ii)
+  {
+    ASSERT_EQ(expanded[ii], gray_palette[atari_indexed.tia_.indexed_display_[ii]]) << " pixel " << ii;
+  }
+}
+
+/**
+ * Observation made from whole RGBA display after it was drawn
+ */
+std::vector<uint8_t> referenceObservation(const std::vector<RGBA>& display, TiaObservation::Format format,
+                                          uint8_t channels)
+{
+  constexpr int W = Tia::DISPLAY_WIDTH;
+  constexpr int H = Tia::DISPLAY_HEIGHT;
+  auto luma = [&display](int x, int y) { return TiaObservation::luminance(display.at(y * W + x)); };
+  std::vector<uint8_t> observation;
+  switch (format)
+  {
+    case TiaObservation::Format::LUMINANCE:
+      for (int y = 0; y < H; ++y)
+      {
+        for (int x = 0; x < W; ++x)
+        {
+          observation.push_back(luma(x, y));
+        }
+      }
+      break;
+    case TiaObservation::Format::CHANNELS:
+      for (const RGBA& rgba : display)
+      {
+        const uint8_t values[] = {rgba.r, rgba.g, rgba.b, rgba.a};
+        for (int channel = 0; channel < 4; ++channel)
+        {
+          if (channels & (1 << channel))
+          {
+            observation.push_back(values[channel]);
+          }
+        }
+      }
+      break;
+    case TiaObservation::Format::RESIZE:
+      for (int out_y = 0; out_y < 84; ++out_y)
+      {
+        for (int out_x = 0; out_x < 84; ++out_x)
+        {
+          unsigned sum = 0;
+          unsigned count = 0;
+          for (int y = 0; y < H; ++y)
+          {
+            for (int x = 0; x < W; ++x)
+            {
+              if ((x * 84 / W == out_x) and (y * 84 / H == out_y))
+              {
+                sum += luma(x, y);
+                ++count;
+              }
+            }
+          }
+          observation.push_back((sum + count / 2) / count);
+        }
+      }
+      break;
+    case TiaObservation::Format::MAX_POOL_2X:
+      for (int y = 0; y < H; y += 2)
+      {
+        for (int x = 0; x < W; x += 2)
+        {
+          uint8_t value = luma(x, y);
+          for (auto [dx, dy] : {std::pair{1, 0}, std::pair{0, 1}, std::pair{1, 1}})
+          {
+            if ((x + dx < W) and (y + dy < H))
+            {
+              value = std::max(value, luma(x + dx, y + dy));
+            }
+          }
+          observation.push_back(value);
+        }
+      }
+      break;
+  }
+  return observation;
+}
+
+/**
+ * Observations TIA writes while drawing match ones made from finished RGBA display, when drawing RGBA or indices
+ */
+TEST(TiaObservation, formats)
+{
+  using Format = TiaObservation::Format;
+  const std::pair<Format, uint8_t> configs[] = {
+    {Format::LUMINANCE, 0},
+    {Format::CHANNELS, TiaObservation::CHANNEL_R | TiaObservation::CHANNEL_G | TiaObservation::CHANNEL_B},
+    {Format::CHANNELS, TiaObservation::CHANNEL_G | TiaObservation::CHANNEL_A},
+    {Format::RESIZE, 0},
+    {Format::MAX_POOL_2X, 0},
+  };
+
+  Atari2600 reference;
+  loadPlayfieldColors(reference);
+  reference.runFrame();
+  reference.runFrame();
+
+  for (auto [format, channels] : configs)
+  {
+    for (bool indexed : {false, true})
+    {
+      TiaObservation observation(format, channels);
+      std::vector<uint8_t> buffer(observation.size(), 0xAA);
+      observation.buffer_ = buffer.data();
+
+      Atari2600 atari;
+      loadPlayfieldColors(atari);
+      atari.tia_.indexed_output_ = indexed;
+      atari.runFrame();
+      atari.tia_.observation_ = &observation;
+      atari.runFrame();
+
+      std::vector<uint8_t> expected = referenceObservation(reference.tia_.display_, format, channels);
+      ASSERT_EQ(buffer.size(), expected.size()) << TiaObservation::formatName(format);
+      for (size_t ii = 0; ii < buffer.size(); ++ii)
+      {
+        ASSERT_EQ(buffer[ii], expected[ii])
+          << TiaObservation::formatName(format) << " channels " << static_cast<int>(channels)
+          << " indexed " << indexed << " byte " << ii;
+      }
+    }
+  }
+
+  EXPECT_EQ(TiaObservation(Format::RESIZE).size(), 84u * 84u);
+  EXPECT_EQ(TiaObservation(Format::MAX_POOL_2X).size(), 80u * ((Tia::DISPLAY_HEIGHT + 1) / 2));
+  EXPECT_THROW(TiaObservation(Format::CHANNELS, 0), std::runtime_error);
+}
+
+TEST(TraceBuffer, drain)
+{
+  TraceBuffer buffer(5);
+  ASSERT_EQ(buffer.capacity(), 8u);
+
+  // wrap around a few times
+  std::vector<TraceEvent> events;
+  for (uint32_t round = 0; round < 3; ++round)
+  {
+    for (uint32_t ii = 0; ii < 6; ++ii)
+    {
+      buffer.record(TraceType::TIA_WRITE, round * 100 + ii, 0x2, 0);
+    }
+    events.clear();
+    ASSERT_EQ(buffer.drain(events), 6u);
+    for (uint32_t ii = 0; ii < 6; ++ii)
+    {
+      EXPECT_EQ(events.at(ii).pixel_count, round * 100 + ii);
+    }
+  }
+  EXPECT_EQ(buffer.dropped(), 0u);
+
+  // events that don't fit are dropped, oldest ones are kept
+  for (uint32_t ii = 0; ii < 10; ++ii)
+  {
+    buffer.record(TraceType::WSYNC, ii, 0, 0);
+  }
+  EXPECT_EQ(buffer.dropped(), 2u);
+  events.clear();
+  ASSERT_EQ(buffer.drain(events), 8u);
+  EXPECT_EQ(events.back().pixel_count, 7u);
+
+  // categories that are not enabled are not recorded
+  buffer.categories_ = TRACE_ALL & ~TRACE_WSYNC;
+  buffer.record(TraceType::WSYNC, 0, 0, 0);
+  buffer.record(TraceType::VSYNC_START, 1, 0, 0);
+  events.clear();
+  ASSERT_EQ(buffer.drain(events), 1u);
+  EXPECT_EQ(events.at(0).type, TraceType::VSYNC_START);
+}
+
+/**
+ * Consumer on another thread should see every event that wasn't dropped, in order
+ */
+TEST(TraceBuffer, threads)
+{
+  TraceBuffer buffer(64);
+  constexpr uint32_t EVENT_COUNT = 20000;
+
+  std::thread producer([&buffer]()
+  {
+    for (uint32_t ii = 0; ii < EVENT_COUNT; ++ii)
+    {
+      while (!buffer.push(TraceEvent{ii, 0, 0, TraceType::TIA_WRITE}))
+      {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  uint32_t expected = 0;
+  bool in_order = true;
+  while (expected < EVENT_COUNT)
+  {
+    size_t drained = buffer.drain([&](const TraceEvent& event)
+    {
+      in_order = in_order and (event.pixel_count == expected);
+      ++expected;
+    });
+    if (drained == 0)
+    {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  EXPECT_TRUE(in_order);
+  EXPECT_EQ(expected, EVENT_COUNT);
+}
+
+TEST(FrameMailbox, update)
+{
+  FrameMailbox<int> mailbox;
+  EXPECT_FALSE(mailbox.update());
+
+  mailbox.back() = 1;
+  mailbox.publish();
+  ASSERT_TRUE(mailbox.update());
+  EXPECT_EQ(mailbox.front(), 1);
+  EXPECT_FALSE(mailbox.update());
+  EXPECT_EQ(mailbox.front(), 1);
+
+  // Consumer only gets newest frame
+  mailbox.back() = 2;
+  mailbox.publish();
+  mailbox.back() = 3;
+  mailbox.publish();
+  ASSERT_TRUE(mailbox.update());
+  EXPECT_EQ(mailbox.front(), 3);
+  EXPECT_FALSE(mailbox.update());
+}
+
+TEST(FrameMailbox, threads)
+{
+  // Every frame is filled with its number, a torn frame would have a mix of them
+  using Frame = std::array<uint32_t, 256>;
+  FrameMailbox<Frame> mailbox;
+  constexpr uint32_t FRAME_COUNT = 20000;
+
+  std::thread producer([&mailbox]()
+  {
+    for (uint32_t frame = 1; frame <= FRAME_COUNT; ++frame)
+    {
+      mailbox.back().fill(frame);
+      mailbox.publish();
+    }
+  });
+
+  uint32_t last_frame = 0;
+  unsigned updates = 0;
+  while (last_frame != FRAME_COUNT)
+  {
+    if (!mailbox.update())
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    ++updates;
+    const Frame& frame = mailbox.front();
+    ASSERT_GT(frame[0], last_frame);
+    for (uint32_t value : frame)
+    {
+      ASSERT_EQ(value, frame[0]);
+    }
+    last_frame = frame[0];
+  }
+  producer.join();
+  EXPECT_GT(updates, 0u);
+}
+
+TEST(Atari2600, trace)
+{
+  if (!TRACE_ENABLED)
+  {
+    GTEST_SKIP() << "tracing not compiled in";
+  }
+
+  Atari2600 atari;
+  loadPlayfieldColors(atari);
+  atari.runFrame();
+  atari.trace_.drain([](const TraceEvent&) {});
+
+  atari.runFrame();
+  std::vector<TraceEvent> events;
+  atari.trace_.drain(events);
+  ASSERT_EQ(atari.trace_.dropped(), 0u);
+
+  unsigned wsync_count = 0;
+  unsigned vsync_start_count = 0;
+  uint32_t pixel_count = 0;
+  for (const TraceEvent& event : events)
+  {
+    EXPECT_GE(event.pixel_count, pixel_count) << event;
+    pixel_count = event.pixel_count;
+    wsync_count += (event.type == TraceType::WSYNC);
+    vsync_start_count += (event.type == TraceType::VSYNC_START);
+  }
+  // frame ends at start of next VSYNC
+  EXPECT_EQ(vsync_start_count, 1u);
+  EXPECT_EQ(events.back().type, TraceType::VSYNC_START);
+  // every scanline of frame ends with a WSYNC, including ones during VSYNC
+  EXPECT_EQ(wsync_count, 3u + 37u + 192u + 30u);
+}
+
+TEST(Riot, timer)
+{
+  Riot riot;
+  riot.advanceCycles(100);
+
+  // TIM64T : decrements on cycle after write, then every 64 cycles
+  riot.write(Riot::TIM64T_ADDR, 3);
+  EXPECT_EQ(riot.getIntim(), 3);
+  riot.advanceCycles(1);
+  EXPECT_EQ(riot.getIntim(), 2);
+  riot.advanceCycles(63);
+  EXPECT_EQ(riot.getIntim(), 2);
+  riot.advanceCycles(1);
+  EXPECT_EQ(riot.getIntim(), 1);
+  riot.advanceCycles(64);
+  EXPECT_EQ(riot.getIntim(), 0);
+  EXPECT_FALSE(riot.getTimerFlag());
+  EXPECT_EQ(riot.read(Riot::TIMINT_ADDR), 0x00);
+
+  // Passing 0 sets flag, then timer counts down once per cycle
+  riot.advanceCycles(64);
+  EXPECT_EQ(riot.cycle_count_, riot.getTimerExpireCycle());
+  EXPECT_EQ(riot.getIntim(), 0xFF);
+  EXPECT_TRUE(riot.getTimerFlag());
+  riot.advanceCycles(1);
+  EXPECT_EQ(riot.getIntim(), 0xFE);
+  riot.advanceCycles(0xFE);
+  EXPECT_EQ(riot.getIntim(), 0x00);
+  riot.advanceCycles(1);
+  EXPECT_EQ(riot.getIntim(), 0xFF);
+
+  // Reading TIMINT doesn't clear flag, reading INTIM does
+  EXPECT_EQ(riot.read(Riot::TIMINT_ADDR), 0x80);
+  EXPECT_EQ(riot.read(Riot::TIMINT_ADDR), 0x80);
+  EXPECT_EQ(riot.read(Riot::INTIM_ADDR), 0xFF);
+  EXPECT_EQ(riot.read(Riot::TIMINT_ADDR), 0x00);
+
+  // Other intervals, and mirrors of timer registers
+  const std::pair<uint16_t, unsigned> timers[] = {
+    {Riot::TIM1T_ADDR, 1}, {Riot::TIM8T_ADDR, 8}, {Riot::TIM64T_ADDR, 64}, {Riot::T1024T_ADDR, 1024}, {0x29F, 1024}, {0x2B5, 8}
+  };
+  for (auto timer : timers)
+  {
+    riot.write(timer.first, 10);
+    EXPECT_FALSE(riot.getTimerFlag());
+    const uint64_t start_cycle = riot.cycle_count_;
+    for (unsigned elapsed = 0; elapsed <= 10 * timer.second + 300; ++elapsed)
+    {
+      unsigned expected = (elapsed == 0) ? 10 : 9 - (elapsed - 1) / timer.second;
+      if (elapsed > 10 * timer.second)
+      {
+        expected = (0xFF - (elapsed - 10 * timer.second - 1)) & 0xFF;
+      }
+      ASSERT_EQ(riot.getIntim(start_cycle + elapsed), expected)
+        << Riot::addrName(timer.first) << " elapsed " << elapsed;
+    }
+  }
+}
+
+/**
+ * Zero cycle should be first cycle that INTIM reads 0
+ */
+TEST(Riot, getIntimZeroCycle)
+{
+  Riot riot;
+  for (uint16_t addr : {Riot::TIM1T_ADDR, Riot::TIM8T_ADDR, Riot::TIM64T_ADDR})
+  {
+    for (uint8_t value : {0, 1, 2, 17, 255})
+    {
+      riot.write(addr, value);
+      const uint64_t start_cycle = riot.cycle_count_;
+      const uint64_t expire_cycle = riot.getTimerExpireCycle();
+      for (uint64_t cycle = start_cycle; cycle < expire_cycle + 600; cycle += 1)
+      {
+        uint64_t expected = cycle;
+        while (riot.getIntim(expected) != 0)
+        {
+          ++expected;
+        }
+        ASSERT_EQ(riot.getIntimZeroCycle(cycle), expected)
+          << Riot::addrName(addr) << " value " << static_cast<int>(value) << " cycle " << (cycle - start_cycle);
+      }
+      riot.advanceCycles(12345);
+    }
+  }
+}
+
+TEST(Riot, ports)
+{
+  Riot riot;
+  riot.write(0x80, 0x12);
+  riot.write(0x1FF, 0x34);
+  EXPECT_EQ(riot.ram_[0], 0x12);
+  EXPECT_EQ(riot.read(0xFF), 0x34);
+
+  // All pins are inputs after reset
+  riot.swcha_input_ = 0xEF;  // P0 up pressed
+  EXPECT_EQ(riot.read(Riot::SWCHA_ADDR), 0xEF);
+  EXPECT_EQ(riot.read(Riot::SWCHB_ADDR), 0x7F);
+
+  // Output pins read back what was written
+  riot.write(Riot::SWACNT_ADDR, 0x0F);
+  riot.write(Riot::SWCHA_ADDR, 0x05);
+  EXPECT_EQ(riot.read(Riot::SWACNT_ADDR), 0x0F);
+  EXPECT_EQ(riot.read(Riot::SWCHA_ADDR), 0xE5);
+  riot.write(Riot::SWBCNT_ADDR, 0x80);
+  riot.write(Riot::SWCHB_ADDR, 0x80);
+  EXPECT_EQ(riot.read(Riot::SWCHB_ADDR), 0xFF);
+}
+
+/**
+ * ROM with frame loop that waits for the timer during VBLANK and overscan by polling INTIM,
+ * then for a short timer by polling TIMINT
+ */
+std::string makeTimerRom()
+{
+  const uint8_t instructions[] =
+  {
+    0xA9, 0x02,        // F000 : LDA #2
+    0x85, 0x00,        // F002 : STA VSYNC
+    0x85, 0x02,        // F004 : STA WSYNC
+    0x85, 0x02,        // F006 : STA WSYNC
+    0x85, 0x02,        // F008 : STA WSYNC
+    0xA9, 0x00,        // F00A : LDA #0
+    0x85, 0x00,        // F00C : STA VSYNC
+    0xA9, 0x2B,        // F00E : LDA #43
+    0x8D, 0x96, 0x02,  // F010 : STA TIM64T
+    0xAD, 0x84, 0x02,  // F013 : LDA INTIM
+    0xD0, 0xFB,        // F016 : BNE F013
+    0x85, 0x02,        // F018 : STA WSYNC
+    0xA2, 0xC0,        // F01A : LDX #192
+    0x86, 0x09,        // F01C : STX COLUBK
+    0x85, 0x02,        // F01E : STA WSYNC
+    0xCA,              // F020 : DEX
+    0xD0, 0xF9,        // F021 : BNE F01C
+    0xA9, 0xFA,        // F023 : LDA #250
+    0x8D, 0x95, 0x02,  // F025 : STA TIM8T
+    0xAD, 0x84, 0x02,  // F028 : LDA INTIM
+    0xD0, 0xFB,        // F02B : BNE F028
+    0xA9, 0x05,        // F02D : LDA #5
+    0x8D, 0x95, 0x02,  // F02F : STA TIM8T
+    0x2C, 0x85, 0x02,  // F032 : BIT TIMINT
+    0x10, 0xFB,        // F035 : BPL F032
+    0x4C, 0x00, 0xF0,  // F037 : JMP F000
+  };
+  std::string rom(Atari2600::ROM_SIZE, '\0');
+  std::copy(std::begin(instructions), std::end(instructions), rom.begin());
+  rom[0xFFC] = 0x00;
+  rom[0xFFD] = static_cast<char>(0xF0);
+  return rom;
+}
+
+void loadTimerRom(Atari2600& atari)
+{
+  std::istringstream rom_input(makeTimerRom());
+  atari.loadRom(rom_input);
+  for (unsigned ii = 0; ii < 256; ++ii)
+  {
+    atari.tia_.palette_[ii] = RGBA{static_cast<uint8_t>(ii), 0, 0, 255};
+  }
+}
+
+void expectSameState(const Atari2600& atari0, const Atari2600& atari1)
+{
+  ASSERT_EQ(atari0.cpu_.pc_, atari1.cpu_.pc_);
+  ASSERT_EQ(atari0.cpu_.a_, atari1.cpu_.a_);
+  ASSERT_EQ(atari0.cpu_.x_, atari1.cpu_.x_);
+  ASSERT_EQ(atari0.cpu_.y_, atari1.cpu_.y_);
+  ASSERT_EQ(atari0.cpu_.sp_, atari1.cpu_.sp_);
+  ASSERT_EQ(atari0.cpu_.getStatus(), atari1.cpu_.getStatus());
+  ASSERT_EQ(atari0.cpu_.instr_, atari1.cpu_.instr_);
+  ASSERT_EQ(atari0.cpu_.instr_len_, atari1.cpu_.instr_len_);
+  ASSERT_EQ(atari0.cpu_.instr_cycle_count_, atari1.cpu_.instr_cycle_count_);
+
+  ASSERT_EQ(atari0.riot_.cycle_count_, atari1.riot_.cycle_count_);
+  ASSERT_EQ(atari0.riot_.getIntim(), atari1.riot_.getIntim());
+  ASSERT_EQ(atari0.riot_.getTimerFlag(), atari1.riot_.getTimerFlag());
+  ASSERT_EQ(atari0.riot_.ram_, atari1.riot_.ram_);
+
+  ASSERT_EQ(atari0.tia_.frame_count_, atari1.tia_.frame_count_);
+  ASSERT_EQ(atari0.tia_.line_count_, atari1.tia_.line_count_);
+  ASSERT_EQ(atari0.tia_.pixel_count_, atari1.tia_.pixel_count_);
+  ASSERT_EQ(atari0.tia_.scan_x_, atari1.tia_.scan_x_);
+  ASSERT_EQ(atari0.tia_.scan_y_, atari1.tia_.scan_y_);
+  ASSERT_TRUE(atari0.tia_.display_ == atari1.tia_.display_);
+  ASSERT_TRUE(atari0.tia_.back_display_ == atari1.tia_.back_display_);
+}
+
+void expectSameStatus(const Atari2600::RunStatus& status0, const Atari2600::RunStatus& status1)
+{
+  EXPECT_EQ(status0.frame_complete, status1.frame_complete);
+  EXPECT_EQ(status0.breakpoint_hit, status1.breakpoint_hit);
+  EXPECT_EQ(status0.instructions, status1.instructions);
+  EXPECT_EQ(status0.cycles, status1.cycles);
+}
+
+class Atari2600Access : public Atari2600
+{
+public:
+  using Atari2600::skipIdleLoop;
+};
+
+/**
+ * Frames run without rendering end up in exactly same state as rendered ones,
+ * and front display is left with last frame that was rendered
+ */
+TEST(Atari2600, renderSuppressed)
+{
+  std::vector<Atari2600> ataris(2);
+  auto& rendered = ataris.at(0);
+  auto& skipped = ataris.at(1);
+  loadPlayfieldColors(rendered);
+  loadPlayfieldColors(skipped);
+  EXPECT_TRUE(skipped.rendering());
+
+  for (unsigned frame = 0; frame < 12; ++frame)
+  {
+    // only draw every 4th frame, like an action repeated for 4 frames
+    const bool render = ((frame % 4) == 3);
+    skipped.setRendering(render);
+    const std::vector<RGBA> last_display = skipped.tia_.display_;
+    const unsigned ready_frame_count = skipped.tia_.ready_frame_count_;
+
+    expectSameStatus(rendered.runFrame(), skipped.runFrame());
+    ASSERT_EQ(rendered.saveState(), skipped.saveState()) << " frame " << frame;
+    ASSERT_EQ(rendered.tia_.position_x_p0_, skipped.tia_.position_x_p0_);
+    ASSERT_EQ(rendered.tia_.position_x_p1_, skipped.tia_.position_x_p1_);
+    if (render)
+    {
+      ASSERT_TRUE(rendered.tia_.display_ == skipped.tia_.display_) << " frame " << frame;
+      EXPECT_EQ(skipped.tia_.ready_frame_count_, ready_frame_count + 1);
+    }
+    else
+    {
+      ASSERT_TRUE(skipped.tia_.display_ == last_display) << " frame " << frame;
+      EXPECT_EQ(skipped.tia_.ready_frame_count_, ready_frame_count);
+    }
+  }
+}
+
+/**
+ * Skipping idle loops should end up in exactly same state as running every iteration
+ */
+TEST(Atari2600, skipIdleLoops)
+{
+  Atari2600Access fast;
+  Atari2600 slow;
+  loadTimerRom(fast);
+  loadTimerRom(slow);
+  slow.skip_idle_loops_ = false;
+
+  for (unsigned frame = 0; frame < 5; ++frame)
+  {
+    expectSameStatus(fast.runFrame(), slow.runFrame());
+    expectSameState(fast, slow);
+  }
+
+  for (unsigned line = 0; line < 600; ++line)
+  {
+    expectSameStatus(fast.runScanlines(1), slow.runScanlines(1));
+    expectSameState(fast, slow);
+  }
+
+  // Budgets that end in middle of loops, and loops that are skipped in pieces
+  for (unsigned cycle_count = 1; cycle_count < 3000; cycle_count += 37)
+  {
+    expectSameStatus(fast.runCycles(cycle_count), slow.runCycles(cycle_count));
+    expectSameState(fast, slow);
+  }
+
+  for (unsigned instruction_count = 1; instruction_count < 1000; instruction_count += 13)
+  {
+    fast.execInstructions(instruction_count);
+    slow.execInstructions(instruction_count);
+    expectSameState(fast, slow);
+  }
+
+  // Make sure loop is being skipped at all
+  while (fast.cpu_.pc_ != 0xF013)
+  {
+    fast.execInstructions(1);
+  }
+  Atari2600::RunStatus status;
+  EXPECT_TRUE(fast.skipIdleLoop(status, 1000, 1000, std::numeric_limits<unsigned>::max()));
+  EXPECT_GT(status.instructions, 2u);
+  EXPECT_GT(status.skipped_cycles, 0u);
+  EXPECT_GT(fast.skipped_cycles_, 0u);
+  EXPECT_EQ(slow.skipped_cycles_, 0u);
+
+  for (uint16_t loop_pc : {0xF028, 0xF032})
+  {
+    while (fast.cpu_.pc_ != loop_pc)
+    {
+      fast.execInstructions(1);
+    }
+    status = Atari2600::RunStatus();
+    EXPECT_TRUE(fast.skipIdleLoop(status, 1000, 1000, std::numeric_limits<unsigned>::max())) << loop_pc;
+    EXPECT_GT(status.skipped_cycles, 0u) << loop_pc;
+  }
+}
+
+/**
+ * A jump to itself never exits, skipping it must still stop at forced VSYNC and run limits
+ */
+TEST(Atari2600, skipIdleLoopsForever)
+{
+  std::string rom(Atari2600::ROM_SIZE, '\0');
+  const uint8_t instructions[] =
+  {
+    0xA9, 0x00,        // F000 : LDA #0
+    0x85, 0x00,        // F002 : STA VSYNC
+    0x4C, 0x04, 0xF0,  // F004 : JMP F004
+  };
+  std::copy(std::begin(instructions), std::end(instructions), rom.begin());
+  rom[0xFFC] = 0x00;
+  rom[0xFFD] = static_cast<char>(0xF0);
+
+  Atari2600 fast;
+  Atari2600 slow;
+  for (Atari2600* atari : {&fast, &slow})
+  {
+    std::istringstream rom_input(rom);
+    atari->loadRom(rom_input);
+  }
+  slow.skip_idle_loops_ = false;
+
+  for (unsigned frame = 0; frame < 3; ++frame)
+  {
+    expectSameStatus(fast.runFrame(), slow.runFrame());
+    expectSameState(fast, slow);
+  }
+  for (unsigned line = 0; line < 300; ++line)
+  {
+    expectSameStatus(fast.runScanlines(1), slow.runScanlines(1));
+    expectSameState(fast, slow);
+  }
+  for (unsigned cycle_count = 1; cycle_count < 3000; cycle_count += 101)
+  {
+    expectSameStatus(fast.runCycles(cycle_count), slow.runCycles(cycle_count));
+    expectSameState(fast, slow);
+  }
+  EXPECT_GT(fast.skipped_cycles_, 0u);
+}
+
+/**
+ * Restoring a snapshot should continue emulation exactly like the machine it was taken from
+ */
+TEST(Atari2600, saveState)
+{
+  Atari2600 atari;
+  loadTimerRom(atari);
+  atari.runFrame();
+  atari.runFrame();
+  // stop in middle of a line, with pixels pending
+  atari.runCycles(1234);
+
+  Atari2600State state;
+  atari.saveState(state);
+  std::vector<uint8_t> blob = atari.saveState(true);
+  EXPECT_EQ(blob.size(), sizeof(Atari2600State) + 2 * Tia::DISPLAY_WIDTH * Tia::DISPLAY_HEIGHT * sizeof(RGBA));
+  EXPECT_EQ(atari.saveState().size(), sizeof(Atari2600State));
+
+  Atari2600 copy;
+  loadTimerRom(copy);
+  copy.loadState(blob.data(), blob.size());
+  expectSameState(atari, copy);
+  for (unsigned frame = 0; frame < 3; ++frame)
+  {
+    expectSameStatus(atari.runFrame(), copy.runFrame());
+    expectSameState(atari, copy);
+  }
+
+  // Going back to snapshot and running again ends up in same place
+  const std::vector<uint8_t> end_blob = atari.saveState();
+  atari.loadState(state);
+  atari.runCycles(1234);
+  atari.loadState(state);
+  for (unsigned frame = 0; frame < 3; ++frame)
+  {
+    atari.runFrame();
+  }
+  EXPECT_EQ(atari.saveState(), end_blob);
+
+  // Blob with only front display still loads, back display starts as a copy of it
+  const size_t display_size = Tia::DISPLAY_WIDTH * Tia::DISPLAY_HEIGHT * sizeof(RGBA);
+  std::vector<uint8_t> front_blob(blob.begin(), blob.end() - display_size);
+  Atari2600State front_state;
+  std::memcpy(&front_state, front_blob.data(), sizeof(front_state));
+  front_state.flags &= ~Atari2600State::HAS_BACK_DISPLAY;
+  std::memcpy(front_blob.data(), &front_state, sizeof(front_state));
+  Atari2600 front_copy;
+  loadTimerRom(front_copy);
+  front_copy.loadState(front_blob.data(), front_blob.size());
+  EXPECT_EQ(std::memcmp(front_copy.tia_.display_.data(), blob.data() + sizeof(Atari2600State), display_size), 0);
+  EXPECT_EQ(std::memcmp(front_copy.tia_.back_display_.data(), blob.data() + sizeof(Atari2600State), display_size), 0);
+  front_state.flags = Atari2600State::HAS_BACK_DISPLAY;
+  std::memcpy(front_blob.data(), &front_state, sizeof(front_state));
+  EXPECT_THROW(front_copy.loadState(front_blob.data(), front_blob.size()), std::runtime_error);
+
+  EXPECT_THROW(atari.loadState(blob.data(), blob.size() - 1), std::runtime_error);
+  EXPECT_THROW(atari.loadState(blob.data(), sizeof(Atari2600State) - 1), std::runtime_error);
+  blob[4] ^= 0xFF;
+  EXPECT_THROW(atari.loadState(blob.data(), blob.size()), std::runtime_error);
+  state.magic = 0;
+  EXPECT_THROW(atari.loadState(state), std::runtime_error);
+}
+
+/**
+ * Blob saved in indexed mode restores indexed displays, frame in progress is finished the same way
+ */
+TEST(Atari2600, saveStateIndexed)
+{
+  Atari2600 atari;
+  loadTimerRom(atari);
+  atari.tia_.indexed_output_ = true;
+  atari.runFrame();
+  atari.runFrame();
+  atari.runCycles(1234);
+
+  std::vector<uint8_t> blob = atari.saveState(true);
+  const size_t indexed_size = Tia::DISPLAY_WIDTH * Tia::DISPLAY_HEIGHT;
+  ASSERT_EQ(blob.size(), sizeof(Atari2600State) + 2 * indexed_size);
+  Atari2600State state;
+  std::memcpy(&state, blob.data(), sizeof(state));
+  EXPECT_EQ(state.flags, Atari2600State::HAS_INDEXED_DISPLAY);
+
+  Atari2600 copy;
+  loadTimerRom(copy);
+  copy.tia_.indexed_output_ = true;
+  copy.loadState(blob.data(), blob.size());
+  EXPECT_EQ(copy.tia_.indexed_display_, atari.tia_.indexed_display_);
+  EXPECT_EQ(copy.tia_.back_indexed_display_, atari.tia_.back_indexed_display_);
+  expectSameState(atari, copy);
+  for (unsigned frame = 0; frame < 2; ++frame)
+  {
+    expectSameStatus(atari.runFrame(), copy.runFrame());
+    expectSameState(atari, copy);
+    EXPECT_EQ(copy.tia_.indexed_display_, atari.tia_.indexed_display_);
+    EXPECT_EQ(copy.tia_.back_indexed_display_, atari.tia_.back_indexed_display_);
+  }
+
+  EXPECT_THROW(copy.loadState(blob.data(), blob.size() - 1), std::runtime_error);
+}
+
+TEST(RewindBuffer, delta)
+{
+  Atari2600 atari;
+  loadTimerRom(atari);
+  Atari2600State prev;
+  Atari2600State cur;
+  atari.saveState(prev);
+  atari.runFrame();
+  atari.saveState(cur);
+
+  std::array<uint8_t, RewindBuffer::MAX_DELTA_SIZE> delta;
+  size_t delta_size = RewindBuffer::encodeDelta(reinterpret_cast<const uint8_t*>(&prev),
+                                                reinterpret_cast<const uint8_t*>(&cur), delta.data());
+  EXPECT_LT(delta_size, sizeof(Atari2600State) / 2);
+  RewindBuffer::applyDelta(delta.data(), delta_size, reinterpret_cast<uint8_t*>(&prev));
+  EXPECT_EQ(std::memcmp(&prev, &cur, sizeof(cur)), 0);
+
+  // worst case
+  std::array<uint8_t, sizeof(Atari2600State)> zeros = {};
+  std::array<uint8_t, sizeof(Atari2600State)> alternating = {};
+  for (unsigned ii = 0; ii < alternating.size(); ii += 2)
+  {
+    alternating[ii] = 0xA5;
+  }
+  delta_size = RewindBuffer::encodeDelta(zeros.data(), alternating.data(), delta.data());
+  EXPECT_LE(delta_size, RewindBuffer::MAX_DELTA_SIZE);
+  EXPECT_GT(delta_size, sizeof(Atari2600State));
+
+  // Buffer stores a keyframe instead of a delta bigger than a state
+  RewindBuffer rewind(1 << 16, 10);
+  Atari2600State state;
+  std::memcpy(&state, zeros.data(), sizeof(state));
+  rewind.push(state, 0);
+  std::memcpy(&state, alternating.data(), sizeof(state));
+  rewind.push(state, 1);
+  EXPECT_EQ(rewind.usedBytes(), 2 * sizeof(Atari2600State));
+  Atari2600State restored;
+  ASSERT_TRUE(rewind.getState(1, restored));
+  EXPECT_EQ(std::memcmp(&restored, alternating.data(), sizeof(restored)), 0);
+
+  RewindBuffer::applyDelta(delta.data(), delta_size, zeros.data());
+  EXPECT_EQ(zeros, alternating);
+}
+
+/**
+ * Every frame in buffer should seek back to exactly the state it was recorded with
+ */
+TEST(RewindBuffer, seek)
+{
+  Atari2600 atari;
+  loadTimerRom(atari);
+  RewindBuffer rewind(1 << 20, 10);
+  std::vector<std::vector<uint8_t>> states;
+  for (unsigned frame = 0; frame < 100; ++frame)
+  {
+    // change some RAM so deltas have more than counters in them
+    atari.riot_.ram_[frame % 128] = frame;
+    rewind.push(atari);
+    states.push_back(atari.saveState());
+    atari.runFrame();
+  }
+  ASSERT_EQ(rewind.size(), 100u);
+  EXPECT_EQ(rewind.oldestFrame(), 0u);
+  EXPECT_EQ(rewind.newestFrame(), 99u);
+  EXPECT_LT(rewind.usedBytes(), 100 * sizeof(Atari2600State) / 3);
+
+  Atari2600 other;
+  loadTimerRom(other);
+  for (unsigned frame = 0; frame < 100; ++frame)
+  {
+    ASSERT_TRUE(rewind.seek(frame, other));
+    EXPECT_EQ(other.saveState(), states.at(frame)) << "frame " << frame;
+  }
+  EXPECT_FALSE(rewind.seek(100, other));
+
+  // Continuing from an earlier frame replaces later history
+  ASSERT_TRUE(rewind.seek(50, atari));
+  atari.runFrame();
+  atari.riot_.ram_[0] = 0xEE;
+  rewind.push(atari);
+  EXPECT_EQ(rewind.newestFrame(), 51u);
+  EXPECT_EQ(rewind.size(), 52u);
+  ASSERT_TRUE(rewind.seek(51, other));
+  EXPECT_EQ(other.saveState(), atari.saveState());
+  ASSERT_TRUE(rewind.seek(50, other));
+  EXPECT_EQ(other.saveState(), states.at(50));
+}
+
+/**
+ * Small arena should drop oldest frames, and still be able to seek to remaining ones
+ */
+TEST(RewindBuffer, arenaFull)
+{
+  Atari2600 atari;
+  loadTimerRom(atari);
+  RewindBuffer rewind(4096, 8);
+  std::vector<std::vector<uint8_t>> states;
+  for (unsigned frame = 0; frame < 500; ++frame)
+  {
+    atari.riot_.ram_[(frame * 7) % 128] = frame;
+    rewind.push(atari);
+    states.push_back(atari.saveState());
+    atari.runFrame();
+    ASSERT_LE(rewind.usedBytes(), rewind.arenaSize());
+  }
+  EXPECT_EQ(rewind.newestFrame(), 499u);
+  EXPECT_GT(rewind.oldestFrame(), 0u);
+  EXPECT_EQ(rewind.oldestFrame() % 8, 0u);
+  EXPECT_FALSE(rewind.seek(0, atari));
+
+  Atari2600 other;
+  loadTimerRom(other);
+  for (unsigned frame = rewind.oldestFrame(); frame <= rewind.newestFrame(); ++frame)
+  {
+    ASSERT_TRUE(rewind.seek(frame, other));
+    EXPECT_EQ(other.saveState(), states.at(frame)) << "frame " << frame;
+  }
+}
+
+/**
+ * Batch should produce same frames as running each instance on its own, and share one ROM
+ */
+TEST(Atari2600Batch, step)
+{
+  const std::string rom_str = makeTimerRom();
+  auto rom = RomImage::fromBytes(std::vector<uint8_t>(rom_str.begin(), rom_str.end()));
+
+  constexpr size_t INSTANCES = 5;
+  Atari2600Batch batch(INSTANCES, rom, 3);
+  EXPECT_EQ(batch.size(), INSTANCES);
+  EXPECT_EQ(batch.threadCount(), 3u);
+
+  std::vector<Atari2600> singles(INSTANCES);
+  for (size_t ii = 0; ii < INSTANCES; ++ii)
+  {
+    loadTimerRom(singles[ii]);
+    batch.instance(ii).tia_.palette_ = singles[ii].tia_.palette_;
+    EXPECT_EQ(batch.instance(ii).cartridge_->romImage(), rom);
+    // start instances at different points, so they don't all produce the same frame
+    batch.instance(ii).runCycles(ii * 1000);
+    singles[ii].runCycles(ii * 1000);
+  }
+
+  std::vector<uint8_t> actions(INSTANCES);
+  std::vector<uint8_t> observations(INSTANCES * Atari2600Batch::OBSERVATION_SIZE);
+  for (unsigned step = 0; step < 4; ++step)
+  {
+    for (size_t ii = 0; ii < INSTANCES; ++ii)
+    {
+      actions[ii] = static_cast<uint8_t>(~(step + ii));
+    }
+    batch.step(actions.data(), observations.data());
+
+    for (size_t ii = 0; ii < INSTANCES; ++ii)
+    {
+      singles[ii].riot_.swcha_input_ = actions[ii];
+      singles[ii].runFrame();
+      expectSameState(batch.instance(ii), singles[ii]);
+      EXPECT_EQ(batch.instance(ii).riot_.swcha_input_, actions[ii]);
+      EXPECT_EQ(std::memcmp(observations.data() + ii * Atari2600Batch::OBSERVATION_SIZE,
+                            singles[ii].tia_.display_.data(), Atari2600Batch::OBSERVATION_SIZE), 0);
+    }
+  }
+
+  // Invalid opcode in ROM is passed on to caller
+  batch.instance(2).riot_.ram_[0] = 0x02;
+  batch.instance(2).cpu_.pc_ = 0x80;
+  EXPECT_THROW(batch.step(actions.data(), nullptr), std::runtime_error);
+}
+
+/**
+ * Batch can step instances into downscaled observations instead of RGBA displays
+ */
+TEST(Atari2600Batch, observe)
+{
+  constexpr size_t INSTANCES = 4;
+  Atari2600Batch batch(INSTANCES, RomImage::mapFile("playfield_colors_out.bin"), 2);
+  std::ifstream palette_input("palette/REALNTSC.pal", std::ifstream::binary);
+  ASSERT_TRUE(palette_input.good());
+  batch.loadPalette(palette_input);
+  batch.observe(TiaObservation::Format::RESIZE);
+  ASSERT_EQ(batch.observationSize(), 84u * 84u);
+
+  std::vector<Atari2600> singles(INSTANCES);
+  for (Atari2600& single : singles)
+  {
+    loadPlayfieldColors(single);
+  }
+
+  std::vector<uint8_t> actions(INSTANCES, 0xFF);
+  std::vector<uint8_t> observations(INSTANCES * batch.observationSize());
+  for (unsigned step = 0; step < 3; ++step)
+  {
+    batch.step(actions.data(), observations.data());
+    for (size_t ii = 0; ii < INSTANCES; ++ii)
+    {
+      singles[ii].runFrame();
+      if (step == 0)
+      {
+        // first frame doesn't draw whole display
+        continue;
+      }
+      std::vector<uint8_t> expected = referenceObservation(singles[ii].tia_.display_, TiaObservation::Format::RESIZE, 0);
+      EXPECT_TRUE(std::equal(expected.begin(), expected.end(), observations.begin() + ii * batch.observationSize()))
+        << " instance " << ii << " step " << step;
+    }
+  }
+
+  // Rows drawn before observe() aren't drawn again by next step, they are zeroed instead of left as they were
+  batch.instance(0).runScanlines(150);
+  batch.observe(TiaObservation::Format::LUMINANCE);
+  observations.assign(INSTANCES * batch.observationSize(), 0xAB);
+  batch.step(actions.data(), observations.data());
+  EXPECT_TRUE(std::all_of(observations.begin(), observations.begin() + Tia::DISPLAY_WIDTH,
+                          [](uint8_t luminance) { return luminance == 0; }));
+  EXPECT_EQ(std::count(observations.begin(), observations.end(), 0xAB), 0);
+}
+
+TEST(RomImage, mapFile)
+{
+  const std::string rom_str = makeTimerRom();
+  const std::string rom_fn = "rom_image_test.bin";
+  {
+    std::ofstream output(rom_fn, std::ofstream::binary);
+    output.write(rom_str.data(), rom_str.size());
+  }
+
+  std::shared_ptr<const RomImage> mapped = RomImage::mapFile(rom_fn);
+  ASSERT_EQ(mapped->size(), Atari2600::ROM_SIZE);
+  EXPECT_EQ(std::memcmp(mapped->data(), rom_str.data(), rom_str.size()), 0);
+  EXPECT_EQ(mapped->path(), rom_fn);
+  EXPECT_EQ(mapped->hashString().size(), 16u);
+
+  std::shared_ptr<const RomImage> copied = RomImage::fromBytes(std::vector<uint8_t>(rom_str.begin(), rom_str.end()));
+  EXPECT_FALSE(copied->isMapped());
+  EXPECT_EQ(mapped->hash(), copied->hash());
+
+  // Mapped ROM runs same as one loaded from stream
+  Atari2600 atari0;
+  Atari2600 atari1;
+  loadTimerRom(atari0);
+  loadTimerRom(atari1);
+  atari1.loadRom(mapped);
+  EXPECT_EQ(atari1.cartridge_->romImage(), mapped);
+  atari0.runFrame();
+  atari1.runFrame();
+  expectSameState(atari0, atari1);
+
+  EXPECT_THROW(RomImage::mapFile("no_such_rom.bin"), std::runtime_error);
+  EXPECT_THROW(RomImage::fromBytes(std::vector<uint8_t>(1000)), std::runtime_error);
+  EXPECT_THROW(atari0.loadRom(RomImage::fromBytes(std::vector<uint8_t>(12 << 10))), std::runtime_error);
+  {
+    std::ofstream output(rom_fn, std::ofstream::binary | std::ofstream::app);
+    output.put(0);
+  }
+  EXPECT_THROW(RomImage::mapFile(rom_fn), std::runtime_error);
+  std::remove(rom_fn.c_str());
+}
+
+TEST(RomStore, share)
+{
+  const std::string rom_str = makeTimerRom();
+  const std::string rom_fn = "rom_store_test.bin";
+  {
+    std::ofstream output(rom_fn, std::ofstream::binary);
+    output.write(rom_str.data(), rom_str.size());
+  }
+
+  RomStore store;
+  std::shared_ptr<const RomImage> rom0 = store.open(rom_fn);
+  std::shared_ptr<const RomImage> rom1 = store.open(rom_fn);
+  EXPECT_EQ(rom0, rom1);
+  EXPECT_EQ(store.add(RomImage::fromBytes(std::vector<uint8_t>(rom_str.begin(), rom_str.end()))), rom0);
+  EXPECT_EQ(store.find(rom0->hash()), rom0);
+  EXPECT_EQ(store.size(), 1u);
+
+  std::shared_ptr<const RomImage> other = store.add(RomImage::fromBytes(std::vector<uint8_t>(Atari2600::ROM_SIZE, 0xEA)));
+  EXPECT_NE(other, rom0);
+  EXPECT_EQ(store.size(), 2u);
+
+  // Store doesn't keep images alive
+  const uint64_t hash = rom0->hash();
+  rom0.reset();
+  rom1.reset();
+  EXPECT_EQ(store.find(hash), nullptr);
+  EXPECT_EQ(store.size(), 1u);
+  std::remove(rom_fn.c_str());
+}
+
+// Byte at offset of a 4K bank, differs between banks, and between first and second 128 bytes
+uint8_t bankByte(unsigned bank, unsigned offset)
+{
+  return (bank << 5) | ((offset >> 7) & 0x1F);
+}
+
+std::shared_ptr<const RomImage> makeBankedRom(unsigned bank_count)
+{
+  std::vector<uint8_t> rom(bank_count * 0x1000);
+  for (size_t ii = 0; ii < rom.size(); ++ii)
+  {
+    rom[ii] = bankByte(ii / 0x1000, ii % 0x1000);
+  }
+  return RomImage::fromBytes(std::move(rom));
+}
+
+TEST(Cartridge, atari)
+{
+  using Mapper = Cartridge::Mapper;
+  const std::vector<std::pair<Mapper, unsigned>> mappers = {{Mapper::F8, 0xFF8}, {Mapper::F6, 0xFF6}, {Mapper::F4, 0xFF4}};
+  for (const auto& [mapper, first_hotspot] : mappers)
+  {
+    const unsigned bank_count = (mapper == Mapper::F8) ? 2 : (mapper == Mapper::F6) ? 4 : 8;
+    std::shared_ptr<const RomImage> rom = makeBankedRom(bank_count);
+    EXPECT_EQ(Cartridge::detect(*rom), mapper);
+    std::unique_ptr<Cartridge> cart = Cartridge::create(rom);
+    ASSERT_EQ(cart->mapper(), mapper);
+
+    // Starts in last bank
+    EXPECT_EQ(cart->read(0x1234), bankByte(bank_count - 1, 0x234));
+    for (unsigned bank = 0; bank < bank_count; ++bank)
+    {
+      // Reading hotspot (mirrored at 0xF000) switches bank, and returns byte from new bank
+      EXPECT_EQ(cart->read(0xF000 + first_hotspot + bank), bankByte(bank, first_hotspot + bank));
+      EXPECT_EQ(cart->read(0x1000), bankByte(bank, 0));
+      EXPECT_EQ(cart->read(0x1FFF), bankByte(bank, 0xFFF));
+      EXPECT_EQ(cart->peek(0x1800), bankByte(bank, 0x800));
+    }
+    // So does writing it
+    cart->write(0x1000 + first_hotspot, 0);
+    EXPECT_EQ(cart->read(0x1100), bankByte(0, 0x100));
+  }
+
+  EXPECT_THROW(Cartridge::create(makeBankedRom(2), Mapper::F6), std::runtime_error);
+  EXPECT_THROW(Cartridge::detect(*RomImage::fromBytes(std::vector<uint8_t>(12 << 10))), std::runtime_error);
+}
+
+TEST(Cartridge, superchip)
+{
+  // Superchip hides first 256 bytes of each bank, so they are padded with a repeated pattern
+  std::vector<uint8_t> rom(0x2000, 0xEA);
+  rom[0x1FFF] = 0x12;
+  std::shared_ptr<const RomImage> image = RomImage::fromBytes(std::move(rom));
+  ASSERT_EQ(Cartridge::detect(*image), Cartridge::Mapper::F8SC);
+
+  Atari2600 atari0;
+  atari0.loadRom(image);
+  Cartridge& cart = *atari0.cartridge_;
+  cart.write(0x1005, 0x77);
+  cart.write(0x107F, 0x88);
+  EXPECT_EQ(cart.read(0x1085), 0x77);
+  EXPECT_EQ(cart.read(0x10FF), 0x88);
+  EXPECT_EQ(cart.read(0x1100), 0xEA);
+
+  // RAM and bank are part of saved state
+  cart.read(0x1FF8);
+  Atari2600State state;
+  atari0.saveState(state);
+  Atari2600 atari1;
+  atari1.loadRom(image);
+  atari1.loadState(state);
+  EXPECT_EQ(atari1.cartridge_->read(0x1085), 0x77);
+  EXPECT_EQ(atari1.cartridge_->read(0x1FFF), 0xEA);
+  atari1.cartridge_->read(0x1FF9);
+  EXPECT_EQ(atari1.cartridge_->read(0x1FFF), 0x12);
+}
+
+/**
+ * Saved cartridge state has to fit mapper and ROM it is loaded into
+ */
+TEST(Cartridge, loadStateChecks)
+{
+  std::shared_ptr<const RomImage> f8_rom = makeBankedRom(2);
+  std::shared_ptr<const RomImage> f6_rom = makeBankedRom(4);
+  Atari2600 f6;
+  f6.loadRom(f6_rom);
+  f6.cartridge_->read(0x1FF8);
+  std::vector<uint8_t> blob = f6.saveState(false);
+
+  Atari2600 atari;
+  atari.loadRom(f6_rom);
+  atari.loadState(blob.data(), blob.size());
+  EXPECT_EQ(atari.cartridge_->peek(0x1000), bankByte(2, 0));
+
+  // Bank past end of ROM
+  const size_t bank_offset = offsetof(Atari2600State, cartridge) + offsetof(CartridgeState, banks);
+  std::vector<uint8_t> bad_bank = blob;
+  bad_bank[bank_offset] = 4;
+  atari.cartridge_->read(0x1FF6);
+  EXPECT_THROW(atari.loadState(bad_bank.data(), bad_bank.size()), std::runtime_error);
+  EXPECT_EQ(atari.cartridge_->peek(0x1000), bankByte(0, 0));
+  bad_bank[bank_offset] = 0;
+  bad_bank[bank_offset + 1] = 1;
+  EXPECT_THROW(atari.loadState(bad_bank.data(), bad_bank.size()), std::runtime_error);
+
+  // State saved with another mapper, even if its banks would fit
+  Atari2600 f8;
+  f8.loadRom(f8_rom);
+  blob = f8.saveState(false);
+  EXPECT_THROW(atari.loadState(blob.data(), blob.size()), std::runtime_error);
+}
+
+TEST(Cartridge, e0)
+{
+  std::vector<uint8_t> rom(0x2000);
+  for (size_t ii = 0; ii < rom.size(); ++ii)
+  {
+    // slice number in high bits
+    rom[ii] = ((ii / 0x400) << 4) | (ii & 0xF);
+  }
+  // STA $1FE0, so it is detected as E0
+  const uint8_t sta_hotspot[] = {0x8D, 0xE0, 0x1F};
+  std::copy(std::begin(sta_hotspot), std::end(sta_hotspot), rom.begin() + 0x1C10);
+  std::shared_ptr<const RomImage> image = RomImage::fromBytes(std::move(rom));
+  ASSERT_EQ(Cartridge::detect(*image), Cartridge::Mapper::E0);
+  std::unique_ptr<Cartridge> cart = Cartridge::create(image);
+
+  for (unsigned segment = 0; segment < 3; ++segment)
+  {
+    for (unsigned slice = 0; slice < 8; ++slice)
+    {
+      cart->read(0x1FE0 + segment * 8 + slice);
+      EXPECT_EQ(cart->read(0x1001 + segment * 0x400) >> 4, slice);
+    }
+  }
+  // Last segment is always last slice
+  EXPECT_EQ(cart->read(0x1C01) >> 4, 7u);
+  // Other segments kept last selected slice
+  EXPECT_EQ(cart->read(0x1001) >> 4, 7u);
+}
+
+TEST(Cartridge, fe)
+{
+  // Bank 0 runs at 0xF000, and calls subroutine in bank 1 at 0xD000
+  std::vector<uint8_t> rom(0x2000, 0xEA);
+  const uint8_t bank0[] = {
+    0xA2, 0xFF,        // LDX #$FF
+    0x9A,              // TXS
+    0x20, 0x00, 0xD0,  // JSR $D000
+    0x85, 0x80,        // STA $80
+    0x4C, 0x08, 0xF0   // JMP $F008
+  };
+  const uint8_t bank1[] = {
+    0xA9, 0x42,        // LDA #$42
+    0x60               // RTS
+  };
+  std::copy(std::begin(bank0), std::end(bank0), rom.begin());
+  std::copy(std::begin(bank1), std::end(bank1), rom.begin() + 0x1000);
+  rom[0xFFC] = 0x00;
+  rom[0xFFD] = 0xF0;
+
+  Atari2600 atari;
+  atari.loadRom(RomImage::fromBytes(std::move(rom)), Cartridge::Mapper::FE);
+  atari.runCycles(2 + 2 + 2 + 6);
+  EXPECT_EQ(atari.cpu_.pc_, 0xD000);
+  // Bank switches on fetch from 0xD000
+  atari.runCycles(2);
+  EXPECT_EQ(atari.cartridge_->peek(0x1000), 0xA9);
+  atari.runCycles(6 + 3);
+  EXPECT_EQ(atari.cpu_.pc_, 0xF008);
+  EXPECT_EQ(atari.riot_.ram_[0], 0x42);
+  EXPECT_EQ(atari.cartridge_->peek(0x1000), 0xA2);
+}
+
+/**
+ * Every ExecMode ends up in same state as fetching instructions from bus, after each
+ * instruction, and after runs that stop in middle of basic blocks
+ * Returns cycles run by compiled blocks in JIT mode
+ */
+uint64_t expectSameExecModes(const std::function<void(Atari2600&)>& load_rom)
+{
+  using ExecMode = Atari2600::ExecMode;
+  uint64_t jit_cycles = 0;
+  for (ExecMode exec_mode : {ExecMode::DECODED, ExecMode::THREADED, ExecMode::JIT})
+  {
+    SCOPED_TRACE(Atari2600::execModeName(exec_mode));
+    Atari2600 atari;
+    Atari2600 fetched;
+    load_rom(atari);
+    load_rom(fetched);
+    atari.exec_mode_ = exec_mode;
+    fetched.exec_mode_ = ExecMode::FETCH;
+
+    for (unsigned ii = 0; ii < 300; ++ii)
+    {
+      atari.execInstructions(1);
+      fetched.execInstructions(1);
+      expectSameState(atari, fetched);
+    }
+    for (unsigned frame = 0; frame < 3; ++frame)
+    {
+      expectSameStatus(atari.runFrame(), fetched.runFrame());
+      expectSameState(atari, fetched);
+    }
+    for (unsigned line = 0; line < 300; ++line)
+    {
+      expectSameStatus(atari.runScanlines(1), fetched.runScanlines(1));
+      expectSameState(atari, fetched);
+    }
+    for (unsigned cycle_count = 1; cycle_count < 3000; cycle_count += 37)
+    {
+      expectSameStatus(atari.runCycles(cycle_count), fetched.runCycles(cycle_count));
+      expectSameState(atari, fetched);
+    }
+    for (unsigned instruction_count = 1; instruction_count < 1000; instruction_count += 13)
+    {
+      atari.execInstructions(instruction_count);
+      fetched.execInstructions(instruction_count);
+      expectSameState(atari, fetched);
+    }
+    jit_cycles += atari.jit_cycles_;
+  }
+  return jit_cycles;
+}
+
+/**
+ * Bank switches run different code at same PC, without decoded ROM being invalidated
+ */
+TEST(Atari2600, execModes)
+{
+  // F8, starts in bank 1 which switches to bank 0 and back
+  std::vector<uint8_t> rom(0x2000, 0xEA);
+  const uint8_t bank0[] = {
+    0xE6, 0x80,        // F005 : INC $80
+    0xAD, 0xF9, 0x1F,  // F007 : LDA $1FF9
+  };
+  const uint8_t bank1[] = {
+    0xE6, 0x81,        // F000 : INC $81
+    0xAD, 0xF8, 0x1F,  // F002 : LDA $1FF8
+  };
+  const uint8_t bank1_jump[] = {
+    0x4C, 0x00, 0xF0   // F00A : JMP $F000
+  };
+  std::copy(std::begin(bank0), std::end(bank0), rom.begin() + 0x0005);
+  std::copy(std::begin(bank1), std::end(bank1), rom.begin() + 0x1000);
+  std::copy(std::begin(bank1_jump), std::end(bank1_jump), rom.begin() + 0x100A);
+  rom[0x1FFC] = 0x00;
+  rom[0x1FFD] = 0xF0;
+  std::shared_ptr<const RomImage> image = RomImage::fromBytes(std::move(rom));
+
+  expectSameExecModes([&image](Atari2600& atari) { atari.loadRom(image); });
+  expectSameExecModes(loadTimerRom);
+
+  Atari2600 atari;
+  atari.loadRom(image);
+  atari.exec_mode_ = Atari2600::ExecMode::THREADED;
+  atari.execInstructions(200);
+  EXPECT_GT(atari.riot_.ram_[0], 10);
+  EXPECT_EQ(atari.riot_.ram_[0], atari.riot_.ram_[1]);
+  EXPECT_GT(atari.threaded_cycles_, 0u);
+}
+
+/**
+ * Translated blocks catch TIA and RIOT up to cycle each access happens on, with a timer
+ * that counts down every cycle, and blocks that end in TIA and RIOT writes
+ */
+TEST(Atari2600, threadedBlockAccesses)
+{
+  const uint8_t instructions[] =
+  {
+    0xA9, 0xF0,        // F000 : LDA #$F0
+    0x8D, 0x94, 0x02,  // F002 : STA TIM1T
+    0xE6, 0x82,        // F005 : INC $82
+    0xEA,              // F007 : NOP
+    0xAD, 0x84, 0x02,  // F008 : LDA INTIM
+    0x85, 0x80,        // F00B : STA $80
+    0xA6, 0x82,        // F00D : LDX $82
+    0xE8,              // F00F : INX
+    0xAC, 0x84, 0x02,  // F010 : LDY INTIM
+    0x84, 0x81,        // F013 : STY $81
+    0x86, 0x09,        // F015 : STX COLUBK
+    0xA5, 0x80,        // F017 : LDA $80
+    0x85, 0x02,        // F019 : STA WSYNC
+    0xB5, 0x80,        // F01B : LDA $80,X
+    0x4C, 0x00, 0xF0,  // F01D : JMP F000
+  };
+  std::string rom(Atari2600::ROM_SIZE, '\0');
+  std::copy(std::begin(instructions), std::end(instructions), rom.begin());
+  rom[0xFFC] = 0x00;
+  rom[0xFFD] = static_cast<char>(0xF0);
+  auto load_rom = [&rom](Atari2600& atari)
+  {
+    std::istringstream rom_input(rom);
+    atari.loadRom(rom_input);
+  };
+  expectSameExecModes(load_rom);
+
+  Atari2600 atari;
+  load_rom(atari);
+  atari.exec_mode_ = Atari2600::ExecMode::THREADED;
+  atari.runFrame();
+  EXPECT_GT(atari.threaded_cycles_, 0u);
+  // INTIM read 12 cycles apart, by LDA INTIM, STA, LDX and INX
+  EXPECT_EQ(static_cast<uint8_t>(atari.riot_.ram_[0] - atari.riot_.ram_[1]), 12u);
+}
+
+/**
+ * Test ROMs from README, instr_test.rom is only checked if it has been built with DASM
+ */
+TEST(Atari2600, execModesTestRoms)
+{
+  expectSameExecModes(loadPlayfieldColors);
+
+  std::ifstream instr_test("instr_test.rom", std::ifstream::binary);
+  if (!instr_test.good())
+  {
+    GTEST_SKIP() << "instr_test.rom not built";
+  }
+  std::string rom{std::istreambuf_iterator<char>(instr_test), std::istreambuf_iterator<char>()};
+  expectSameExecModes([&rom](Atari2600& atari)
+  {
+    std::istringstream rom_input(rom);
+    atari.loadRom(rom_input);
+  });
+}
+
+/**
+ * Random programs mixing instructions JIT compiles with TIA and RIOT accesses it can't,
+ * run same in JIT mode as when fetching every instruction
+ */
+TEST(Atari2600, jitFuzz)
+{
+  if (!Mos6502Jit::SUPPORTED)
+  {
+    GTEST_SKIP() << "JIT not supported on this host";
+  }
+
+  enum class Operand
+  {
+    NONE,
+    IMMEDIATE,
+    RAM,
+    BRANCH,
+    FIXED
+  };
+  struct FuzzInstr
+  {
+    std::vector<uint8_t> bytes;
+    Operand operand;
+  };
+  const std::vector<FuzzInstr> instrs = {
+    {{0xA9, 0}, Operand::IMMEDIATE},  // LDA #
+    {{0xA2, 0}, Operand::IMMEDIATE},  // LDX #
+    {{0xA0, 0}, Operand::IMMEDIATE},  // LDY #
+    {{0xA5, 0}, Operand::RAM},        // LDA zpg
+    {{0xA6, 0}, Operand::RAM},        // LDX zpg
+    {{0xA4, 0}, Operand::RAM},        // LDY zpg
+    {{0x85, 0}, Operand::RAM},        // STA zpg
+    {{0x86, 0}, Operand::RAM},        // STX zpg
+    {{0x84, 0}, Operand::RAM},        // STY zpg
+    {{0xE6, 0}, Operand::RAM},        // INC zpg
+    {{0xC6, 0}, Operand::RAM},        // DEC zpg
+    {{0xAA}, Operand::NONE},          // TAX
+    {{0xA8}, Operand::NONE},          // TAY
+    {{0x8A}, Operand::NONE},          // TXA
+    {{0x98}, Operand::NONE},          // TYA
+    {{0xE8}, Operand::NONE},          // INX
+    {{0xC8}, Operand::NONE},          // INY
+    {{0xCA}, Operand::NONE},          // DEX
+    {{0x88}, Operand::NONE},          // DEY
+    {{0xEA}, Operand::NONE},          // NOP
+    {{0x18}, Operand::NONE},          // CLC
+    {{0x38}, Operand::NONE},          // SEC
+    {{0x29, 0}, Operand::IMMEDIATE},  // AND #
+    {{0x25, 0}, Operand::RAM},        // AND zpg
+    {{0x09, 0}, Operand::IMMEDIATE},  // ORA #
+    {{0x05, 0}, Operand::RAM},        // ORA zpg
+    {{0x49, 0}, Operand::IMMEDIATE},  // EOR #
+    {{0x45, 0}, Operand::RAM},        // EOR zpg
+    {{0x69, 0}, Operand::IMMEDIATE},  // ADC #
+    {{0x65, 0}, Operand::RAM},        // ADC zpg
+    {{0xE9, 0}, Operand::IMMEDIATE},  // SBC #
+    {{0xE5, 0}, Operand::RAM},        // SBC zpg
+    {{0xC9, 0}, Operand::IMMEDIATE},  // CMP #
+    {{0xC5, 0}, Operand::RAM},        // CMP zpg
+    {{0xE0, 0}, Operand::IMMEDIATE},  // CPX #
+    {{0xE4, 0}, Operand::RAM},        // CPX zpg
+    {{0xC0, 0}, Operand::IMMEDIATE},  // CPY #
+    {{0xC4, 0}, Operand::RAM},        // CPY zpg
+    {{0x10, 0}, Operand::BRANCH},     // BPL
+    {{0x30, 0}, Operand::BRANCH},     // BMI
+    {{0x50, 0}, Operand::BRANCH},     // BVC
+    {{0x70, 0}, Operand::BRANCH},     // BVS
+    {{0x90, 0}, Operand::BRANCH},     // BCC
+    {{0xB0, 0}, Operand::BRANCH},     // BCS
+    {{0xD0, 0}, Operand::BRANCH},     // BNE
+    {{0xF0, 0}, Operand::BRANCH},     // BEQ
+    // Not compiled
+    {{0x85, 0x02}, Operand::FIXED},         // STA WSYNC
+    {{0x85, 0x09}, Operand::FIXED},         // STA COLUBK
+    {{0x85, 0x10}, Operand::FIXED},         // STA RESP0
+    {{0xAD, 0x84, 0x02}, Operand::FIXED},   // LDA INTIM
+    {{0x8D, 0x96, 0x02}, Operand::FIXED},   // STA TIM64T
+    {{0x0A}, Operand::NONE},                // ASL A
+    {{0x4A}, Operand::NONE},                // LSR A
+    {{0x24, 0}, Operand::RAM},              // BIT zpg, can set both N and Z
+  };
+
+  // No VSYNC writes, a loop doing them more than once a line would keep runScanlines() from returning
+  uint64_t jit_cycles = 0;
+  for (unsigned seed = 0; seed < 20; ++seed)
+  {
+    SCOPED_TRACE(seed);
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> rom(0x1000, 0xEA);
+    std::vector<size_t> instr_starts;
+    std::vector<size_t> branches;
+    size_t offset = 0;
+    while (offset < 0x300)
+    {
+      const FuzzInstr& instr = instrs[rng() % instrs.size()];
+      instr_starts.push_back(offset);
+      std::copy(instr.bytes.begin(), instr.bytes.end(), rom.begin() + offset);
+      if (instr.operand == Operand::IMMEDIATE)
+      {
+        rom[offset + 1] = rng();
+      }
+      else if (instr.operand == Operand::RAM)
+      {
+        rom[offset + 1] = 0x80 + rng() % 8;
+      }
+      else if (instr.operand == Operand::BRANCH)
+      {
+        branches.push_back(offset);
+      }
+      offset += instr.bytes.size();
+    }
+    // JMP $F000
+    rom[offset] = 0x4C;
+    rom[offset + 1] = 0x00;
+    rom[offset + 2] = 0xF0;
+    instr_starts.push_back(offset);
+
+    // Branch to start of a random instruction in range
+    for (size_t branch : branches)
+    {
+      std::vector<size_t> targets;
+      for (size_t target : instr_starts)
+      {
+        const int distance = static_cast<int>(target) - static_cast<int>(branch + 2);
+        if ((distance >= -128) and (distance <= 127))
+        {
+          targets.push_back(target);
+        }
+      }
+      rom[branch + 1] = static_cast<int8_t>(static_cast<int>(targets[rng() % targets.size()]) - static_cast<int>(branch + 2));
+    }
+    rom[0xFFC] = 0x00;
+    rom[0xFFD] = 0xF0;
+    std::shared_ptr<const RomImage> image = RomImage::fromBytes(std::move(rom));
+    jit_cycles += expectSameExecModes([&image](Atari2600& atari) { atari.loadRom(image); });
+  }
+  EXPECT_GT(jit_cycles, 0);
+}
+
+TEST(Cartridge, tigervision)
+{
+  // Each 2K bank is filled with its number, code is in fixed last bank at 0xF800
+  std::vector<uint8_t> rom(0x2000);
+  for (size_t ii = 0; ii < rom.size(); ++ii)
+  {
+    rom[ii] = 0x10 + ii / 0x800;
+  }
+  const uint8_t code[] = {
+    0xA9, 0x01,        // LDA #1
+    0x85, 0x3F,        // STA $3F
+    0xAD, 0x00, 0xF0,  // LDA $F000
+    0x85, 0x80,        // STA $80
+    0xA9, 0x02,        // LDA #2
+    0x85, 0x3F,        // STA $3F
+    0xAD, 0x00, 0xF0,  // LDA $F000
+    0x85, 0x81,        // STA $81
+    0x4C, 0x12, 0xF8   // JMP $F812
+  };
+  std::copy(std::begin(code), std::end(code), rom.begin() + 0x1800);
+  rom[0x1FFC] = 0x00;
+  rom[0x1FFD] = 0xF8;
+  std::shared_ptr<const RomImage> image = RomImage::fromBytes(std::move(rom));
+  ASSERT_EQ(Cartridge::detect(*image), Cartridge::Mapper::TIGERVISION_3F);
+
+  Atari2600 atari;
+  atari.loadRom(image);
+  EXPECT_EQ(atari.cartridge_->peek(0x1000), 0x10);
+  atari.runCycles(100);
+  EXPECT_EQ(atari.riot_.ram_[0], 0x11);
+  EXPECT_EQ(atari.riot_.ram_[1], 0x12);
+  EXPECT_EQ(atari.cpu_.pc_, 0xF812);
+}
+
+// Branching decode of bus from before it used page tables, reference for page table decode
+uint8_t referenceRead(Atari2600& atari, uint16_t addr)
+{
+  if (addr & 0x1000)
+  {
+    return atari.cartridge_->read(addr);
+  }
+  addr &= 0x1FFF;
+  if (atari.cartridge_->watches_low_addresses_)
+  {
+    atari.cartridge_->lowAccess(addr, 0, false);
+  }
+  return (addr & 0x80) ? atari.riot_.read(addr) : 0;
+}
+
+void referenceWrite(Atari2600& atari, uint16_t addr, uint8_t data)
+{
+  if (addr & 0x1000)
+  {
+    atari.cartridge_->write(addr, data);
+    return;
+  }
+  addr &= 0x1FFF;
+  if (atari.cartridge_->watches_low_addresses_)
+  {
+    atari.cartridge_->lowAccess(addr, data, true);
+  }
+  if (addr & 0x80)
+  {
+    atari.riot_.write(addr, data);
+  }
+  else
+  {
+    atari.tia_.write(addr, data);
+  }
+}
+
+void expectSameBusState(const Atari2600& atari0, const Atari2600& atari1)
+{
+  Atari2600State state0{};
+  Atari2600State state1{};
+  atari0.saveState(state0);
+  atari1.saveState(state1);
+  ASSERT_EQ(std::memcmp(&state0, &state1, sizeof(state0)), 0);
+  for (uint16_t addr = 0x1000; addr < 0x2000; ++addr)
+  {
+    ASSERT_EQ(atari0.cartridge_->peek(addr), atari1.cartridge_->peek(addr));
+  }
+}
+
+/**
+ * Every address, and its mirror with A13-A15 set, decodes same through page tables
+ * as through branches on A12, A7 and A9, including side effects like bank switching
+ */
+TEST(Atari2600, busDecode)
+{
+  using Mapper = Cartridge::Mapper;
+  std::vector<uint8_t> rom_8k(0x2000);
+  for (size_t ii = 0; ii < rom_8k.size(); ++ii)
+  {
+    rom_8k[ii] = ii * 13 + (ii >> 8);
+  }
+  std::shared_ptr<const RomImage> rom_4k = RomImage::fromBytes(std::vector<uint8_t>(rom_8k.begin(), rom_8k.begin() + 0x1000));
+  std::shared_ptr<const RomImage> rom = RomImage::fromBytes(rom_8k);
+  const std::vector<std::pair<std::shared_ptr<const RomImage>, Mapper>> cartridges = {
+    {rom_4k, Mapper::ROM_4K}, {rom, Mapper::F8SC}, {rom, Mapper::FE}, {rom, Mapper::TIGERVISION_3F}};
+
+  for (const auto& [image, mapper] : cartridges)
+  {
+    SCOPED_TRACE(Cartridge::mapperName(mapper));
+    Atari2600 bus_atari;
+    Atari2600 reference_atari;
+    bus_atari.loadRom(image, mapper);
+    reference_atari.loadRom(image, mapper);
+    Atari2600Bus bus{&bus_atari};
+
+    for (uint16_t mirror : {0x0000, 0xE000})
+    {
+      for (uint16_t addr = 0; addr < 0x2000; ++addr)
+      {
+        const uint8_t data = addr * 7 + (addr >> 8);
+        bus.write(addr | mirror, data);
+        referenceWrite(reference_atari, addr | mirror, data);
+        ASSERT_EQ(bus.read(addr | mirror), referenceRead(reference_atari, addr | mirror)) << "addr " << addr;
+      }
+      expectSameBusState(bus_atari, reference_atari);
+    }
+  }
+}
@@ -0,0 +1,599 @@
+#include "cartridge.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+Cartridge::Cartridge(std::shared_ptr<const RomImage> rom, Mapper mapper) :
+  rom_{std::move(rom)},
+  mapper_{mapper}
+{
+}
+
+void Cartridge::lowAccess(uint16_t, uint8_t, bool)
+{
+}
+
+void Cartridge::reset()
+{
+  banks_ = {};
+  flags_ = 0;
+  ram_.fill(0);
+  mapBanks();
+}
+
+void Cartridge::saveState(CartridgeState& state) const
+{
+  std::copy(banks_.begin(), banks_.end(), state.banks);
+  state.flags = flags_;
+  state.mapper = static_cast<uint8_t>(mapper_);
+  std::fill(std::begin(state.reserved), std::end(state.reserved), 0);
+  std::copy(ram_.begin(), ram_.end(), state.ram);
+}
+
+void Cartridge::loadState(const CartridgeState& state)
+{
+  if (state.mapper != static_cast<uint8_t>(mapper_))
+  {
+    throw std::runtime_error(std::string("Cartridge state was saved with another mapper than ") + mapperName(mapper_));
+  }
+  for (unsigned segment = 0; segment < banks_.size(); ++segment)
+  {
+    if (state.banks[segment] >= bankCount(segment))
+    {
+      throw std::runtime_error("Cartridge state selects bank " + std::to_string(state.banks[segment]) +
+                               " of segment " + std::to_string(segment) + ", which " + mapperName(mapper_) +
+                               " ROM doesn't have");
+    }
+  }
+  std::copy(std::begin(state.banks), std::end(state.banks), banks_.begin());
+  flags_ = state.flags;
+  std::copy(std::begin(state.ram), std::end(state.ram), ram_.begin());
+  mapBanks();
+}
+
+unsigned Cartridge::bankCount(unsigned) const
+{
+  return 1;
+}
+
+void Cartridge::mapRom(unsigned first_page, unsigned page_count, size_t rom_offset)
+{
+  for (unsigned ii = 0; ii < page_count; ++ii)
+  {
+    mapped_pages_[first_page + ii] = rom_->data() + rom_offset + ii * PAGE_SIZE;
+  }
+}
+
+void Cartridge::updatePages()
+{
+  for (unsigned ii = 0; ii < PAGE_COUNT; ++ii)
+  {
+    read_pages_[ii] = ((hotspot_pages_ >> ii) & 1) ? nullptr : mapped_pages_[ii];
+    write_pages_[ii] = nullptr;
+  }
+  if (has_ram_)
+  {
+    // RAM write port at 0x1000-0x107F, and read port at 0x1080-0x10FF. Reading write port
+    // on real hardware writes garbage to RAM, here it just reads RAM.
+    constexpr unsigned RAM_PAGES = 128 / PAGE_SIZE;
+    for (unsigned ii = 0; ii < RAM_PAGES; ++ii)
+    {
+      uint8_t* ram_page = ram_.data() + ii * PAGE_SIZE;
+      mapped_pages_[ii] = ram_page;
+      mapped_pages_[RAM_PAGES + ii] = ram_page;
+      read_pages_[ii] = ram_page;
+      read_pages_[RAM_PAGES + ii] = ram_page;
+      write_pages_[ii] = ram_page;
+    }
+  }
+  publishPages();
+}
+
+void Cartridge::publishPages()
+{
+  if (bus_read_pages_)
+  {
+    std::copy(read_pages_.begin(), read_pages_.end(), bus_read_pages_);
+    std::copy(write_pages_.begin(), write_pages_.end(), bus_write_pages_);
+  }
+}
+
+void Cartridge::attachBus(const uint8_t** read_pages, uint8_t** write_pages)
+{
+  bus_read_pages_ = read_pages;
+  bus_write_pages_ = write_pages;
+  publishPages();
+}
+
+uint8_t Cartridge::readSlow(uint16_t addr)
+{
+  return readHotspot(addr);
+}
+
+void Cartridge::writeSlow(uint16_t addr, uint8_t data)
+{
+  writeHotspot(addr, data);
+}
+
+uint8_t Cartridge::readHotspot(uint16_t addr)
+{
+  return peek(addr);
+}
+
+void Cartridge::writeHotspot(uint16_t, uint8_t)
+{
+  // Writes to ROM are ignored
+}
+
+namespace
+{
+
+// Last page of cartridge space, holds hotspots of Atari and Parker Bros mappers
+constexpr uint64_t LAST_PAGE = uint64_t(1) << (Cartridge::PAGE_COUNT - 1);
+
+/**
+ * 2K or 4K ROM without bank switching
+ */
+class PlainCartridge : public Cartridge
+{
+public:
+  PlainCartridge(std::shared_ptr<const RomImage> rom, Mapper mapper) :
+    Cartridge(std::move(rom), mapper)
+  {
+    reset();
+  }
+
+protected:
+  void mapBanks() override
+  {
+    const unsigned rom_pages = rom_->size() / PAGE_SIZE;
+    for (unsigned first_page = 0; first_page < PAGE_COUNT; first_page += rom_pages)
+    {
+      mapRom(first_page, rom_pages, 0);
+    }
+    updatePages();
+  }
+};
+
+/**
+ * Atari F8/F6/F4, switches whole 4K bank on any access to one of bank_count hotspots
+ */
+class AtariCartridge : public Cartridge
+{
+public:
+  AtariCartridge(std::shared_ptr<const RomImage> rom, Mapper mapper, unsigned first_hotspot, bool has_ram) :
+    Cartridge(std::move(rom), mapper),
+    bank_count_(rom_->size() / 0x1000),
+    first_hotspot_{first_hotspot}
+  {
+    has_ram_ = has_ram;
+    hotspot_pages_ = LAST_PAGE;
+    reset();
+  }
+
+  void reset() override
+  {
+    // Bank at power on is random on real hardware, games have startup code in last bank
+    Cartridge::reset();
+    banks_[0] = bank_count_ - 1;
+    mapBanks();
+  }
+
+protected:
+  const unsigned bank_count_;
+  const unsigned first_hotspot_;
+
+  unsigned bankCount(unsigned segment) const override
+  {
+    return (segment == 0) ? bank_count_ : 1;
+  }
+
+  void mapBanks() override
+  {
+    mapRom(0, PAGE_COUNT, banks_[0] * 0x1000);
+    updatePages();
+  }
+
+  void checkHotspot(uint16_t addr)
+  {
+    const unsigned offset = addr & 0xFFF;
+    if ((offset >= first_hotspot_) and (offset < (first_hotspot_ + bank_count_)))
+    {
+      banks_[0] = offset - first_hotspot_;
+      mapBanks();
+    }
+  }
+
+  uint8_t readHotspot(uint16_t addr) override
+  {
+    checkHotspot(addr);
+    return peek(addr);
+  }
+
+  void writeHotspot(uint16_t addr, uint8_t) override
+  {
+    checkHotspot(addr);
+  }
+};
+
+/**
+ * Parker Bros E0, 1K slices at 0x1000, 0x1400 and 0x1800 selected by access to 0x1FE0-0x1FE7,
+ * 0x1FE8-0x1FEF and 0x1FF0-0x1FF7. Slice at 0x1C00 is always last 1K of ROM.
+ */
+class E0Cartridge : public Cartridge
+{
+public:
+  explicit E0Cartridge(std::shared_ptr<const RomImage> rom) :
+    Cartridge(std::move(rom), Mapper::E0)
+  {
+    hotspot_pages_ = LAST_PAGE;
+    reset();
+  }
+
+  void reset() override
+  {
+    Cartridge::reset();
+    banks_ = {4, 5, 6, 7};
+    mapBanks();
+  }
+
+protected:
+  static constexpr unsigned SLICE_PAGES = 0x400 / PAGE_SIZE;
+
+  // last segment is fixed to slice 7, but holds 7 too
+  unsigned bankCount(unsigned) const override
+  {
+    return 8;
+  }
+
+  void mapBanks() override
+  {
+    for (unsigned segment = 0; segment < 4; ++segment)
+    {
+      const unsigned slice = (segment == 3) ? 7 : (banks_[segment] & 7);
+      mapRom(segment * SLICE_PAGES, SLICE_PAGES, slice * 0x400);
+    }
+    updatePages();
+  }
+
+  void checkHotspot(uint16_t addr)
+  {
+    const unsigned offset = addr & 0xFFF;
+    if ((offset >= 0xFE0) and (offset < 0xFF8))
+    {
+      banks_[(offset - 0xFE0) >> 3] = offset & 7;
+      mapBanks();
+    }
+  }
+
+  uint8_t readHotspot(uint16_t addr) override
+  {
+    checkHotspot(addr);
+    return peek(addr);
+  }
+
+  void writeHotspot(uint16_t addr, uint8_t) override
+  {
+    checkHotspot(addr);
+  }
+};
+
+/**
+ * Activision FE, JSR and RTS with stack pointer at 0xFF access 0x01FE, followed by a fetch from
+ * new PC. Bit 13 of that address (bit 5 of its high byte) selects bank, 0xFxxx is the first 4K
+ * of ROM and 0xDxxx is the second.
+ */
+class FECartridge : public Cartridge
+{
+public:
+  explicit FECartridge(std::shared_ptr<const RomImage> rom) :
+    Cartridge(std::move(rom), Mapper::FE)
+  {
+    watches_low_addresses_ = true;
+    reset();
+  }
+
+  void lowAccess(uint16_t addr, uint8_t, bool) override
+  {
+    if ((addr & 0x1FFF) == 0x01FE)
+    {
+      // Trap next access to cartridge space, wherever it is
+      flags_ = PENDING;
+      mapBanks();
+    }
+  }
+
+protected:
+  static constexpr uint8_t PENDING = 0x1;
+
+  unsigned bankCount(unsigned segment) const override
+  {
+    return (segment == 0) ? 2 : 1;
+  }
+
+  void mapBanks() override
+  {
+    mapRom(0, PAGE_COUNT, (banks_[0] & 1) * 0x1000);
+    hotspot_pages_ = (flags_ & PENDING) ? ~uint64_t(0) : 0;
+    updatePages();
+  }
+
+  void checkSwitch(uint16_t addr)
+  {
+    if (flags_ & PENDING)
+    {
+      banks_[0] = (addr & 0x2000) ? 0 : 1;
+      flags_ = 0;
+      mapBanks();
+    }
+  }
+
+  uint8_t readHotspot(uint16_t addr) override
+  {
+    checkSwitch(addr);
+    return peek(addr);
+  }
+
+  void writeHotspot(uint16_t addr, uint8_t) override
+  {
+    checkSwitch(addr);
+  }
+};
+
+/**
+ * Tigervision 3F, any write to 0x00-0x3F (TIA addresses) selects 2K bank at 0x1000-0x17FF,
+ * 0x1800-0x1FFF is always last 2K of ROM.
+ */
+class TigervisionCartridge : public Cartridge
+{
+public:
+  explicit TigervisionCartridge(std::shared_ptr<const RomImage> rom) :
+    Cartridge(std::move(rom), Mapper::TIGERVISION_3F),
+    bank_count_(rom_->size() / 0x800)
+  {
+    watches_low_addresses_ = true;
+    reset();
+  }
+
+  void lowAccess(uint16_t addr, uint8_t data, bool write) override
+  {
+    if (write and ((addr & 0x1FFF) < 0x40))
+    {
+      banks_[0] = data % bank_count_;
+      mapBanks();
+    }
+  }
+
+protected:
+  const unsigned bank_count_;
+  static constexpr unsigned BANK_PAGES = 0x800 / PAGE_SIZE;
+
+  unsigned bankCount(unsigned segment) const override
+  {
+    return (segment == 0) ? bank_count_ : 1;
+  }
+
+  void mapBanks() override
+  {
+    mapRom(0, BANK_PAGES, banks_[0] * 0x800);
+    mapRom(BANK_PAGES, BANK_PAGES, rom_->size() - 0x800);
+    updatePages();
+  }
+};
+
+// Number of places any of patterns appears in ROM
+size_t countPatterns(const RomImage& rom, std::initializer_list<std::vector<uint8_t>> patterns)
+{
+  const uint8_t* begin = rom.data();
+  const uint8_t* end = begin + rom.size();
+  size_t count = 0;
+  for (const std::vector<uint8_t>& pattern : patterns)
+  {
+    for (const uint8_t* it = begin;; ++it)
+    {
+      it = std::search(it, end, pattern.begin(), pattern.end());
+      if (it == end)
+      {
+        break;
+      }
+      ++count;
+    }
+  }
+  return count;
+}
+
+// Writes to 0x3F select bank, more than one "STA $3F" is a good sign ROM is Tigervision
+bool isProbably3F(const RomImage& rom)
+{
+  return countPatterns(rom, {{0x85, 0x3F}}) >= 2;
+}
+
+// Signatures from Stella's CartDetector
+bool isProbablyE0(const RomImage& rom)
+{
+  return countPatterns(rom, {
+      {0x8D, 0xE0, 0x1F},  // STA $1FE0
+      {0x8D, 0xE0, 0x5F},  // STA $5FE0
+      {0x8D, 0xE9, 0xFF},  // STA $FFE9
+      {0x0C, 0xE0, 0x1F},  // NOP $1FE0
+      {0xAD, 0xE0, 0x1F},  // LDA $1FE0
+      {0xAD, 0xE9, 0xFF},  // LDA $FFE9
+      {0xAD, 0xED, 0xFF},  // LDA $FFED
+      {0xAD, 0xF3, 0xBF}   // LDA $BFF3
+    }) > 0;
+}
+
+bool isProbablyFE(const RomImage& rom)
+{
+  return countPatterns(rom, {
+      {0x20, 0x00, 0xD0, 0xC6, 0xC5},  // JSR $D000; DEC $C5
+      {0x20, 0xC3, 0xF8, 0xA5, 0x82},  // JSR $F8C3; LDA $82
+      {0xD0, 0xFB, 0x20, 0x73, 0xFE},  // BNE $FB; JSR $FE73
+      {0x20, 0x00, 0xF0, 0x84, 0xD6}   // JSR $F000; STY $D6
+    }) > 0;
+}
+
+// Superchip RAM hides first 256 bytes of each bank, which are filled with a repeated 128 byte pattern
+bool isProbablySuperchip(const RomImage& rom)
+{
+  for (size_t offset = 0; offset < rom.size(); offset += 0x1000)
+  {
+    if (std::memcmp(rom.data() + offset, rom.data() + offset + 128, 128) != 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t mapperRomSize(Cartridge::Mapper mapper)
+{
+  using Mapper = Cartridge::Mapper;
+  switch (mapper)
+  {
+    case Mapper::ROM_2K:
+      return 0x800;
+    case Mapper::ROM_4K:
+      return 0x1000;
+    case Mapper::F8:
+    case Mapper::F8SC:
+    case Mapper::E0:
+    case Mapper::FE:
+      return 0x2000;
+    case Mapper::F6:
+    case Mapper::F6SC:
+      return 0x4000;
+    case Mapper::F4:
+    case Mapper::F4SC:
+      return 0x8000;
+    default:
+      // 3F is any multiple of 2K, AUTO is resolved before size is checked
+      return 0;
+  }
+}
+
+}  // namespace
+
+Cartridge::Mapper Cartridge::detect(const RomImage& rom)
+{
+  switch (rom.size())
+  {
+    case 0x800:
+      return Mapper::ROM_2K;
+    case 0x1000:
+      return Mapper::ROM_4K;
+    case 0x2000:
+      if (isProbablyE0(rom))
+      {
+        return Mapper::E0;
+      }
+      if (isProbably3F(rom))
+      {
+        return Mapper::TIGERVISION_3F;
+      }
+      if (isProbablyFE(rom))
+      {
+        return Mapper::FE;
+      }
+      return isProbablySuperchip(rom) ? Mapper::F8SC : Mapper::F8;
+    case 0x4000:
+      if (isProbably3F(rom))
+      {
+        return Mapper::TIGERVISION_3F;
+      }
+      return isProbablySuperchip(rom) ? Mapper::F6SC : Mapper::F6;
+    case 0x8000:
+      if (isProbably3F(rom))
+      {
+        return Mapper::TIGERVISION_3F;
+      }
+      return isProbablySuperchip(rom) ? Mapper::F4SC : Mapper::F4;
+    case 0x10000:
+      if (isProbably3F(rom))
+      {
+        return Mapper::TIGERVISION_3F;
+      }
+      break;
+    default:
+      break;
+  }
+  throw std::runtime_error("No supported cartridge mapper for " + std::to_string(rom.size()) + " byte ROM");
+}
+
+const char* Cartridge::mapperName(Mapper mapper)
+{
+  switch (mapper)
+  {
+    case Mapper::AUTO:
+      return "AUTO";
+    case Mapper::ROM_2K:
+      return "2K";
+    case Mapper::ROM_4K:
+      return "4K";
+    case Mapper::F8:
+      return "F8";
+    case Mapper::F6:
+      return "F6";
+    case Mapper::F4:
+      return "F4";
+    case Mapper::F8SC:
+      return "F8SC";
+    case Mapper::F6SC:
+      return "F6SC";
+    case Mapper::F4SC:
+      return "F4SC";
+    case Mapper::E0:
+      return "E0";
+    case Mapper::FE:
+      return "FE";
+    case Mapper::TIGERVISION_3F:
+      return "3F";
+  }
+  return "?";
+}
+
+std::unique_ptr<Cartridge> Cartridge::create(std::shared_ptr<const RomImage> rom, Mapper mapper)
+{
+  if (!rom)
+  {
+    throw std::runtime_error("No ROM image for cartridge");
+  }
+  if (mapper == Mapper::AUTO)
+  {
+    mapper = detect(*rom);
+  }
+
+  const size_t expected_size = mapperRomSize(mapper);
+  const bool size_ok = expected_size ? (rom->size() == expected_size)
+                                     : ((rom->size() >= 0x1000) and (rom->size() % 0x800 == 0));
+  if (!size_ok)
+  {
+    throw std::runtime_error(std::string(mapperName(mapper)) + " cartridge can't use " +
+                             std::to_string(rom->size()) + " byte ROM");
+  }
+
+  switch (mapper)
+  {
+    case Mapper::F8:
+    case Mapper::F8SC:
+      return std::make_unique<AtariCartridge>(std::move(rom), mapper, 0xFF8, mapper == Mapper::F8SC);
+    case Mapper::F6:
+    case Mapper::F6SC:
+      return std::make_unique<AtariCartridge>(std::move(rom), mapper, 0xFF6, mapper == Mapper::F6SC);
+    case Mapper::F4:
+    case Mapper::F4SC:
+      return std::make_unique<AtariCartridge>(std::move(rom), mapper, 0xFF4, mapper == Mapper::F4SC);
+    case Mapper::E0:
+      return std::make_unique<E0Cartridge>(std::move(rom));
+    case Mapper::FE:
+      return std::make_unique<FECartridge>(std::move(rom));
+    case Mapper::TIGERVISION_3F:
+      return std::make_unique<TigervisionCartridge>(std::move(rom));
+    default:
+      return std::make_unique<PlainCartridge>(std::move(rom), mapper);
+  }
+}
@@ -0,0 +1,201 @@
+#ifndef ATARI2600_CARTRIDGE_HPP_GUARD
+#define ATARI2600_CARTRIDGE_HPP_GUARD
+
+#include <array>
+#include <cstdint>
+#include <memory>
+
+#include "rom.hpp"
+
+/**
+ * Fixed layout snapshot of cartridge bank switching state and RAM, see Cartridge::saveState
+ */
+struct CartridgeState
+{
+  // bank (or slice) selected for each switchable segment
+  uint8_t banks[4];
+  // mapper specific flags, like FE waiting for access after 0x01FE
+  uint8_t flags;
+  // Cartridge::Mapper state was saved with
+  uint8_t mapper;
+  uint8_t reserved[2];
+  // Superchip RAM
+  uint8_t ram[128];
+};
+
+/**
+ * Cartridge mapper, decodes accesses to 0x1000-0x1FFF (and mirrors) into ROM banks and cartridge RAM
+ * http://blog.kevtris.org/blogfiles/Atari%202600%20Mappers.txt
+ *
+ * Cartridge space is divided into PAGE_COUNT pages, each with a host pointer to the bytes
+ * currently mapped there. Bank switching only updates pointers, so an access to a page
+ * is a single indexed load. Pages holding bank switching hotspots have a nullptr entry
+ * and go through the mapper's virtual functions instead.
+ */
+class Cartridge
+{
+public:
+  enum class Mapper : uint8_t
+  {
+    AUTO,
+    // 2K, mirrored twice
+    ROM_2K,
+    ROM_4K,
+    // Atari 8K, 16K and 32K, bank selected by access to 0x1FF8-0x1FF9, 0x1FF6-0x1FF9 or 0x1FF4-0x1FFB
+    F8,
+    F6,
+    F4,
+    // With 128 bytes of Superchip RAM, written at 0x1000-0x107F, read at 0x1080-0x10FF
+    F8SC,
+    F6SC,
+    F4SC,
+    // Parker Bros 8K, three switchable 1K slices selected by access to 0x1FE0-0x1FF7, last 1K is fixed
+    E0,
+    // Activision 8K, bank selected by high byte of address following a stack access at 0x01FE
+    FE,
+    // Tigervision, 2K bank at 0x1000-0x17FF selected by write to 0x00-0x3F, last 2K is fixed
+    TIGERVISION_3F
+  };
+
+  static constexpr unsigned PAGE_BITS = 6;
+  static constexpr unsigned PAGE_SIZE = 1 << PAGE_BITS;
+  static constexpr unsigned PAGE_COUNT = 0x1000 / PAGE_SIZE;
+
+  /**
+   * @brief mapper for ROM, mapper is detected from ROM size and contents if it is AUTO
+   * Throws std::runtime_error if ROM size doesn't match mapper, or no supported mapper fits
+   */
+  static std::unique_ptr<Cartridge> create(std::shared_ptr<const RomImage> rom, Mapper mapper = Mapper::AUTO);
+
+  /**
+   * @brief guess mapper from ROM size, and instructions that access hotspots
+   * Throws std::runtime_error if no supported mapper has ROM's size
+   */
+  static Mapper detect(const RomImage& rom);
+
+  static const char* mapperName(Mapper mapper);
+
+  virtual ~Cartridge() = default;
+
+  Cartridge(const Cartridge&) = delete;
+  Cartridge& operator=(const Cartridge&) = delete;
+
+  Mapper mapper() const
+  {
+    return mapper_;
+  }
+
+  const std::shared_ptr<const RomImage>& romImage() const
+  {
+    return rom_;
+  }
+
+  // Set when mapper needs lowAccess() to be called for accesses with A12 = 0
+  bool watches_low_addresses_ = false;
+
+  uint8_t read(uint16_t addr)
+  {
+    const uint8_t* page = read_pages_[(addr >> PAGE_BITS) & (PAGE_COUNT - 1)];
+    if (page)
+    {
+      return page[addr & (PAGE_SIZE - 1)];
+    }
+    return readSlow(addr);
+  }
+
+  void write(uint16_t addr, uint8_t data)
+  {
+    uint8_t* page = write_pages_[(addr >> PAGE_BITS) & (PAGE_COUNT - 1)];
+    if (page)
+    {
+      page[addr & (PAGE_SIZE - 1)] = data;
+      return;
+    }
+    writeSlow(addr, data);
+  }
+
+  /**
+   * @brief value read from addr, without switching banks
+   */
+  uint8_t peek(uint16_t addr) const
+  {
+    return mapped_pages_[(addr >> PAGE_BITS) & (PAGE_COUNT - 1)][addr & (PAGE_SIZE - 1)];
+  }
+
+  /**
+   * @brief host pointer to page holding addr, or nullptr if reading page can switch banks
+   */
+  const uint8_t* readPage(uint16_t addr) const
+  {
+    return read_pages_[(addr >> PAGE_BITS) & (PAGE_COUNT - 1)];
+  }
+
+  /**
+   * @brief keep copy of page tables in bus's tables, which have PAGE_COUNT entries for cartridge space
+   * Entries are updated whenever banks switch, until another bus is attached
+   */
+  void attachBus(const uint8_t** read_pages, uint8_t** write_pages);
+
+  /**
+   * @brief called for TIA and RIOT accesses, only when watches_low_addresses_ is set
+   */
+  virtual void lowAccess(uint16_t addr, uint8_t data, bool write);
+
+  // Bank switching state and cartridge RAM after power on
+  virtual void reset();
+
+  void saveState(CartridgeState& state) const;
+
+  /**
+   * @brief restore state from saveState, throws std::runtime_error if it was saved with another mapper,
+   * or selects a bank that ROM doesn't have
+   */
+  void loadState(const CartridgeState& state);
+
+protected:
+  Cartridge(std::shared_ptr<const RomImage> rom, Mapper mapper);
+
+  std::shared_ptr<const RomImage> rom_;
+  Mapper mapper_;
+
+  // selected bank of each segment, meaning is up to mapper
+  std::array<uint8_t, 4> banks_ = {};
+  uint8_t flags_ = 0;
+
+  bool has_ram_ = false;
+  std::array<uint8_t, 128> ram_ = {};
+
+  // Bytes mapped at each page, and pages that switch banks when accessed
+  std::array<const uint8_t*, PAGE_COUNT> mapped_pages_ = {};
+  uint64_t hotspot_pages_ = 0;
+
+  // mapped_pages_ with hotspot pages set to nullptr, and RAM write port
+  std::array<const uint8_t*, PAGE_COUNT> read_pages_ = {};
+  std::array<uint8_t*, PAGE_COUNT> write_pages_ = {};
+
+  // Bus tables that read_pages_ and write_pages_ are copied to
+  const uint8_t** bus_read_pages_ = nullptr;
+  uint8_t** bus_write_pages_ = nullptr;
+
+  // number of values banks_[segment] can have, segments mapper doesn't use are always 0
+  virtual unsigned bankCount(unsigned segment) const;
+
+  // map page_count pages starting at first_page to ROM starting at rom_offset
+  void mapRom(unsigned first_page, unsigned page_count, size_t rom_offset);
+
+  // Out of line calls of readHotspot and writeHotspot, so inlined read and write stay small
+  uint8_t readSlow(uint16_t addr);
+  void writeSlow(uint16_t addr, uint8_t data);
+
+  // update page tables from banks_
+  virtual void mapBanks() = 0;
+
+  // Rebuild read_pages_ and write_pages_ (and bus copies) after mapped_pages_ or hotspot_pages_ changed
+  void updatePages();
+  void publishPages();
+
+  virtual uint8_t readHotspot(uint16_t addr);
+  virtual void writeHotspot(uint16_t addr, uint8_t data);
+};
+
+#endif  // ATARI2600_CARTRIDGE_HPP_GUARD
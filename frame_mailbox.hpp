@@ -0,0 +1,71 @@
+#ifndef ATARI2600_FRAME_MAILBOX_HPP_GUARD
+#define ATARI2600_FRAME_MAILBOX_HPP_GUARD
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Lock-free triple buffer, for one producer (the emulation thread) publishing frames
+ * and one consumer (the render thread) that always wants the newest one
+ *
+ * Producer fills back() and publish()es it, consumer calls update() and reads front().
+ * Buffers are swapped rather than copied, and neither side ever waits for the other:
+ * producer always has a buffer consumer isn't reading, and frames consumer didn't get
+ * to before a newer one was published are dropped.
+ */
+template<typename T>
+class FrameMailbox
+{
+public:
+  FrameMailbox() = default;
+
+  FrameMailbox(const FrameMailbox&) = delete;
+  FrameMailbox& operator=(const FrameMailbox&) = delete;
+
+  // Producer side, buffer to fill with next frame, holds whatever frame was last swapped into it
+  T& back()
+  {
+    return buffers_[back_];
+  }
+
+  // Producer side, make back() available to consumer, and get another buffer to fill
+  void publish()
+  {
+    back_ = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+  }
+
+  /**
+   * Consumer side, returns true if a frame was published since last update, and front() is now that frame
+   * front() stays same until next update, producer never touches it.
+   */
+  bool update()
+  {
+    if (!(middle_.load(std::memory_order_relaxed) & FRESH))
+    {
+      return false;
+    }
+    front_ = middle_.exchange(front_, std::memory_order_acq_rel) & INDEX_MASK;
+    return true;
+  }
+
+  // Consumer side, newest frame as of last update()
+  const T& front() const
+  {
+    return buffers_[front_];
+  }
+
+protected:
+  // middle_ holds index of buffer that is neither producer's nor consumer's, and if it was published
+  static constexpr uint8_t INDEX_MASK = 0x3;
+  static constexpr uint8_t FRESH = 0x4;
+
+  std::array<T, 3> buffers_ = {};
+
+  // producer's and consumer's indices are on separate cache lines so they don't contend
+  alignas(64) uint8_t back_ = 0;
+  alignas(64) std::atomic<uint8_t> middle_{1};
+  alignas(64) uint8_t front_ = 2;
+};
+
+#endif  // ATARI2600_FRAME_MAILBOX_HPP_GUARD
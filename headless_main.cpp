@@ -0,0 +1,290 @@
+// Headless runner, executes a ROM for a number of frames without any display
+// Useful for throughput measurements and regression runs on machines without GLUT/OpenGL
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <string>
+
+#include "atari2600.hpp"
+#include "rewind.hpp"
+
+namespace
+{
+
+void usage(std::ostream& os, const char* prog)
+{
+  os << "Usage: " << prog << " [options] <romfile>\n"
+     << "  -n, --frames N        number of frames to run (default 60)\n"
+     << "  -p, --palette FILE    color palette (default palette/REALNTSC.pal)\n"
+     << "  -d, --dump-frame N    write frame N to a file, can be repeated\n"
+     << "  -f, --format FMT      frame file format, ppm or rgba (default ppm)\n"
+     << "  -o, --output PREFIX   frame filename prefix (default frame)\n"
+     << "  -t, --trace           print trace events to stderr (needs ATARI2600_TRACE build)\n"
+     << "  -r, --rewind N        record frames, then step back N frames before printing state\n"
+     << "  -e, --exec-mode MODE  fetch, decoded, threaded or jit (default decoded)\n"
+     << "  -s, --skip-render     only draw frames that are dumped\n"
+     << "  -h, --help            show this message\n";
+}
+
+bool writeFrame(const Tia& tia, const std::string& fn, bool ppm)
+{
+  std::ofstream output(fn, std::ofstream::binary);
+  if (!output.good())
+  {
+    return false;
+  }
+
+  if (ppm)
+  {
+    output << "P6\n" << Tia::DISPLAY_WIDTH << " " << Tia::DISPLAY_HEIGHT << "\n255\n";
+    for (const RGBA& rgba : tia.display_)
+    {
+      const char rgb[3] = {
+        static_cast<char>(rgba.r),
+        static_cast<char>(rgba.g),
+        static_cast<char>(rgba.b)
+      };
+      output.write(rgb, sizeof(rgb));
+    }
+  }
+  else
+  {
+    output.write(reinterpret_cast<const char*>(tia.display_.data()), tia.display_.size() * sizeof(RGBA));
+  }
+  return output.good();
+}
+
+void outputRam(std::ostream& os, const Atari2600& atari)
+{
+  const auto& ram = atari.riot_.ram_;
+  for (unsigned idx = 0; idx < ram.size(); idx += 8)
+  {
+    char line[64];
+    const uint8_t* row = &ram[idx];
+    const unsigned addr = idx + 0x80;  // RAM starts at 0x80
+    std::snprintf(line, sizeof(line), "  %02X : %02X %02X %02X %02X  %02X %02X %02X %02X",
+                  addr, row[0], row[1], row[2], row[3], row[4], row[5], row[6], row[7]);
+    os << line << std::endl;
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  unsigned frame_limit = 60;
+  std::string palette_fn = "palette/REALNTSC.pal";
+  std::string rom_fn;
+  std::string output_prefix = "frame";
+  std::set<unsigned> dump_frames;
+  bool ppm = true;
+  bool trace = false;
+  bool skip_render = false;
+  bool rewind_frames_set = false;
+  unsigned rewind_frames = 0;
+  Atari2600::ExecMode exec_mode = Atari2600::ExecMode::DECODED;
+
+  for (int ii = 1; ii < argc; ++ii)
+  {
+    std::string arg = argv[ii];
+    bool has_value = (ii + 1) < argc;
+    try
+    {
+      if ((arg == "-h") or (arg == "--help"))
+      {
+        usage(std::cout, argv[0]);
+        return 0;
+      }
+      else if (((arg == "-n") or (arg == "--frames")) and has_value)
+      {
+        frame_limit = std::stoul(argv[++ii]);
+      }
+      else if (((arg == "-p") or (arg == "--palette")) and has_value)
+      {
+        palette_fn = argv[++ii];
+      }
+      else if (((arg == "-d") or (arg == "--dump-frame")) and has_value)
+      {
+        dump_frames.insert(std::stoul(argv[++ii]));
+      }
+      else if (((arg == "-f") or (arg == "--format")) and has_value)
+      {
+        std::string format = argv[++ii];
+        if ((format != "ppm") and (format != "rgba"))
+        {
+          std::cerr << "Unknown frame format " << format << std::endl;
+          return 1;
+        }
+        ppm = (format == "ppm");
+      }
+      else if (((arg == "-o") or (arg == "--output")) and has_value)
+      {
+        output_prefix = argv[++ii];
+      }
+      else if ((arg == "-t") or (arg == "--trace"))
+      {
+        trace = true;
+        if (!TRACE_ENABLED)
+        {
+          std::cerr << "Tracing is not compiled in, rebuild with -DATARI2600_TRACE=ON" << std::endl;
+        }
+      }
+      else if (((arg == "-r") or (arg == "--rewind")) and has_value)
+      {
+        rewind_frames = std::stoul(argv[++ii]);
+        rewind_frames_set = true;
+      }
+      else if (((arg == "-e") or (arg == "--exec-mode")) and has_value)
+      {
+        std::string mode = argv[++ii];
+        using ExecMode = Atari2600::ExecMode;
+        bool found = false;
+        for (ExecMode candidate : {ExecMode::FETCH, ExecMode::DECODED, ExecMode::THREADED, ExecMode::JIT})
+        {
+          if (mode == Atari2600::execModeName(candidate))
+          {
+            exec_mode = candidate;
+            found = true;
+          }
+        }
+        if (!found)
+        {
+          std::cerr << "Unknown exec mode " << mode << std::endl;
+          return 1;
+        }
+      }
+      else if ((arg == "-s") or (arg == "--skip-render"))
+      {
+        skip_render = true;
+      }
+      else if ((arg.size() > 1) and (arg[0] == '-'))
+      {
+        std::cerr << "Unknown or incomplete option " << arg << std::endl;
+        usage(std::cerr, argv[0]);
+        return 1;
+      }
+      else
+      {
+        rom_fn = arg;
+      }
+    }
+    catch (const std::exception& ex)
+    {
+      std::cerr << "Invalid value for " << arg << " : " << ex.what() << std::endl;
+      return 1;
+    }
+  }
+
+  if (rom_fn.empty())
+  {
+    std::cerr << "Specify ROM filename" << std::endl;
+    usage(std::cerr, argv[0]);
+    return 1;
+  }
+
+  Atari2600 atari;
+  atari.exec_mode_ = exec_mode;
+
+  try
+  {
+    atari.loadRom(RomImage::mapFile(rom_fn));
+  }
+  catch (const std::exception& ex)
+  {
+    std::cerr << ex.what() << std::endl;
+    return 1;
+  }
+
+  std::ifstream palette_input(palette_fn, std::ifstream::binary);
+  if (!palette_input.good())
+  {
+    std::cerr << "Palette could not be openned" << std::endl;
+    return 1;
+  }
+  atari.tia_.loadPalette(palette_input);
+
+  RewindBuffer rewind;
+  unsigned instruction_count = 0;
+  auto start_time = std::chrono::steady_clock::now();
+  try
+  {
+    while (atari.tia_.frame_count_ < frame_limit)
+    {
+      // frame that will be complete after this run is next one
+      atari.setRendering(!skip_render or dump_frames.count(atari.tia_.frame_count_ + 1));
+      Atari2600::RunStatus status = atari.runFrame();
+      instruction_count += status.instructions;
+      if (trace)
+      {
+        atari.trace_.drain([](const TraceEvent& event) { std::cerr << event << '\n'; });
+      }
+      if (!status.frame_complete)
+      {
+        std::cerr << "Frame did not complete after " << status.cycles << " cycles" << std::endl;
+        return 1;
+      }
+      if (rewind_frames_set)
+      {
+        rewind.push(atari);
+      }
+
+      // Display still has completed frame right after VSYNC starts
+      if (dump_frames.count(atari.tia_.frame_count_))
+      {
+        std::string fn = output_prefix + "_" + std::to_string(atari.tia_.frame_count_) + (ppm ? ".ppm" : ".rgba");
+        if (!writeFrame(atari.tia_, fn, ppm))
+        {
+          std::cerr << "Could not write frame to " << fn << std::endl;
+          return 1;
+        }
+      }
+    }
+  }
+  catch (const std::exception& ex)
+  {
+    std::cerr << "Emulation stopped : " << ex.what() << std::endl;
+    return 1;
+  }
+  auto stop_time = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(stop_time - start_time).count();
+
+  if (rewind_frames_set and !rewind.empty())
+  {
+    // can't go back further than oldest recorded frame
+    unsigned frame = atari.tia_.frame_count_ - std::min(rewind_frames, atari.tia_.frame_count_);
+    frame = std::max(frame, rewind.oldestFrame());
+    rewind.seek(frame, atari);
+    std::cout << "Rewound to frame " << frame << ", rewind buffer holds " << rewind.size() << " frames in "
+              << rewind.usedBytes() << " bytes" << std::endl;
+  }
+
+  std::cout << "CPU" << std::endl;
+  atari.cpu_.outputRegs(std::cout);
+  std::cout << "RAM" << std::endl;
+  outputRam(std::cout, atari);
+
+  if (trace and atari.trace_.dropped())
+  {
+    std::cerr << "Trace buffer full, dropped " << atari.trace_.dropped() << " events" << std::endl;
+  }
+
+  std::cout << std::dec << std::setfill(' ');
+  std::cout << "Cartridge " << Cartridge::mapperName(atari.cartridge_->mapper())
+            << " ROM " << atari.cartridge_->romImage()->size() << " bytes" << std::endl;
+  std::cout << "Frames " << atari.tia_.frame_count_
+            << " instructions " << instruction_count
+            << " cycles " << atari.cpu_.instr_cycle_count_
+            << " (" << atari.skipped_cycles_ << " skipped in idle loops)"
+            << " in " << seconds << " s" << std::endl;
+  if (seconds > 0.0)
+  {
+    std::cout << "Emulated frames/s " << (atari.tia_.frame_count_ / seconds)
+              << " instructions/s " << (instruction_count / seconds) << std::endl;
+  }
+  return 0;
+}
@@ -28,25 +28,188 @@
 #include <GL/freeglut.h>
 #endif
 
-#include <GL/glu.h>
-
 #ifdef _MSC_VER
 #pragma warning(disable : 4505) // unreferenced local function has been removed
 #endif
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <iomanip>
+#include <limits>
+#include <mutex>
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <thread>
 
 #include "atari2600.hpp"
+#include "frame_mailbox.hpp"
+#include "rewind.hpp"
 
 // Forward declarations of helper functions
 void MainLoopStep();
 
 #include "misc/cpp/imgui_stdlib.h"
 
+// Emulated by EmulationThread, only touch it while holding its mutex_
 Atari2600 atari;
+// Debugger windows draw from this copy of state of last frame emulation thread published
+Atari2600 snapshot;
+
+// What emulation thread publishes after each frame
+struct EmulatorFrame
+{
+  // palette indices, expanded to RGBA by render thread when it is uploaded
+  std::vector<uint8_t> display;
+  Atari2600State state;
+  unsigned frame_count = 0;
+  // when frame's VSYNC started (or when it was stepped to), for measuring latency until it is on screen
+  std::chrono::steady_clock::time_point vsync_time;
+  // rewind history when frame was published, so rewind window doesn't need emulator mutex to draw
+  bool recording = false;
+  bool rewind_empty = true;
+  unsigned rewind_oldest = 0;
+  unsigned rewind_newest = 0;
+  size_t rewind_bytes = 0;
+};
+
+/**
+ * Runs emulator on its own thread, at NTSC frame rate or as fast as it can,
+ * and publishes each frame to render thread through a triple buffered mailbox
+ *
+ * Everything that changes emulator (stepping, breakpoints, rewind) goes through apply(),
+ * which holds mutex_ while emulator is changed and publishes result, so there is only
+ * ever one producer for mailbox_.
+ */
+class EmulationThread
+{
+public:
+  // NTSC frame rate is 60 / 1.001 Hz
+  static constexpr std::chrono::nanoseconds FRAME_PERIOD{16683333};
+
+  Atari2600& atari_;
+  std::mutex mutex_;
+  FrameMailbox<EmulatorFrame> mailbox_;
+
+  std::atomic<bool> running_{true};
+  // run frames back to back instead of at NTSC frame rate
+  std::atomic<bool> free_running_{false};
+  std::atomic<bool> quit_{false};
+  std::thread thread_;
+
+  // Rewind history is recorded as frames are published, only touch it while holding mutex_
+  bool record_ = true;
+  RewindBuffer rewind_;
+  // frame_count_ that was last recorded (or seeked to), so each frame is only recorded once
+  unsigned recorded_frame_ = std::numeric_limits<unsigned>::max();
+
+  explicit EmulationThread(Atari2600& atari) :
+    atari_(atari)
+  {
+  }
+
+  void start()
+  {
+    apply([](Atari2600&) {});
+    thread_ = std::thread([this] { run(); });
+  }
+
+  void stop()
+  {
+    quit_ = true;
+    if (thread_.joinable())
+    {
+      thread_.join();
+    }
+  }
+
+  // run func on emulator while it is not running, then publish frame it left
+  template<typename FUNC>
+  void apply(FUNC func)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    func(atari_);
+    publish();
+  }
+
+  // copy display and state into mailbox, mutex_ must be held
+  void publish()
+  {
+    if (record_ and (atari_.tia_.frame_count_ != recorded_frame_))
+    {
+      rewind_.push(atari_);
+      recorded_frame_ = atari_.tia_.frame_count_;
+    }
+
+    // When stepped (or stopped at a breakpoint) part way through a frame, show frame being drawn up to beam
+    // over last complete one, so each step shows what it drew. Drawing pending pixels now doesn't change
+    // how emulation runs, TIA does the same whenever a register is written.
+    Tia& tia = atari_.tia_;
+    tia.syncPixels();
+    size_t drawn = 0;
+    if (!tia.vertical_sync_)
+    {
+      drawn = (tia.scan_y_ >= Tia::DISPLAY_HEIGHT) ? tia.back_indexed_display_.size() :
+        (tia.scan_y_ * Tia::DISPLAY_WIDTH + std::clamp(Tia::scanToDisplayX(tia.scan_x_ + 1), 0, Tia::DISPLAY_WIDTH));
+    }
+
+    EmulatorFrame& frame = mailbox_.back();
+    frame.display.assign(tia.back_indexed_display_.begin(), tia.back_indexed_display_.begin() + drawn);
+    frame.display.insert(frame.display.end(), tia.indexed_display_.begin() + drawn, tia.indexed_display_.end());
+    atari_.saveState(frame.state);
+    frame.frame_count = atari_.tia_.frame_count_;
+    frame.vsync_time = std::chrono::steady_clock::now();
+    frame.recording = record_;
+    frame.rewind_empty = rewind_.empty();
+    frame.rewind_oldest = frame.rewind_empty ? 0 : rewind_.oldestFrame();
+    frame.rewind_newest = frame.rewind_empty ? 0 : rewind_.newestFrame();
+    frame.rewind_bytes = rewind_.usedBytes();
+    mailbox_.publish();
+  }
+
+protected:
+  void run()
+  {
+    auto next_frame_time = std::chrono::steady_clock::now();
+    while (!quit_)
+    {
+      if (!running_)
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        next_frame_time = std::chrono::steady_clock::now();
+        continue;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (atari_.runFrame().breakpoint_hit)
+        {
+          running_ = false;
+        }
+        publish();
+      }
+
+      if (free_running_)
+      {
+        next_frame_time = std::chrono::steady_clock::now();
+        continue;
+      }
+      next_frame_time += FRAME_PERIOD;
+      const auto now = std::chrono::steady_clock::now();
+      if (next_frame_time < now)
+      {
+        // Fell behind (or was held up by debugger), don't run extra frames to catch up
+        next_frame_time = now;
+      }
+      std::this_thread::sleep_until(next_frame_time);
+    }
+  }
+};
+
+EmulationThread emulation(atari);
 
 int main(int argc, char **argv)
 {
@@ -68,13 +231,16 @@ int main(int argc, char **argv)
   std::string rom_fn = argv[1];
   std::cout << "Loading ROM " << rom_fn << std::endl;
   // Load rom
-  std::ifstream rom_input(rom_fn, std::ifstream::binary);
-  if (!rom_input.good())
+  try
   {
-    std::cerr << "ROM could not be openned" << std::endl;
+    atari.loadRom(RomImage::mapFile(rom_fn));
+    std::cout << "Cartridge mapper " << Cartridge::mapperName(atari.cartridge_->mapper()) << std::endl;
+  }
+  catch (const std::exception& ex)
+  {
+    std::cerr << ex.what() << std::endl;
     return 1;
   }
-  atari.loadRom(rom_input);
 
   std::string palette_fn = "palette/REALNTSC.pal";
   std::cout << "Loading color palette " << palette_fn << std::endl;
@@ -86,6 +252,9 @@ int main(int argc, char **argv)
     return 1;
   }
   atari.tia_.loadPalette(palette_input);
+  atari.tia_.indexed_output_ = true;
+  snapshot.loadRom(atari.cartridge_->romImage(), atari.cartridge_->mapper());
+  snapshot.tia_.palette_ = atari.tia_.palette_;
 
   // Setup GLUT display function
   // We will also call ImGui_ImplGLUT_InstallFuncs() to get all the other functions installed for us,
@@ -132,9 +301,11 @@ int main(int argc, char **argv)
   // IM_ASSERT(font != nullptr);
 
   // Main loop
+  emulation.start();
   glutMainLoop();
 
   // Cleanup
+  emulation.stop();
   ImGui_ImplOpenGL2_Shutdown();
   ImGui_ImplGLUT_Shutdown();
   ImGui::DestroyContext();
@@ -154,7 +325,7 @@ public:
 
   std::ostringstream ss_;
 
-  void draw(Atari2600 &atari)
+  void draw(const Atari2600 &snapshot)
   {
     if (!show_)
     {
@@ -162,7 +333,7 @@ public:
     }
 
     ImGui::Begin("RAM", &show_);
-    const auto &ram = atari.ram_;
+    const auto &ram = snapshot.riot_.ram_;
     for (unsigned idx = 0; idx < ram.size(); idx += 8)
     {
       const uint8_t *row = &ram[idx];
@@ -188,9 +359,9 @@ public:
     return ss_.str();
   }
 
-  void draw(Atari2600 &atari)
+  void draw(const Atari2600 &snapshot, EmulationThread &emulation)
   {
-    Mos6502 &cpu = atari.cpu_;
+    const auto &cpu = snapshot.cpu_;
 
     if (!show_)
     {
@@ -199,22 +370,32 @@ public:
 
     ImGui::Begin("6502", &show_); // Pass a pointer to our bool variable (the window will have a closing button that will clear the bool when clicked)
 
-    if (ImGui::Button("Step"))
-    {
-      atari.execInstructions(1);
-    }
-    if (ImGui::Button("Step 10"))
+    bool running = emulation.running_;
+    if (ImGui::Checkbox("Run", &running))
     {
-      atari.execInstructions(10);
+      emulation.running_ = running;
     }
-    if (ImGui::Button("Step 100"))
+    ImGui::SameLine();
+    bool free_running = emulation.free_running_;
+    if (ImGui::Checkbox("Free Run", &free_running))
     {
-      atari.execInstructions(100);
+      emulation.free_running_ = free_running;
     }
-    if (ImGui::Button("Step 1000"))
+
+    auto step_button = [&emulation](const char* label, auto step)
     {
-      atari.execInstructions(1000);
-    }
+      if (ImGui::Button(label))
+      {
+        emulation.running_ = false;
+        emulation.apply(step);
+      }
+    };
+    step_button("Step", [](Atari2600& atari) { atari.execInstructions(1); });
+    step_button("Step 10", [](Atari2600& atari) { atari.execInstructions(10); });
+    step_button("Step 100", [](Atari2600& atari) { atari.execInstructions(100); });
+    step_button("Step 1000", [](Atari2600& atari) { atari.execInstructions(1000); });
+    step_button("Step Line", [](Atari2600& atari) { atari.runScanlines(1); });
+    step_button("Step Frame", [](Atari2600& atari) { atari.runFrame(); });
 
     {
       std::string break_str;
@@ -224,8 +405,11 @@ public:
         {
           int breakpoint = stoi(break_str, nullptr, 16);
           std::cerr << "setting breakpoint at " << std::hex << breakpoint << std::dec << std::endl;
-          atari.clearBreakpoints();
-          atari.addBreakpoint(breakpoint);
+          emulation.apply([breakpoint](Atari2600& atari)
+          {
+            atari.clearBreakpoints();
+            atari.addBreakpoint(breakpoint);
+          });
         }
         catch (const std::exception& ex)
         {
@@ -269,12 +453,12 @@ public:
     draw_reg_row("A", "%02X", cpu.a_);
     draw_reg_row("X", "%02X", cpu.x_);
     draw_reg_row("Y", "%02X", cpu.y_);
-    draw_reg_row("N", "%d", cpu.negative_);
-    draw_reg_row("Z", "%d", cpu.zero_);
-    draw_reg_row("C", "%d", cpu.carry_);
-    draw_reg_row("I", "%d", cpu.irq_disable_);
-    draw_reg_row("D", "%d", cpu.decimal_mode_);
-    draw_reg_row("V", "%d", cpu.overflow_);
+    draw_reg_row("N", "%d", cpu.negative());
+    draw_reg_row("Z", "%d", cpu.zero());
+    draw_reg_row("C", "%d", cpu.carry());
+    draw_reg_row("I", "%d", cpu.irqDisable());
+    draw_reg_row("D", "%d", cpu.decimalMode());
+    draw_reg_row("V", "%d", cpu.overflow());
     ImGui::EndTable();
 
     ImGui::End();
@@ -286,9 +470,9 @@ class TiaWindow
 public:
   bool show_ = true;
 
-  void draw(Atari2600 &atari)
+  void draw(const Atari2600 &snapshot)
   {
-    Tia &tia = atari.tia_;
+    const Tia &tia = snapshot.tia_;
     if (!show_)
     {
       return;
@@ -343,50 +527,252 @@ public:
   }
 };
 
-// Generate a empty texture with glGenTextures, bind it with glBindTexture, fill your data in with glTexImage2D
-class DisplayWindow
+class TraceWindow
 {
 public:
-  bool initialized_ = false;
-  GLuint texture_id_;
+  bool show_ = true;
+  bool paused_ = false;
 
-  static constexpr int DISPLAY_SIZE_MULT = 3;
-  static constexpr int DISPLAY_MULT_WIDTH = Tia::DISPLAY_WIDTH * DISPLAY_SIZE_MULT;
-  static constexpr int DISPLAY_MULT_HEIGHT = Tia::DISPLAY_HEIGHT * DISPLAY_SIZE_MULT;
-  std::vector<RGBA> display_{DISPLAY_MULT_WIDTH * DISPLAY_MULT_HEIGHT};
+  static constexpr size_t MAX_LINES = 2000;
+  std::deque<std::string> lines_;
+  std::ostringstream ss_;
 
-  void draw(Atari2600 &atari)
+  void draw(EmulationThread &emulation)
   {
-    if (!initialized_)
+    // Trace buffer is single producer single consumer, so it is drained while emulation thread is writing to it.
+    // Keep draining even when hidden so buffer doesn't fill up and drop newer events
+    TraceBuffer &trace = emulation.atari_.trace_;
+    trace.drain([this](const TraceEvent& event)
     {
-      init(atari);
+      if (paused_)
+      {
+        return;
+      }
+      ss_.str("");
+      ss_ << event;
+      lines_.push_back(ss_.str());
+      if (lines_.size() > MAX_LINES)
+      {
+        lines_.pop_front();
+      }
+    });
+
+    if (!show_)
+    {
+      return;
     }
 
-    Tia &tia = atari.tia_;
+    ImGui::Begin("Trace", &show_);
+    if (!TRACE_ENABLED)
+    {
+      ImGui::Text("Tracing not compiled in, configure with -DATARI2600_TRACE=ON");
+      ImGui::End();
+      return;
+    }
 
-    for (int y = 0; y < DISPLAY_MULT_HEIGHT; ++y)
+    auto category_checkbox = [&trace, &emulation](const char* name, uint32_t category)
     {
-      int y2 = y / DISPLAY_SIZE_MULT;
-      for (int x = 0; x < DISPLAY_MULT_WIDTH; ++x)
+      // categories_ is only changed from this thread, but emulation thread reads it
+      bool enabled = trace.categories_ & category;
+      if (ImGui::Checkbox(name, &enabled))
       {
-        int x2 = x / DISPLAY_SIZE_MULT;
-        display_[y * DISPLAY_MULT_WIDTH + x] = tia.getDisplay(x2, y2);
+        std::lock_guard<std::mutex> lock(emulation.mutex_);
+        trace.categories_ ^= category;
       }
+      ImGui::SameLine();
+    };
+    category_checkbox("TIA", TRACE_TIA_WRITE);
+    category_checkbox("WSYNC", TRACE_WSYNC);
+    category_checkbox("VSYNC", TRACE_VSYNC);
+    category_checkbox("RIOT", TRACE_RIOT_IO);
+    category_checkbox("Display", TRACE_DISPLAY);
+    ImGui::Checkbox("Pause", &paused_);
+    ImGui::SameLine();
+    if (ImGui::Button("Clear"))
+    {
+      lines_.clear();
     }
+    ImGui::Text("Dropped %zu", trace.dropped());
 
-    glEnable(GL_TEXTURE_2D);
-    glDisable(GL_BLEND);
+    ImGui::BeginChild("events");
+    for (const std::string& line : lines_)
+    {
+      ImGui::TextUnformatted(line.c_str());
+    }
+    if (!paused_)
+    {
+      ImGui::SetScrollHereY(1.0f);
+    }
+    ImGui::EndChild();
+    ImGui::End();
+  }
+};
+
+class RewindWindow
+{
+public:
+  bool show_ = true;
+
+  int seek_frame_ = 0;
+
+  // Draws rewind range published with frame, only takes emulation.mutex_ (through apply) to seek or toggle recording
+  void draw(EmulationThread &emulation, const EmulatorFrame &published)
+  {
+    // Emulation thread records every frame while it holds mutex_, whether or not window is open
+    if (!show_)
+    {
+      return;
+    }
+
+    ImGui::Begin("Rewind", &show_);
+    bool record = published.recording;
+    if (ImGui::Checkbox("Record", &record))
+    {
+      emulation.apply([&emulation, record](Atari2600&) { emulation.record_ = record; });
+    }
+    if (published.rewind_empty)
+    {
+      ImGui::Text("No frames recorded");
+      ImGui::End();
+      return;
+    }
+
+    const unsigned oldest = published.rewind_oldest;
+    const unsigned newest = published.rewind_newest;
+    ImGui::Text("Frames %u - %u in %zu KB", oldest, newest, published.rewind_bytes / 1024);
+
+    const unsigned frame = published.frame_count;
+    if (ImGui::Button("Back Frame") and (frame > oldest))
+    {
+      seek(emulation, frame - 1);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Forward Frame") and (frame < newest))
+    {
+      seek(emulation, frame + 1);
+    }
+
+    seek_frame_ = std::clamp<int>(frame, oldest, newest);
+    if (ImGui::SliderInt("frame", &seek_frame_, oldest, newest))
+    {
+      seek(emulation, seek_frame_);
+    }
+    ImGui::End();
+  }
+
+  void seek(EmulationThread &emulation, unsigned frame)
+  {
+    // Running on from restored frame replaces history after it, just seeking doesn't
+    emulation.running_ = false;
+    emulation.apply([&emulation, frame](Atari2600& atari)
+    {
+      if (emulation.rewind_.seek(frame, atari))
+      {
+        emulation.recorded_frame_ = frame;
+      }
+    });
+  }
+};
+
+// Frame times of render loop, display texture upload and latency from VSYNC until frame is on screen,
+// drawn over bottom left corner of window
+class FrameTimeOverlay
+{
+public:
+  bool show_ = true;
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16, DISPLAY_MULT_WIDTH, DISPLAY_MULT_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, display_.data());
+  static constexpr size_t HISTORY_SIZE = 120;
+  std::array<float, HISTORY_SIZE> frame_ms_ = {};
+  std::array<float, HISTORY_SIZE> upload_ms_ = {};
+  size_t next_ = 0;
 
-    auto result = gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGBA8, DISPLAY_MULT_WIDTH, DISPLAY_MULT_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, display_.data());
-    if (result != 0)
+  std::array<float, HISTORY_SIZE> latency_ms_ = {};
+  size_t next_latency_ = 0;
+
+  std::chrono::steady_clock::time_point last_frame_time_ = std::chrono::steady_clock::now();
+
+  // record time since last frame, and how long display upload of this frame took
+  void record(float upload_ms)
+  {
+    const auto now = std::chrono::steady_clock::now();
+    frame_ms_[next_] = std::chrono::duration<float, std::milli>(now - last_frame_time_).count();
+    upload_ms_[next_] = upload_ms;
+    next_ = (next_ + 1) % HISTORY_SIZE;
+    last_frame_time_ = now;
+  }
+
+  // record time from emulated frame's VSYNC until buffers were swapped to show it
+  void recordLatency(std::chrono::steady_clock::time_point vsync_time)
+  {
+    const auto now = std::chrono::steady_clock::now();
+    latency_ms_[next_latency_] = std::chrono::duration<float, std::milli>(now - vsync_time).count();
+    next_latency_ = (next_latency_ + 1) % HISTORY_SIZE;
+  }
+
+  void draw()
+  {
+    if (!show_)
+    {
+      return;
+    }
+
+    const ImGuiViewport* viewport = ImGui::GetMainViewport();
+    ImGui::SetNextWindowPos(ImVec2(viewport->WorkPos.x + 10.0f, viewport->WorkPos.y + viewport->WorkSize.y - 10.0f),
+                            ImGuiCond_Always, ImVec2(0.0f, 1.0f));
+    ImGui::SetNextWindowBgAlpha(0.35f);
+    const ImGuiWindowFlags flags = ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_AlwaysAutoResize |
+      ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav |
+      ImGuiWindowFlags_NoMove;
+    ImGui::Begin("Frame Time", &show_, flags);
+
+    auto average = [](const std::array<float, HISTORY_SIZE>& times)
+    {
+      float sum = 0.0f;
+      for (float time : times)
+      {
+        sum += time;
+      }
+      return sum / times.size();
+    };
+    const float frame_ms = average(frame_ms_);
+    ImGui::Text("Frame %.2f ms (%.1f FPS)", frame_ms, (frame_ms > 0.0f) ? 1000.0f / frame_ms : 0.0f);
+    ImGui::Text("Display upload %.3f ms", average(upload_ms_));
+    ImGui::Text("VSYNC to display %.2f ms", average(latency_ms_));
+    ImGui::PlotLines("##frame_ms", frame_ms_.data(), HISTORY_SIZE, next_, nullptr, 0.0f, 50.0f, ImVec2(240.0f, 40.0f));
+    ImGui::End();
+  }
+};
+
+// Texture with TIA's native 160 pixel wide display, GPU scales it up when drawing
+class DisplayWindow
+{
+public:
+  bool initialized_ = false;
+  GLuint texture_id_;
+  // RGBA of displayed frame, expanded from palette indices
+  std::vector<RGBA> rgba_ = std::vector<RGBA>(Tia::DISPLAY_WIDTH * Tia::DISPLAY_HEIGHT);
+
+  // Returns milliseconds taken by palette expansion and texture upload
+  float draw(const EmulatorFrame &frame, const std::array<RGBA, 256> &palette)
+  {
+    if (!initialized_)
     {
-      std::cerr << "gluBuild2DMipmaps fail " << result << std::endl;
+      init();
     }
 
+    glEnable(GL_TEXTURE_2D);
+    glDisable(GL_BLEND);
     glBindTexture(GL_TEXTURE_2D, texture_id_);
 
+    // Texture storage was allocated once in init(), only its contents change
+    const auto upload_start = std::chrono::steady_clock::now();
+    // Expanded straight from mailbox's front buffer, which emulation thread leaves alone until next update()
+    Tia::expandIndexed(frame.display.data(), frame.display.size(), palette, rgba_.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, Tia::DISPLAY_WIDTH, Tia::DISPLAY_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE,
+                    rgba_.data());
+    const auto upload_stop = std::chrono::steady_clock::now();
+
     float w = 1.2;
     float h = 1.6;
     float x = -0.5 * w;
@@ -401,23 +787,27 @@ public:
     glVertex3f(x + w, y + h, 0.0f);
     glTexCoord2f(1.0, 1.0);
     glVertex3f(x + w, y, 0.0f);
+    glEnd();
 
     glDisable(GL_TEXTURE_2D);
-
-    glEnd();
+    return std::chrono::duration<float, std::milli>(upload_stop - upload_start).count();
   }
 
-  void init(Atari2600 &atari)
+  void init()
   {
     initialized_ = true;
     glGenTextures(1, &texture_id_);
     glBindTexture(GL_TEXTURE_2D, texture_id_);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    // Pixels stay sharp when scaled up, and there are no mipmaps to rebuild every frame
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, Tia::DISPLAY_WIDTH, Tia::DISPLAY_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 nullptr);
     std::cout << " Texture ID " << texture_id_ << std::endl;
   }
 };
@@ -426,6 +816,9 @@ Mos6502Window mos6502_window;
 RamWindow ram_window;
 DisplayWindow display_window;
 TiaWindow tia_window;
+TraceWindow trace_window;
+RewindWindow rewind_window;
+FrameTimeOverlay frame_time_overlay;
 
 void MainLoopStep()
 {
@@ -435,9 +828,20 @@ void MainLoopStep()
   ImGui::NewFrame();
   ImGuiIO &io = ImGui::GetIO();
 
-  mos6502_window.draw(atari);
-  ram_window.draw(atari);
-  tia_window.draw(atari);
+  // All debugger windows show same frame, even while emulation thread is already running next one
+  const bool new_frame = emulation.mailbox_.update();
+  const EmulatorFrame &frame = emulation.mailbox_.front();
+  if (new_frame)
+  {
+    snapshot.loadState(frame.state);
+  }
+
+  mos6502_window.draw(snapshot, emulation);
+  ram_window.draw(snapshot);
+  tia_window.draw(snapshot);
+  trace_window.draw(emulation);
+  rewind_window.draw(emulation, frame);
+  frame_time_overlay.draw();
 
   // 2. Show a simple window that we create ourselves. We use a Begin/End pair to create a named window.
   if (false)
@@ -472,10 +876,14 @@ void MainLoopStep()
   // glUseProgram(0); // You may want this if using this code in an OpenGL 3+ context where shaders may be bound, but prefer using the GL3+ code.
 
   // Draw rect to screen
-  display_window.draw(atari);
+  frame_time_overlay.record(display_window.draw(frame, snapshot.tia_.palette_));
 
   ImGui_ImplOpenGL2_RenderDrawData(ImGui::GetDrawData());
 
   glutSwapBuffers();
+  if (new_frame)
+  {
+    frame_time_overlay.recordLatency(frame.vsync_time);
+  }
   glutPostRedisplay();
 }
@@ -21,7 +21,7 @@ void write_callback(uint16_t addr, uint8_t data)
 
 int main()
 {
-  Mos6502 proc{read_callback, write_callback};
+  Mos6502 proc{Mos6502CallbackBus{read_callback, write_callback}};
   for (unsigned cycle = 0; cycle < 10; )
   {
     std::cout << "Cycle " << std::dec << cycle << std::endl;
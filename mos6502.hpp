@@ -6,16 +6,69 @@
 #include <functional>
 #include <iostream>
 
-class Mos6502
+/**
+ * Bus that forwards every memory access through type-erased callbacks.
+ * Convenient for standalone use, but each access is an indirect call.
+ */
+struct Mos6502CallbackBus
 {
-public:
   // ReadCallback takes a 16bit address and returns an 8bit value
   using ReadCallback = std::function<uint8_t(uint16_t)>;
 
   // WriteCallback takes a 16bit address and 8bit value
   using WriteCallback = std::function<void(uint16_t, uint8_t)>;
 
-  Mos6502(ReadCallback read_callback, WriteCallback write_callback);
+  Mos6502CallbackBus(ReadCallback read_callback, WriteCallback write_callback) :
+    read_callback_{read_callback},
+    write_callback_{write_callback}
+  {
+  }
+
+  uint8_t read(uint16_t addr) { return read_callback_(addr); }
+  void write(uint16_t addr, uint8_t data) { write_callback_(addr, data); }
+
+  // These must be provided
+  ReadCallback read_callback_ = nullptr;
+  WriteCallback write_callback_ = nullptr;
+};
+
+/**
+ * Fixed layout snapshot of CPU registers, see Mos6502Core::saveState
+ */
+struct Mos6502State
+{
+  uint32_t instr_cycle_count;
+  uint16_t pc;
+  uint8_t a;
+  uint8_t x;
+  uint8_t y;
+  uint8_t sp;
+  // processor status (P) register
+  uint8_t status;
+  uint8_t reseting;
+  uint8_t instr[3];
+  uint8_t instr_len;
+};
+
+/**
+ * MOS 6502 CPU core
+ *
+ * BUS is any type that provides:
+ *   uint8_t read(uint16_t addr);
+ *   void write(uint16_t addr, uint8_t data);
+ * Since the bus type is known at compile time, bus accesses can be inlined into
+ * each opcode function instead of going through a std::function.
+ *
+ * Member functions are defined in mos6502_impl.hpp, a TU that needs a new
+ * instantiation should include that and explicitly instantiate Mos6502Core<BUS>.
+ */
+template<typename BUS>
+class Mos6502Core
+{
+public:
+  using Bus = BUS;
+
+  explicit Mos6502Core(Bus bus);
 
   // Output register values to stream
   void outputRegs(std::ostream& os) const;
@@ -30,13 +83,71 @@ public:
   std::array<uint8_t, 3> instr_ = {0,0,0};
   uint8_t instr_len_ = 0;
 
-  bool carry_ = false;
-  bool zero_ = false;
-  bool irq_disable_ = true;
-  bool decimal_mode_ = false;
-  bool brk_ = true;
-  bool overflow_ = false;
-  bool negative_ = false;
+  // Processor status (P) register bits
+  static constexpr uint8_t FLAG_CARRY = 0x01;
+  static constexpr uint8_t FLAG_ZERO = 0x02;
+  static constexpr uint8_t FLAG_IRQ_DISABLE = 0x04;
+  static constexpr uint8_t FLAG_DECIMAL_MODE = 0x08;
+  static constexpr uint8_t FLAG_BRK = 0x10;
+  static constexpr uint8_t FLAG_UNUSED = 0x20;
+  static constexpr uint8_t FLAG_OVERFLOW = 0x40;
+  static constexpr uint8_t FLAG_NEGATIVE = 0x80;
+
+  /**
+   * Flags other than N and Z, laid out like processor status (P) register, N and Z bits are always 0
+   * Most instructions set N and Z, and most of the time next one overwrites them before anything
+   * reads them, so instead of being worked out each time they are kept as nz_.
+   */
+  uint8_t status_ = FLAG_IRQ_DISABLE | FLAG_BRK | FLAG_UNUSED;
+
+  // Result N and Z were last set from, Z is set if low byte is 0, N if bit 7 or 15 is set.
+  // Bit 15 is only used to have both set, since no single result does.
+  uint16_t nz_ = 1;
+
+  bool carry() const
+  {
+    return status_ & FLAG_CARRY;
+  }
+
+  bool zero() const
+  {
+    return (nz_ & 0xFF) == 0;
+  }
+
+  bool irqDisable() const
+  {
+    return status_ & FLAG_IRQ_DISABLE;
+  }
+
+  bool decimalMode() const
+  {
+    return status_ & FLAG_DECIMAL_MODE;
+  }
+
+  bool brk() const
+  {
+    return status_ & FLAG_BRK;
+  }
+
+  bool overflow() const
+  {
+    return status_ & FLAG_OVERFLOW;
+  }
+
+  bool negative() const
+  {
+    return nz_ & 0x8080;
+  }
+
+  void setFlag(uint8_t flag, bool value)
+  {
+    status_ = value ? (status_ | flag) : (status_ & ~flag);
+  }
+
+  void setNZ(bool negative, bool zero)
+  {
+    nz_ = negative ? (zero ? 0x8000 : 0x80) : (zero ? 0 : 1);
+  }
 
   bool reseting_ = true;
 
@@ -44,24 +155,60 @@ public:
 
   uint8_t getStatus() const;
 
+  // Set flags from processor status (P) register value, bit 5 is ignored
+  void setStatus(uint8_t status);
+
+  void saveState(Mos6502State& state) const;
+  void loadState(const Mos6502State& state);
+
   /**
    * Execute one instruction, return number of instruction clock cycles needed
    */
   unsigned execOne();
 
+  // Takea a pointer to Mos6502 instruction and updates processor state
+  // Returns number of instruction cycles need to complete instruction
+  using OpFunc = unsigned(*)(Mos6502Core& cpu);
+
+  /**
+   * Instruction decoded from memory that never changes (ROM), so it can run again without fetching it
+   */
+  struct DecodedInstr
+  {
+    OpFunc func;
+    std::array<uint8_t, 3> instr;
+    uint8_t len;
+  };
+
+  /**
+   * @brief decode instruction starting at bytes[0], reading at most size bytes
+   * Operand bytes past size are left as 0, caller must not execute an instruction that didn't fit
+   */
+  static DecodedInstr decode(const uint8_t* bytes, size_t size);
+
+  /**
+   * @brief execute instruction at PC, decoded from same bytes that reading PC from bus would return
+   * Same as execOne(), without instruction fetch bus accesses
+   */
+  unsigned execDecoded(const DecodedInstr& decoded);
+
   const char* getOpName(uint8_t opcode) const;
 
 protected:
 
-  // These must be provided
-  ReadCallback read_callback_ = nullptr;
-  WriteCallback write_callback_ = nullptr;
+  Bus bus_;
 
-  //https://www.masswerk.at/6502/6502_instruction_set.html
+  inline uint8_t read(uint16_t addr)
+  {
+    return bus_.read(addr);
+  }
 
-  // Takea a pointer to Mos6502 instruction and updates processor state
-  // Returns number of instruction cycles need to complete instruction
-  using OpFunc = unsigned(*)(Mos6502& cpu);
+  inline void write(uint16_t addr, uint8_t data)
+  {
+    bus_.write(addr, data);
+  }
+
+  //https://www.masswerk.at/6502/6502_instruction_set.html
 
   struct OpInfo
   {
@@ -71,19 +218,33 @@ protected:
     uint8_t len;
   };
 
-  std::array<OpInfo, 256> op_table_;
+  using OpTable = std::array<OpInfo, 256>;
+
+  /**
+   * @brief op_table shared by all instances, built at compile time by makeOpTable()
+   */
+  static const OpTable& opTable();
+
+  /**
+   * @brief build op_table for all instructions, invalid opcodes are filled with a function that throws
+   */
+  static constexpr OpTable makeOpTable();
 
   /**
    * @brief add instruction to op_table, and description to decode table
+   * @param op_table table to add instruction to
    * @param opcode 8bit opcode for instruction
    * @param op_name short description name for opcode (ADC, AND, ASL, ...)
    * @param op_len len of opcode 1, 2, or 3 bytes
    * @param op_func pointer to unction to call to execute instruction
+   *
+   * Since op_table is built at compile time, adding the same opcode twice is a compile error
   */
-  void addInstruction(uint8_t opcode, const char* op_name, uint8_t op_len, OpFunc op_func);
+  static constexpr void addInstruction(OpTable& op_table, uint8_t opcode, const char* op_name, uint8_t op_len, OpFunc op_func);
 
   /**
    * @brief add immediate instruction to op_table
+   * @param op_table table to add instruction to
    * @param opcode 8bit opcode for instruction
    * @param op_name short description name for opcode (ADC, AND, ASL, ...)
    * @param unused_op_func stateless lambda operation that takes two inputs, a Mos6502 reference, and a 8bit operand
@@ -91,9 +252,9 @@ protected:
    * For this the operand value passed to labmda will always be immediate value from instruction
    */
   template<unsigned CYCLES=2, typename OP_FUNC_TYPE>
-  void addInstructionImmediate(uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
+  static constexpr void addInstructionImmediate(OpTable& op_table, uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
   {
-    addInstruction(opcode, op_name, 2, [](Mos6502& cpu) -> unsigned
+    addInstruction(op_table, opcode, op_name, 2, [](Mos6502Core& cpu) -> unsigned
     {
       // Stateless lamdas don't have a default constructor, so use this hack to allow use
       // of operator() from stateless lambda
@@ -107,6 +268,7 @@ protected:
 
   /**
    * @brief add immediate instruction to op_table
+   * @param op_table table to add instruction to
    * @param opcode 8bit opcode for instruction
    * @param op_name short description name for opcode (ADC, AND, ASL, ...)
    * @param unused_op_func stateless lambda operation that takes two inputs, a Mos6502 reference, and a 8bit operand
@@ -114,9 +276,9 @@ protected:
    * For this the operand value passed to labmda will always be zeropage load based on address from instruction
    */
   template<unsigned CYCLES=3, typename OP_FUNC_TYPE>
-  void addInstructionZeroPage(uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
+  static constexpr void addInstructionZeroPage(OpTable& op_table, uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
   {
-    addInstruction(opcode, op_name, 2, [](Mos6502& cpu) -> unsigned
+    addInstruction(op_table, opcode, op_name, 2, [](Mos6502Core& cpu) -> unsigned
     {
       OP_FUNC_TYPE* op_func_pointer = nullptr;
       OP_FUNC_TYPE op_func = *op_func_pointer;
@@ -127,19 +289,20 @@ protected:
 
   /**
    * @brief add immediate instruction to op_table
+   * @param op_table table to add instruction to
    * @param opcode 8bit opcode for instruction
    * @param op_name short description name for opcode (ADC, AND, ASL, ...)
    * @param unused_op_func stateless lambda operation that takes two inputs, a Mos6502 reference, and a 8bit operand
    */
   template<typename OP_FUNC_TYPE>
-  void addInstructionZeroPageX(uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
+  static constexpr void addInstructionZeroPageX(OpTable& op_table, uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
   {
-    addInstruction(opcode, op_name, 2, [](Mos6502& cpu) -> unsigned
+    addInstruction(op_table, opcode, op_name, 2, [](Mos6502Core& cpu) -> unsigned
     {
       OP_FUNC_TYPE* op_func_pointer = nullptr;
       OP_FUNC_TYPE op_func = *op_func_pointer;
       uint16_t addr = (cpu.instr_[1] + cpu.x_) & 0xFF;
-      uint8_t data = cpu.read_callback_(addr);
+      uint8_t data = cpu.read(addr);
       op_func(cpu, data);
       return 4;
     });
@@ -148,20 +311,21 @@ protected:
 
   /**
    * @brief add absolute instruction to op_table
+   * @param op_table table to add instruction to
    * @param opcode 8bit opcode for instruction
    * @param op_name short description name for opcode (ADC, AND, ASL, ...)
    * @param unused_op_func stateless lambda operation that takes two inputs, a Mos6502 reference, and a 8bit operand
    *
    */
   template<typename OP_FUNC_TYPE>
-  void addInstructionAbsolute(uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
+  static constexpr void addInstructionAbsolute(OpTable& op_table, uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
   {
-    addInstruction(opcode, op_name, 3, [](Mos6502& cpu) -> unsigned
+    addInstruction(op_table, opcode, op_name, 3, [](Mos6502Core& cpu) -> unsigned
     {
       OP_FUNC_TYPE* op_func_pointer = nullptr;
       OP_FUNC_TYPE op_func = *op_func_pointer;
       uint16_t addr = cpu.getAbsoluteAddress();
-      uint8_t data = cpu.read_callback_(addr);
+      uint8_t data = cpu.read(addr);
       op_func(cpu, data);
       return 4;
     });
@@ -169,21 +333,22 @@ protected:
 
   /**
    * @brief add absolute,X instruction to op_table
+   * @param op_table table to add instruction to
    * @param opcode 8bit opcode for instruction
    * @param op_name short description name for opcode (ADC, AND, ASL, ...)
    * @param unused_op_func stateless lambda operation that takes two inputs, a Mos6502 reference, and a 8bit operand
    *
    */
   template<typename OP_FUNC_TYPE>
-  void addInstructionAbsoluteX(uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
+  static constexpr void addInstructionAbsoluteX(OpTable& op_table, uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
   {
-    addInstruction(opcode, op_name, 3, [](Mos6502& cpu) -> unsigned
+    addInstruction(op_table, opcode, op_name, 3, [](Mos6502Core& cpu) -> unsigned
     {
       OP_FUNC_TYPE* op_func_pointer = nullptr;
       OP_FUNC_TYPE op_func = *op_func_pointer;
       uint16_t base_addr = cpu.getAbsoluteAddress();
       uint16_t addr = base_addr + cpu.x_;
-      uint8_t data = cpu.read_callback_(addr);
+      uint8_t data = cpu.read(addr);
       op_func(cpu, data);
       // +1 extra cycle if high byte of address changed
       return 4 + hasHighByteChanged(base_addr, addr) ? 1 : 0;
@@ -192,21 +357,22 @@ protected:
 
   /**
    * @brief add absolute,Y instruction to op_table
+   * @param op_table table to add instruction to
    * @param opcode 8bit opcode for instruction
    * @param op_name short description name for opcode (ADC, AND, ASL, ...)
    * @param unused_op_func stateless lambda operation that takes two inputs, a Mos6502 reference, and a 8bit operand
    *
    */
   template<typename OP_FUNC_TYPE>
-  void addInstructionAbsoluteY(uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
+  static constexpr void addInstructionAbsoluteY(OpTable& op_table, uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
   {
-    addInstruction(opcode, op_name, 3, [](Mos6502& cpu) -> unsigned
+    addInstruction(op_table, opcode, op_name, 3, [](Mos6502Core& cpu) -> unsigned
     {
       OP_FUNC_TYPE* op_func_pointer = nullptr;
       OP_FUNC_TYPE op_func = *op_func_pointer;
       uint16_t base_addr = cpu.getAbsoluteAddress();
       uint16_t addr = base_addr + cpu.y_;
-      uint8_t data = cpu.read_callback_(addr);
+      uint8_t data = cpu.read(addr);
       op_func(cpu, data);
       // +1 extra cycle if high byte of address changed
       return 4 + hasHighByteChanged(base_addr, addr) ? 1 : 0;
@@ -215,6 +381,7 @@ protected:
 
   /**
    * @brief add indirect,X instruction to op_table (indirect-indexed)
+   * @param op_table table to add instruction to
    * @param opcode 8bit opcode for instruction
    * @param op_name short description name for opcode (ADC, AND, ASL, ...)
    * @param unused_op_func stateless lambda operation that takes two inputs, a Mos6502 reference, and a 8bit operand
@@ -224,17 +391,17 @@ protected:
    * then add indirect address to y
    */
   template<typename OP_FUNC_TYPE>
-  void addInstructionIndirectX(uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
+  static constexpr void addInstructionIndirectX(OpTable& op_table, uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
   {
-    addInstruction(opcode, op_name, 2, [](Mos6502& cpu) -> unsigned
+    addInstruction(op_table, opcode, op_name, 2, [](Mos6502Core& cpu) -> unsigned
     {
       OP_FUNC_TYPE* op_func_pointer = nullptr;
       OP_FUNC_TYPE op_func = *op_func_pointer;
       uint16_t addr_zpg = cpu.instr_[1] + cpu.x_;
-      uint8_t addr_lo = cpu.read_callback_(addr_zpg & 0xFF);
-      uint8_t addr_hi = cpu.read_callback_((addr_zpg + 1) & 0xFF); // todo does this wrap
+      uint8_t addr_lo = cpu.read(addr_zpg & 0xFF);
+      uint8_t addr_hi = cpu.read((addr_zpg + 1) & 0xFF); // todo does this wrap
       uint16_t addr = ((addr_hi << 8) | addr_lo);
-      uint8_t data = cpu.read_callback_(addr);
+      uint8_t data = cpu.read(addr);
       op_func(cpu, data);
       return 6;
     });
@@ -242,6 +409,7 @@ protected:
 
   /**
    * @brief add indirect,Y instruction to op_table (indirect-indexed)
+   * @param op_table table to add instruction to
    * @param opcode 8bit opcode for instruction
    * @param op_name short description name for opcode (ADC, AND, ASL, ...)
    * @param unused_op_func stateless lambda operation that takes two inputs, a Mos6502 reference, and a 8bit operand
@@ -251,17 +419,17 @@ protected:
    * then add indirect address to y
    */
   template<typename OP_FUNC_TYPE>
-  void addInstructionIndirectY(uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
+  static constexpr void addInstructionIndirectY(OpTable& op_table, uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
   {
-    addInstruction(opcode, op_name, 2, [](Mos6502& cpu) -> unsigned
+    addInstruction(op_table, opcode, op_name, 2, [](Mos6502Core& cpu) -> unsigned
     {
       OP_FUNC_TYPE* op_func_pointer = nullptr;
       OP_FUNC_TYPE op_func = *op_func_pointer;
       uint16_t addr_zpg = cpu.instr_[1];
-      uint8_t addr_lo = cpu.read_callback_(addr_zpg);
-      uint8_t addr_hi = cpu.read_callback_((addr_zpg + 1) & 0xFF); // todo does this wrap
+      uint8_t addr_lo = cpu.read(addr_zpg);
+      uint8_t addr_hi = cpu.read((addr_zpg + 1) & 0xFF); // todo does this wrap
       uint16_t addr = ((addr_hi << 8) | addr_lo) + cpu.y_;
-      uint8_t data = cpu.read_callback_(addr);
+      uint8_t data = cpu.read(addr);
       op_func(cpu, data);
       return 6;  // 5* for cmp?
     });
@@ -269,14 +437,15 @@ protected:
 
   /**
    * @brief add a unary operation that modifies accumulator
+   * @param op_table table to add instruction to
    * @param opcode 8bit opcode for instruction
    * @param op_name short description name for opcode (ADC, AND, ASL, ...)
    * @param unused_op_func stateless lambda operation that takes two inputs, a Mos6502 reference, and a 8bit operand, and returns an 8bit value
    */
   template<unsigned CYCLES=2, typename OP_FUNC_TYPE>
-  void addInstructionUnaryA(uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
+  static constexpr void addInstructionUnaryA(OpTable& op_table, uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
   {
-    addInstruction(opcode, op_name, 1, [](Mos6502& cpu) -> unsigned
+    addInstruction(op_table, opcode, op_name, 1, [](Mos6502Core& cpu) -> unsigned
     {
       OP_FUNC_TYPE* op_func_pointer = nullptr;
       OP_FUNC_TYPE op_func = *op_func_pointer;
@@ -287,76 +456,80 @@ protected:
 
   /**
    * @brief add a unary operation that modifies a zeropage address
+   * @param op_table table to add instruction to
    * @param opcode 8bit opcode for instruction
    * @param op_name short description name for opcode (ADC, AND, ASL, ...)
    * @param unused_op_func stateless lambda operation that takes two inputs, a Mos6502 reference, and a 8bit operand, and returns an 8bit value
    */
   template<unsigned CYCLES=5, typename OP_FUNC_TYPE>
-  void addInstructionUnaryZeroPage(uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
+  static constexpr void addInstructionUnaryZeroPage(OpTable& op_table, uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
   {
-    addInstruction(opcode, op_name, 2, [](Mos6502& cpu) -> unsigned
+    addInstruction(op_table, opcode, op_name, 2, [](Mos6502Core& cpu) -> unsigned
     {
       OP_FUNC_TYPE* op_func_pointer = nullptr;
       OP_FUNC_TYPE op_func = *op_func_pointer;
       uint16_t addr = cpu.instr_[1];
-      cpu.write_callback_(addr, op_func(cpu, cpu.read_callback_(addr)));
+      cpu.write(addr, op_func(cpu, cpu.read(addr)));
       return CYCLES;
     });
   }
 
   /**
    * @brief add a unary operation that modifies a zeropage + x address
+   * @param op_table table to add instruction to
    * @param opcode 8bit opcode for instruction
    * @param op_name short description name for opcode (ADC, AND, ASL, ...)
    * @param unused_op_func stateless lambda operation that takes two inputs, a Mos6502 reference, and a 8bit operand, and returns an 8bit value
    */
   template<unsigned CYCLES=6, typename OP_FUNC_TYPE>
-  void addInstructionUnaryZeroPageX(uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
+  static constexpr void addInstructionUnaryZeroPageX(OpTable& op_table, uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
   {
-    addInstruction(opcode, op_name, 2, [](Mos6502& cpu) -> unsigned
+    addInstruction(op_table, opcode, op_name, 2, [](Mos6502Core& cpu) -> unsigned
     {
       OP_FUNC_TYPE* op_func_pointer = nullptr;
       OP_FUNC_TYPE op_func = *op_func_pointer;
       uint16_t addr = (cpu.instr_[1] + cpu.x_) & 0xFF;
-      cpu.write_callback_(addr, op_func(cpu, cpu.read_callback_(addr)));
+      cpu.write(addr, op_func(cpu, cpu.read(addr)));
       return CYCLES;
     });
   }
 
   /**
    * @brief add a unary operation that modifies an absolute address
+   * @param op_table table to add instruction to
    * @param opcode 8bit opcode for instruction
    * @param op_name short description name for opcode (ADC, AND, ASL, ...)
    * @param unused_op_func stateless lambda operation that takes two inputs, a Mos6502 reference, and a 8bit operand, and returns an 8bit value
    */
   template<unsigned CYCLES=6, typename OP_FUNC_TYPE>
-  void addInstructionUnaryAbsolute(uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
+  static constexpr void addInstructionUnaryAbsolute(OpTable& op_table, uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
   {
-    addInstruction(opcode, op_name, 3, [](Mos6502& cpu) -> unsigned
+    addInstruction(op_table, opcode, op_name, 3, [](Mos6502Core& cpu) -> unsigned
     {
       OP_FUNC_TYPE* op_func_pointer = nullptr;
       OP_FUNC_TYPE op_func = *op_func_pointer;
       uint16_t addr = cpu.getAbsoluteAddress();
-      cpu.write_callback_(addr, op_func(cpu, cpu.read_callback_(addr)));
+      cpu.write(addr, op_func(cpu, cpu.read(addr)));
       return CYCLES;
     });
   }
 
   /**
    * @brief add a unary operation that modifies an absolute,x address
+   * @param op_table table to add instruction to
    * @param opcode 8bit opcode for instruction
    * @param op_name short description name for opcode (ADC, AND, ASL, ...)
    * @param unused_op_func stateless lambda operation that takes two inputs, a Mos6502 reference, and a 8bit operand, and returns an 8bit value
    */
   template<unsigned CYCLES=7, typename OP_FUNC_TYPE>
-  void addInstructionUnaryAbsoluteX(uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
+  static constexpr void addInstructionUnaryAbsoluteX(OpTable& op_table, uint8_t opcode, const char* op_name, OP_FUNC_TYPE& unused_op_func)
   {
-    addInstruction(opcode, op_name, 3, [](Mos6502& cpu) -> unsigned
+    addInstruction(op_table, opcode, op_name, 3, [](Mos6502Core& cpu) -> unsigned
     {
       OP_FUNC_TYPE* op_func_pointer = nullptr;
       OP_FUNC_TYPE op_func = *op_func_pointer;
       uint16_t addr = cpu.getAbsoluteAddress() + cpu.x_;
-      cpu.write_callback_(addr, op_func(cpu, cpu.read_callback_(addr)));
+      cpu.write(addr, op_func(cpu, cpu.read(addr)));
       return CYCLES;
     });
   }
@@ -375,7 +548,10 @@ protected:
   /**
    * @brief update N (negative) and Z (zero) flags with value
   */
-  void updateNZ(uint8_t value);
+  void updateNZ(uint8_t value)
+  {
+    nz_ = value;
+  }
 
   /**
    * @brief update N (negative) and Z (zero) flags with value
@@ -409,17 +585,22 @@ protected:
   unsigned branch();
 
   // Helpers
-  void addArithmeticInstructions();
-  void addLoadInstructions();
-  void addStoreInstructions();
-  void addTransferInstructions();
-  void addSpecialInstructions();
-  void addBranchInstructions();
-  void addStackInstructions();
-  void addCompareInstructions();
+  static constexpr void addArithmeticInstructions(OpTable& op_table);
+  static constexpr void addLoadInstructions(OpTable& op_table);
+  static constexpr void addStoreInstructions(OpTable& op_table);
+  static constexpr void addTransferInstructions(OpTable& op_table);
+  static constexpr void addSpecialInstructions(OpTable& op_table);
+  static constexpr void addBranchInstructions(OpTable& op_table);
+  static constexpr void addStackInstructions(OpTable& op_table);
+  static constexpr void addCompareInstructions(OpTable& op_table);
   void aaddShiftAndRotateInstructions();
-  void addShiftAndRotateInstructions();
-  void addLogicalInstructions();
+  static constexpr void addShiftAndRotateInstructions(OpTable& op_table);
+  static constexpr void addLogicalInstructions(OpTable& op_table);
 };
 
+// CPU that accesses memory through std::function callbacks
+using Mos6502 = Mos6502Core<Mos6502CallbackBus>;
+
+extern template class Mos6502Core<Mos6502CallbackBus>;
+
 #endif  // ATARI2600_MOS6502_HPP_GUARD
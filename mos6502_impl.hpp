@@ -0,0 +1,947 @@
+#ifndef ATARI2600_MOS6502_IMPL_HPP_GUARD
+#define ATARI2600_MOS6502_IMPL_HPP_GUARD
+
+#include "mos6502.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+template<typename BUS>
+Mos6502Core<BUS>::Mos6502Core(Bus bus) :
+  bus_{bus}
+{
+}
+
+template<typename BUS>
+constexpr typename Mos6502Core<BUS>::OpTable Mos6502Core<BUS>::makeOpTable()
+{
+  OpTable op_table{};
+
+  addArithmeticInstructions(op_table);
+  addLoadInstructions(op_table);
+  addStoreInstructions(op_table);
+  addTransferInstructions(op_table);
+  addSpecialInstructions(op_table);
+  addBranchInstructions(op_table);
+  addStackInstructions(op_table);
+  addCompareInstructions(op_table);
+  addShiftAndRotateInstructions(op_table);
+  addLogicalInstructions(op_table);
+
+  OpFunc invalid_func = [](Mos6502Core& cpu) -> unsigned
+  {
+    std::ostringstream ss;
+    ss << "Invalid Instr " << std::hex << std::setfill('0') << std::setw(2) << static_cast<int>(cpu.instr_[0]);
+    throw std::runtime_error(ss.str());
+    return 1;
+  };
+
+  for (auto& op_info : op_table)
+  {
+    if (op_info.func == nullptr)
+    {
+      op_info = OpInfo{"<?>", invalid_func, 1};
+    }
+  }
+  return op_table;
+}
+
+template<typename BUS>
+const typename Mos6502Core<BUS>::OpTable& Mos6502Core<BUS>::opTable()
+{
+  // constexpr forces makeOpTable() to be evaluated at compile time
+  static constexpr OpTable op_table = makeOpTable();
+  return op_table;
+}
+
+template<typename BUS>
+constexpr void Mos6502Core<BUS>::addInstruction(OpTable& op_table, uint8_t opcode, const char* op_name, uint8_t op_len, OpFunc op_func)
+{
+  auto& op_info = op_table[opcode];
+  if ((op_info.func != nullptr) and (op_info.name != nullptr))
+  {
+    // table is built in a constant expression, so reaching this is a compile error
+    throw std::logic_error("repeat instruction with opcode");
+  }
+  op_info = {op_name, op_func, op_len};
+}
+
+template<typename BUS>
+uint8_t Mos6502Core<BUS>::loadImmediateNZ()
+{
+  updateNZ(instr_[1]);
+  return instr_[1];
+}
+
+template<typename BUS>
+uint8_t Mos6502Core<BUS>::loadZeroPage()
+{
+  uint16_t addr = instr_[1];
+  return read(addr);
+}
+
+template<typename BUS>
+uint8_t Mos6502Core<BUS>::loadZeroPageNZ()
+{
+  uint8_t data = loadZeroPage();
+  updateNZ(data);
+  return data;
+}
+
+template<typename BUS>
+uint8_t Mos6502Core<BUS>::transfer(uint8_t value)
+{
+  updateNZ(value);
+  return value;
+}
+
+template<typename BUS>
+void Mos6502Core<BUS>::compareFlags(uint8_t value1, uint8_t value2)
+{
+  // Carry flag is like an active low borrow, unlike SBC, V is left alone
+  // https://www.righto.com/2012/12/the-6502-overflow-flag-explained.html
+  setFlag(FLAG_CARRY, value1 >= value2);
+  updateNZ(value1 - value2);
+}
+
+template<typename BUS>
+uint8_t Mos6502Core<BUS>::getStatus() const
+{
+  return status_ | (negative() ? FLAG_NEGATIVE : 0) | (zero() ? FLAG_ZERO : 0);
+}
+
+template<typename BUS>
+void Mos6502Core<BUS>::setStatus(uint8_t status)
+{
+  status_ = (status & ~(FLAG_NEGATIVE | FLAG_ZERO)) | FLAG_UNUSED;
+  setNZ(status & FLAG_NEGATIVE, status & FLAG_ZERO);
+}
+
+template<typename BUS>
+void Mos6502Core<BUS>::saveState(Mos6502State& state) const
+{
+  state.instr_cycle_count = instr_cycle_count_;
+  state.pc = pc_;
+  state.a = a_;
+  state.x = x_;
+  state.y = y_;
+  state.sp = sp_;
+  state.status = getStatus();
+  state.reseting = reseting_;
+  std::copy(instr_.begin(), instr_.end(), state.instr);
+  state.instr_len = instr_len_;
+}
+
+template<typename BUS>
+void Mos6502Core<BUS>::loadState(const Mos6502State& state)
+{
+  instr_cycle_count_ = state.instr_cycle_count;
+  pc_ = state.pc;
+  a_ = state.a;
+  x_ = state.x;
+  y_ = state.y;
+  sp_ = state.sp;
+  setStatus(state.status);
+  reseting_ = state.reseting;
+  std::copy(state.instr, state.instr + instr_.size(), instr_.begin());
+  instr_len_ = state.instr_len;
+}
+
+template<typename BUS>
+unsigned Mos6502Core<BUS>::execOne()
+{
+  // Right after reset, the processor will read memory addresses 0xFFFC and 0xFFFD into PC
+  if (reseting_)
+  {
+    reseting_ = false;
+    // TODO which order are value read, probably doesn't matter
+    uint8_t pc_lo = read(0xFFFC);
+    uint8_t pc_hi = read(0xFFFD);
+    pc_ = (pc_hi << 8) | pc_lo;
+    instr_cycle_count_ += 2;
+    return 2;  // assume 2 instructions to read ROM into PC
+  }
+
+  uint8_t op_code = read(pc_);
+  instr_[0] = op_code;
+  const OpInfo& op_info = opTable()[op_code];
+  for (unsigned ii = 1; ii < op_info.len; ++ii)
+  {
+    instr_[ii] = read(pc_ + ii);
+  }
+  instr_len_ = op_info.len;
+  pc_ += op_info.len;
+  try {
+    unsigned cycle_count = op_info.func(*this);
+    instr_cycle_count_ += cycle_count;
+    return cycle_count;
+  }
+  catch (const std::exception& ex)
+  {
+    std::ostringstream ss;
+    ss << "Error running instruction at PC=" << std::hex << (pc_ - op_info.len) << " : " << ex.what();
+    throw std::runtime_error(ss.str());
+  }
+}
+
+template<typename BUS>
+typename Mos6502Core<BUS>::DecodedInstr Mos6502Core<BUS>::decode(const uint8_t* bytes, size_t size)
+{
+  const OpInfo& op_info = opTable()[bytes[0]];
+  DecodedInstr decoded{op_info.func, {bytes[0], 0, 0}, op_info.len};
+  for (unsigned ii = 1; (ii < op_info.len) and (ii < size); ++ii)
+  {
+    decoded.instr[ii] = bytes[ii];
+  }
+  return decoded;
+}
+
+template<typename BUS>
+unsigned Mos6502Core<BUS>::execDecoded(const DecodedInstr& decoded)
+{
+  // Bytes past instruction length keep their old value, like execOne() leaves them
+  instr_[0] = decoded.instr[0];
+  for (unsigned ii = 1; ii < decoded.len; ++ii)
+  {
+    instr_[ii] = decoded.instr[ii];
+  }
+  instr_len_ = decoded.len;
+  pc_ += decoded.len;
+  try {
+    unsigned cycle_count = decoded.func(*this);
+    instr_cycle_count_ += cycle_count;
+    return cycle_count;
+  }
+  catch (const std::exception& ex)
+  {
+    std::ostringstream ss;
+    ss << "Error running instruction at PC=" << std::hex << (pc_ - decoded.len) << " : " << ex.what();
+    throw std::runtime_error(ss.str());
+  }
+}
+
+template<typename BUS>
+const char* Mos6502Core<BUS>::getOpName(uint8_t opcode) const
+{
+  return opTable()[opcode].name;
+}
+
+template<typename BUS>
+void Mos6502Core<BUS>::outputRegs(std::ostream& os) const
+{
+  os << "  PC: " << std::hex << std::setw(4) << std::setfill('0') << static_cast<unsigned>(pc_) << std::endl;
+  os << "  A: " << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned>(a_) << std::endl;
+  os << "  X: " << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned>(x_) << std::endl;
+  os << "  Y: " << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned>(y_) << std::endl;
+  os << "  SP: " << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned>(sp_) << std::endl;
+  os << "  P: " << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned>(getStatus()) << std::endl;
+}
+
+template<typename BUS>
+unsigned Mos6502Core<BUS>::branch()
+{
+  uint16_t old_pc = pc_;
+  pc_ += static_cast<int8_t>(instr_[1]);
+
+  // same page
+  if ((pc_ & 0xff00) == (old_pc & 0xff00))
+  {
+    return 3;
+  }
+  //next page
+  return 4; //cycles
+}
+
+
+template<typename BUS>
+constexpr void Mos6502Core<BUS>::addArithmeticInstructions(OpTable& op_table)
+{
+  // https://www.masswerk.at/6502/6502_instruction_set.html
+
+  auto inc_op = [](Mos6502Core& cpu, uint8_t operand) -> uint8_t
+  {
+    ++operand;
+    cpu.updateNZ(operand);
+    return operand;
+  };
+
+  addInstructionUnaryZeroPage(op_table, 0xE6, "INC zpg", inc_op);
+  addInstructionUnaryZeroPageX(op_table, 0xF6, "INC zpg,x", inc_op);
+  addInstructionUnaryAbsolute(op_table, 0xEE, "INC abs", inc_op);
+  addInstructionUnaryAbsoluteX(op_table, 0xFE, "INC abs,x", inc_op);
+
+  // increment X by 1
+  addInstruction(op_table, 0xE8, "INX", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.updateNZ(++cpu.x_);
+    return 2; //cycles
+  });
+
+  // increment Y by 1
+  addInstruction(op_table, 0xC8, "INY", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.updateNZ(++cpu.y_);
+    return 2; //cycles
+  });
+
+  // decrement at zeropage Memory by 1
+  addInstruction(op_table, 0xC6, "DEC zpg", 2, [](Mos6502Core& cpu) -> unsigned
+  {
+    uint16_t addr = cpu.instr_[1];
+    uint8_t data = cpu.read(addr);
+    --data;
+    cpu.updateNZ(data);
+    cpu.write(addr, data);
+    return 5; //cycles
+  });
+
+  // decrement X by 1
+  addInstruction(op_table, 0xCA, "DEX", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.updateNZ(--cpu.x_);
+    return 2; //cycles
+  });
+
+  // decrement Y by 1
+  addInstruction(op_table, 0x88, "DEY", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.updateNZ(--cpu.y_);
+    return 2; //cycles
+  });
+
+  // add with carry
+  auto adc_op = [](Mos6502Core& cpu, uint8_t operand)
+  {
+    const unsigned sum = cpu.a_ + operand + (cpu.status_ & FLAG_CARRY);
+    // overflow if both operands have same sign, and result has another
+    const bool overflow = ~(cpu.a_ ^ operand) & (cpu.a_ ^ sum) & 0x80;
+    cpu.a_ = sum;
+    cpu.status_ = (cpu.status_ & ~(FLAG_CARRY | FLAG_OVERFLOW)) | (sum >> 8) | (overflow ? FLAG_OVERFLOW : 0);
+    cpu.updateNZ(cpu.a_);
+  };
+  addInstructionImmediate(op_table, 0x69, "ADC #", adc_op);
+  addInstructionZeroPage(op_table, 0x65, "ADC zpg", adc_op);
+  addInstructionZeroPageX(op_table, 0x75, "ADC zpg", adc_op);
+  addInstructionAbsolute(op_table, 0x6D, "ADC abs", adc_op);
+  addInstructionAbsoluteX(op_table, 0x7D, "ADC abs,x", adc_op);
+  addInstructionAbsoluteY(op_table, 0x79, "ADC abs,y", adc_op);
+  addInstructionIndirectX(op_table, 0x61, "ADC (indirect),x", adc_op);
+  addInstructionIndirectY(op_table, 0x71, "ADC (indirect,y)", adc_op);
+
+  /*
+  subtract with carry
+  A - M - C̅ -> A
+  N	Z	C	I	D	V
+  +	+	+	-	-	+
+  addressing	assembler	opc	bytes	cycles
+  immediate	SBC #oper	E9	2	2
+  zeropage	SBC oper	E5	2	3
+  zeropage,X	SBC oper,X	F5	2	4
+  absolute	SBC oper	ED	3	4
+  absolute,X	SBC oper,X	FD	3	4*
+  absolute,Y	SBC oper,Y	F9	3	4*
+  (indirect,X)	SBC (oper,X)	E1	2	6
+  (indirect),Y	SBC (oper),Y	F1	2	5*
+  */
+  auto sbc_op = [](Mos6502Core& cpu, uint8_t operand)
+  {
+    // same as ADC of operand's complement
+    const uint8_t inverted = ~operand;
+    const unsigned sum = cpu.a_ + inverted + (cpu.status_ & FLAG_CARRY);
+    const bool overflow = ~(cpu.a_ ^ inverted) & (cpu.a_ ^ sum) & 0x80;
+    cpu.a_ = sum;
+    cpu.status_ = (cpu.status_ & ~(FLAG_CARRY | FLAG_OVERFLOW)) | (sum >> 8) | (overflow ? FLAG_OVERFLOW : 0);
+    cpu.updateNZ(cpu.a_);
+  };
+  addInstructionImmediate(op_table, 0xE9, "SBC #", sbc_op);
+  addInstructionZeroPage(op_table, 0xE5, "SBC zpg", sbc_op);
+  addInstructionZeroPageX(op_table, 0xF5, "SBC zpg", sbc_op);
+  addInstructionAbsolute(op_table, 0xED, "SBC abs", sbc_op);
+  addInstructionAbsoluteX(op_table, 0xFD, "SBC abs,x", sbc_op);
+  addInstructionAbsoluteY(op_table, 0xF9, "SBC abs,y", sbc_op);
+  addInstructionIndirectX(op_table, 0xE1, "SBC (indirect),x", sbc_op);
+  addInstructionIndirectY(op_table, 0xF1, "SBC (indirect,y)", sbc_op);
+}
+
+template<typename BUS>
+constexpr void Mos6502Core<BUS>::addLoadInstructions(OpTable& op_table)
+{
+
+  // Load A
+  auto op_lda = [](Mos6502Core& cpu, uint8_t data)
+  {
+    cpu.updateNZ(data);
+    cpu.a_ = data;
+  };
+
+  addInstructionImmediate(op_table, 0xA9, "LDA #", op_lda);
+  addInstructionZeroPage(op_table, 0xA5, "LDA zpg", op_lda);
+  addInstructionZeroPageX(op_table, 0xB5, "LDA zpg,x", op_lda);
+  addInstructionAbsolute(op_table, 0xAD, "LDA abs", op_lda);
+  addInstructionAbsoluteX(op_table, 0xBD, "LDA abs,x", op_lda);
+  addInstructionAbsoluteY(op_table, 0xB9, "LDA abs,y", op_lda);
+  addInstructionIndirectY(op_table, 0xB1, "LDA (indirect),y", op_lda);
+
+  // Load X
+  auto op_ldx = [](Mos6502Core& cpu, uint8_t data)
+  {
+    cpu.updateNZ(data);
+    cpu.x_ = data;
+  };
+
+  addInstructionImmediate(op_table, 0xA2, "LDX #", op_ldx);
+  addInstructionZeroPage(op_table, 0xA6, "LDX zpg", op_ldx);
+  addInstructionAbsolute(op_table, 0xAE, "LDX abs", op_ldx);
+  addInstructionAbsoluteY(op_table, 0xBE, "LDX abs,y", op_ldx);
+
+  // Load Y
+  auto op_ldy = [](Mos6502Core& cpu, uint8_t data)
+  {
+    cpu.updateNZ(data);
+    cpu.y_ = data;
+  };
+
+  addInstructionImmediate(op_table, 0xA0, "LDY #", op_ldy);
+  addInstructionZeroPage(op_table, 0xA4, "LDY zpg", op_ldy);
+  addInstructionZeroPageX(op_table, 0xB4, "LDY zpg,x", op_ldy);
+  addInstructionAbsolute(op_table, 0xAC, "LDY abs", op_ldy);
+  addInstructionAbsoluteX(op_table, 0xBC, "LDY abs,x", op_ldy);
+}
+
+template<typename BUS>
+constexpr void Mos6502Core<BUS>::addStoreInstructions(OpTable& op_table)
+{
+  // STA store accumulator into memory zpg,X
+  addInstruction(op_table, 0x95, "STA zpg,x", 2, [](Mos6502Core& cpu) -> unsigned
+  {
+    uint16_t addr = (cpu.instr_[1] + cpu.x_) & 0xFF;
+    cpu.write(addr, cpu.a_);
+    return 4; //cycles
+  });
+
+  // STA zeropage
+  addInstruction(op_table, 0x85, "STA zpg", 2, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.write(cpu.instr_[1], cpu.a_);
+    return 3; //cycles
+  });
+
+  // STA abs
+  addInstruction(op_table, 0x8D, "STA abs", 3, [](Mos6502Core& cpu) -> unsigned
+  {
+    uint16_t addr = cpu.getAbsoluteAddress();
+    cpu.write(addr, cpu.a_);
+    return 4; //cycles
+  });
+
+  // STA abs,x
+  addInstruction(op_table, 0x9D, "STA abs,x", 3, [](Mos6502Core& cpu) -> unsigned
+  {
+    uint16_t addr = cpu.getAbsoluteAddress() + cpu.x_;
+    cpu.write(addr, cpu.a_);
+    return 5; //cycles
+  });
+
+  // STA abs,y
+  addInstruction(op_table, 0x99, "STA abs,y", 3, [](Mos6502Core& cpu) -> unsigned
+  {
+    uint16_t addr = cpu.getAbsoluteAddress() + cpu.y_;
+    cpu.write(addr, cpu.a_);
+    return 5; //cycles
+  });
+
+  // STX zeropage
+  addInstruction(op_table, 0x86, "STX zpg", 2, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.write(cpu.instr_[1], cpu.x_);
+    return 3; //cycles
+  });
+
+  // STY zeropage
+  addInstruction(op_table, 0x84, "STY zpg", 2, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.write(cpu.instr_[1], cpu.y_);
+    return 3; //cycles
+  });
+
+  // STY zeropage,x
+  addInstruction(op_table, 0x94, "STY zpg,x", 2, [](Mos6502Core& cpu) -> unsigned
+  {
+    uint16_t addr = (cpu.instr_[1] + cpu.x_) & 0xFF;
+    cpu.write(addr, cpu.y_);
+    return 4; //cycles
+  });
+
+  // STY absolute
+  addInstruction(op_table, 0x8C, "STY abs", 3, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.write(cpu.getAbsoluteAddress(), cpu.y_);
+    return 4; //cycles
+  });
+}
+
+template<typename BUS>
+constexpr void Mos6502Core<BUS>::addTransferInstructions(OpTable& op_table)
+{
+  // TXS move X to SP
+  addInstruction(op_table, 0x9A, "TXS", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.sp_ = cpu.transfer(cpu.x_);
+    return 2; //cycles
+  });
+
+  // TSX move SP to X
+  addInstruction(op_table, 0xBA, "TSX", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.x_ = cpu.transfer(cpu.sp_);
+    return 2; //cycles
+  });
+
+  // transfer x to a
+  addInstruction(op_table, 0x8A, "TXA", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.a_ = cpu.transfer(cpu.x_);
+    return 2; //cycles
+  });
+
+  // transfer A to X
+  addInstruction(op_table, 0xAA, "TAX", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.x_ = cpu.transfer(cpu.a_);
+    return 2; //cycles
+  });
+
+  // transfer A to Y
+  addInstruction(op_table, 0xA8, "TAY", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.y_ = cpu.transfer(cpu.a_);
+    return 2; //cycles
+  });
+
+  // transfer Y to A
+  addInstruction(op_table, 0x98, "TYA", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.a_ = cpu.transfer(cpu.y_);
+    return 2; //cycles
+  });
+}
+
+template<typename BUS>
+constexpr void Mos6502Core<BUS>::addSpecialInstructions(OpTable& op_table)
+{
+  // NOP (no operation)
+  addInstruction(op_table, 0xEA, "NOP", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    return 2;
+  });
+
+  // SEI set interupt disable
+  addInstruction(op_table, 0x78, "SEI", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.setFlag(FLAG_IRQ_DISABLE, true);
+    return 2;
+  });
+
+  // CLD clear decimal mode
+  addInstruction(op_table, 0xD8, "CLD", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.setFlag(FLAG_DECIMAL_MODE, false);
+    return 2;
+  });
+
+  // SEC set carry flag
+  addInstruction(op_table, 0x38, "SEC", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.setFlag(FLAG_CARRY, true);
+    return 2;
+  });
+
+  // clear carry flag
+  addInstruction(op_table, 0x18, "CLC", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.setFlag(FLAG_CARRY, false);
+    return 2;
+  });
+
+}
+
+
+template<typename BUS>
+constexpr void Mos6502Core<BUS>::addBranchInstructions(OpTable& op_table)
+{
+  // BNE Branching if not equal to zero
+  addInstruction(op_table, 0xD0, "BNE", 2, [](Mos6502Core& cpu) -> unsigned
+  {
+    // branch if not zero (not equal)
+    if (!cpu.zero())
+    {
+      return cpu.branch();
+    }
+    return 2;
+  });
+
+  // BEQ Branching if equal to zero
+  addInstruction(op_table, 0xF0, "BEQ", 2, [](Mos6502Core& cpu) -> unsigned
+  {
+    // branch zero (equal)
+    if (cpu.zero())
+    {
+      return cpu.branch();
+    }
+    return 2;
+  });
+
+  // BPL Branching if plus
+  addInstruction(op_table, 0x10, "BPL", 2, [](Mos6502Core& cpu) -> unsigned
+  {
+    // branch on N = 0
+    if (!cpu.negative())
+    {
+      return cpu.branch();
+    }
+    return 2;
+  });
+
+  // BMI Branching if minus
+  addInstruction(op_table, 0x30, "BMI", 2, [](Mos6502Core& cpu) -> unsigned
+  {
+    // branch on N = 1
+    if (cpu.negative())
+    {
+      return cpu.branch();
+    }
+    return 2;
+  });
+
+  // BCS Branching if carry set
+  addInstruction(op_table, 0xB0, "BCS", 2, [](Mos6502Core& cpu) -> unsigned
+  {
+    // branch on c = 1
+    if (cpu.carry())
+    {
+      return cpu.branch();
+    }
+    return 2;
+  });
+
+  // BCC Branching if carry set
+  addInstruction(op_table, 0x90, "BCC", 2, [](Mos6502Core& cpu) -> unsigned
+  {
+    // branch on c = 0
+    if (!cpu.carry())
+    {
+      return cpu.branch();
+    }
+    return 2;
+  });
+
+  // BVC Branching overflow clear
+  addInstruction(op_table, 0x50, "BVC", 2, [](Mos6502Core& cpu) -> unsigned
+  {
+    // branch on V = 0
+    if (!cpu.overflow())
+    {
+      return cpu.branch();
+    }
+    return 2;
+  });
+
+  // BVS Branching overflow set
+  addInstruction(op_table, 0x70, "BVS", 2, [](Mos6502Core& cpu) -> unsigned
+  {
+    // branch on V = 1
+    if (cpu.overflow())
+    {
+      return cpu.branch();
+    }
+    return 2;
+  });
+
+  // JSR Jump to New Location Saving Return Address
+  addInstruction(op_table, 0x20, "JSR", 3, [](Mos6502Core& cpu) -> unsigned
+  {
+    uint16_t stack_addr = 0x100 + cpu.sp_;
+    // PC is incremented by +3 before this function is called
+    // however 6502 will store PC+2 to stack (not PC+3) which would be next instruction
+    uint16_t ret_addr = cpu.pc_ - 1;
+    cpu.write(stack_addr, ret_addr >> 8);
+    cpu.write(stack_addr - 1, ret_addr & 0xff );
+
+    cpu.sp_ -= 2;
+    cpu.pc_ =  (cpu.instr_[2] << 8  ) + cpu.instr_[1] ;
+    return 6; //cycles
+  });
+
+  // Return from subroutine
+  addInstruction(op_table, 0x60, "RTS", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    uint16_t stack_addr = 0x100 + cpu.sp_;
+    uint16_t ret_addr = cpu.pc_ + 2;
+    uint8_t pcl = cpu.read(stack_addr + 1);
+    uint8_t pch = cpu.read(stack_addr + 2);
+    cpu.sp_ += 2;
+    // return to address on stack +1
+    cpu.pc_ = ((pch << 8) | pcl) + 1;
+    return 6; //cycles
+  });
+
+
+  // jmp absolute
+  addInstruction(op_table, 0x4C, "JMP", 3, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.pc_ = (cpu.instr_[2] << 8) | cpu.instr_[1];
+    return 3; //cycles
+  });
+}
+
+
+template<typename BUS>
+constexpr void Mos6502Core<BUS>::addStackInstructions(OpTable& op_table)
+{
+  // Push accumulator onto stack
+  addInstruction(op_table, 0x48, "PHA", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    uint16_t write_addr = 0x100 + cpu.sp_;
+    cpu.write(write_addr, cpu.a_);
+    cpu.sp_ -= 1;
+    return 3; //cycles
+  });
+
+  // Pull accumulator from stack
+  addInstruction(op_table, 0x68, "PLA", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.sp_ += 1;
+    uint16_t read_addr = 0x100 + cpu.sp_;
+    cpu.a_ = cpu.read(read_addr);
+    cpu.updateNZ(cpu.a_);
+    return 3; //cycles
+  });
+}
+
+
+template<typename BUS>
+constexpr void Mos6502Core<BUS>::addCompareInstructions(OpTable& op_table)
+{
+  // compare A
+  auto cmp_op = [](Mos6502Core& cpu, uint8_t operand)
+  {
+    cpu.compareFlags(cpu.a_, operand);
+  };
+
+  /*
+  addressing	assembler	opc	bytes	cycles
+  immediate	CMP #oper	C9	2	2
+  zeropage	CMP oper	C5	2	3
+  zeropage,X	CMP oper,X	D5	2	4
+  absolute	CMP oper	CD	3	4
+  absolute,X	CMP oper,X	DD	3	4*
+  absolute,Y	CMP oper,Y	D9	3	4*
+  (indirect,X)	CMP (oper,X)	C1	2	6
+  (indirect),Y	CMP (oper),Y	D1	2	5*
+  */
+  addInstructionImmediate(op_table, 0xC9, "CMP #", cmp_op);
+  addInstructionZeroPage(op_table, 0xC5, "CMP zpg", cmp_op);
+  addInstructionZeroPageX(op_table, 0xD5, "CMP zpg,x", cmp_op);
+  addInstructionAbsolute(op_table, 0xCD, "CMP abs", cmp_op);
+  addInstructionAbsoluteX(op_table, 0xDD, "CMP abs,x", cmp_op);
+  addInstructionAbsoluteY(op_table, 0xD9, "CMP abs,y", cmp_op);
+  addInstructionIndirectX(op_table, 0xC1, "CMP (indirect,x)", cmp_op);
+  addInstructionIndirectY(op_table, 0xD1, "CMP (indirect),y", cmp_op);
+
+  /*
+  Compare Memory and Index X
+  X - M
+  N	Z	C	I	D	V
+  +	+	+	-	-	-
+  addressing	assembler	opc	bytes	cycles
+  immediate	CPX #oper	E0	2	2
+  zeropage	CPX oper	E4	2	3
+  absolute	CPX oper	EC	3	4
+  */
+  auto cpx_op = [](Mos6502Core& cpu, uint8_t operand)
+  {
+    cpu.compareFlags(cpu.x_, operand);
+  };
+  addInstructionImmediate(op_table, 0xE0, "CPX #", cpx_op);
+  addInstructionZeroPage(op_table, 0xE4, "CPX zpg", cpx_op);
+  addInstructionAbsolute(op_table, 0xEC, "CPX abs", cpx_op);
+
+  /*
+    Compare Memory and Index Y
+    Y - M
+    N	Z	C	I	D	V
+    +	+	+	-	-	-
+    addressing	assembler	opc	bytes	cycles
+    immediate	CPY #oper	C0	2	2
+    zeropage	CPY oper	C4	2	3
+    absolute	CPY oper	CC	3	4
+  */
+  auto cpy_op = [](Mos6502Core& cpu, uint8_t operand)
+  {
+    cpu.compareFlags(cpu.y_, operand);
+  };
+  addInstructionImmediate(op_table, 0xC0, "CPY #", cpy_op);
+  addInstructionZeroPage(op_table, 0xC4, "CPY zpg", cpy_op);
+  addInstructionAbsolute(op_table, 0xCC, "CPY abs", cpy_op);
+}
+
+template<typename BUS>
+constexpr void Mos6502Core<BUS>::addShiftAndRotateInstructions(OpTable& op_table)
+{
+  /*
+  Arithmetic Shift Left
+  C <- [76543210] <- 0
+  N	Z	C	I	D	V
+  +	+	+	-	-	-
+  addressing	assembler	opc	bytes	cycles
+  accumulator	ASL A	0A	1	2
+  zeropage	ASL oper	06	2	5
+  zeropage,X	ASL oper,X	16	2	6
+  absolute	ASL oper	0E	3	6
+  absolute,X	ASL oper,X	1E	3	7
+  */
+  auto asl_op = [](Mos6502Core& cpu, uint8_t operand) -> uint8_t
+  {
+    cpu.setFlag(FLAG_CARRY, operand & 0x80);
+    operand <<= 1;
+    cpu.updateNZ(operand);
+    return operand;
+  };
+  addInstructionUnaryA(op_table, 0x0A, "ASL A", asl_op);
+  addInstructionUnaryZeroPage(op_table, 0x06, "ASL zpg", asl_op);
+  addInstructionUnaryZeroPageX(op_table, 0x16, "ASL zpg,x", asl_op);
+  addInstructionUnaryAbsolute(op_table, 0x0E, "ASL abs", asl_op);
+  addInstructionUnaryAbsoluteX(op_table, 0x1E, "ASL abs,x", asl_op);
+
+  // arithmatic shift right accumulator
+  addInstruction(op_table, 0x4A, "LSR", 1, [](Mos6502Core& cpu) -> unsigned
+  {
+    cpu.setFlag(FLAG_CARRY, cpu.a_ & 1);
+    cpu.a_ >>= 1;
+    cpu.updateNZ(cpu.a_);
+    return 2; //cycles
+  });
+
+  /*
+  Rotate One Bit Right (Memory or Accumulator)
+  C -> [76543210] -> C
+  N	Z	C	I	D	V
+  +	+	+	-	-	-
+  addressing	assembler	opc	bytes	cycles
+  accumulator	ROR A	6A	1	2
+  zeropage	ROR oper	66	2	5
+  zeropage,X	ROR oper,X	76	2	6
+  absolute	ROR oper	6E	3	6
+  absolute,X	ROR oper,X	7E	3	7
+  */
+  auto ror_op = [](Mos6502Core& cpu, uint8_t operand) -> uint8_t
+  {
+    bool carry_out = operand & 1;
+    operand >>= 1;
+    operand |= cpu.carry() ? 0x80 : 0;
+    cpu.setFlag(FLAG_CARRY, carry_out);
+    cpu.updateNZ(operand);
+    return operand;
+  };
+  addInstructionUnaryA(op_table, 0x6A, "ROR A", ror_op);
+  addInstructionUnaryZeroPage(op_table, 0x66, "ROR zpg", ror_op);
+  addInstructionUnaryZeroPageX(op_table, 0x76, "ROR zpg,x", ror_op);
+  addInstructionUnaryAbsolute(op_table, 0x6E, "ROR abs", ror_op);
+  addInstructionUnaryAbsoluteX(op_table, 0x7E, "ROR abs,x", ror_op);
+
+  /*
+  C <- [76543210] <- C
+  N	Z	C	I	D	V
+  +	+	+	-	-	-
+  addressing	assembler	opc	bytes	cycles
+  accumulator	ROL A	2A	1	2
+  zeropage	ROL oper	26	2	5
+  zeropage,X	ROL oper,X	36	2	6
+  absolute	ROL oper	2E	3	6
+  absolute,X	ROL oper,X	3E	3	7
+  */
+  auto rol_op = [](Mos6502Core& cpu, uint8_t operand) -> uint8_t
+  {
+    bool carry_out = operand & 0x80;
+    operand <<= 1;
+    operand |= cpu.carry() ? 1 : 0;
+    cpu.setFlag(FLAG_CARRY, carry_out);
+    cpu.updateNZ(operand);
+    return operand;
+  };
+  addInstructionUnaryA(op_table, 0x2A, "ROL A", rol_op);
+  addInstructionUnaryZeroPage(op_table, 0x26, "ROL zpg", rol_op);
+  addInstructionUnaryZeroPageX(op_table, 0x36, "ROL zpg,x", rol_op);
+  addInstructionUnaryAbsolute(op_table, 0x2E, "ROL abs", rol_op);
+  addInstructionUnaryAbsoluteX(op_table, 0x3E, "ROL abs,x", rol_op);
+}
+
+
+template<typename BUS>
+constexpr void Mos6502Core<BUS>::addLogicalInstructions(OpTable& op_table)
+{
+  // Logical And
+  /*
+  addressing	assembler	opc	bytes	cycles
+  immediate	AND #oper	29	2	2
+  zeropage	AND oper	25	2	3
+  zeropage,X	AND oper,X	35	2	4
+  absolute	AND oper	2D	3	4
+  absolute,X	AND oper,X	3D	3	4*
+  absolute,Y	AND oper,Y	39	3	4*
+  (indirect,X)	AND (oper,X)	21	2	6
+  (indirect),Y	AND (oper),Y	31	2	5*
+  */
+  auto and_op = [](Mos6502Core& cpu, uint8_t operand)
+  {
+    cpu.a_ &= operand;
+    cpu.updateNZ(cpu.a_);
+  };
+  addInstructionImmediate(op_table, 0x29, "AND #", and_op);
+  addInstructionZeroPage(op_table, 0x25, "AND zpg", and_op);
+  addInstructionZeroPageX(op_table, 0x35, "AND zpg,x", and_op);
+  addInstructionAbsolute(op_table, 0x2D, "AND abs", and_op);
+  addInstructionAbsoluteX(op_table, 0x3D, "AND abs,x", and_op);
+  addInstructionAbsoluteX(op_table, 0x39, "AND abs,y", and_op);
+  addInstructionIndirectX(op_table, 0x21, "AND (indirect),x", and_op);
+  addInstructionIndirectY(op_table, 0x31, "AND (indirect,y)", and_op);
+
+  // Logical Or
+  auto or_op = [](Mos6502Core& cpu, uint8_t operand)
+  {
+    cpu.a_ |= operand;
+    cpu.updateNZ(cpu.a_);
+  };
+  addInstructionImmediate(op_table, 0x09, "ORA #", or_op);
+  addInstructionZeroPage(op_table, 0x05, "ORA zpg", or_op);
+
+  // Exclusive or
+  auto eor_op = [](Mos6502Core& cpu, uint8_t operand)
+  {
+    cpu.a_ ^= operand;
+    cpu.updateNZ(cpu.a_);
+  };
+  addInstructionImmediate(op_table, 0x49, "EOR #", eor_op);
+  addInstructionZeroPage(op_table, 0x45, "EOR zpg", eor_op);
+
+  /*
+  A AND M -> Z, M7 -> N, M6 -> V
+  N	Z	C	I	D	V
+  M7	+	-	-	-	M6
+  addressing	assembler	opc	bytes	cycles
+  zeropage	BIT oper	24	2	3
+  absolute	BIT oper	2C	3	4
+  */
+  auto bit_op = [](Mos6502Core& cpu, uint8_t operand)
+  {
+    cpu.setNZ(operand & 0x80, (cpu.a_ & operand) == 0);
+    cpu.setFlag(FLAG_OVERFLOW, operand & 0x40);
+  };
+  addInstructionZeroPage(op_table, 0x24, "BIT zpg", bit_op);
+  addInstructionAbsolute(op_table, 0x2C, "BIT abs", bit_op);
+
+}
+
+#endif  // ATARI2600_MOS6502_IMPL_HPP_GUARD
@@ -0,0 +1,620 @@
+#include "mos6502_jit.hpp"
+
+#include <cstddef>
+#include <stdexcept>
+
+#ifdef ATARI2600_JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+
+// x86-64 registers, numbered as they are encoded
+enum Reg : uint8_t
+{
+  EAX = 0,
+  ECX = 1,
+  EDX = 2,
+  ESI = 6,
+  EDI = 7,
+  R8 = 8,
+  R9 = 9,
+  R10 = 10,
+  R11 = 11
+};
+
+// Where 6502 state is kept while a block runs, all caller saved so nothing has to be pushed.
+// Registers hold 8-bit values zero extended to 32 bits, 8-bit operations leave upper bits alone.
+constexpr Reg REG_A = R8;
+constexpr Reg REG_X = R9;
+constexpr Reg REG_Y = R10;
+constexpr Reg REG_CARRY = R11;
+constexpr Reg REG_OVERFLOW = EDX;
+constexpr Reg REG_NZ = ECX;
+constexpr Reg REG_SCRATCH = EAX;
+// Arguments of Block::Func
+constexpr Reg REG_REGS = EDI;
+constexpr Reg REG_RAM = ESI;
+
+// x86 condition codes
+enum Cond : uint8_t
+{
+  COND_O = 0x0,
+  COND_C = 0x2,
+  COND_NC = 0x3,
+  COND_Z = 0x4,
+  COND_NZ = 0x5
+};
+
+/**
+ * Encodes the handful of x86-64 instructions compiled blocks are made of
+ * Byte registers are only ever AL, CL, DL or R8B-R11B, which don't need a REX prefix to tell them from AH-BH
+ */
+class Emitter
+{
+public:
+  std::vector<uint8_t> code_;
+
+  // mov dst, imm32
+  void movImm(Reg dst, uint32_t imm)
+  {
+    rex(0, dst);
+    byte(0xB8 + (dst & 7));
+    imm32(imm);
+  }
+
+  // mov dst, src (32-bit)
+  void movReg(Reg dst, Reg src)
+  {
+    rex(src, dst);
+    byte(0x89);
+    modrmReg(src, dst);
+  }
+
+  // movzx dst, byte [base + disp]
+  void loadByte(Reg dst, Reg base, int32_t disp)
+  {
+    rex(dst, base);
+    byte(0x0F);
+    byte(0xB6);
+    modrmMem(dst, base, disp);
+  }
+
+  // mov byte [base + disp], src
+  void storeByte(Reg src, Reg base, int32_t disp)
+  {
+    rex(src, base);
+    byte(0x88);
+    modrmMem(src, base, disp);
+  }
+
+  // mov word [base + disp], imm16
+  void storeWord(Reg base, int32_t disp, uint16_t imm)
+  {
+    byte(0x66);
+    rex(0, base);
+    byte(0xC7);
+    modrmMem(0, base, disp);
+    byte(imm & 0xFF);
+    byte(imm >> 8);
+  }
+
+  // 8-bit ALU operation on dst with imm8, digit selects operation (add 0, or 1, adc 2, sbb 3, and 4, sub 5, xor 6)
+  void aluImm(uint8_t digit, Reg dst, uint8_t imm)
+  {
+    rex(0, dst);
+    byte(0x80);
+    modrmReg(digit, dst);
+    byte(imm);
+  }
+
+  // 8-bit ALU operation on dst with byte [base + disp], opcode is the "r8, r/m8" form
+  void aluMem(uint8_t opcode, Reg dst, Reg base, int32_t disp)
+  {
+    rex(dst, base);
+    byte(opcode);
+    modrmMem(dst, base, disp);
+  }
+
+  // inc (digit 0) or dec (digit 1) of byte [base + disp]
+  void incDecMem(uint8_t digit, Reg base, int32_t disp)
+  {
+    rex(0, base);
+    byte(0xFE);
+    modrmMem(digit, base, disp);
+  }
+
+  // inc (digit 0) or dec (digit 1) of low byte of reg
+  void incDecReg(uint8_t digit, Reg reg)
+  {
+    rex(0, reg);
+    byte(0xFE);
+    modrmReg(digit, reg);
+  }
+
+  // CF = bit 0 of reg
+  void bitToCarry(Reg reg)
+  {
+    rex(0, reg);
+    byte(0x0F);
+    byte(0xBA);
+    modrmReg(4, reg);
+    byte(0);
+  }
+
+  // complement CF
+  void cmc()
+  {
+    byte(0xF5);
+  }
+
+  // low byte of reg = condition
+  void setcc(Cond cond, Reg reg)
+  {
+    rex(0, reg);
+    byte(0x0F);
+    byte(0x90 | cond);
+    modrmReg(0, reg);
+  }
+
+  // test reg, reg
+  void test(Reg reg)
+  {
+    rex(reg, reg);
+    byte(0x85);
+    modrmReg(reg, reg);
+  }
+
+  // test low byte of reg, imm8
+  void testImm(Reg reg, uint8_t imm)
+  {
+    rex(0, reg);
+    byte(0xF6);
+    modrmReg(0, reg);
+    byte(imm);
+  }
+
+  // jcc rel32, returns offset of rel32 to patch once target is known
+  size_t jcc(Cond cond)
+  {
+    byte(0x0F);
+    byte(0x80 | cond);
+    imm32(0);
+    return code_.size() - 4;
+  }
+
+  // point jump at patch to current end of code
+  void patch(size_t patch_offset)
+  {
+    const uint32_t rel = code_.size() - (patch_offset + 4);
+    for (unsigned ii = 0; ii < 4; ++ii)
+    {
+      code_[patch_offset + ii] = rel >> (8 * ii);
+    }
+  }
+
+  void ret()
+  {
+    byte(0xC3);
+  }
+
+protected:
+  void byte(uint8_t value)
+  {
+    code_.push_back(value);
+  }
+
+  void imm32(uint32_t value)
+  {
+    for (unsigned ii = 0; ii < 4; ++ii)
+    {
+      byte(value >> (8 * ii));
+    }
+  }
+
+  // REX prefix for registers 8-15, if any are used
+  void rex(unsigned reg, unsigned rm)
+  {
+    const uint8_t prefix = 0x40 | ((reg >> 3) << 2) | (rm >> 3);
+    if (prefix != 0x40)
+    {
+      byte(prefix);
+    }
+  }
+
+  void modrmReg(unsigned reg, unsigned rm)
+  {
+    byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+  }
+
+  // [base + disp32], base is never RSP or R12, which would need a SIB byte
+  void modrmMem(unsigned reg, unsigned base, int32_t disp)
+  {
+    byte(0x80 | ((reg & 7) << 3) | (base & 7));
+    imm32(disp);
+  }
+};
+
+enum class Kind : uint8_t
+{
+  LOAD_IMM,
+  LOAD_ZP,
+  STORE_ZP,
+  INC_ZP,
+  DEC_ZP,
+  TRANSFER,
+  INC_REG,
+  DEC_REG,
+  NOP,
+  CLC,
+  SEC,
+  ALU_IMM,
+  ALU_ZP,
+  BRANCH,
+  JMP
+};
+
+enum class Alu : uint8_t
+{
+  AND,
+  ORA,
+  EOR,
+  ADC,
+  SBC,
+  CMP
+};
+
+/**
+ * Instruction that can be compiled, with same length and cycles as interpreter's
+ */
+struct JitOp
+{
+  Kind kind;
+  uint8_t len;
+  uint8_t cycles;
+  // register instruction works on, and source register of transfers
+  Reg reg = REG_A;
+  Reg src = REG_A;
+  Alu alu = Alu::AND;
+  // branches test reg (with mask for N), taken_if_set tells if branch is taken when flag is set
+  uint8_t mask = 0;
+  bool taken_if_set = false;
+};
+
+bool decodeOp(uint8_t op_code, JitOp& op)
+{
+  auto branch = [&op](Reg reg, uint8_t mask, bool taken_if_set)
+  {
+    op = JitOp{Kind::BRANCH, 2, 2, reg};
+    op.mask = mask;
+    op.taken_if_set = taken_if_set;
+  };
+  auto alu = [&op](Kind kind, Alu alu, Reg reg = REG_A)
+  {
+    op = JitOp{kind, 2, static_cast<uint8_t>((kind == Kind::ALU_IMM) ? 2 : 3), reg};
+    op.alu = alu;
+  };
+  auto transfer = [&op](Reg dst, Reg src)
+  {
+    op = JitOp{Kind::TRANSFER, 1, 2, dst};
+    op.src = src;
+  };
+
+  switch (op_code)
+  {
+    case 0xA9: op = JitOp{Kind::LOAD_IMM, 2, 2, REG_A}; return true;
+    case 0xA2: op = JitOp{Kind::LOAD_IMM, 2, 2, REG_X}; return true;
+    case 0xA0: op = JitOp{Kind::LOAD_IMM, 2, 2, REG_Y}; return true;
+    case 0xA5: op = JitOp{Kind::LOAD_ZP, 2, 3, REG_A}; return true;
+    case 0xA6: op = JitOp{Kind::LOAD_ZP, 2, 3, REG_X}; return true;
+    case 0xA4: op = JitOp{Kind::LOAD_ZP, 2, 3, REG_Y}; return true;
+    case 0x85: op = JitOp{Kind::STORE_ZP, 2, 3, REG_A}; return true;
+    case 0x86: op = JitOp{Kind::STORE_ZP, 2, 3, REG_X}; return true;
+    case 0x84: op = JitOp{Kind::STORE_ZP, 2, 3, REG_Y}; return true;
+    case 0xE6: op = JitOp{Kind::INC_ZP, 2, 5}; return true;
+    case 0xC6: op = JitOp{Kind::DEC_ZP, 2, 5}; return true;
+    case 0xAA: transfer(REG_X, REG_A); return true;
+    case 0xA8: transfer(REG_Y, REG_A); return true;
+    case 0x8A: transfer(REG_A, REG_X); return true;
+    case 0x98: transfer(REG_A, REG_Y); return true;
+    case 0xE8: op = JitOp{Kind::INC_REG, 1, 2, REG_X}; return true;
+    case 0xC8: op = JitOp{Kind::INC_REG, 1, 2, REG_Y}; return true;
+    case 0xCA: op = JitOp{Kind::DEC_REG, 1, 2, REG_X}; return true;
+    case 0x88: op = JitOp{Kind::DEC_REG, 1, 2, REG_Y}; return true;
+    case 0xEA: op = JitOp{Kind::NOP, 1, 2}; return true;
+    case 0x18: op = JitOp{Kind::CLC, 1, 2}; return true;
+    case 0x38: op = JitOp{Kind::SEC, 1, 2}; return true;
+    case 0x29: alu(Kind::ALU_IMM, Alu::AND); return true;
+    case 0x25: alu(Kind::ALU_ZP, Alu::AND); return true;
+    case 0x09: alu(Kind::ALU_IMM, Alu::ORA); return true;
+    case 0x05: alu(Kind::ALU_ZP, Alu::ORA); return true;
+    case 0x49: alu(Kind::ALU_IMM, Alu::EOR); return true;
+    case 0x45: alu(Kind::ALU_ZP, Alu::EOR); return true;
+    case 0x69: alu(Kind::ALU_IMM, Alu::ADC); return true;
+    case 0x65: alu(Kind::ALU_ZP, Alu::ADC); return true;
+    case 0xE9: alu(Kind::ALU_IMM, Alu::SBC); return true;
+    case 0xE5: alu(Kind::ALU_ZP, Alu::SBC); return true;
+    case 0xC9: alu(Kind::ALU_IMM, Alu::CMP); return true;
+    case 0xC5: alu(Kind::ALU_ZP, Alu::CMP); return true;
+    case 0xE0: alu(Kind::ALU_IMM, Alu::CMP, REG_X); return true;
+    case 0xE4: alu(Kind::ALU_ZP, Alu::CMP, REG_X); return true;
+    case 0xC0: alu(Kind::ALU_IMM, Alu::CMP, REG_Y); return true;
+    case 0xC4: alu(Kind::ALU_ZP, Alu::CMP, REG_Y); return true;
+    case 0x10: branch(REG_NZ, 0x80, false); return true;  // BPL
+    case 0x30: branch(REG_NZ, 0x80, true); return true;   // BMI
+    case 0x50: branch(REG_OVERFLOW, 0, false); return true;  // BVC
+    case 0x70: branch(REG_OVERFLOW, 0, true); return true;   // BVS
+    case 0x90: branch(REG_CARRY, 0, false); return true;  // BCC
+    case 0xB0: branch(REG_CARRY, 0, true); return true;   // BCS
+    // Z is set when NZ result is 0, so BNE is taken when test finds bits set
+    case 0xD0: branch(REG_NZ, 0, true); return true;   // BNE
+    case 0xF0: branch(REG_NZ, 0, false); return true;  // BEQ
+    case 0x4C: op = JitOp{Kind::JMP, 3, 3}; return true;
+    default:
+      return false;
+  }
+}
+
+bool usesZeroPage(Kind kind)
+{
+  return (kind == Kind::LOAD_ZP) or (kind == Kind::STORE_ZP) or (kind == Kind::INC_ZP) or
+    (kind == Kind::DEC_ZP) or (kind == Kind::ALU_ZP);
+}
+
+// Store registers back to Mos6502JitRegs, and return cycles
+void emitExit(Emitter& emitter, uint16_t pc, unsigned cycles)
+{
+  emitter.storeByte(REG_A, REG_REGS, offsetof(Mos6502JitRegs, a));
+  emitter.storeByte(REG_X, REG_REGS, offsetof(Mos6502JitRegs, x));
+  emitter.storeByte(REG_Y, REG_REGS, offsetof(Mos6502JitRegs, y));
+  emitter.storeByte(REG_CARRY, REG_REGS, offsetof(Mos6502JitRegs, carry));
+  emitter.storeByte(REG_OVERFLOW, REG_REGS, offsetof(Mos6502JitRegs, overflow));
+  emitter.storeByte(REG_NZ, REG_REGS, offsetof(Mos6502JitRegs, nz));
+  emitter.storeWord(REG_REGS, offsetof(Mos6502JitRegs, pc), pc);
+  emitter.movImm(EAX, cycles);
+  emitter.ret();
+}
+
+void emitAlu(Emitter& emitter, const JitOp& op, uint8_t operand)
+{
+  // r/m8 forms of the 8-bit ALU operations, and /digit of the imm8 forms
+  struct AluEncoding
+  {
+    uint8_t mem_opcode;
+    uint8_t imm_digit;
+  };
+  auto encode = [&emitter, &op, operand](AluEncoding encoding, Reg dst)
+  {
+    if (op.kind == Kind::ALU_IMM)
+    {
+      emitter.aluImm(encoding.imm_digit, dst, operand);
+    }
+    else
+    {
+      emitter.aluMem(encoding.mem_opcode, dst, REG_RAM, operand & 0x7F);
+    }
+  };
+
+  switch (op.alu)
+  {
+    case Alu::AND:
+      encode({0x22, 4}, REG_A);
+      break;
+    case Alu::ORA:
+      encode({0x0A, 1}, REG_A);
+      break;
+    case Alu::EOR:
+      encode({0x32, 6}, REG_A);
+      break;
+    case Alu::ADC:
+      // x86 carry and overflow out of an 8-bit adc are the same as 6502's
+      emitter.bitToCarry(REG_CARRY);
+      encode({0x12, 2}, REG_A);
+      emitter.setcc(COND_C, REG_CARRY);
+      emitter.setcc(COND_O, REG_OVERFLOW);
+      break;
+    case Alu::SBC:
+      // 6502 carry is an inverted borrow
+      emitter.bitToCarry(REG_CARRY);
+      emitter.cmc();
+      encode({0x1A, 3}, REG_A);
+      emitter.setcc(COND_NC, REG_CARRY);
+      emitter.setcc(COND_O, REG_OVERFLOW);
+      break;
+    case Alu::CMP:
+      // Subtraction that only keeps carry and result, V is left alone
+      emitter.movReg(REG_SCRATCH, op.reg);
+      encode({0x2A, 5}, REG_SCRATCH);
+      emitter.setcc(COND_NC, REG_CARRY);
+      emitter.movReg(REG_NZ, REG_SCRATCH);
+      return;
+  }
+  emitter.movReg(REG_NZ, REG_A);
+}
+
+}  // namespace
+
+Mos6502Jit::~Mos6502Jit()
+{
+#ifdef ATARI2600_JIT_X86_64
+  for (const Chunk& chunk : chunks_)
+  {
+    munmap(chunk.memory, CHUNK_SIZE);
+  }
+#endif
+}
+
+const Mos6502Jit::Block* Mos6502Jit::compile(const uint8_t* code, size_t size, uint16_t pc)
+{
+  if (!SUPPORTED)
+  {
+    return nullptr;
+  }
+
+  Block block{};
+  block.pc = pc;
+  block.final_instr = {-1, -1, -1};
+
+  Emitter emitter;
+  emitter.loadByte(REG_A, REG_REGS, offsetof(Mos6502JitRegs, a));
+  emitter.loadByte(REG_X, REG_REGS, offsetof(Mos6502JitRegs, x));
+  emitter.loadByte(REG_Y, REG_REGS, offsetof(Mos6502JitRegs, y));
+  emitter.loadByte(REG_CARRY, REG_REGS, offsetof(Mos6502JitRegs, carry));
+  emitter.loadByte(REG_OVERFLOW, REG_REGS, offsetof(Mos6502JitRegs, overflow));
+  emitter.loadByte(REG_NZ, REG_REGS, offsetof(Mos6502JitRegs, nz));
+
+  size_t offset = 0;
+  bool ended = false;
+  while (!ended and (offset < size))
+  {
+    JitOp op;
+    if (!decodeOp(code[offset], op) or (offset + op.len > size))
+    {
+      break;
+    }
+    const uint8_t operand = (op.len > 1) ? code[offset + 1] : 0;
+    // Zero page below 0x80 is TIA
+    if (usesZeroPage(op.kind) and (operand < 0x80))
+    {
+      break;
+    }
+    if ((op.kind == Kind::BRANCH) or (op.kind == Kind::JMP))
+    {
+      if (block.instruction_count == 0)
+      {
+        break;
+      }
+      ended = true;
+    }
+
+    for (unsigned ii = 0; ii < op.len; ++ii)
+    {
+      block.final_instr[ii] = code[offset + ii];
+    }
+    block.final_instr_len = op.len;
+    ++block.instruction_count;
+
+    const uint16_t next_pc = pc + offset + op.len;
+    const int32_t ram_offset = operand & 0x7F;
+    switch (op.kind)
+    {
+      case Kind::LOAD_IMM:
+        emitter.movImm(op.reg, operand);
+        emitter.movImm(REG_NZ, operand);
+        break;
+      case Kind::LOAD_ZP:
+        emitter.loadByte(op.reg, REG_RAM, ram_offset);
+        emitter.movReg(REG_NZ, op.reg);
+        break;
+      case Kind::STORE_ZP:
+        emitter.storeByte(op.reg, REG_RAM, ram_offset);
+        break;
+      case Kind::INC_ZP:
+      case Kind::DEC_ZP:
+        emitter.incDecMem((op.kind == Kind::INC_ZP) ? 0 : 1, REG_RAM, ram_offset);
+        emitter.loadByte(REG_NZ, REG_RAM, ram_offset);
+        break;
+      case Kind::TRANSFER:
+        emitter.movReg(op.reg, op.src);
+        emitter.movReg(REG_NZ, op.reg);
+        break;
+      case Kind::INC_REG:
+      case Kind::DEC_REG:
+        emitter.incDecReg((op.kind == Kind::INC_REG) ? 0 : 1, op.reg);
+        emitter.movReg(REG_NZ, op.reg);
+        break;
+      case Kind::NOP:
+        break;
+      case Kind::CLC:
+      case Kind::SEC:
+        emitter.movImm(REG_CARRY, (op.kind == Kind::SEC) ? 1 : 0);
+        break;
+      case Kind::ALU_IMM:
+      case Kind::ALU_ZP:
+        emitAlu(emitter, op, operand);
+        break;
+      case Kind::BRANCH:
+      {
+        const uint16_t target = next_pc + static_cast<int8_t>(operand);
+        // Taking a branch costs a cycle, and another one if it goes to another page
+        const unsigned taken_cycles = ((target & 0xFF00) == (next_pc & 0xFF00)) ? 3 : 4;
+        if (op.mask)
+        {
+          emitter.testImm(op.reg, op.mask);
+        }
+        else
+        {
+          emitter.test(op.reg);
+        }
+        const size_t taken = emitter.jcc(op.taken_if_set ? COND_NZ : COND_Z);
+        emitExit(emitter, next_pc, block.body_cycles + op.cycles);
+        emitter.patch(taken);
+        emitExit(emitter, target, block.body_cycles + taken_cycles);
+        block.max_cycles = block.body_cycles + 4;
+        break;
+      }
+      case Kind::JMP:
+        emitExit(emitter, code[offset + 1] | (code[offset + 2] << 8), block.body_cycles + op.cycles);
+        block.max_cycles = block.body_cycles + op.cycles;
+        break;
+    }
+    if (!ended)
+    {
+      block.body_cycles += op.cycles;
+    }
+    offset += op.len;
+  }
+
+  if (block.instruction_count < 2)
+  {
+    return nullptr;
+  }
+  if (!ended)
+  {
+    emitExit(emitter, pc + offset, block.body_cycles);
+    block.max_cycles = block.body_cycles;
+  }
+  block.func = install(emitter.code_);
+  blocks_.push_back(block);
+  return &blocks_.back();
+}
+
+Mos6502Jit::Block::Func Mos6502Jit::install(const std::vector<uint8_t>& machine_code)
+{
+#ifdef ATARI2600_JIT_X86_64
+  if (machine_code.size() > CHUNK_SIZE)
+  {
+    throw std::runtime_error("JIT block does not fit in a code chunk");
+  }
+  if (chunks_.empty() or (chunks_.back().used + machine_code.size() > CHUNK_SIZE))
+  {
+    void* memory = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+      throw std::runtime_error("Could not allocate JIT code memory");
+    }
+    chunks_.push_back(Chunk{static_cast<uint8_t*>(memory), 0});
+  }
+
+  // Code is never writable and executable at same time
+  Chunk& chunk = chunks_.back();
+  if ((chunk.used != 0) and (mprotect(chunk.memory, CHUNK_SIZE, PROT_READ | PROT_WRITE) != 0))
+  {
+    throw std::runtime_error("Could not make JIT code memory writable");
+  }
+  uint8_t* func = chunk.memory + chunk.used;
+  std::copy(machine_code.begin(), machine_code.end(), func);
+  if (mprotect(chunk.memory, CHUNK_SIZE, PROT_READ | PROT_EXEC) != 0)
+  {
+    throw std::runtime_error("Could not make JIT code memory executable");
+  }
+  // Keep functions 16 byte aligned
+  chunk.used += (machine_code.size() + 15) & ~size_t{15};
+  code_size_ += machine_code.size();
+  return reinterpret_cast<Block::Func>(func);
+#else
+  (void)machine_code;
+  return nullptr;
+#endif
+}
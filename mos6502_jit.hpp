@@ -0,0 +1,99 @@
+#ifndef ATARI2600_MOS6502_JIT_HPP_GUARD
+#define ATARI2600_MOS6502_JIT_HPP_GUARD
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#if defined(ATARI2600_JIT) && defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define ATARI2600_JIT_X86_64
+#endif
+
+/**
+ * 6502 registers handed to and from compiled code
+ */
+struct Mos6502JitRegs
+{
+  uint8_t a;
+  uint8_t x;
+  uint8_t y;
+  uint8_t carry;
+  uint8_t overflow;
+  // N and Z flags are kept lazily as the result byte they were last set from
+  uint8_t nz;
+  uint16_t pc;
+};
+
+/**
+ * Compiles straight line 6502 code into x86-64 machine code
+ *
+ * Only instructions that use registers, immediates and zero page RAM (0x80-0xFF) are compiled,
+ * ending with a branch or JMP. None of them can touch TIA, RIOT or cartridge, so whether a block
+ * can run without advancing them after each instruction only has to be checked before it starts.
+ * While a block runs, 6502 registers stay in host registers and N and Z are only worked out
+ * from last result when it exits.
+ */
+class Mos6502Jit
+{
+public:
+#ifdef ATARI2600_JIT_X86_64
+  static constexpr bool SUPPORTED = true;
+#else
+  static constexpr bool SUPPORTED = false;
+#endif
+
+  struct Block
+  {
+    // Returns cycles run, regs->pc is set to where block exited to. zero_page_ram holds 0x80-0xFF.
+    using Func = unsigned (*)(Mos6502JitRegs* regs, uint8_t* zero_page_ram);
+    Func func;
+    // address block was compiled for, branch targets and cycles are only right there
+    uint16_t pc;
+    unsigned instruction_count;
+    // cycles of all instructions before the branch or JMP ending block, and most cycles whole block can take
+    unsigned body_cycles;
+    unsigned max_cycles;
+    // CPU's instr_ after block, bytes that are -1 are left unchanged
+    std::array<int16_t, 3> final_instr;
+    uint8_t final_instr_len;
+  };
+
+  Mos6502Jit() = default;
+  ~Mos6502Jit();
+
+  Mos6502Jit(const Mos6502Jit&) = delete;
+  Mos6502Jit& operator=(const Mos6502Jit&) = delete;
+
+  /**
+   * @brief compile instructions at pc, from at most size bytes of code
+   * Returns nullptr if fewer than two instructions from start of code can be compiled.
+   * Block stays valid as long as JIT does.
+   */
+  const Block* compile(const uint8_t* code, size_t size, uint16_t pc);
+
+  // bytes of machine code generated
+  size_t codeSize() const
+  {
+    return code_size_;
+  }
+
+protected:
+  struct Chunk
+  {
+    uint8_t* memory;
+    size_t used;
+  };
+
+  static constexpr size_t CHUNK_SIZE = 64 << 10;
+
+  std::vector<Chunk> chunks_;
+  std::deque<Block> blocks_;
+  size_t code_size_ = 0;
+
+  // copy machine code into executable memory
+  Block::Func install(const std::vector<uint8_t>& machine_code);
+};
+
+#endif  // ATARI2600_MOS6502_JIT_HPP_GUARD
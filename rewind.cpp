@@ -0,0 +1,226 @@
+#include "rewind.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+RewindBuffer::RewindBuffer(size_t arena_size, unsigned keyframe_interval) :
+  arena_(std::max(arena_size, 4 * (sizeof(Atari2600State) + MAX_DELTA_SIZE))),
+  keyframe_interval_{std::max(keyframe_interval, 1u)}
+{
+}
+
+void RewindBuffer::push(const Atari2600& atari)
+{
+  Atari2600State state;
+  atari.saveState(state);
+  push(state, atari.tia_.frame_count_);
+}
+
+void RewindBuffer::push(const Atari2600State& state, unsigned frame)
+{
+  if (!entries_.empty() and (frame <= entries_.back().frame))
+  {
+    dropFrom(frame);
+  }
+
+  const uint8_t* state_bytes = reinterpret_cast<const uint8_t*>(&state);
+  std::array<uint8_t, MAX_DELTA_SIZE> delta;
+  bool keyframe = entries_.empty() or ((deltas_since_keyframe_ + 1) >= keyframe_interval_);
+  size_t size = sizeof(state);
+  if (!keyframe)
+  {
+    size = encodeDelta(reinterpret_cast<const uint8_t*>(&newest_state_), state_bytes, delta.data());
+    if (size >= sizeof(state))
+    {
+      // Delta is no smaller than state, keyframe takes no more room and is faster to seek to
+      keyframe = true;
+      size = sizeof(state);
+    }
+  }
+  size_t offset = allocate(size);
+  if (!keyframe and entries_.empty())
+  {
+    // Making room dropped the states delta was made against
+    keyframe = true;
+    size = sizeof(state);
+    offset = allocate(size);
+  }
+
+  std::memcpy(&arena_[offset], keyframe ? state_bytes : delta.data(), size);
+  entries_.push_back(Entry{frame, static_cast<uint32_t>(offset), static_cast<uint32_t>(size), keyframe});
+  head_ = offset + size;
+  used_bytes_ += size;
+  deltas_since_keyframe_ = keyframe ? 0 : (deltas_since_keyframe_ + 1);
+  newest_state_ = state;
+}
+
+bool RewindBuffer::seek(unsigned frame, Atari2600& atari) const
+{
+  Atari2600State state;
+  if (!getState(frame, state))
+  {
+    return false;
+  }
+  atari.loadState(state);
+  return true;
+}
+
+bool RewindBuffer::getState(unsigned frame, Atari2600State& state) const
+{
+  size_t index = findFrame(frame);
+  if (index == entries_.size())
+  {
+    return false;
+  }
+  decodeState(index, state);
+  return true;
+}
+
+void RewindBuffer::clear()
+{
+  entries_.clear();
+  head_ = 0;
+  used_bytes_ = 0;
+  deltas_since_keyframe_ = 0;
+}
+
+size_t RewindBuffer::encodeDelta(const uint8_t* prev, const uint8_t* cur, uint8_t* out)
+{
+  constexpr size_t STATE_SIZE = sizeof(Atari2600State);
+  size_t pos = 0;
+  size_t out_size = 0;
+  while (pos < STATE_SIZE)
+  {
+    size_t zeros = 0;
+    while (((pos + zeros) < STATE_SIZE) and (zeros < 255) and (prev[pos + zeros] == cur[pos + zeros]))
+    {
+      ++zeros;
+    }
+    pos += zeros;
+
+    size_t literals = 0;
+    while (((pos + literals) < STATE_SIZE) and (literals < 255) and (prev[pos + literals] != cur[pos + literals]))
+    {
+      ++literals;
+    }
+
+    out[out_size++] = zeros;
+    out[out_size++] = literals;
+    for (size_t ii = 0; ii < literals; ++ii, ++pos)
+    {
+      out[out_size++] = prev[pos] ^ cur[pos];
+    }
+  }
+  return out_size;
+}
+
+void RewindBuffer::applyDelta(const uint8_t* delta, size_t delta_size, uint8_t* state)
+{
+  size_t pos = 0;
+  size_t ii = 0;
+  while ((ii + 2) <= delta_size)
+  {
+    pos += delta[ii];
+    size_t literals = delta[ii + 1];
+    ii += 2;
+    for (size_t jj = 0; jj < literals; ++jj)
+    {
+      state[pos++] ^= delta[ii++];
+    }
+  }
+}
+
+size_t RewindBuffer::allocate(size_t size)
+{
+  while (!entries_.empty())
+  {
+    size_t tail = entries_.front().offset;
+    if (head_ > tail)
+    {
+      // Entries are in [tail, head_), use space after them, or wrap around to start of arena
+      if ((arena_.size() - head_) >= size)
+      {
+        return head_;
+      }
+      if (tail >= size)
+      {
+        return 0;
+      }
+    }
+    else if ((tail - head_) >= size)
+    {
+      // Entries have wrapped around, only space between head_ and tail is free
+      return head_;
+    }
+    dropOldest();
+  }
+  head_ = 0;
+  return 0;
+}
+
+void RewindBuffer::dropOldest()
+{
+  do
+  {
+    used_bytes_ -= entries_.front().size;
+    entries_.pop_front();
+  } while (!entries_.empty() and !entries_.front().keyframe);
+
+  if (entries_.empty())
+  {
+    clear();
+  }
+}
+
+void RewindBuffer::dropFrom(unsigned frame)
+{
+  while (!entries_.empty() and (entries_.back().frame >= frame))
+  {
+    used_bytes_ -= entries_.back().size;
+    entries_.pop_back();
+  }
+  if (entries_.empty())
+  {
+    clear();
+    return;
+  }
+
+  const Entry& newest = entries_.back();
+  head_ = newest.offset + newest.size;
+  decodeState(entries_.size() - 1, newest_state_);
+  deltas_since_keyframe_ = 0;
+  for (size_t index = entries_.size() - 1; !entries_[index].keyframe; --index)
+  {
+    ++deltas_since_keyframe_;
+  }
+}
+
+size_t RewindBuffer::findFrame(unsigned frame) const
+{
+  auto it = std::lower_bound(entries_.begin(), entries_.end(), frame,
+                             [](const Entry& entry, unsigned value) { return entry.frame < value; });
+  if ((it == entries_.end()) or (it->frame != frame))
+  {
+    return entries_.size();
+  }
+  return it - entries_.begin();
+}
+
+void RewindBuffer::decodeState(size_t index, Atari2600State& state) const
+{
+  size_t keyframe_index = index;
+  while (!entries_[keyframe_index].keyframe)
+  {
+    --keyframe_index;
+  }
+
+  uint8_t* state_bytes = reinterpret_cast<uint8_t*>(&state);
+  const Entry& keyframe = entries_[keyframe_index];
+  std::memcpy(state_bytes, &arena_[keyframe.offset], sizeof(state));
+  for (size_t ii = keyframe_index + 1; ii <= index; ++ii)
+  {
+    const Entry& entry = entries_[ii];
+    applyDelta(&arena_[entry.offset], entry.size, state_bytes);
+  }
+}
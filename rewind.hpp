@@ -0,0 +1,153 @@
+#ifndef ATARI2600_REWIND_HPP_GUARD
+#define ATARI2600_REWIND_HPP_GUARD
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "atari2600.hpp"
+
+/**
+ * History of Atari2600 states, one per frame, for stepping backwards
+ *
+ * Every keyframe_interval frames a whole Atari2600State is stored (keyframe), the frames
+ * in between only store how they differ from the frame before: state bytes XORed with
+ * previous state, with runs of zeros run-length encoded. A frame whose delta would be
+ * no smaller than a whole state is stored as a keyframe instead.
+ * Entries are packed into a fixed size arena, when it is full the oldest keyframe and
+ * the deltas that depend on it are dropped.
+ * Seeking restores a keyframe and applies at most keyframe_interval - 1 deltas.
+ */
+class RewindBuffer
+{
+public:
+  static constexpr size_t DEFAULT_ARENA_SIZE = 4 << 20;
+  static constexpr unsigned DEFAULT_KEYFRAME_INTERVAL = 30;
+
+  /**
+   * @brief arena_size is rounded up so at least a few keyframes fit
+   */
+  explicit RewindBuffer(size_t arena_size = DEFAULT_ARENA_SIZE, unsigned keyframe_interval = DEFAULT_KEYFRAME_INTERVAL);
+
+  /**
+   * @brief record state of atari as tia_.frame_count_
+   */
+  void push(const Atari2600& atari);
+
+  /**
+   * @brief record state as given frame number
+   * Frame numbers should increase, if frame is not after newest one, history
+   * from frame onwards is dropped first (for continuing after a seek)
+   */
+  void push(const Atari2600State& state, unsigned frame);
+
+  /**
+   * @brief restore state recorded for frame into atari
+   * Display is not part of state, it only catches up once the next frame is drawn
+   * Returns false if frame is not in buffer
+   */
+  bool seek(unsigned frame, Atari2600& atari) const;
+
+  /**
+   * @brief decode state recorded for frame, returns false if frame is not in buffer
+   */
+  bool getState(unsigned frame, Atari2600State& state) const;
+
+  void clear();
+
+  bool empty() const
+  {
+    return entries_.empty();
+  }
+
+  // number of frames in buffer
+  size_t size() const
+  {
+    return entries_.size();
+  }
+
+  // only valid when not empty
+  unsigned oldestFrame() const
+  {
+    return entries_.front().frame;
+  }
+
+  unsigned newestFrame() const
+  {
+    return entries_.back().frame;
+  }
+
+  // arena bytes holding keyframes and deltas
+  size_t usedBytes() const
+  {
+    return used_bytes_;
+  }
+
+  size_t arenaSize() const
+  {
+    return arena_.size();
+  }
+
+  unsigned keyframeInterval() const
+  {
+    return keyframe_interval_;
+  }
+
+  /**
+   * @brief XOR cur with prev and run-length encode zeros into out, returns encoded size
+   * Encoding is pairs of zero count and literal count (bytes), followed by literal bytes
+   * out must have room for MAX_DELTA_SIZE bytes
+   */
+  static size_t encodeDelta(const uint8_t* prev, const uint8_t* cur, uint8_t* out);
+
+  /**
+   * @brief XOR delta from encodeDelta into state, restoring state delta was made from
+   */
+  static void applyDelta(const uint8_t* delta, size_t delta_size, uint8_t* state);
+
+  // worst case is alternating zero and non-zero bytes, 3 encoded bytes for every 2
+  static constexpr size_t MAX_DELTA_SIZE = 2 * sizeof(Atari2600State);
+
+protected:
+  struct Entry
+  {
+    unsigned frame;
+    uint32_t offset;
+    uint32_t size;
+    bool keyframe;
+  };
+
+  std::vector<uint8_t> arena_;
+  std::deque<Entry> entries_;
+
+  // where next entry is written in arena
+  size_t head_ = 0;
+  size_t used_bytes_ = 0;
+
+  unsigned keyframe_interval_;
+  // deltas since newest keyframe
+  unsigned deltas_since_keyframe_ = 0;
+
+  // state of newest entry, next delta is made against this
+  Atari2600State newest_state_;
+
+  /**
+   * @brief find room for size bytes, dropping oldest keyframes and their deltas if needed
+   * Returns offset in arena
+   */
+  size_t allocate(size_t size);
+
+  // drops oldest keyframe and deltas up to next keyframe
+  void dropOldest();
+
+  // drops entries for frame and after it
+  void dropFrom(unsigned frame);
+
+  // index of entry with frame, or entries_.size() if there isn't one
+  size_t findFrame(unsigned frame) const;
+
+  void decodeState(size_t index, Atari2600State& state) const;
+};
+
+#endif  // ATARI2600_REWIND_HPP_GUARD
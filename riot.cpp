@@ -0,0 +1,185 @@
+#include "riot.hpp"
+
+#include <algorithm>
+
+Riot::Riot()
+{
+  std::fill(ram_.begin(), ram_.end(), 0);
+}
+
+uint8_t Riot::getIntim(uint64_t cycle) const
+{
+  // Timer is decremented on cycle after it is written, then once every interval
+  uint64_t elapsed = cycle - timer_start_cycle_;
+  uint64_t interval = uint64_t(1) << timer_shift_;
+  uint64_t ticks = (elapsed + interval - 1) >> timer_shift_;
+  if (ticks <= timer_start_value_)
+  {
+    return timer_start_value_ - ticks;
+  }
+  // After passing 0, timer counts down once per cycle from 0xFF
+  return 0xFF - ((cycle - getTimerExpireCycle()) & 0xFF);
+}
+
+uint64_t Riot::getIntimZeroCycle(uint64_t cycle) const
+{
+  // INTIM is 0 for one interval before it expires
+  uint64_t zero_start = timer_start_cycle_;
+  if (timer_start_value_ > 0)
+  {
+    zero_start += (static_cast<uint64_t>(timer_start_value_ - 1) << timer_shift_) + 1;
+  }
+  uint64_t expire_cycle = getTimerExpireCycle();
+  if (cycle < expire_cycle)
+  {
+    return std::max(cycle, zero_start);
+  }
+  // then every 256 cycles
+  uint64_t since_zero = (cycle - expire_cycle + 1) & 0xFF;
+  return (since_zero == 0) ? cycle : (cycle + 256 - since_zero);
+}
+
+uint8_t Riot::peek(uint16_t addr, uint64_t cycle) const
+{
+  if ((addr & 0x200) == 0)
+  {
+    return ram_[addr & 0x7F];
+  }
+
+  if (addr & 0x4)
+  {
+    // Timer, or TIMINT : Bit7 timer flag, Bit6 PA7 flag (not implemented)
+    if (addr & 0x1)
+    {
+      return getTimerFlag(cycle) ? 0x80 : 0x00;
+    }
+    return getIntim(cycle);
+  }
+
+  // Ports, pins set as outputs read back what was written to them
+  switch (addr & 0x3)
+  {
+    case 0:  // SWCHA
+      return (swcha_output_ & swacnt_) | (swcha_input_ & ~swacnt_);
+    case 1:  // SWACNT
+      return swacnt_;
+    case 2:  // SWCHB
+      return (swchb_output_ & swbcnt_) | (swchb_input_ & ~swbcnt_);
+    default:  // SWBCNT
+      return swbcnt_;
+  }
+}
+
+uint8_t Riot::read(uint16_t addr)
+{
+  // Reading INTIM clears timer flag
+  if ((addr & 0x205) == 0x204)
+  {
+    timer_irq_enable_ = addr & 0x8;
+    if (cycle_count_ >= getTimerExpireCycle())
+    {
+      timer_flag_cleared_ = true;
+    }
+  }
+  return peek(addr, cycle_count_);
+}
+
+void Riot::write(uint16_t addr, uint8_t data)
+{
+  if ((addr & 0x200) == 0)
+  {
+    ram_[addr & 0x7F] = data;
+    return;
+  }
+
+  if (addr & 0x4)
+  {
+    if (addr & 0x10)
+    {
+      // TIM1T, TIM8T, TIM64T, T1024T
+      static constexpr uint8_t interval_shifts[4] = {0, 3, 6, 10};
+      timer_start_cycle_ = cycle_count_;
+      timer_start_value_ = data;
+      timer_shift_ = interval_shifts[addr & 0x3];
+      timer_flag_cleared_ = false;
+      timer_irq_enable_ = addr & 0x8;
+    }
+    else
+    {
+      edge_control_ = addr & 0x3;
+    }
+    return;
+  }
+
+  switch (addr & 0x3)
+  {
+    case 0:
+      swcha_output_ = data;
+      break;
+    case 1:
+      swacnt_ = data;
+      break;
+    case 2:
+      swchb_output_ = data;
+      break;
+    default:
+      swbcnt_ = data;
+      break;
+  }
+}
+
+void Riot::saveState(RiotState& state) const
+{
+  state.cycle_count = cycle_count_;
+  state.timer_start_cycle = timer_start_cycle_;
+  std::copy(ram_.begin(), ram_.end(), state.ram);
+  state.swcha_input = swcha_input_;
+  state.swchb_input = swchb_input_;
+  state.swcha_output = swcha_output_;
+  state.swacnt = swacnt_;
+  state.swchb_output = swchb_output_;
+  state.swbcnt = swbcnt_;
+  state.timer_start_value = timer_start_value_;
+  state.timer_shift = timer_shift_;
+  state.timer_flag_cleared = timer_flag_cleared_;
+  state.timer_irq_enable = timer_irq_enable_;
+  state.edge_control = edge_control_;
+  std::fill(std::begin(state.reserved), std::end(state.reserved), 0);
+}
+
+void Riot::loadState(const RiotState& state)
+{
+  cycle_count_ = state.cycle_count;
+  timer_start_cycle_ = state.timer_start_cycle;
+  std::copy(state.ram, state.ram + ram_.size(), ram_.begin());
+  swcha_input_ = state.swcha_input;
+  swchb_input_ = state.swchb_input;
+  swcha_output_ = state.swcha_output;
+  swacnt_ = state.swacnt;
+  swchb_output_ = state.swchb_output;
+  swbcnt_ = state.swbcnt;
+  timer_start_value_ = state.timer_start_value;
+  timer_shift_ = state.timer_shift;
+  timer_flag_cleared_ = state.timer_flag_cleared;
+  timer_irq_enable_ = state.timer_irq_enable;
+  edge_control_ = state.edge_control;
+}
+
+const char* Riot::addrName(uint16_t addr)
+{
+  if ((addr & 0x200) == 0)
+  {
+    return "RAM";
+  }
+  if (addr & 0x4)
+  {
+    if (addr & 0x10)
+    {
+      static const char* timer_names[4] = {"TIM1T", "TIM8T", "TIM64T", "T1024T"};
+      return timer_names[addr & 0x3];
+    }
+    return (addr & 0x1) ? "TIMINT" : "INTIM";
+  }
+  static const char* port_names[4] = {"SWCHA", "SWACNT", "SWCHB", "SWBCNT"};
+  return port_names[addr & 0x3];
+}
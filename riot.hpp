@@ -0,0 +1,139 @@
+#ifndef ATARI2600_RIOT_HPP_GUARD
+#define ATARI2600_RIOT_HPP_GUARD
+
+#include <array>
+#include <cstdint>
+
+/**
+ * Fixed layout snapshot of RIOT, see Riot::saveState
+ */
+struct RiotState
+{
+  uint64_t cycle_count;
+  uint64_t timer_start_cycle;
+  uint8_t ram[128];
+  uint8_t swcha_input;
+  uint8_t swchb_input;
+  uint8_t swcha_output;
+  uint8_t swacnt;
+  uint8_t swchb_output;
+  uint8_t swbcnt;
+  uint8_t timer_start_value;
+  uint8_t timer_shift;
+  uint8_t timer_flag_cleared;
+  uint8_t timer_irq_enable;
+  uint8_t edge_control;
+  uint8_t reserved[5];
+};
+
+/**
+ * 6532 RAM-I/O-Timer (RIOT / PIA)
+ * https://alienbill.com/2600/101/docs/stella.html#pia
+ *
+ * Timer is not decremented every cycle, its value is computed from
+ * how many cycles have gone by since it was last written
+ */
+class Riot
+{
+public:
+  Riot();
+
+  enum
+  {
+    SWCHA_ADDR = 0x280,
+    SWACNT_ADDR = 0x281,
+    SWCHB_ADDR = 0x282,
+    SWBCNT_ADDR = 0x283,
+    INTIM_ADDR = 0x284,
+    TIMINT_ADDR = 0x285,
+    TIM1T_ADDR = 0x294,
+    TIM8T_ADDR = 0x295,
+    TIM64T_ADDR = 0x296,
+    T1024T_ADDR = 0x297
+  };
+
+  static const char* addrName(uint16_t addr);
+
+  // 128 bytes of RAM, at 0x80-0xFF (and mirrors)
+  std::array<uint8_t, 128> ram_;
+
+  // Levels on port pins, 0 = pressed
+  // SWCHA Bit7-4 : P0 right, left, down, up.  Bit3-0 : P1 right, left, down, up
+  uint8_t swcha_input_ = 0xFF;
+  // SWCHB Bit7 : P1 difficulty, Bit6 : P0 difficulty, Bit3 : color, Bit1 : select, Bit0 : reset
+  uint8_t swchb_input_ = 0x7F;
+
+  // Values written to port data and data direction registers (1 = output)
+  uint8_t swcha_output_ = 0;
+  uint8_t swacnt_ = 0;
+  uint8_t swchb_output_ = 0;
+  uint8_t swbcnt_ = 0;
+
+  // CPU cycles since power on
+  uint64_t cycle_count_ = 0;
+
+  // Timer state from last write to TIM1T/TIM8T/TIM64T/T1024T
+  uint64_t timer_start_cycle_ = 0;
+  uint8_t timer_start_value_ = 0;
+  // log2 of interval, 0, 3, 6 or 10
+  uint8_t timer_shift_ = 10;
+  // INTIM was read after timer expired, so interrupt flag has been cleared
+  bool timer_flag_cleared_ = false;
+  // A3 of last timer access, 6507 has no IRQ pin, so this is only kept for debugging
+  bool timer_irq_enable_ = false;
+
+  // Edge detect control, PA7 interrupt is not implemented
+  uint8_t edge_control_ = 0;
+
+  inline void advanceCycles(unsigned cycles)
+  {
+    cycle_count_ += cycles;
+  }
+
+  /**
+   * @brief INTIM value at given cycle, without side effects of reading it
+   */
+  uint8_t getIntim(uint64_t cycle) const;
+
+  uint8_t getIntim() const
+  {
+    return getIntim(cycle_count_);
+  }
+
+  /**
+   * @brief cycle on which timer counts down past 0 and interrupt flag is set
+   * After that timer keeps counting down once per cycle
+   */
+  uint64_t getTimerExpireCycle() const
+  {
+    return timer_start_cycle_ + 1 + (static_cast<uint64_t>(timer_start_value_) << timer_shift_);
+  }
+
+  bool getTimerFlag(uint64_t cycle) const
+  {
+    return (cycle >= getTimerExpireCycle()) and !timer_flag_cleared_;
+  }
+
+  bool getTimerFlag() const
+  {
+    return getTimerFlag(cycle_count_);
+  }
+
+  /**
+   * @brief first cycle, at or after cycle, that INTIM reads 0
+   */
+  uint64_t getIntimZeroCycle(uint64_t cycle) const;
+
+  /**
+   * @brief value read from addr at given cycle, without side effects of reading it
+   */
+  uint8_t peek(uint16_t addr, uint64_t cycle) const;
+
+  uint8_t read(uint16_t addr);
+  void write(uint16_t addr, uint8_t data);
+
+  void saveState(RiotState& state) const;
+  void loadState(const RiotState& state);
+};
+
+#endif  // ATARI2600_RIOT_HPP_GUARD
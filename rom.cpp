@@ -0,0 +1,188 @@
+#include "rom.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ATARI2600_ROM_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+RomImage::~RomImage()
+{
+#ifdef ATARI2600_ROM_MMAP
+  if (mapping_)
+  {
+    munmap(mapping_, size_);
+  }
+#endif
+}
+
+void RomImage::validateSize(size_t size)
+{
+  static constexpr size_t valid_sizes[] = {2 << 10, 4 << 10, 8 << 10, 12 << 10, 16 << 10, 32 << 10, 64 << 10};
+  if (std::find(std::begin(valid_sizes), std::end(valid_sizes), size) == std::end(valid_sizes))
+  {
+    throw std::runtime_error("ROM size of " + std::to_string(size) + " bytes is not a cartridge size");
+  }
+}
+
+uint64_t RomImage::computeHash(const uint8_t* data, size_t size)
+{
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t ii = 0; ii < size; ++ii)
+  {
+    hash = (hash ^ data[ii]) * 0x100000001b3;
+  }
+  return hash;
+}
+
+std::string RomImage::hashString() const
+{
+  std::ostringstream ss;
+  ss << std::hex << std::setw(16) << std::setfill('0') << hash_;
+  return ss.str();
+}
+
+std::shared_ptr<const RomImage> RomImage::fromBytes(std::vector<uint8_t> bytes)
+{
+  return ownBytes(std::move(bytes));
+}
+
+std::shared_ptr<RomImage> RomImage::ownBytes(std::vector<uint8_t> bytes)
+{
+  validateSize(bytes.size());
+  std::shared_ptr<RomImage> image{new RomImage};
+  image->bytes_ = std::move(bytes);
+  image->data_ = image->bytes_.data();
+  image->size_ = image->bytes_.size();
+  image->hash_ = computeHash(image->data_, image->size_);
+  return image;
+}
+
+std::shared_ptr<const RomImage> RomImage::mapFile(const std::string& path)
+{
+#ifdef ATARI2600_ROM_MMAP
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    throw std::runtime_error("ROM " + path + " could not be opened : " + std::strerror(errno));
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    ::close(fd);
+    throw std::runtime_error("ROM " + path + " could not be read : " + std::strerror(errno));
+  }
+  const size_t size = st.st_size;
+  try
+  {
+    validateSize(size);
+  }
+  catch (const std::runtime_error& ex)
+  {
+    ::close(fd);
+    throw std::runtime_error(path + " : " + ex.what());
+  }
+  void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // mapping stays valid after file is closed
+  ::close(fd);
+  if (mapping == MAP_FAILED)
+  {
+    throw std::runtime_error("ROM " + path + " could not be mapped : " + std::strerror(errno));
+  }
+
+  std::shared_ptr<RomImage> image{new RomImage};
+  image->mapping_ = mapping;
+  image->data_ = static_cast<const uint8_t*>(mapping);
+  image->size_ = size;
+  image->hash_ = computeHash(image->data_, image->size_);
+  image->path_ = path;
+  return image;
+#else
+  // No mmap, read whole file instead
+  std::ifstream input(path, std::ifstream::binary);
+  if (!input.good())
+  {
+    throw std::runtime_error("ROM " + path + " could not be opened");
+  }
+  std::vector<uint8_t> bytes{std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+  std::shared_ptr<RomImage> image = ownBytes(std::move(bytes));
+  image->path_ = path;
+  return image;
+#endif
+}
+
+std::shared_ptr<const RomImage> RomStore::open(const std::string& path)
+{
+  std::error_code ec;
+  const auto write_time = std::filesystem::last_write_time(path, ec);
+  const uintmax_t size = ec ? 0 : std::filesystem::file_size(path, ec);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  OpenedFile& file = files_[path];
+  if (!ec and (file.write_time == write_time) and (file.size == size))
+  {
+    if (std::shared_ptr<const RomImage> image = file.image.lock())
+    {
+      return image;
+    }
+  }
+  std::shared_ptr<const RomImage> image = addLocked(RomImage::mapFile(path));
+  file = OpenedFile{image, write_time, size};
+  return image;
+}
+
+std::shared_ptr<const RomImage> RomStore::add(std::shared_ptr<const RomImage> image)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return addLocked(std::move(image));
+}
+
+std::shared_ptr<const RomImage> RomStore::addLocked(std::shared_ptr<const RomImage> image)
+{
+  std::weak_ptr<const RomImage>& entry = images_[image->hash()];
+  std::shared_ptr<const RomImage> existing = entry.lock();
+  if (!existing)
+  {
+    entry = image;
+    // forget images that are no longer used, while lock is held anyway
+    for (auto it = images_.begin(); it != images_.end();)
+    {
+      it = it->second.expired() ? images_.erase(it) : std::next(it);
+    }
+    for (auto it = files_.begin(); it != files_.end();)
+    {
+      it = it->second.image.expired() ? files_.erase(it) : std::next(it);
+    }
+    return image;
+  }
+  if ((existing->size() == image->size()) and (std::memcmp(existing->data(), image->data(), image->size()) == 0))
+  {
+    return existing;
+  }
+  // Hash collision, new image just isn't shared
+  return image;
+}
+
+std::shared_ptr<const RomImage> RomStore::find(uint64_t hash) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = images_.find(hash);
+  return (it == images_.end()) ? nullptr : it->second.lock();
+}
+
+size_t RomStore::size() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return std::count_if(images_.begin(), images_.end(), [](const auto& entry) { return !entry.second.expired(); });
+}
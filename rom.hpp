@@ -0,0 +1,129 @@
+#ifndef ATARI2600_ROM_HPP_GUARD
+#define ATARI2600_ROM_HPP_GUARD
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Read-only cartridge image, memory mapped from a file or holding its own copy of the bytes
+ * Images are handed out as shared_ptr<const RomImage>, so any number of Atari2600 instances
+ * can use one copy, and a mapping lasts until last instance using it is gone.
+ */
+class RomImage
+{
+public:
+  ~RomImage();
+
+  RomImage(const RomImage&) = delete;
+  RomImage& operator=(const RomImage&) = delete;
+
+  /**
+   * @brief map file read-only, throws std::runtime_error if it can't be opened or isn't a valid size
+   */
+  static std::shared_ptr<const RomImage> mapFile(const std::string& path);
+
+  /**
+   * @brief image holding a copy of bytes, throws std::runtime_error if it isn't a valid size
+   */
+  static std::shared_ptr<const RomImage> fromBytes(std::vector<uint8_t> bytes);
+
+  /**
+   * @brief throws std::runtime_error if size isn't one of the cartridge sizes (2K, 4K, 8K, 12K, 16K, 32K, 64K)
+   */
+  static void validateSize(size_t size);
+
+  // 64bit FNV-1a hash of ROM bytes, used to identify it
+  static uint64_t computeHash(const uint8_t* data, size_t size);
+
+  const uint8_t* data() const
+  {
+    return data_;
+  }
+
+  size_t size() const
+  {
+    return size_;
+  }
+
+  uint64_t hash() const
+  {
+    return hash_;
+  }
+
+  // hash as 16 hex digits
+  std::string hashString() const;
+
+  // file ROM was mapped from, empty for images made from bytes
+  const std::string& path() const
+  {
+    return path_;
+  }
+
+  bool isMapped() const
+  {
+    return mapping_ != nullptr;
+  }
+
+protected:
+  RomImage() = default;
+
+  static std::shared_ptr<RomImage> ownBytes(std::vector<uint8_t> bytes);
+
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  uint64_t hash_ = 0;
+  std::string path_;
+
+  // set when image is a mapping of file, otherwise bytes_ holds image
+  void* mapping_ = nullptr;
+  std::vector<uint8_t> bytes_;
+};
+
+/**
+ * Keeps track of ROM images that are in use, so opening same ROM again (even from another path)
+ * returns the image that is already loaded instead of mapping another copy of it.
+ * Store only holds weak references, images are freed once nothing uses them. Thread safe.
+ */
+class RomStore
+{
+public:
+  /**
+   * @brief map file, or return already loaded image with same contents
+   * A path that was opened before is only checked for changes (size and modification time)
+   * throws std::runtime_error if file can't be opened or isn't a valid ROM
+   */
+  std::shared_ptr<const RomImage> open(const std::string& path);
+
+  /**
+   * @brief add image made some other way (like RomImage::fromBytes), or return already loaded image with same contents
+   */
+  std::shared_ptr<const RomImage> add(std::shared_ptr<const RomImage> image);
+
+  // image with hash that is still in use, or nullptr
+  std::shared_ptr<const RomImage> find(uint64_t hash) const;
+
+  // number of images still in use
+  size_t size() const;
+
+protected:
+  struct OpenedFile
+  {
+    std::weak_ptr<const RomImage> image;
+    std::filesystem::file_time_type write_time;
+    uintmax_t size;
+  };
+
+  mutable std::mutex mutex_;
+  std::unordered_map<uint64_t, std::weak_ptr<const RomImage>> images_;
+  std::unordered_map<std::string, OpenedFile> files_;
+
+  std::shared_ptr<const RomImage> addLocked(std::shared_ptr<const RomImage> image);
+};
+
+#endif  // ATARI2600_ROM_HPP_GUARD
@@ -1,4 +1,5 @@
 #include "tia.hpp"
+#include "tia_observation.hpp"
 #include "util.hpp"
 
 #include <algorithm>
@@ -6,22 +7,111 @@
 
 Tia::Tia()
 {
-  display_.resize(DISPLAY_WIDTH * DISPLAY_HEIGHT, RGBA{0,0,0,0});
-  clearDisplay();
+  display_.resize(DISPLAY_WIDTH * DISPLAY_HEIGHT, RGBA{0,0,0,255});
+  back_display_ = display_;
+  indexed_display_.resize(DISPLAY_WIDTH * DISPLAY_HEIGHT, 0);
+  back_indexed_display_ = indexed_display_;
   std::fill(palette_.begin(), palette_.end(), RGBA{0,0,0,0});
 }
 
 
-void Tia::clearDisplay()
+void Tia::flipDisplay()
 {
-  std::cerr << "clear display" << std::endl;
-  for (unsigned y = 0; y < DISPLAY_HEIGHT; ++y)
+  if (fill_undrawn_ and (scan_y_ < DISPLAY_HEIGHT))
   {
-    for (unsigned x = 0; x < DISPLAY_WIDTH; ++x)
+    // anything after beam wasn't drawn this frame, and still holds frame before last one
+    size_t start = scan_y_ * DISPLAY_WIDTH + std::clamp(scanToDisplayX(scan_x_ + 1), 0, DISPLAY_WIDTH);
+    if (indexed_output_)
     {
-      getDisplay(x, y) = ((x ^ y) & 1) ? RGBA{0,0,0,255} : RGBA{255,255,255,255};
+      std::fill(back_indexed_display_.begin() + start, back_indexed_display_.end(), 0);
+    }
+    else
+    {
+      std::fill(back_display_.begin() + start, back_display_.end(), palette_[0]);
     }
   }
+
+  // only whichever pair is being drawn matters, but swapping vectors is cheap enough to do both
+  display_.swap(back_display_);
+  indexed_display_.swap(back_indexed_display_);
+  ++ready_frame_count_;
+  ATARI2600_TRACE_EVENT(trace_, TraceType::FRAME_READY, pixel_count_, ready_frame_count_, 0);
+}
+
+namespace
+{
+
+void saveSettings(const TiaSettings& settings, TiaSettingsState& state)
+{
+  state.pf_mask = settings.pf_mask;
+  state.ctrl_pf = settings.ctrl_pf;
+  state.p0_mask = settings.p0_mask;
+  state.p1_mask = settings.p1_mask;
+  state.color_pf = settings.color_pf;
+  state.color_bk = settings.color_bk;
+  state.color_p0 = settings.color_p0;
+  state.color_p1 = settings.color_p1;
+  state.reflect = (settings.reflect_p0 ? 1 : 0) | (settings.reflect_p1 ? 2 : 0);
+}
+
+void loadSettings(const TiaSettingsState& state, const std::array<RGBA, 256>& palette, TiaSettings& settings)
+{
+  settings.pf_mask = state.pf_mask;
+  settings.ctrl_pf = state.ctrl_pf;
+  settings.p0_mask = state.p0_mask;
+  settings.p1_mask = state.p1_mask;
+  settings.color_pf = state.color_pf;
+  settings.color_bk = state.color_bk;
+  settings.color_p0 = state.color_p0;
+  settings.color_p1 = state.color_p1;
+  settings.reflect_p0 = state.reflect & 1;
+  settings.reflect_p1 = state.reflect & 2;
+  settings.rgba_pf = palette[state.color_pf];
+  settings.rgba_bk = palette[state.color_bk];
+  settings.rgba_p0 = palette[state.color_p0];
+  settings.rgba_p1 = palette[state.color_p1];
+}
+
+}  // namespace
+
+void Tia::saveState(TiaState& state) const
+{
+  saveSettings(settings_, state.settings);
+  saveSettings(next_settings_, state.next_settings);
+  state.frame_count = frame_count_;
+  state.pixel_cycles = pixel_cycles_;
+  state.pixel_count = pixel_count_;
+  state.line_count = line_count_;
+  state.scan_x = scan_x_;
+  state.scan_y = scan_y_;
+  state.position_x_p0 = position_x_p0_;
+  state.position_x_p1 = position_x_p1_;
+  state.settings_changed = settings_changed_;
+  state.wait_sync = wait_sync_;
+  state.vertical_sync = vertical_sync_;
+  state.next_vertical_sync = next_vertical_sync_;
+  state.reset_p0 = reset_p0_;
+  state.reset_p1 = reset_p1_;
+}
+
+void Tia::loadState(const TiaState& state)
+{
+  loadSettings(state.settings, palette_, settings_);
+  loadSettings(state.next_settings, palette_, next_settings_);
+  frame_count_ = state.frame_count;
+  pixel_cycles_ = state.pixel_cycles;
+  pixel_count_ = state.pixel_count;
+  line_count_ = state.line_count;
+  scan_x_ = state.scan_x;
+  scan_y_ = state.scan_y;
+  position_x_p0_ = state.position_x_p0;
+  position_x_p1_ = state.position_x_p1;
+  settings_changed_ = state.settings_changed;
+  wait_sync_ = state.wait_sync;
+  vertical_sync_ = state.vertical_sync;
+  next_vertical_sync_ = state.next_vertical_sync;
+  reset_p0_ = state.reset_p0;
+  reset_p1_ = state.reset_p1;
 }
 
 // https://forums.atariage.com/topic/204247-new-generated-ntsc-color-palette-files/#comment-2621055
@@ -57,11 +147,6 @@ unsigned Tia::drawPixelLine(unsigned pixel_cycles)
 
   if (vertical_sync_)
   {
-    if ((scan_y_ != 0) or (scan_x_ != -1))
-    {
-      clearDisplay();
-    }
-
     scan_x_ = -1;
     scan_y_ = 0;
     pixel_count_ += pixel_cycles;
@@ -76,13 +161,18 @@ unsigned Tia::drawPixelLine(unsigned pixel_cycles)
     scan_x_ = -1;
 
     ++scan_y_;
+    ++line_count_;
 
     // automatically start next screen if VSYNC doesn't occur after a while
     if (scan_y_ >= AUTO_VSYNC)
     {
-      std::cerr << "forcing screen refreshed (needed veritical sync)" << std::endl;
+      ATARI2600_TRACE_EVENT(trace_, TraceType::FORCED_VSYNC, pixel_count_, 0, 0);
       scan_y_ = 0;
-      clearDisplay();
+      ++frame_count_;
+      if (render_)
+      {
+        flipDisplay();
+      }
     }
   }
 
@@ -99,15 +189,19 @@ unsigned Tia::drawPixelLine(unsigned pixel_cycles)
     else
     {
       pixel_cycles -= pixels_to_line_start;
+      pixel_count_ += pixels_to_line_start;
       scan_x_ = HORIZONTAL_BLANK - 1;
     }
   }
 
-  // Don't draw anything beyond display limits
+  // Don't draw anything beyond display limits, but keep scanning until (AUTO_)VSYNC
   if (scan_y_ >= DISPLAY_HEIGHT)
   {
-      std::cerr << "overdraw " << scan_y_ << std::endl;
-      return 0;
+    unsigned pixels_to_line_end = (HORIZONTAL_BLANK + DISPLAY_WIDTH - 1) - scan_x_;
+    unsigned overdraw_cycles = std::min(pixel_cycles, pixels_to_line_end);
+    scan_x_ += overdraw_cycles;
+    pixel_count_ += overdraw_cycles;
+    return pixel_cycles - overdraw_cycles;
   }
 
   assert(scan_x_ >= (HORIZONTAL_BLANK - 1));
@@ -122,6 +216,21 @@ unsigned Tia::drawPixelLine(unsigned pixel_cycles)
   scan_x_ += display_cycles;
   pixel_cycles -= display_cycles;
 
+  assert(scan_y_ >= 0);
+  assert(scan_y_ < DISPLAY_HEIGHT);
+
+  if (render_)
+  {
+    drawPixelSpan(display_x, display_x_stop);
+  }
+
+  pixel_count_ += display_cycles;
+  return pixel_cycles;
+}
+
+
+uint64_t Tia::getPlayfieldLineMask() const
+{
   uint64_t pf = settings_.pf_mask;
   bool reflect = settings_.ctrl_pf & 1;
   if (reflect)
@@ -132,12 +241,117 @@ unsigned Tia::drawPixelLine(unsigned pixel_cycles)
   {
     pf |= (pf & 0xFFFFF) << 20;
   }
+  return pf;
+}
+
+void Tia::drawPixelSpan(int display_x, int display_x_stop)
+{
+  if (indexed_output_)
+  {
+    // AVX2 CPUs have SSE2, 16 one byte pixels already fill an SSE2 vector
+    if (compositor_ == Compositor::SCALAR)
+    {
+      drawPixelSpanIndexedScalar(display_x, display_x_stop);
+    }
+    else
+    {
+      drawPixelSpanIndexedSse2(display_x, display_x_stop);
+    }
+  }
+  else
+  {
+    switch (compositor_)
+    {
+      case Compositor::AVX2:
+        drawPixelSpanAvx2(display_x, display_x_stop);
+        break;
+      case Compositor::SSE2:
+        drawPixelSpanSse2(display_x, display_x_stop);
+        break;
+      default:
+        drawPixelSpanScalar(display_x, display_x_stop);
+        break;
+    }
+  }
 
+  // Span is still in cache, so observation is made from it right away instead of from whole frame later
+  if (observation_)
+  {
+    if (indexed_output_)
+    {
+      observation_->writeSpan(&back_indexed_display_.at(scan_y_ * DISPLAY_WIDTH), palette_, scan_y_, display_x, display_x_stop);
+    }
+    else
+    {
+      observation_->writeSpan(&back_display_.at(scan_y_ * DISPLAY_WIDTH), scan_y_, display_x, display_x_stop);
+    }
+  }
+}
+
+const char* Tia::compositorName(Compositor compositor)
+{
+  switch (compositor)
+  {
+    case Compositor::SCALAR: return "scalar";
+    case Compositor::SSE2: return "SSE2";
+    case Compositor::AVX2: return "AVX2";
+    default: return "?";
+  }
+}
+
+Tia::Compositor Tia::defaultCompositor()
+{
+  return compositorSupported(Compositor::SSE2) ? Compositor::SSE2 : Compositor::SCALAR;
+}
+
+template<typename Pixel>
+void Tia::compositeSpanScalar(Pixel* row, Pixel pf_color, Pixel bk_color, Pixel p0_color, Pixel p1_color,
+                              int display_x, int display_x_stop)
+{
+  uint64_t pf = getPlayfieldLineMask();
+
+  // Playfield and background, filled in runs of playfield cells (4 pixels each) with same value
+  int x = display_x;
+  while (x < display_x_stop)
+  {
+    bool use_pf = (pf >> (x >> 2)) & 1;
+    int run_stop = ((x >> 2) + 1) << 2;
+    while ((run_stop < display_x_stop) and (((pf >> (run_stop >> 2)) & 1) == use_pf))
+    {
+      run_stop += 4;
+    }
+    run_stop = std::min(run_stop, display_x_stop);
+    std::fill(row + x, row + run_stop, use_pf ? pf_color : bk_color);
+    x = run_stop;
+  }
+
+  // Players are drawn over playfield, P1 first so P0 has priority over it
   uint8_t p0_mask = settings_.reflect_p0 ? reverseBits8(settings_.p0_mask) : settings_.p0_mask;
   uint8_t p1_mask = settings_.reflect_p1 ? reverseBits8(settings_.p1_mask) : settings_.p1_mask;
+  drawPlayerSpan(row, p1_mask, position_x_p1_, p1_color, display_x, display_x_stop);
+  drawPlayerSpan(row, p0_mask, position_x_p0_, p0_color, display_x, display_x_stop);
+}
 
-  assert(scan_y_ >= 0);
-  assert(scan_y_ < DISPLAY_HEIGHT);
+void Tia::drawPixelSpanScalar(int display_x, int display_x_stop)
+{
+  compositeSpanScalar(&back_display_.at(scan_y_ * DISPLAY_WIDTH),
+                      settings_.rgba_pf, settings_.rgba_bk, settings_.rgba_p0, settings_.rgba_p1,
+                      display_x, display_x_stop);
+}
+
+void Tia::drawPixelSpanIndexedScalar(int display_x, int display_x_stop)
+{
+  compositeSpanScalar(&back_indexed_display_.at(scan_y_ * DISPLAY_WIDTH),
+                      settings_.color_pf, settings_.color_bk, settings_.color_p0, settings_.color_p1,
+                      display_x, display_x_stop);
+}
+
+void Tia::drawPixelSpanSlow(int display_x, int display_x_stop)
+{
+  uint64_t pf = getPlayfieldLineMask();
+
+  uint8_t p0_mask = settings_.reflect_p0 ? reverseBits8(settings_.p0_mask) : settings_.p0_mask;
+  uint8_t p1_mask = settings_.reflect_p1 ? reverseBits8(settings_.p1_mask) : settings_.p1_mask;
 
   for  (; display_x < display_x_stop; ++display_x)
   {
@@ -152,12 +366,8 @@ unsigned Tia::drawPixelLine(unsigned pixel_cycles)
       settings_.rgba_bk;
     getDisplay(display_x, scan_y_) = rgba;
   }
-
-  pixel_count_ += display_cycles;
-  return pixel_cycles;
 }
 
-
 void Tia::syncPixels()
 {
   //std::cerr << std::dec << pixel_count_ << " syncPixels " << std::dec << pixel_cycles_ << std::endl;
@@ -168,17 +378,35 @@ void Tia::syncPixels()
 }
 
 
-void Tia::advancePixels(unsigned pixel_cycles)
+void Tia::updatePixels()
 {
-  pixel_cycles_ += pixel_cycles;
+  // Keep lazy drawing within about a scanline, so line and frame counters
+  // don't fall far behind when a ROM goes a long time without TIA writes
+  if (pixel_cycles_ >= SCANLINE_PIXELS)
+  {
+    syncPixels();
+  }
 
   if (settings_changed_)
   {
     //std::cerr << std::dec << pixel_count_  << " settings changed (before sync)" << std::endl;
     settings_changed_ = false;
     syncPixels();
-    std::cerr << std::dec << pixel_count_  << " settings changed (after sync)" << std::endl;
     settings_ = next_settings_;
+    if (next_vertical_sync_ and !vertical_sync_)
+    {
+      ATARI2600_TRACE_EVENT(trace_, TraceType::VSYNC_START, pixel_count_, scan_y_, 0);
+      ++frame_count_;
+      if (render_)
+      {
+        flipDisplay();
+      }
+    }
+    else if (!next_vertical_sync_ and vertical_sync_)
+    {
+      ATARI2600_TRACE_EVENT(trace_, TraceType::VSYNC_END, pixel_count_, scan_y_, 0);
+    }
+    vertical_sync_ = next_vertical_sync_;
   }
 
   if (wait_sync_)
@@ -189,7 +417,7 @@ void Tia::advancePixels(unsigned pixel_cycles)
     assert(pixel_cycles_to_line_end >= 0);
     //std::cout << std::dec << pixel_count_ << " before wsync on scan_y " << std::dec << scan_y_ << " remaining pixels " << pixel_cycles_to_line_end << std::endl;
     unsigned remaining_cycles = drawPixelLine(pixel_cycles_to_line_end);
-    std::cerr << std::dec << pixel_count_  << " after wsync" << std::endl;
+    ATARI2600_TRACE_EVENT(trace_, TraceType::WSYNC, pixel_count_, scan_y_, 0);
     assert(remaining_cycles == 0);
   }
 
@@ -206,6 +434,17 @@ void Tia::advancePixels(unsigned pixel_cycles)
   }
 }
 
+unsigned Tia::getPendingLineCount() const
+{
+  if (vertical_sync_ or (pixel_cycles_ == 0))
+  {
+    return 0;
+  }
+  // position in line, 0 is start of line and SCANLINE_PIXELS is end of line
+  unsigned line_position = scan_x_ + 1;
+  return (line_position + pixel_cycles_ - 1) / SCANLINE_PIXELS;
+}
+
 uint8_t Tia::getPlayerPositionX() const
 {
   int display_x = scanToDisplayX(scan_x_);
@@ -223,7 +462,8 @@ void Tia::write(uint16_t addr, uint8_t data)
   // TIA only has 6 address pins
   addr &= 0x3F;
 
-  std::cerr << "TIA write " <<  std::hex << static_cast<int>(data) << " to ADDR_" << std::hex << addr << " " << addrName(addr) << std::dec << std::endl;
+  ATARI2600_TRACE_EVENT(trace_, TraceType::TIA_WRITE, getPixelClock(), addr, data);
+
   // Assume a write will probably change a drawing settings
   bool settings_changed = true;
   switch (addr)
@@ -232,7 +472,7 @@ void Tia::write(uint16_t addr, uint8_t data)
       wait_sync_ = true;
       break;
     case VSYNC_ADDR:
-      vertical_sync_ = data & 2;
+      next_vertical_sync_ = data & 2;
       //std::cerr << " vertical sync change to " << vertical_sync_ << std::endl;
       break;
     case COLUP0_ADDR:
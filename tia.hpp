@@ -1,12 +1,18 @@
 #ifndef ATARI2600_TIA_HPP_GUARD
 #define ATARI2600_TIA_HPP_GUARD
 
+#include <algorithm>
 #include <array>
+#include <cstddef>
 #include <cstdint>
 #include <iostream>
 #include <optional>
 #include <vector>
 
+#include "trace.hpp"
+
+class TiaObservation;
+
 // atari doesn't really have a display buffer
 // but need to store scanline data somewhere
 struct RGBA
@@ -45,6 +51,46 @@ struct TiaSettings
   RGBA rgba_p1 = {0,0,0,0};
 };
 
+/**
+ * Fixed layout snapshot of TiaSettings, RGBA colors are looked up from palette again when loaded
+ */
+struct TiaSettingsState
+{
+  uint32_t pf_mask;
+  uint8_t ctrl_pf;
+  uint8_t p0_mask;
+  uint8_t p1_mask;
+  uint8_t color_pf;
+  uint8_t color_bk;
+  uint8_t color_p0;
+  uint8_t color_p1;
+  // Bit0 : reflect P0, Bit1 : reflect P1
+  uint8_t reflect;
+};
+
+/**
+ * Fixed layout snapshot of TIA, see Tia::saveState
+ */
+struct TiaState
+{
+  TiaSettingsState settings;
+  TiaSettingsState next_settings;
+  uint32_t frame_count;
+  uint32_t pixel_cycles;
+  uint32_t pixel_count;
+  uint32_t line_count;
+  int16_t scan_x;
+  int16_t scan_y;
+  uint8_t position_x_p0;
+  uint8_t position_x_p1;
+  uint8_t settings_changed;
+  uint8_t wait_sync;
+  uint8_t vertical_sync;
+  uint8_t next_vertical_sync;
+  uint8_t reset_p0;
+  uint8_t reset_p1;
+};
+
 /**
  * Television interface adapter
  */
@@ -108,6 +154,12 @@ public:
 
   static const char* addrName(uint16_t);
 
+  // trace events are recorded here (if tracing is compiled in and this is set)
+  TraceBuffer* trace_ = nullptr;
+
+  // if set, every span drawn is also written to this observation
+  TiaObservation* observation_ = nullptr;
+
   // Color palette (NTSC / PAL)
   std::array<RGBA, 256> palette_;
 
@@ -117,6 +169,12 @@ public:
   // set if tia is performing a vertical sync
   bool vertical_sync_ = false;
 
+  // value written to VSYNC, applied to vertical_sync_ once pending pixels are drawn
+  bool next_vertical_sync_ = false;
+
+  // number of frames started, incremented on each VSYNC start (or forced refresh)
+  unsigned frame_count_ = 0;
+
   bool reset_p0_ = false;
   bool reset_p1_ = false;
 
@@ -134,8 +192,16 @@ public:
 
   void loadPalette(std::istream& input);
 
+  /**
+   * Snapshot of everything that affects emulation, except displays and palette_
+   * Pending pixels are kept pending, so they are drawn into whatever back_display_ holds after loadState
+   */
+  void saveState(TiaState& state) const;
+  void loadState(const TiaState& state);
+
   static constexpr int DISPLAY_WIDTH = 160;
   static constexpr int HORIZONTAL_BLANK = 68;
+  static constexpr int SCANLINE_PIXELS = HORIZONTAL_BLANK + DISPLAY_WIDTH;
 
   static constexpr int DISPLAY_NOMINAL_HEIGHT = 192;
   static constexpr int VERTICAL_SYNC = 3;
@@ -145,24 +211,98 @@ public:
   static constexpr int AUTO_VSYNC = DISPLAY_HEIGHT + 100;
 
 
+  /**
+   * Last complete frame, stays the same while next frame is drawn into back_display_
+   * Front and back are flipped (swapped, not copied) when VSYNC starts, or on a forced refresh.
+   */
   std::vector<RGBA> display_;
 
+  // Frame being drawn, rows beam hasn't reached yet still hold frame before last one
+  std::vector<RGBA> back_display_;
+
+  /**
+   * Color register value (palette index) of each pixel, drawn instead of RGBA when indexed_output_ is set
+   * Atari2600::saveState(true) saves these instead of RGBA displays when indexed_output_ is set
+   */
+  std::vector<uint8_t> indexed_display_;
+  std::vector<uint8_t> back_indexed_display_;
+
+  /**
+   * Number of times a complete frame was flipped to front, so a consumer can tell when display_
+   * (or indexed_display_) holds a new frame. Unlike frame_count_, frames that weren't rendered don't count.
+   */
+  unsigned ready_frame_count_ = 0;
+
+  /**
+   * Fill part of frame after beam with palette_[0] (or index 0) before flipping it to front,
+   * for ROMs that VSYNC before the end of display, instead of leaving what was drawn two frames ago
+   */
+  bool fill_undrawn_ = false;
+
+  /**
+   * When cleared, beam, counters and player positions still advance exactly the same, but nothing is drawn
+   * in back displays or observation_ and they aren't flipped, so display_ keeps last frame that was drawn.
+   */
+  bool render_ = true;
+
+  /**
+   * Draw palette indices into back_indexed_display_ instead of RGBA into back_display_
+   * Frame buffer is a quarter of the size, and is only turned into RGBA (with whatever palette)
+   * by expandDisplay() when it is shown, so changing palette_ also changes frames already drawn.
+   */
+  bool indexed_output_ = false;
+
   /**
    * @brief Advance a certain amount of pixels, should be called after each CPU instruction completes
    * Function is lazy and qill drawing to display buffer unless some previous
    * insruction changes a display setting
+   * Returns true if pixels were drawn or written settings were applied, so line and frame counters may have changed
    */
-  void advancePixels(unsigned pixel_cycles);
+  bool advancePixels(unsigned pixel_cycles)
+  {
+    pixel_cycles_ += pixel_cycles;
+    if ((pixel_cycles_ >= SCANLINE_PIXELS) or updatePending())
+    {
+      updatePixels();
+      return true;
+    }
+    return false;
+  }
+
+  // a write is waiting to be applied, so next advancePixels() will update
+  bool updatePending() const
+  {
+    return settings_changed_ or wait_sync_ or reset_p0_ or reset_p1_;
+  }
+
+  // Out of line part of advancePixels, draws pending pixels and applies written settings
+  void updatePixels();
 
   unsigned pixel_cycles_ = 0;
   unsigned pixel_count_ = 0;
 
+  // pixel clock including pixels that are pending (not drawn yet)
+  unsigned getPixelClock() const
+  {
+    return pixel_count_ + pixel_cycles_;
+  }
+
+  // number of scan lines started (not reset by VSYNC)
+  unsigned line_count_ = 0;
+
+  /**
+   * @brief number of scan lines that will be started once pending pixel cycles are drawn
+   * line_count_ + getPendingLineCount() is where the beam is, without needing a syncPixels()
+   */
+  unsigned getPendingLineCount() const;
+
   /**
    * Sync(hronize) any undrawn pixels to display buffer
    */
   void syncPixels();
 
-  void clearDisplay();
+  // Make back display (just completed) the front one, and draw next frame over old front one
+  void flipDisplay();
 
   static inline int scanToDisplayX(int scan_x) {return scan_x - HORIZONTAL_BLANK;}
   static inline int scanToDisplayY(int scan_y) {return scan_y - VERTICAL_BLANK;}
@@ -174,7 +314,7 @@ public:
 
   RGBA& getDisplay(unsigned display_x, unsigned scan_y)
   {
-    return display_.at(scan_y*DISPLAY_WIDTH + display_x);
+    return back_display_.at(scan_y*DISPLAY_WIDTH + display_x);
   }
 
   /**
@@ -185,6 +325,104 @@ public:
 
   void drawPixels(unsigned pixel_cycles);
 
+  /**
+   * @brief 40bit mask of playfield for whole line (one bit per 4 pixels), with right half repeated or reflected
+   */
+  uint64_t getPlayfieldLineMask() const;
+
+  /**
+   * Implementations of scanline compositing, SIMD ones are only usable if CPU supports them
+   */
+  enum class Compositor
+  {
+    SCALAR,
+    SSE2,
+    AVX2
+  };
+
+  static const char* compositorName(Compositor);
+
+  // Checks CPUID (once) for instruction set compositor needs
+  static bool compositorSupported(Compositor);
+
+  /**
+   * SSE2 if this CPU supports it, otherwise scalar
+   * AVX2 is only faster for long spans, and is slower than scalar for short spans that are most of a
+   * real frame, so it has to be picked explicitly.
+   */
+  static Compositor defaultCompositor();
+
+  // Used by drawPixelSpan, can be changed to compare compositors
+  Compositor compositor_ = defaultCompositor();
+
+  /**
+   * @brief look up count palette indices in palette, writing RGBA pixels
+   * If gather is set and CPU supports AVX2, 8 pixels are gathered at a time, otherwise pixels are looked up
+   * one by one. Unlike compositing spans, a whole frame is a single long run, where gathering is faster,
+   * so it doesn't follow compositor_ and is on by default.
+   */
+  static void expandIndexed(const uint8_t* indices, size_t count, const std::array<RGBA, 256>& palette, RGBA* rgba,
+                            bool gather = true);
+
+  // Expand indexed_display_ with palette_ into rgba, which must hold DISPLAY_WIDTH * DISPLAY_HEIGHT pixels
+  void expandDisplay(RGBA* rgba) const
+  {
+    expandIndexed(indexed_display_.data(), indexed_display_.size(), palette_, rgba);
+  }
+
+  /**
+   * Draw pixels display_x to display_x_stop (exclusive) of scan_y_ with current settings
+   * Uses compositor_ to do the drawing, into back_display_ (or back_indexed_display_ if indexed_output_ is set),
+   * then writes span to observation_ if there is one
+   */
+  void drawPixelSpan(int display_x, int display_x_stop);
+
+  /**
+   * Fills runs of constant playfield / background, then draws players over them
+   * Portable fallback for when SIMD compositors are not supported
+   */
+  void drawPixelSpanScalar(int display_x, int display_x_stop);
+
+  /**
+   * Expands playfield and player masks to per-lane masks and blends colors with vector selects
+   * SSE2 does 8 pixels per iteration, AVX2 does 16 pixels per iteration
+   * Must only be called if compositorSupported() is true for them
+   */
+  void drawPixelSpanSse2(int display_x, int display_x_stop);
+  void drawPixelSpanAvx2(int display_x, int display_x_stop);
+
+  /**
+   * Same as scalar and SSE2 compositors, but draw color register values into back_indexed_display_
+   * SSE2 does 16 pixels per iteration, one byte lane per pixel
+   */
+  void drawPixelSpanIndexedScalar(int display_x, int display_x_stop);
+  void drawPixelSpanIndexedSse2(int display_x, int display_x_stop);
+
+  /**
+   * Same as drawPixelSpan, but decides color of each pixel separately
+   */
+  void drawPixelSpanSlow(int display_x, int display_x_stop);
+
+  // Pixel is RGBA or uint8_t palette index
+  template<typename Pixel>
+  static void drawPlayerSpan(Pixel* row, uint8_t mask, uint8_t position_x, Pixel color, int display_x, int display_x_stop)
+  {
+    // player is at most 8 pixels wide, only look at part of span it overlaps
+    int start = std::max<int>(display_x, position_x);
+    int stop = std::min<int>(display_x_stop, position_x + 8);
+    for (int x = start; x < stop; ++x)
+    {
+      if ((mask >> (x - position_x)) & 1)
+      {
+        row[x] = color;
+      }
+    }
+  }
+
+  // Fills runs of constant playfield / background, then draws players over them
+  template<typename Pixel>
+  void compositeSpanScalar(Pixel* row, Pixel pf, Pixel bk, Pixel p0, Pixel p1, int display_x, int display_x_stop);
+
   uint8_t read(uint16_t addr);
   void write(uint16_t addr, uint8_t data);
 };
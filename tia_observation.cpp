@@ -0,0 +1,224 @@
+#include "tia_observation.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+
+struct RgbaRow
+{
+  const RGBA* pixels;
+
+  RGBA rgba(int x) const
+  {
+    return pixels[x];
+  }
+
+  uint8_t luminance(int x) const
+  {
+    return TiaObservation::luminance(pixels[x]);
+  }
+};
+
+struct IndexedRow
+{
+  const uint8_t* indices;
+  const RGBA* palette;
+  const uint8_t* palette_luminance;
+
+  RGBA rgba(int x) const
+  {
+    return palette[indices[x]];
+  }
+
+  uint8_t luminance(int x) const
+  {
+    return palette_luminance[indices[x]];
+  }
+};
+
+}  // namespace
+
+const char* TiaObservation::formatName(Format format)
+{
+  switch (format)
+  {
+    case Format::LUMINANCE: return "luminance";
+    case Format::CHANNELS: return "channels";
+    case Format::RESIZE: return "resize";
+    case Format::MAX_POOL_2X: return "max-pool-2x";
+    default: return "?";
+  }
+}
+
+TiaObservation::TiaObservation(Format format, uint8_t channels) :
+  format_(format),
+  channels_(channels & (CHANNEL_R | CHANNEL_G | CHANNEL_B | CHANNEL_A)),
+  channel_count_(1),
+  width_(Tia::DISPLAY_WIDTH),
+  height_(Tia::DISPLAY_HEIGHT)
+{
+  switch (format)
+  {
+    case Format::LUMINANCE:
+      break;
+    case Format::CHANNELS:
+      channel_count_ = 0;
+      for (unsigned channel = 0; channel < 4; ++channel)
+      {
+        if (channels_ & (1 << channel))
+        {
+          channel_offsets_[channel_count_++] = channel;
+        }
+      }
+      if (channel_count_ == 0)
+      {
+        throw std::runtime_error("Observation with no channels");
+      }
+      break;
+    case Format::RESIZE:
+      width_ = RESIZE_WIDTH;
+      height_ = RESIZE_HEIGHT;
+      break;
+    case Format::MAX_POOL_2X:
+      width_ = (Tia::DISPLAY_WIDTH + 1) / 2;
+      height_ = (Tia::DISPLAY_HEIGHT + 1) / 2;
+      break;
+    default:
+      throw std::runtime_error("Unknown observation format");
+  }
+
+  // Each display pixel goes into one resized pixel, and resized pixels cover 1-2 columns and 3-4 rows
+  resize_column_pixels_.fill(0);
+  for (unsigned x = 0; x < Tia::DISPLAY_WIDTH; ++x)
+  {
+    resize_column_[x] = x * RESIZE_WIDTH / Tia::DISPLAY_WIDTH;
+    ++resize_column_pixels_[resize_column_[x]];
+  }
+  resize_row_pixels_.fill(0);
+  for (unsigned y = 0; y < Tia::DISPLAY_HEIGHT; ++y)
+  {
+    resize_row_[y] = y * RESIZE_HEIGHT / Tia::DISPLAY_HEIGHT;
+    ++resize_row_pixels_[resize_row_[y]];
+  }
+  resize_sums_.fill(0);
+}
+
+void TiaObservation::writeSpan(const RGBA* row, int scan_y, int display_x, int display_x_stop)
+{
+  write(RgbaRow{row}, scan_y, display_x, display_x_stop);
+}
+
+void TiaObservation::writeSpan(const uint8_t* row, const std::array<RGBA, 256>& palette, int scan_y, int display_x,
+                               int display_x_stop)
+{
+  if (!palette_luminance_valid_ or ((scan_y == 0) and (display_x == 0)))
+  {
+    for (unsigned ii = 0; ii < palette.size(); ++ii)
+    {
+      palette_luminance_[ii] = luminance(palette[ii]);
+    }
+    palette_luminance_valid_ = true;
+  }
+  write(IndexedRow{row, palette.data(), palette_luminance_.data()}, scan_y, display_x, display_x_stop);
+}
+
+template<typename Row>
+void TiaObservation::write(Row row, int scan_y, int display_x, int display_x_stop)
+{
+  if (!buffer_)
+  {
+    return;
+  }
+
+  switch (format_)
+  {
+    case Format::LUMINANCE:
+    {
+      uint8_t* out = buffer_ + scan_y * Tia::DISPLAY_WIDTH;
+      for (int x = display_x; x < display_x_stop; ++x)
+      {
+        out[x] = row.luminance(x);
+      }
+      break;
+    }
+
+    case Format::CHANNELS:
+    {
+      uint8_t* out = buffer_ + (scan_y * Tia::DISPLAY_WIDTH + display_x) * channel_count_;
+      if (channels_ == (CHANNEL_R | CHANNEL_G | CHANNEL_B))
+      {
+        for (int x = display_x; x < display_x_stop; ++x, out += 3)
+        {
+          RGBA rgba = row.rgba(x);
+          out[0] = rgba.r;
+          out[1] = rgba.g;
+          out[2] = rgba.b;
+        }
+        break;
+      }
+      for (int x = display_x; x < display_x_stop; ++x)
+      {
+        RGBA rgba = row.rgba(x);
+        const uint8_t* bytes = &rgba.r;
+        for (unsigned channel = 0; channel < channel_count_; ++channel)
+        {
+          *out++ = bytes[channel_offsets_[channel]];
+        }
+      }
+      break;
+    }
+
+    case Format::RESIZE:
+    {
+      // Sums are started on first display row of each resized row, and written out after its last row
+      const unsigned out_y = resize_row_[scan_y];
+      const bool first_row = (scan_y == 0) or (resize_row_[scan_y - 1] != out_y);
+      if (first_row and (display_x == 0))
+      {
+        resize_sums_.fill(0);
+      }
+      for (int x = display_x; x < display_x_stop; ++x)
+      {
+        resize_sums_[resize_column_[x]] += row.luminance(x);
+      }
+
+      const bool last_row = (scan_y + 1 == Tia::DISPLAY_HEIGHT) or (resize_row_[scan_y + 1] != out_y);
+      if (last_row and (display_x_stop == Tia::DISPLAY_WIDTH))
+      {
+        uint8_t* out = buffer_ + out_y * RESIZE_WIDTH;
+        for (unsigned out_x = 0; out_x < RESIZE_WIDTH; ++out_x)
+        {
+          unsigned pixels = resize_column_pixels_[out_x] * resize_row_pixels_[out_y];
+          out[out_x] = (resize_sums_[out_x] + pixels / 2) / pixels;
+        }
+      }
+      break;
+    }
+
+    case Format::MAX_POOL_2X:
+    {
+      // First row of each 2x2 block sets it, second row can only raise it
+      uint8_t* out = buffer_ + (scan_y / 2) * width_;
+      const bool first_row = !(scan_y & 1);
+      int x = display_x;
+      if (x & 1)
+      {
+        // left pixel of block was in span before this one
+        out[x / 2] = std::max(out[x / 2], row.luminance(x));
+        ++x;
+      }
+      for (; x + 1 < display_x_stop; x += 2)
+      {
+        uint8_t luma = std::max(row.luminance(x), row.luminance(x + 1));
+        out[x / 2] = first_row ? luma : std::max(out[x / 2], luma);
+      }
+      if (x < display_x_stop)
+      {
+        out[x / 2] = first_row ? row.luminance(x) : std::max(out[x / 2], row.luminance(x));
+      }
+      break;
+    }
+  }
+}
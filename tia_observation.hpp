@@ -0,0 +1,119 @@
+#ifndef ATARI2600_TIA_OBSERVATION_HPP_GUARD
+#define ATARI2600_TIA_OBSERVATION_HPP_GUARD
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "tia.hpp"
+
+/**
+ * Observation of display that TIA writes as it draws each span, into a caller provided buffer
+ * Grayscale, channel subset or downscaled frames are made without going through full RGBA frame again,
+ * and with Tia::indexed_output_ set, full RGBA frame is never made at all.
+ * Rows a frame doesn't draw are left as they were in buffer.
+ */
+class TiaObservation
+{
+public:
+  enum class Format
+  {
+    // Luminance of each display pixel, DISPLAY_WIDTH x DISPLAY_HEIGHT bytes
+    LUMINANCE,
+    // Selected channels of each display pixel, in RGBA order
+    CHANNELS,
+    // RESIZE_WIDTH x RESIZE_HEIGHT luminance, each pixel averaged over area of display it covers
+    RESIZE,
+    // Luminance, max of each 2x2 block of display pixels
+    MAX_POOL_2X
+  };
+
+  static const char* formatName(Format format);
+
+  enum : uint8_t
+  {
+    CHANNEL_R = 0x1,
+    CHANNEL_G = 0x2,
+    CHANNEL_B = 0x4,
+    CHANNEL_A = 0x8,
+  };
+
+  static constexpr unsigned RESIZE_WIDTH = 84;
+  static constexpr unsigned RESIZE_HEIGHT = 84;
+
+  // channels are only used by CHANNELS format
+  explicit TiaObservation(Format format, uint8_t channels = CHANNEL_R | CHANNEL_G | CHANNEL_B);
+
+  // Buffer of size() bytes frames are written to, nothing is written while it is nullptr
+  uint8_t* buffer_ = nullptr;
+
+  Format format() const
+  {
+    return format_;
+  }
+
+  unsigned width() const
+  {
+    return width_;
+  }
+
+  unsigned height() const
+  {
+    return height_;
+  }
+
+  // bytes per pixel
+  unsigned channelCount() const
+  {
+    return channel_count_;
+  }
+
+  size_t size() const
+  {
+    return static_cast<size_t>(width_) * height_ * channel_count_;
+  }
+
+  // BT.601 luma, in 8 bit fixed point
+  static inline uint8_t luminance(RGBA rgba)
+  {
+    return (77 * rgba.r + 150 * rgba.g + 29 * rgba.b + 128) >> 8;
+  }
+
+  /**
+   * @brief write pixels display_x to display_x_stop (exclusive) of display row scan_y, that were just drawn
+   * Spans of a row have to be written left to right, and rows top to bottom, like TIA draws them.
+   */
+  void writeSpan(const RGBA* row, int scan_y, int display_x, int display_x_stop);
+
+  // Same, for a row of palette indices
+  void writeSpan(const uint8_t* row, const std::array<RGBA, 256>& palette, int scan_y, int display_x,
+                 int display_x_stop);
+
+protected:
+  Format format_;
+  uint8_t channels_;
+  unsigned channel_count_;
+  // byte offset in RGBA of each selected channel
+  std::array<uint8_t, 4> channel_offsets_ = {};
+  unsigned width_;
+  unsigned height_;
+
+  // Display pixels that are averaged into each column and row of a resized observation
+  std::array<uint8_t, Tia::DISPLAY_WIDTH> resize_column_;
+  std::array<uint8_t, RESIZE_WIDTH> resize_column_pixels_;
+  std::array<uint8_t, Tia::DISPLAY_HEIGHT> resize_row_;
+  std::array<uint8_t, RESIZE_HEIGHT> resize_row_pixels_;
+
+  // sum of luminance of each column of resized row being drawn
+  std::array<uint16_t, RESIZE_WIDTH> resize_sums_;
+
+  // luminance of each palette index, made again at start of each frame in case palette changed
+  std::array<uint8_t, 256> palette_luminance_;
+  bool palette_luminance_valid_ = false;
+
+  // Row is a row of display, row.rgba(x) and row.luminance(x) are color and luminance of pixel x
+  template<typename Row>
+  void write(Row row, int scan_y, int display_x, int display_x_stop);
+};
+
+#endif  // ATARI2600_TIA_OBSERVATION_HPP_GUARD
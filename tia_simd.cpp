@@ -0,0 +1,369 @@
+// SIMD scanline compositors, instruction sets are enabled per function so
+// the rest of the build doesn't depend on what CPU it will run on
+
+#include "tia.hpp"
+#include "util.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define ATARI2600_TIA_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+// 16 bits of playfield, one bit per pixel starting at display_x
+inline uint32_t playfieldBits16(uint64_t pf, int display_x)
+{
+  // playfield mask has 1 bit per 4 pixels, 16 pixels starting at any x touch at most 5 cells
+  static constexpr uint16_t nibble_to_pixels[16] = {
+    0x0000, 0x000F, 0x00F0, 0x00FF, 0x0F00, 0x0F0F, 0x0FF0, 0x0FFF,
+    0xF000, 0xF00F, 0xF0F0, 0xF0FF, 0xFF00, 0xFF0F, 0xFFF0, 0xFFFF
+  };
+  uint32_t cells = pf >> (display_x >> 2);
+  uint32_t pixels = nibble_to_pixels[cells & 0xF] | ((cells & 0x10) ? 0xF0000 : 0);
+  return (pixels >> (display_x & 3)) & 0xFFFF;
+}
+
+// 16 bits of player image, starting at display_x
+inline uint32_t playerBits16(uint8_t mask, uint8_t position_x, int display_x)
+{
+  int offset = position_x - display_x;
+  if ((offset <= -8) or (offset >= 16))
+  {
+    return 0;
+  }
+  return (offset >= 0) ? ((static_cast<uint32_t>(mask) << offset) & 0xFFFF) : (mask >> -offset);
+}
+
+/**
+ * Per pixel bits of everything that is drawn on a span
+ */
+struct SpanBits
+{
+  uint64_t pf;
+  uint8_t p0_mask;
+  uint8_t p1_mask;
+  uint8_t position_x_p0;
+  uint8_t position_x_p1;
+};
+
+/**
+ * Colors of everything drawn on a span, Pixel is RGBA or uint8_t palette index
+ */
+template<typename Pixel>
+struct SpanColors
+{
+  Pixel pf;
+  Pixel bk;
+  Pixel p0;
+  Pixel p1;
+};
+
+/**
+ * Draws pixels that don't fill a whole SSE2 vector (at most 15), same priority as vector code
+ */
+template<typename Pixel>
+inline void compositeTail(Pixel* row, const SpanColors<Pixel>& colors, const SpanBits& span,
+                          int display_x, int display_x_stop)
+{
+  uint32_t pf_bits = playfieldBits16(span.pf, display_x);
+  uint32_t p0_bits = playerBits16(span.p0_mask, span.position_x_p0, display_x);
+  uint32_t p1_bits = playerBits16(span.p1_mask, span.position_x_p1, display_x);
+  for (int lane = 0; display_x + lane < display_x_stop; ++lane)
+  {
+    row[display_x + lane] =
+      ((p0_bits >> lane) & 1) ? colors.p0 :
+      ((p1_bits >> lane) & 1) ? colors.p1 :
+      ((pf_bits >> lane) & 1) ? colors.pf :
+      colors.bk;
+  }
+}
+
+#ifdef ATARI2600_TIA_SIMD_X86
+
+bool cpuSupportsSse2()
+{
+  static const bool supported = __builtin_cpu_supports("sse2");
+  return supported;
+}
+
+bool cpuSupportsAvx2()
+{
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+
+// Selects lanes where (bits & lane_bits) is set, lane_bits has one bit per lane
+__attribute__((target("sse2")))
+inline __m128i laneMaskSse2(uint32_t bits, __m128i lane_bits)
+{
+  __m128i masked = _mm_and_si128(_mm_set1_epi32(bits), lane_bits);
+  return _mm_cmpeq_epi32(masked, lane_bits);
+}
+
+// SSE2 has no blendv, so select with and / andnot / or
+__attribute__((target("sse2")))
+inline __m128i selectSse2(__m128i mask, __m128i if_set, __m128i if_clear)
+{
+  return _mm_or_si128(_mm_and_si128(mask, if_set), _mm_andnot_si128(mask, if_clear));
+}
+
+__attribute__((target("sse2")))
+inline __m128i compositeSse2(uint32_t pf_bits, uint32_t p0_bits, uint32_t p1_bits, __m128i lane_bits,
+                             __m128i pf, __m128i bk, __m128i p0, __m128i p1)
+{
+  __m128i rgba = selectSse2(laneMaskSse2(pf_bits, lane_bits), pf, bk);
+  rgba = selectSse2(laneMaskSse2(p1_bits, lane_bits), p1, rgba);
+  return selectSse2(laneMaskSse2(p0_bits, lane_bits), p0, rgba);
+}
+
+// Selects byte lanes where (bits & lane_bits) is set, bits 0-7 are for lanes 0-7 and bits 8-15 for lanes 8-15
+__attribute__((target("sse2")))
+inline __m128i byteLaneMaskSse2(uint32_t bits, __m128i lane_bits)
+{
+  // multiplying copies each byte of bits into 8 byte lanes
+  constexpr uint64_t BYTE_LANES = 0x0101010101010101ULL;
+  __m128i spread = _mm_set_epi64x(((bits >> 8) & 0xFF) * BYTE_LANES, (bits & 0xFF) * BYTE_LANES);
+  return _mm_cmpeq_epi8(_mm_and_si128(spread, lane_bits), lane_bits);
+}
+
+__attribute__((target("avx2")))
+inline __m256i laneMaskAvx2(uint32_t bits, __m256i lane_bits)
+{
+  __m256i masked = _mm256_and_si256(_mm256_set1_epi32(bits), lane_bits);
+  return _mm256_cmpeq_epi32(masked, lane_bits);
+}
+
+__attribute__((target("avx2")))
+inline __m256i compositeAvx2(uint32_t pf_bits, uint32_t p0_bits, uint32_t p1_bits, __m256i lane_bits,
+                             __m256i pf, __m256i bk, __m256i p0, __m256i p1)
+{
+  __m256i rgba = _mm256_blendv_epi8(bk, pf, laneMaskAvx2(pf_bits, lane_bits));
+  rgba = _mm256_blendv_epi8(rgba, p1, laneMaskAvx2(p1_bits, lane_bits));
+  return _mm256_blendv_epi8(rgba, p0, laneMaskAvx2(p0_bits, lane_bits));
+}
+
+// Gathers palette entries of 8 indices at a time, returns number of pixels expanded
+__attribute__((target("avx2")))
+size_t expandIndexedAvx2(const uint8_t* indices, size_t count, const std::array<RGBA, 256>& palette, RGBA* rgba)
+{
+  const int* table = reinterpret_cast<const int*>(palette.data());
+  size_t ii = 0;
+  for (; ii + 8 <= count; ii += 8)
+  {
+    __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(indices + ii));
+    __m256i colors = _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(bytes), sizeof(RGBA));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba + ii), colors);
+  }
+  return ii;
+}
+
+#endif  // ATARI2600_TIA_SIMD_X86
+
+}  // namespace
+
+
+bool Tia::compositorSupported(Compositor compositor)
+{
+  switch (compositor)
+  {
+    case Compositor::SCALAR:
+      return true;
+#ifdef ATARI2600_TIA_SIMD_X86
+    case Compositor::SSE2:
+      return cpuSupportsSse2();
+    case Compositor::AVX2:
+      return cpuSupportsAvx2();
+#endif
+    default:
+      return false;
+  }
+}
+
+
+void Tia::expandIndexed(const uint8_t* indices, size_t count, const std::array<RGBA, 256>& palette, RGBA* rgba,
+                        bool gather)
+{
+  size_t ii = 0;
+#ifdef ATARI2600_TIA_SIMD_X86
+  if (gather and compositorSupported(Compositor::AVX2))
+  {
+    ii = expandIndexedAvx2(indices, count, palette, rgba);
+  }
+#endif
+  for (; ii < count; ++ii)
+  {
+    rgba[ii] = palette[indices[ii]];
+  }
+}
+
+
+#ifdef ATARI2600_TIA_SIMD_X86
+
+__attribute__((target("sse2")))
+void Tia::drawPixelSpanSse2(int display_x, int display_x_stop)
+{
+  RGBA* row = &back_display_.at(scan_y_ * DISPLAY_WIDTH);
+  SpanBits span = {
+    getPlayfieldLineMask(),
+    settings_.reflect_p0 ? reverseBits8(settings_.p0_mask) : settings_.p0_mask,
+    settings_.reflect_p1 ? reverseBits8(settings_.p1_mask) : settings_.p1_mask,
+    position_x_p0_,
+    position_x_p1_
+  };
+
+  const __m128i pf = _mm_set1_epi32(settings_.rgba_pf.raw32);
+  const __m128i bk = _mm_set1_epi32(settings_.rgba_bk.raw32);
+  const __m128i p0 = _mm_set1_epi32(settings_.rgba_p0.raw32);
+  const __m128i p1 = _mm_set1_epi32(settings_.rgba_p1.raw32);
+  const __m128i lane_bits_lo = _mm_setr_epi32(0x01, 0x02, 0x04, 0x08);
+  const __m128i lane_bits_hi = _mm_setr_epi32(0x10, 0x20, 0x40, 0x80);
+
+  // 8 pixels per iteration, as two vectors of 4 pixels
+  for (; display_x + 8 <= display_x_stop; display_x += 8)
+  {
+    uint32_t pf_bits = playfieldBits16(span.pf, display_x);
+    uint32_t p0_bits = playerBits16(span.p0_mask, span.position_x_p0, display_x);
+    uint32_t p1_bits = playerBits16(span.p1_mask, span.position_x_p1, display_x);
+    __m128i lo = compositeSse2(pf_bits, p0_bits, p1_bits, lane_bits_lo, pf, bk, p0, p1);
+    __m128i hi = compositeSse2(pf_bits, p0_bits, p1_bits, lane_bits_hi, pf, bk, p0, p1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(row + display_x), lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(row + display_x + 4), hi);
+  }
+
+  if (display_x + 4 <= display_x_stop)
+  {
+    uint32_t pf_bits = playfieldBits16(span.pf, display_x);
+    uint32_t p0_bits = playerBits16(span.p0_mask, span.position_x_p0, display_x);
+    uint32_t p1_bits = playerBits16(span.p1_mask, span.position_x_p1, display_x);
+    __m128i lo = compositeSse2(pf_bits, p0_bits, p1_bits, lane_bits_lo, pf, bk, p0, p1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(row + display_x), lo);
+    display_x += 4;
+  }
+
+  // SSE2 has no cheap masked store, last 0-3 pixels are done one at a time
+  compositeTail(row, SpanColors<RGBA>{settings_.rgba_pf, settings_.rgba_bk, settings_.rgba_p0, settings_.rgba_p1},
+                span, display_x, display_x_stop);
+}
+
+__attribute__((target("sse2")))
+void Tia::drawPixelSpanIndexedSse2(int display_x, int display_x_stop)
+{
+  uint8_t* row = &back_indexed_display_.at(scan_y_ * DISPLAY_WIDTH);
+  SpanBits span = {
+    getPlayfieldLineMask(),
+    settings_.reflect_p0 ? reverseBits8(settings_.p0_mask) : settings_.p0_mask,
+    settings_.reflect_p1 ? reverseBits8(settings_.p1_mask) : settings_.p1_mask,
+    position_x_p0_,
+    position_x_p1_
+  };
+
+  const __m128i pf = _mm_set1_epi8(settings_.color_pf);
+  const __m128i bk = _mm_set1_epi8(settings_.color_bk);
+  const __m128i p0 = _mm_set1_epi8(settings_.color_p0);
+  const __m128i p1 = _mm_set1_epi8(settings_.color_p1);
+  const __m128i lane_bits = _mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, -0x80,
+                                          0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, -0x80);
+
+  const __m128i lane_index = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+  // 16 pixels per iteration, one byte each
+  for (; display_x < display_x_stop; display_x += 16)
+  {
+    int remaining = display_x_stop - display_x;
+    if ((remaining < 16) and (display_x + 16 > DISPLAY_WIDTH))
+    {
+      // partial vector would go past end of row (and maybe buffer)
+      break;
+    }
+    uint32_t pf_bits = playfieldBits16(span.pf, display_x);
+    uint32_t p0_bits = playerBits16(span.p0_mask, span.position_x_p0, display_x);
+    uint32_t p1_bits = playerBits16(span.p1_mask, span.position_x_p1, display_x);
+    __m128i color = selectSse2(byteLaneMaskSse2(pf_bits, lane_bits), pf, bk);
+    color = selectSse2(byteLaneMaskSse2(p1_bits, lane_bits), p1, color);
+    color = selectSse2(byteLaneMaskSse2(p0_bits, lane_bits), p0, color);
+    __m128i* dst = reinterpret_cast<__m128i*>(row + display_x);
+    if (remaining < 16)
+    {
+      // rest of row past span is written back as it was, spans are usually shorter than 16 pixels
+      __m128i in_span = _mm_cmplt_epi8(lane_index, _mm_set1_epi8(remaining));
+      color = selectSse2(in_span, color, _mm_loadu_si128(dst));
+    }
+    _mm_storeu_si128(dst, color);
+  }
+
+  if (display_x < display_x_stop)
+  {
+    compositeTail(row, SpanColors<uint8_t>{settings_.color_pf, settings_.color_bk, settings_.color_p0, settings_.color_p1},
+                  span, display_x, display_x_stop);
+  }
+}
+
+__attribute__((target("avx2")))
+void Tia::drawPixelSpanAvx2(int display_x, int display_x_stop)
+{
+  RGBA* row = &back_display_.at(scan_y_ * DISPLAY_WIDTH);
+  SpanBits span = {
+    getPlayfieldLineMask(),
+    settings_.reflect_p0 ? reverseBits8(settings_.p0_mask) : settings_.p0_mask,
+    settings_.reflect_p1 ? reverseBits8(settings_.p1_mask) : settings_.p1_mask,
+    position_x_p0_,
+    position_x_p1_
+  };
+
+  const __m256i pf = _mm256_set1_epi32(settings_.rgba_pf.raw32);
+  const __m256i bk = _mm256_set1_epi32(settings_.rgba_bk.raw32);
+  const __m256i p0 = _mm256_set1_epi32(settings_.rgba_p0.raw32);
+  const __m256i p1 = _mm256_set1_epi32(settings_.rgba_p1.raw32);
+  const __m256i lane_bits_lo = _mm256_setr_epi32(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80);
+  const __m256i lane_bits_hi = _mm256_setr_epi32(0x100, 0x200, 0x400, 0x800, 0x1000, 0x2000, 0x4000, 0x8000);
+
+  const __m256i lane_index_lo = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i lane_index_hi = _mm256_setr_epi32(8, 9, 10, 11, 12, 13, 14, 15);
+
+  // 16 pixels per iteration, as two vectors of 8 pixels
+  for (; display_x < display_x_stop; display_x += 16)
+  {
+    uint32_t pf_bits = playfieldBits16(span.pf, display_x);
+    uint32_t p0_bits = playerBits16(span.p0_mask, span.position_x_p0, display_x);
+    uint32_t p1_bits = playerBits16(span.p1_mask, span.position_x_p1, display_x);
+    __m256i lo = compositeAvx2(pf_bits, p0_bits, p1_bits, lane_bits_lo, pf, bk, p0, p1);
+    __m256i hi = compositeAvx2(pf_bits, p0_bits, p1_bits, lane_bits_hi, pf, bk, p0, p1);
+    int remaining = display_x_stop - display_x;
+    if (remaining >= 16)
+    {
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(row + display_x), lo);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(row + display_x + 8), hi);
+    }
+    else
+    {
+      // last partial iteration, masked lanes are not written (or faulted on)
+      __m256i remaining_lanes = _mm256_set1_epi32(remaining);
+      _mm256_maskstore_epi32(reinterpret_cast<int*>(row + display_x),
+                             _mm256_cmpgt_epi32(remaining_lanes, lane_index_lo), lo);
+      _mm256_maskstore_epi32(reinterpret_cast<int*>(row + display_x + 8),
+                             _mm256_cmpgt_epi32(remaining_lanes, lane_index_hi), hi);
+    }
+  }
+}
+
+#else  // ATARI2600_TIA_SIMD_X86
+
+// compositorSupported() is false for these, but keep them usable
+void Tia::drawPixelSpanSse2(int display_x, int display_x_stop)
+{
+  drawPixelSpanScalar(display_x, display_x_stop);
+}
+
+void Tia::drawPixelSpanAvx2(int display_x, int display_x_stop)
+{
+  drawPixelSpanScalar(display_x, display_x_stop);
+}
+
+void Tia::drawPixelSpanIndexedSse2(int display_x, int display_x_stop)
+{
+  drawPixelSpanIndexedScalar(display_x, display_x_stop);
+}
+
+#endif  // ATARI2600_TIA_SIMD_X86
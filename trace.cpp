@@ -0,0 +1,76 @@
+#include "trace.hpp"
+#include "tia.hpp"
+
+#include <iomanip>
+
+TraceBuffer::TraceBuffer(size_t capacity)
+{
+  size_t size = 1;
+  while (size < capacity)
+  {
+    size <<= 1;
+  }
+  events_.resize(size);
+  mask_ = size - 1;
+}
+
+size_t TraceBuffer::drain(std::vector<TraceEvent>& output)
+{
+  return drain([&output](const TraceEvent& event) { output.push_back(event); });
+}
+
+TraceCategory traceCategory(TraceType type)
+{
+  switch (type)
+  {
+    case TraceType::TIA_WRITE: return TRACE_TIA_WRITE;
+    case TraceType::WSYNC: return TRACE_WSYNC;
+    case TraceType::VSYNC_START: return TRACE_VSYNC;
+    case TraceType::VSYNC_END: return TRACE_VSYNC;
+    case TraceType::RIOT_READ: return TRACE_RIOT_IO;
+    case TraceType::RIOT_WRITE: return TRACE_RIOT_IO;
+    case TraceType::FRAME_READY: return TRACE_DISPLAY;
+    case TraceType::FORCED_VSYNC: return TRACE_DISPLAY;
+    default: return TRACE_ALL;
+  }
+}
+
+const char* traceTypeName(TraceType type)
+{
+  switch (type)
+  {
+    case TraceType::TIA_WRITE: return "TIA write";
+    case TraceType::WSYNC: return "WSYNC";
+    case TraceType::VSYNC_START: return "VSYNC start";
+    case TraceType::VSYNC_END: return "VSYNC end";
+    case TraceType::RIOT_READ: return "RIOT read";
+    case TraceType::RIOT_WRITE: return "RIOT write";
+    case TraceType::FRAME_READY: return "frame ready";
+    case TraceType::FORCED_VSYNC: return "forced VSYNC";
+    default: return "?";
+  }
+}
+
+std::ostream& operator<<(std::ostream& os, const TraceEvent& event)
+{
+  os << std::dec << event.pixel_count << " " << traceTypeName(event.type);
+  switch (event.type)
+  {
+    case TraceType::TIA_WRITE:
+      os << " " << Tia::addrName(event.addr & 0x3F) << " = " << std::hex << std::setw(2) << std::setfill('0')
+         << static_cast<unsigned>(event.data) << std::dec;
+      break;
+    case TraceType::RIOT_READ:
+    case TraceType::RIOT_WRITE:
+      os << " " << std::hex << std::setw(4) << std::setfill('0') << event.addr
+         << " = " << std::setw(2) << static_cast<unsigned>(event.data) << std::dec;
+      break;
+    case TraceType::WSYNC:
+    case TraceType::VSYNC_START:
+      os << " line " << event.addr;
+      break;
+    default:
+      break;
+  }
+  return os << std::setfill(' ');
+}
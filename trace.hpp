@@ -0,0 +1,144 @@
+#ifndef ATARI2600_TRACE_HPP_GUARD
+#define ATARI2600_TRACE_HPP_GUARD
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+/**
+ * Tracing is compiled in with -DATARI2600_TRACE (cmake -DATARI2600_TRACE=ON)
+ * Without it, ATARI2600_TRACE_EVENT expands to nothing and its arguments are not evaluated
+ */
+#ifdef ATARI2600_TRACE
+constexpr bool TRACE_ENABLED = true;
+#define ATARI2600_TRACE_EVENT(buffer, type, pixel_count, addr, data) \
+  do { if (buffer) { (buffer)->record((type), (pixel_count), (addr), (data)); } } while (false)
+#else
+constexpr bool TRACE_ENABLED = false;
+#define ATARI2600_TRACE_EVENT(buffer, type, pixel_count, addr, data) \
+  do { } while (false)
+#endif
+
+/**
+ * Groups of trace events, used as bitmask to pick which events are recorded
+ */
+enum TraceCategory : uint32_t
+{
+  TRACE_TIA_WRITE = 1 << 0,
+  TRACE_WSYNC = 1 << 1,
+  TRACE_VSYNC = 1 << 2,
+  TRACE_RIOT_IO = 1 << 3,
+  TRACE_DISPLAY = 1 << 4,
+  TRACE_ALL = 0xFFFFFFFF
+};
+
+enum class TraceType : uint8_t
+{
+  TIA_WRITE,      // addr, data of write to TIA register
+  WSYNC,          // addr is scan line that was finished
+  VSYNC_START,    // addr is scan line VSYNC started on
+  VSYNC_END,
+  RIOT_READ,      // addr, data of read from RIOT I/O or timer register
+  RIOT_WRITE,     // addr, data of write to RIOT I/O or timer register
+  FRAME_READY,    // addr is low bits of Tia::ready_frame_count_ after front and back displays were flipped
+  FORCED_VSYNC,   // frame restarted because VSYNC didn't happen for AUTO_VSYNC lines
+};
+
+struct TraceEvent
+{
+  // pixel clock (TIA color clocks) when event happened
+  uint32_t pixel_count;
+  uint16_t addr;
+  uint8_t data;
+  TraceType type;
+};
+
+TraceCategory traceCategory(TraceType type);
+const char* traceTypeName(TraceType type);
+std::ostream& operator<<(std::ostream& os, const TraceEvent& event);
+
+/**
+ * Lock-free ring buffer of trace events, for one producer (the emulation)
+ * and one consumer (a tool or the GUI) that can be on different threads
+ * Events are dropped (and counted) instead of blocking when buffer is full
+ */
+class TraceBuffer
+{
+public:
+  static constexpr size_t DEFAULT_CAPACITY = 1 << 14;
+
+  // capacity is rounded up to a power of two
+  explicit TraceBuffer(size_t capacity = DEFAULT_CAPACITY);
+
+  TraceBuffer(const TraceBuffer&) = delete;
+  TraceBuffer& operator=(const TraceBuffer&) = delete;
+
+  // only events of these categories are recorded
+  uint32_t categories_ = TRACE_ALL;
+
+  size_t capacity() const
+  {
+    return events_.size();
+  }
+
+  // Producer side
+  inline void record(TraceType type, uint32_t pixel_count, uint16_t addr, uint8_t data)
+  {
+    if (categories_ & traceCategory(type))
+    {
+      push(TraceEvent{pixel_count, addr, data, type});
+    }
+  }
+
+  inline bool push(const TraceEvent& event)
+  {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if ((head - tail_.load(std::memory_order_acquire)) >= events_.size())
+    {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    events_[head & mask_] = event;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Consumer side, calls func(const TraceEvent&) for each recorded event, oldest first
+   * Returns number of events drained
+   */
+  template<typename FUNC>
+  size_t drain(FUNC func)
+  {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_acquire);
+    for (size_t idx = tail; idx != head; ++idx)
+    {
+      func(events_[idx & mask_]);
+    }
+    tail_.store(head, std::memory_order_release);
+    return head - tail;
+  }
+
+  // Appends recorded events to output
+  size_t drain(std::vector<TraceEvent>& output);
+
+  // Number of events dropped because buffer was full
+  size_t dropped() const
+  {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::vector<TraceEvent> events_;
+  size_t mask_;
+
+  // producer and consumer positions are on separate cache lines so they don't contend
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+  std::atomic<size_t> dropped_{0};
+};
+
+#endif  // ATARI2600_TRACE_HPP_GUARD